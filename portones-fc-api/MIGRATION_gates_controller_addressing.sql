@@ -0,0 +1,35 @@
+-- ==========================================
+-- MIGRATION: Controller addressing for gates
+-- ==========================================
+-- Purpose: Map each gate to the ESP32 controller that drives it so the API
+--          can publish to portones/{colonia}/{controller}/gate/{channel}/command
+--          instead of the shared portones/gate/command topic
+-- Date: 2026-10-14
+-- ==========================================
+
+-- 1. Controller ID (MAC without separators, or the configured CONTROLLER_ID)
+ALTER TABLE gates
+ADD COLUMN IF NOT EXISTS controller_id TEXT;
+
+-- 2. Gate number on that controller (1-based, matches the firmware gate index)
+ALTER TABLE gates
+ADD COLUMN IF NOT EXISTS channel SMALLINT CHECK (channel >= 1);
+
+-- 3. Gate ids are no longer limited to a single 4-gate board
+ALTER TABLE gates
+DROP CONSTRAINT IF EXISTS gates_id_check;
+
+-- 4. One gate per controller channel
+CREATE UNIQUE INDEX IF NOT EXISTS gates_controller_channel_idx
+ON gates (controller_id, channel)
+WHERE controller_id IS NOT NULL;
+
+COMMENT ON COLUMN gates.controller_id IS 'ESP32 controller ID; NULL keeps the legacy shared MQTT topic';
+COMMENT ON COLUMN gates.channel IS 'Gate number on the controller (portones/{colonia}/{controller}/gate/{channel})';
+
+-- ==========================================
+-- VERIFICATION QUERIES
+-- ==========================================
+-- SELECT id, name, colonia_id, controller_id, channel
+-- FROM gates
+-- ORDER BY colonia_id, controller_id, channel;
@@ -0,0 +1,335 @@
+/**
+ * Prueba de carga de la cadena API -> broker -> controlador -> API.
+ *
+ *   npm run loadtest -- --controllers 50 --rate 100 --mode burst --burst 40 --duration 120
+ *
+ * Levanta N controladores virtuales de `--gates` portones cada uno, que
+ * hablan el protocolo del firmware (caps, comandos JSON o binarios, acks,
+ * estados por portón o en lote, deduplicación por commandId) y mueven sus
+ * portones con tiempos de recorrido y de cierre automático. Del otro lado
+ * publica comandos con publishGateCommand() de plugins/mqtt.ts, al ritmo
+ * pedido, y reporta la ida y vuelta publicación -> estado recibido
+ * (state/roundtrip) en p50/p99/p999.
+ *
+ * Con --role sim o --role drive las dos mitades corren en procesos (o
+ * máquinas) distintos, para que el simulador no le robe event loop a la API.
+ * Usa el broker de MQTT_* en el entorno y la colonia --colonia, aparte de
+ * las reales; el proceso de la API en producción solo ve estados de
+ * portones que no conoce.
+ */
+import 'dotenv/config'
+import mqtt from 'mqtt'
+import { parseArgs } from 'util'
+import { connectMQTT, publishGateCommand, registerGateChannels } from './plugins/mqtt'
+import { decodeCommandFrame, encodeAckFrame, encodeStatusFrames } from './protocol/binary'
+import { getRoundTripSummary, RoundTripSummary } from './state/roundtrip'
+
+const { values: args } = parseArgs({
+  options: {
+    controllers: { type: 'string', default: '10' },
+    gates: { type: 'string', default: '4' }, // GATE_COUNT del firmware
+    rate: { type: 'string', default: '10' }, // comandos/s en total
+    mode: { type: 'string', default: 'paced' }, // paced | poisson | burst
+    burst: { type: 'string', default: '20' }, // comandos por ráfaga
+    duration: { type: 'string', default: '60' }, // s
+    'travel-ms': { type: 'string', default: '1500' },
+    'open-ms': { type: 'string', default: '5000' }, // GATES[].openMs
+    json: { type: 'boolean', default: false }, // simular firmware sin 'bin1'
+    role: { type: 'string', default: 'both' }, // both | sim | drive
+    colonia: { type: 'string', default: 'loadtest' },
+    verbose: { type: 'boolean', default: false }
+  }
+})
+
+const CONTROLLERS = Number(args.controllers)
+const GATES = Number(args.gates)
+const RATE = Number(args.rate)
+const BURST = Math.max(1, Number(args.burst))
+const DURATION_MS = Number(args.duration) * 1000
+const TRAVEL_MS = Number(args['travel-ms'])
+const OPEN_MS = Number(args['open-ms'])
+const COLONIA = args.colonia!
+const ROLE = args.role!
+const MODE = args.mode!
+
+if (!['paced', 'poisson', 'burst'].includes(MODE) || !['both', 'sim', 'drive'].includes(ROLE)) {
+  console.error('--mode must be paced, poisson or burst; --role must be both, sim or drive')
+  process.exit(1)
+}
+if (![CONTROLLERS, GATES, RATE, DURATION_MS].every((n) => Number.isFinite(n) && n > 0) || GATES > 8) {
+  console.error('--controllers, --rate and --duration must be positive; --gates between 1 and 8')
+  process.exit(1)
+}
+
+const SCHEDULER_TICK_MS = 5
+const REPORT_EVERY_MS = 5000
+const RECENT_COMMANDS = 32 // CommandDedup<32> del firmware
+const GATE_ID_BASE = 1000000 // ids de base de datos ficticios para los portones virtuales
+
+const controllerId = (i: number) => `sim${String(i).padStart(4, '0')}`
+
+const brokerOptions = (clientId: string): mqtt.IClientOptions => ({
+  host: process.env.MQTT_HOST || 'localhost',
+  port: parseInt(process.env.MQTT_PORT || '1883'),
+  username: process.env.MQTT_USERNAME || '',
+  password: process.env.MQTT_PASSWORD || '',
+  protocol: process.env.MQTT_USE_TLS === 'true' ? 'mqtts' : 'mqtt',
+  clientId,
+  reconnectPeriod: 5000,
+  connectTimeout: 30000
+})
+
+// ==================== CONTROLADOR VIRTUAL ====================
+
+type SimStatus = 'CLOSED' | 'OPENING' | 'OPEN' | 'CLOSING' | 'STOPPED'
+
+interface SimGate {
+  status: SimStatus
+  timer?: NodeJS.Timeout
+}
+
+/**
+ * Un controlador como lo ve el broker: misma jerarquía de topics que el
+ * firmware y las mismas reglas de gate_control.cpp en lo que se ve desde
+ * fuera (OPEN repetido y CLOSE en reposo se funden; STOP detiene y cierra
+ * tras openMs).
+ */
+class VirtualController {
+  private readonly prefix: string
+  private readonly gates: SimGate[]
+  private readonly recent: number[] = []
+  private binary = !args.json
+  private changed = new Map<number, SimStatus>()
+  private flushScheduled = false
+
+  constructor(
+    private readonly client: mqtt.MqttClient,
+    readonly key: string
+  ) {
+    this.prefix = `portones/${key}`
+    this.gates = Array.from({ length: GATES }, () => ({ status: 'CLOSED' as SimStatus }))
+    client.on('connect', () => {
+      const protocols = args.json ? ['json', 'ack1'] : ['json', 'bin1', 'ack1']
+      client.publish(`${this.prefix}/caps`, JSON.stringify({ protocols, gates: GATES }), { retain: true })
+      client.subscribe([`${this.prefix}/gate/+/command`, `${this.prefix}/gate/+/command.bin`], { qos: 1 })
+    })
+    client.on('message', (topic, message) => this.onMessage(topic, message))
+  }
+
+  private onMessage(topic: string, message: Buffer) {
+    const receivedAt = performance.now()
+    const match = /\/gate\/(\d+)\/command(\.bin)?$/.exec(topic)
+    if (!match) return
+    const channel = Number(match[1])
+    this.binary = match[2] === '.bin'
+    let command: { action: string; commandId: number; holdSeconds: number } | null = null
+    if (this.binary) {
+      command = decodeCommandFrame(message)
+    } else {
+      try {
+        const data = JSON.parse(message.toString())
+        command = {
+          action: String(data.action),
+          commandId: Number(data.commandId) || 0,
+          holdSeconds: Number(data.holdSeconds) || 0
+        }
+      } catch {
+        command = null
+      }
+    }
+    if (!command) return
+
+    let result: string
+    if (command.commandId && this.recent.includes(command.commandId)) {
+      result = 'DUPLICATE'
+    } else {
+      if (command.commandId) {
+        this.recent.push(command.commandId)
+        if (this.recent.length > RECENT_COMMANDS) this.recent.shift()
+      }
+      result = channel >= 1 && channel <= GATES ? this.apply(channel, command.action, command.holdSeconds) : 'REJECTED'
+    }
+    if (command.commandId) this.sendAck(channel, result, command.commandId, (performance.now() - receivedAt) * 1000)
+  }
+
+  private apply(channel: number, action: string, holdSeconds: number): string {
+    const status = this.gates[channel - 1]!.status
+    switch (action) {
+      case 'OPEN':
+      case 'HOLD_OPEN':
+        if (status === 'OPENING' || status === 'OPEN') return 'MERGED'
+        this.move(channel, 'OPENING', 'OPEN', action === 'HOLD_OPEN' ? holdSeconds * 1000 : OPEN_MS)
+        return 'EXECUTED'
+      case 'CLOSE':
+        if (status === 'CLOSED' || status === 'CLOSING') return 'MERGED'
+        this.move(channel, 'CLOSING', 'CLOSED', 0)
+        return 'EXECUTED'
+      case 'STOP':
+        if (status !== 'OPENING' && status !== 'CLOSING') return 'MERGED'
+        this.set(channel, 'STOPPED', OPEN_MS, () => this.move(channel, 'CLOSING', 'CLOSED', 0))
+        return 'EXECUTED'
+      default:
+        return 'REJECTED'
+    }
+  }
+
+  // Recorrido de TRAVEL_MS hasta `end`; abierto, cierra solo tras holdMs
+  private move(channel: number, moving: SimStatus, end: SimStatus, holdMs: number) {
+    this.set(channel, moving, TRAVEL_MS, () => {
+      if (end === 'CLOSED') {
+        this.set(channel, end)
+      } else {
+        this.set(channel, end, holdMs, () => this.move(channel, 'CLOSING', 'CLOSED', 0))
+      }
+    })
+  }
+
+  private set(channel: number, status: SimStatus, afterMs = 0, next?: () => void) {
+    const gate = this.gates[channel - 1]!
+    clearTimeout(gate.timer)
+    gate.timer = next ? setTimeout(next, afterMs) : undefined
+    gate.status = status
+    this.changed.set(channel, status)
+    // Como el lote por tick del firmware: lo que cambie en esta vuelta del
+    // event loop sale en un solo mensaje
+    if (!this.flushScheduled) {
+      this.flushScheduled = true
+      setImmediate(() => this.flushStatus())
+    }
+  }
+
+  private flushStatus() {
+    this.flushScheduled = false
+    const entries = [...this.changed].map(([gateId, status]) => ({ gateId, status }))
+    this.changed.clear()
+    if (entries.length === 0) return
+    const suffix = this.binary ? '.bin' : ''
+    const topic =
+      entries.length === 1 ? `${this.prefix}/gate/${entries[0]!.gateId}/status${suffix}` : `${this.prefix}/status${suffix}`
+    let payload: Buffer | string
+    if (this.binary) {
+      payload = encodeStatusFrames(entries)
+    } else {
+      payload = JSON.stringify(entries.length === 1 ? entries[0] : { gates: entries })
+    }
+    this.client.publish(topic, payload)
+  }
+
+  private sendAck(gateId: number, result: string, commandId: number, latencyUs: number) {
+    const topic = `${this.prefix}/ack${this.binary ? '.bin' : ''}`
+    const payload = this.binary
+      ? encodeAckFrame(gateId, result, commandId, latencyUs)
+      : JSON.stringify({ gateId, commandId, result, latencyUs: Math.round(latencyUs) })
+    this.client.publish(topic, payload)
+  }
+
+  stop() {
+    for (const gate of this.gates) clearTimeout(gate.timer)
+    this.client.end(true)
+  }
+}
+
+const startSimulators = async (): Promise<VirtualController[]> => {
+  const controllers: VirtualController[] = []
+  const connected: Promise<void>[] = []
+  for (let i = 0; i < CONTROLLERS; i++) {
+    const client = mqtt.connect(brokerOptions(`portones-${COLONIA}-${controllerId(i)}`))
+    controllers.push(new VirtualController(client, `${COLONIA}/${controllerId(i)}`))
+    connected.push(new Promise((resolve) => client.once('connect', () => resolve())))
+  }
+  await Promise.all(connected)
+  console.log(`🤖 ${CONTROLLERS} virtual controllers x ${GATES} gates connected`)
+  return controllers
+}
+
+// ==================== GENERADOR ====================
+
+const formatSummary = (sent: number, summary: RoundTripSummary) =>
+  `sent ${sent}, status ${summary.n}, lost ${summary.lost} | ` +
+  `p50 ${summary.p50.toFixed(1)} ms, p99 ${summary.p99.toFixed(1)} ms, ` +
+  `p999 ${summary.p999.toFixed(1)} ms, max ${summary.max.toFixed(1)} ms`
+
+const drive = async () => {
+  const client = await connectMQTT()
+  const gates: { id: number; colonia_id: string; controller_id: string; channel: number }[] = []
+  for (let c = 0; c < CONTROLLERS; c++) {
+    for (let channel = 1; channel <= GATES; channel++) {
+      gates.push({ id: GATE_ID_BASE + c * GATES + channel, colonia_id: COLONIA, controller_id: controllerId(c), channel })
+    }
+  }
+  registerGateChannels(gates)
+  // Los caps retenidos llegan al suscribirse; sin ellos la API no usaría
+  // tramas binarias ni esperaría acks
+  await new Promise((resolve) => setTimeout(resolve, 2000))
+
+  // Alterna OPEN/CLOSE por portón para que cada comando cambie el estado
+  const opened = new Array<boolean>(gates.length).fill(false)
+  let sent = 0
+  let errors = 0
+  const sendOne = () => {
+    const index = Math.floor(Math.random() * gates.length)
+    const gate = gates[index]!
+    const action = opened[index] ? 'CLOSE' : 'OPEN'
+    opened[index] = !opened[index]
+    publishGateCommand(client, { action, gateId: gate.id }, {
+      coloniaId: COLONIA,
+      controllerId: gate.controller_id,
+      channel: gate.channel
+    }, (err) => {
+      if (err) errors++
+    })
+    sent++
+  }
+
+  const startedAt = performance.now()
+  let nextPoissonAt = 0
+  const reporter = setInterval(() => console.log(`⏱️  ${formatSummary(sent, getRoundTripSummary())}`), REPORT_EVERY_MS)
+  await new Promise<void>((resolve) => {
+    const scheduler = setInterval(() => {
+      const elapsed = performance.now() - startedAt
+      if (elapsed >= DURATION_MS) {
+        clearInterval(scheduler)
+        resolve()
+        return
+      }
+      if (MODE === 'poisson') {
+        while (nextPoissonAt <= elapsed) {
+          sendOne()
+          nextPoissonAt += (-Math.log(1 - Math.random()) / RATE) * 1000
+        }
+        return
+      }
+      const target =
+        MODE === 'burst'
+          ? (Math.floor((elapsed / 1000) * (RATE / BURST)) + 1) * BURST
+          : Math.floor((elapsed / 1000) * RATE)
+      while (sent < target) sendOne()
+    }, SCHEDULER_TICK_MS)
+  })
+
+  // Lo que sigue en vuelo: hasta un recorrido más el margen del broker
+  await new Promise((resolve) => setTimeout(resolve, TRAVEL_MS + 2000))
+  clearInterval(reporter)
+  const summary = getRoundTripSummary()
+  console.log(
+    `🏁 ${MODE} ${RATE}/s for ${DURATION_MS / 1000} s over ${CONTROLLERS}x${GATES} gates: ${formatSummary(sent, summary)}` +
+      (errors ? `, ${errors} publish errors` : '')
+  )
+  console.log(JSON.stringify({ mode: MODE, rate: RATE, controllers: CONTROLLERS, gates: GATES, sent, errors, ...summary }))
+  client.end(true)
+}
+
+if (!args.verbose) console.info = () => {}
+
+const simulators = ROLE === 'drive' ? [] : await startSimulators()
+if (ROLE === 'sim') {
+  console.log('🤖 Simulating; Ctrl+C to stop')
+  process.on('SIGINT', () => {
+    simulators.forEach((sim) => sim.stop())
+    process.exit(0)
+  })
+} else {
+  await drive()
+  simulators.forEach((sim) => sim.stop())
+  process.exit(0)
+}
@@ -1,8 +1,727 @@
 import mqtt from 'mqtt'
-import { setGateStatus } from '../state/gates'
+import { randomInt } from 'crypto'
+import { setGateStatus, GateStatus } from '../state/gates'
+import {
+  setControllerMetrics,
+  ControllerMetrics,
+  setControllerState,
+  ControllerState,
+  setControllerOta,
+  setControllerHealth,
+  ControllerHealth,
+  isControllerOffline
+} from '../state/controllers'
+import { recordRoundTrip, recordRoundTripLost, ROUND_TRIP_TIMEOUT_MS } from '../state/roundtrip'
+import {
+  encodeCommandFrame,
+  CONTROLLER_ACTIONS,
+  decodeStatusFrames,
+  decodeAckFrame,
+  encodeQrDelta,
+  decodeJournalFrame,
+  encodeDesiredFrame,
+  encodeConfigFrame,
+  encodeOtaOffer,
+  OtaOffer,
+  JournalFrame,
+  QrAllowlistEntry,
+  QrDeltaOp,
+  QR_DELTA_RESET,
+  QR_DELTA_HEADER_SIZE,
+  QR_DELTA_OP_SIZE,
+  QR_DELTA_MAC_SIZE
+} from '../protocol/binary'
 
 let mqttClient: mqtt.MqttClient | null = null
 
+/**
+ * Dirección de un portón en la jerarquía por controlador:
+ * portones/{coloniaId}/{controllerId}/gate/{channel}/command
+ */
+export interface GateAddress {
+  coloniaId: string
+  controllerId: string
+  channel: number
+}
+
+// Controladores que anunciaron 'bin1' / 'ack1' en su topic caps ('' = topic compartido)
+const binaryControllers = new Set<string>()
+const ackControllers = new Set<string>()
+const qrControllers = new Set<string>()
+const stateControllers = new Set<string>()
+const configControllers = new Set<string>()
+const otaControllers = new Set<string>()
+// 'time1': aceptan la hora de envío en la trama binaria y devuelven la
+// latencia de un sentido en el ack
+const timeControllers = new Set<string>()
+// Bytes que cada controlador acepta en un mensaje por su partición inbox
+// (campo "inbox" de caps; 0 o ausente = solo el buffer MQTT)
+const inboxSizes = new Map<string, number>()
+
+// El JSON de comando debe caber en el buffer MQTT del firmware
+// (MQTT_COMMAND_MAX); si no cabe se manda solo lo que el firmware lee
+const COMMAND_JSON_MAX = 512
+const COMMAND_FIELDS = ['action', 'gateId', 'commandId', 'priority', 'holdSeconds', 'timestamp']
+
+// Reintentos de comandos sin ack. El firmware deduplica por commandId, así que
+// reenviar el mismo comando es seguro.
+const ACK_TIMEOUT_MS = 1500
+const MAX_COMMAND_RETRIES = 3
+
+interface PendingCommand {
+  attempts: number
+  timer?: NodeJS.Timeout
+  send: () => void
+}
+
+const pendingCommands = new Map<number, PendingCommand>()
+
+// uint32 distinto de 0; arranca en un valor aleatorio para no repetir ids
+// recientes tras reiniciar la API
+let lastCommandId = randomInt(1, 0x7fffffff)
+const nextCommandId = () => {
+  lastCommandId = (lastCommandId + 1) >>> 0 || 1
+  return lastCommandId
+}
+
+// Ida y vuelta comando -> estado (state/roundtrip). Una por portón, la del
+// último comando; un ack sin ejecución (MERGED, DUPLICATE, REJECTED) la
+// descarta porque ese comando no cambia el estado.
+const ROUND_TRIP_STATUSES: Record<string, string[]> = {
+  OPEN: ['OPENING', 'OPEN'],
+  HOLD_OPEN: ['OPENING', 'OPEN'],
+  CLOSE: ['CLOSING', 'CLOSED'],
+  STOP: ['STOPPED']
+}
+
+interface PendingRoundTrip {
+  commandId: number
+  statuses: string[]
+  sentAt: number
+}
+
+const pendingRoundTrips = new Map<string, PendingRoundTrip>()
+const roundTripsByCommand = new Map<number, string>()
+
+// controlador/canal -> id del portón en la base, para interpretar los estados
+const gateIdsByChannel = new Map<string, number>()
+
+const controllerKey = (coloniaId: string, controllerId: string) => `${coloniaId}/${controllerId}`
+
+const GATE_TOPIC = /^portones\/([^/]+)\/([^/]+)\/gate\/(\d+)\/(status|status\.bin)$/
+const ACK_TOPIC = /^portones\/(?:gate|[^/]+\/[^/]+)\/(ack|ack\.bin)$/
+const CONTROLLER_STATUS_TOPIC = /^portones\/([^/]+)\/([^/]+)\/(status|status\.bin)$/
+const CAPS_TOPIC = /^portones\/([^/]+)\/([^/]+)\/caps$/
+const METRICS_TOPIC = /^portones\/([^/]+)\/([^/]+)\/metrics$/
+const QR_SYNC_TOPIC = /^portones\/([^/]+)\/([^/]+)\/qr\/sync$/
+const JOURNAL_TOPIC = /^portones\/([^/]+)\/([^/]+)\/journal\.bin$/
+const STATE_TOPIC = /^portones\/([^/]+)\/([^/]+)\/state$/
+const CONFIG_ACK_TOPIC = /^portones\/([^/]+)\/([^/]+)\/config\/ack$/
+const OTA_STATUS_TOPIC = /^portones\/([^/]+)\/([^/]+)\/ota\/status$/
+const HEALTH_TOPIC = /^portones\/([^/]+)\/([^/]+)\/health$/
+
+// Estado deseado ('state1'), retenido en portones/{key}/desired.bin: los
+// portones que deberían estar abiertos y hasta cuándo. Un controlador que
+// reinicia a mitad de una apertura la retoma con un solo mensaje.
+const DESIRED_OPEN_TTL_S = 30 // = GATE_MAX_OPEN_DURATION del firmware
+const desiredOpenUntil = new Map<string, Map<number, number>>()
+
+// Allowlist QR local ('qr1'). Las deltas van firmadas; el controlador solo
+// aplica una si parte de la versión que tiene, así que la API recuerda la
+// última versión enviada a cada uno. Si no la conoce (p. ej. tras reiniciar)
+// manda la lista completa en trozos encadenados.
+const QR_ALLOWLIST_KEY = process.env.QR_ALLOWLIST_KEY || 'portones-qr-dev-key'
+const QR_DELTA_MAX_OPS = 48 // 16 + 48 * 17 + 32 bytes, dentro del buffer MQTT del firmware
+const QR_ALLOWLIST_MAX = 512 // la capacidad del firmware: más operaciones por delta no sirven
+const qrVersions = new Map<string, number>()
+
+// Configuración remota ('config1'): red, broker, credenciales y claves del
+// controlador, firmadas con una clave propia. El controlador solo acepta una
+// versión mayor que la suya; la API parte de la que anuncia su snapshot de
+// estado y usa la hora como piso para no retroceder tras un reinicio.
+const CONTROLLER_CONFIG_KEY = process.env.CONTROLLER_CONFIG_KEY || 'portones-config-dev-key'
+const configVersions = new Map<string, number>()
+
+export interface AccessUpload {
+  code: number
+  gateId: number
+  result: string
+  at: number
+  uses: number
+  source: string // QR, KEYPAD, CARD o BUTTON
+  offline: boolean
+  clockKnown: boolean
+}
+
+let qrAllowlistLoader: ((coloniaId: string, controllerId: string) => Promise<QrAllowlistEntry[]>) | null = null
+let accessUploadHandler:
+  | ((coloniaId: string, controllerId: string, accesses: AccessUpload[]) => void | Promise<void>)
+  | null = null
+
+// Diario de eventos ('journal1'): el controlador reenvía en orden lo no
+// confirmado. Se ingiere un mensaje a la vez por controlador y se confirma
+// la última secuencia cubierta; lo que llega repetido tras un reenvío se
+// descarta por secuencia. Si el controlador reinicia su diario cambia el id.
+const journalProgress = new Map<string, { journalId: number; seq: number }>()
+const journalQueues = new Map<string, Promise<void>>()
+
+/** Registra de dónde sale la lista completa de un controlador. */
+export const onQrAllowlistRequest = (
+  loader: (coloniaId: string, controllerId: string) => Promise<QrAllowlistEntry[]>
+) => {
+  qrAllowlistLoader = loader
+}
+
+/** Registra qué hacer con los accesos que el controlador autorizó localmente. */
+export const onAccessUpload = (
+  handler: (coloniaId: string, controllerId: string, accesses: AccessUpload[]) => void | Promise<void>
+) => {
+  accessUploadHandler = handler
+}
+
+/**
+ * Registra de antemano qué portón de la base es cada canal, para interpretar
+ * los snapshots retenidos que llegan al suscribirse, antes de cualquier comando.
+ */
+export const registerGateChannels = (
+  gates: { id: number; colonia_id?: string | null; controller_id?: string | null; channel?: number | null }[]
+) => {
+  for (const gate of gates) {
+    const address = gateAddress(gate)
+    if (address) {
+      gateIdsByChannel.set(`${controllerKey(address.coloniaId, address.controllerId)}/${address.channel}`, gate.id)
+    }
+  }
+}
+
+/**
+ * Construye la dirección de un portón a partir de su fila en `gates`.
+ * Devuelve null si el portón todavía no tiene controlador asignado.
+ */
+export const gateAddress = (gate: {
+  colonia_id?: string | null
+  controller_id?: string | null
+  channel?: number | null
+}): GateAddress | null => {
+  if (!gate.colonia_id || !gate.controller_id || !gate.channel) return null
+  return { coloniaId: gate.colonia_id, controllerId: gate.controller_id, channel: gate.channel }
+}
+
+const handleStatus = (gateId: number, status: unknown) => {
+  if (!gateId || !status) {
+    console.warn('Invalid gate status payload', { gateId, status })
+    return
+  }
+  setGateStatus(gateId, status as GateStatus)
+  console.info(`✅ Gate ${gateId} status updated to ${status}`)
+}
+
+type StatusEntry = { gateId: number; status: unknown }
+
+/**
+ * Interpreta un mensaje de estado: un portón ({gateId, status}), un lote
+ * JSON ({gates: [...]}) o tramas binarias concatenadas.
+ */
+const parseStatusEntries = (message: Buffer, binary: boolean): StatusEntry[] | null => {
+  if (binary) return decodeStatusFrames(message)
+  try {
+    const data = JSON.parse(message.toString())
+    if (Array.isArray(data.gates)) {
+      return data.gates.map((g: any) => ({ gateId: Number(g.gateId), status: g.status }))
+    }
+    return [{ gateId: Number(data.gateId), status: data.status }]
+  } catch (err) {
+    console.error('Invalid MQTT status message', err)
+    return null
+  }
+}
+
+/**
+ * Aplica estados cuyo gateId es el número local del controlador.
+ * `channelKey` es la clave colonia/controlador, o null para el topic compartido
+ * donde el número coincide con el id en la base.
+ */
+const applyStatusEntries = (entries: StatusEntry[] | null, channelKey: string | null) => {
+  if (!entries) {
+    console.warn('Invalid gate status payload')
+    return
+  }
+  for (const entry of entries) {
+    noteRoundTrip(`${channelKey ?? ''}/${entry.gateId}`, entry.status)
+    if (channelKey === null) {
+      handleStatus(entry.gateId, entry.status)
+      continue
+    }
+    // Atascado tampoco se reabre por el estado deseado
+    const atRest = entry.status === 'CLOSED' || entry.status === 'STOPPED' || entry.status === 'OBSTRUCTED'
+    if (atRest && desiredOpenUntil.get(channelKey)?.delete(entry.gateId)) {
+      publishDesiredState(channelKey)
+    }
+    const gateId = gateIdsByChannel.get(`${channelKey}/${entry.gateId}`)
+    if (!gateId) {
+      console.warn(`Status from unmapped gate ${channelKey}/${entry.gateId}`)
+      continue
+    }
+    handleStatus(gateId, entry.status)
+  }
+}
+
+// `gateKey` es controlador/canal, o /gateId en el topic compartido
+const startRoundTrip = (gateKey: string, commandId: number, action: string) => {
+  const statuses = ROUND_TRIP_STATUSES[action]
+  if (!statuses) return
+  const previous = pendingRoundTrips.get(gateKey)
+  if (previous) {
+    roundTripsByCommand.delete(previous.commandId)
+    if (performance.now() - previous.sentAt > ROUND_TRIP_TIMEOUT_MS) recordRoundTripLost()
+  }
+  pendingRoundTrips.set(gateKey, { commandId, statuses, sentAt: performance.now() })
+  roundTripsByCommand.set(commandId, gateKey)
+}
+
+const endRoundTrip = (gateKey: string, pending: PendingRoundTrip) => {
+  pendingRoundTrips.delete(gateKey)
+  roundTripsByCommand.delete(pending.commandId)
+}
+
+const noteRoundTrip = (gateKey: string, status: unknown) => {
+  const pending = pendingRoundTrips.get(gateKey)
+  if (!pending) return
+  const elapsed = performance.now() - pending.sentAt
+  if (elapsed > ROUND_TRIP_TIMEOUT_MS) {
+    endRoundTrip(gateKey, pending)
+    recordRoundTripLost()
+  } else if (pending.statuses.includes(String(status))) {
+    endRoundTrip(gateKey, pending)
+    recordRoundTrip(elapsed)
+  }
+}
+
+const publishDesiredState = (key: string) => {
+  if (!mqttClient || !stateControllers.has(key)) return
+  const now = Math.floor(Date.now() / 1000)
+  const open = desiredOpenUntil.get(key) ?? new Map<number, number>()
+  const entries = [...open]
+    .filter(([, until]) => until > now)
+    .map(([gateId, until]) => ({ gateId, status: 'OPEN', until }))
+  mqttClient.publish(`portones/${key}/desired.bin`, encodeDesiredFrame(entries, now), { qos: 1, retain: true })
+}
+
+const handleState = (key: string, payload: string) => {
+  let data: any
+  try {
+    data = JSON.parse(payload)
+  } catch (err) {
+    console.error('Invalid MQTT state message', err)
+    return
+  }
+  if (typeof data !== 'object' || data === null || !Array.isArray(data.gates)) {
+    console.warn(`Invalid state payload from ${key}`)
+    return
+  }
+  const state: ControllerState = { ...data, receivedAt: new Date().toISOString() }
+  setControllerState(key, state)
+  if (typeof state.config === 'number' && state.config > (configVersions.get(key) ?? 0)) {
+    configVersions.set(key, state.config)
+  }
+  applyStatusEntries(
+    state.gates.map((g) => ({ gateId: Number(g.gateId), status: g.status })),
+    key
+  )
+  const crash = state.reset?.lastCrash
+  if (crash && state.reset?.reason === crash.reason && state.uptimeMs < 60000) {
+    console.warn(
+      `⚠️  ${key} restarted by ${crash.reason} after ${crash.uptimeS} s ` +
+        `(net in ${crash.net}, gates in ${crash.gate}; ${state.reset.crashes} unexpected resets)`
+    )
+  }
+  if (state.boot?.consistentMs) {
+    console.info(
+      `✅ ${key} (fw ${state.fw}) consistent ${state.boot.consistentMs} ms after boot, link ready at ${state.boot.readyMs} ms`
+    )
+  }
+}
+
+const scheduleRetry = (commandId: number) => {
+  const pending = pendingCommands.get(commandId)
+  if (!pending) return
+  clearTimeout(pending.timer)
+  pending.timer = setTimeout(() => {
+    if (pending.attempts >= MAX_COMMAND_RETRIES) {
+      pendingCommands.delete(commandId)
+      console.warn(`⚠️  Command ${commandId} not acknowledged after ${pending.attempts} attempts`)
+      return
+    }
+    pending.attempts++
+    console.warn(`🔄 Retrying command ${commandId} (attempt ${pending.attempts})`)
+    pending.send()
+    scheduleRetry(commandId)
+  }, ACK_TIMEOUT_MS)
+}
+
+const handleAck = (
+  ack: { commandId: number; gateId: number; result: string; latencyUs: number; oneWayUs?: number } | null
+) => {
+  if (!ack || !ack.commandId) {
+    console.warn('Invalid gate ack payload')
+    return
+  }
+  const roundTrip = roundTripsByCommand.get(ack.commandId)
+  if (roundTrip && ack.result !== 'EXECUTED' && ack.result !== 'DROPPED') {
+    const pendingRoundTrip = pendingRoundTrips.get(roundTrip)
+    if (pendingRoundTrip) endRoundTrip(roundTrip, pendingRoundTrip)
+  }
+  const pending = pendingCommands.get(ack.commandId)
+  if (!pending) return
+
+  // DROPPED: la cola del controlador estaba llena, reintentar sin esperar
+  if (ack.result === 'DROPPED' && pending.attempts < MAX_COMMAND_RETRIES) {
+    pending.attempts++
+    pending.send()
+    scheduleRetry(ack.commandId)
+    return
+  }
+
+  clearTimeout(pending.timer)
+  pendingCommands.delete(ack.commandId)
+  const oneWay = ack.oneWayUs !== undefined ? `, ${(ack.oneWayUs / 1000).toFixed(1)} ms since sent` : ''
+  console.info(
+    `✅ Command ${ack.commandId} on gate ${ack.gateId}: ${ack.result} (${(ack.latencyUs / 1000).toFixed(1)} ms on device${oneWay})`
+  )
+}
+
+const handleCaps = (key: string, payload: string) => {
+  try {
+    const caps = JSON.parse(payload)
+    const protocols: unknown[] = Array.isArray(caps.protocols) ? caps.protocols : []
+    const binary = protocols.includes('bin1')
+    if (binary) {
+      binaryControllers.add(key)
+    } else {
+      binaryControllers.delete(key)
+    }
+    if (protocols.includes('ack1')) {
+      ackControllers.add(key)
+    } else {
+      ackControllers.delete(key)
+    }
+    if (protocols.includes('qr1')) {
+      qrControllers.add(key)
+    } else {
+      qrControllers.delete(key)
+    }
+    if (protocols.includes('state1')) {
+      stateControllers.add(key)
+    } else {
+      stateControllers.delete(key)
+    }
+    if (protocols.includes('config1')) {
+      configControllers.add(key)
+    } else {
+      configControllers.delete(key)
+    }
+    if (protocols.includes('ota1')) {
+      otaControllers.add(key)
+    } else {
+      otaControllers.delete(key)
+    }
+    if (protocols.includes('time1')) {
+      timeControllers.add(key)
+    } else {
+      timeControllers.delete(key)
+    }
+    if (typeof caps.inbox === 'number' && caps.inbox > 0) {
+      inboxSizes.set(key, caps.inbox)
+    } else {
+      inboxSizes.delete(key)
+    }
+    console.info(`✅ Gate protocol for ${key || 'shared topic'}: ${binary ? 'binary' : 'json'}`)
+  } catch (err) {
+    console.error('Invalid MQTT caps message', err)
+  }
+}
+
+const handleMetrics = (key: string, payload: string) => {
+  let data: any
+  try {
+    data = JSON.parse(payload)
+  } catch (err) {
+    console.error('Invalid MQTT metrics message', err)
+    return
+  }
+  if (typeof data !== 'object' || data === null || typeof data.uptimeMs !== 'number') {
+    console.warn(`Invalid metrics payload from ${key}`)
+    return
+  }
+  const metrics: ControllerMetrics = { ...data, receivedAt: new Date().toISOString() }
+  setControllerMetrics(key, metrics)
+
+  const actuation = metrics.latencyUs?.actuation
+  if (actuation?.n) {
+    console.info(
+      `📊 ${key}: ${actuation.n} commands, actuation p50 ${(actuation.p50 / 1000).toFixed(1)} ms / ` +
+        `p99 ${(actuation.p99 / 1000).toFixed(1)} ms, min heap ${metrics.heap?.min}`
+    )
+  }
+  const wake = metrics.latencyUs?.wake
+  if (metrics.power?.saver) {
+    console.info(
+      `🔋 ${key}: ~${metrics.power.estimatedMa} mA (model), gates awake ${metrics.power.gatesAwakePermille / 10}%, ` +
+        `wake p99 ${wake?.n ? (wake.p99 / 1000).toFixed(1) : '-'} ms, light sleep ${metrics.power.lightSleep ? 'on' : 'off'}`
+    )
+  }
+}
+
+const handleHealth = (key: string, payload: string) => {
+  let data: any
+  try {
+    data = JSON.parse(payload)
+  } catch (err) {
+    console.error('Invalid MQTT health message', err)
+    return
+  }
+  if (typeof data !== 'object' || data === null || typeof data.online !== 'boolean') {
+    console.warn(`Invalid health payload from ${key}`)
+    return
+  }
+  const health: ControllerHealth = { ...data, receivedAt: new Date().toISOString() }
+  const wasOffline = isControllerOffline(key)
+  setControllerHealth(key, health)
+  if (!health.online) {
+    console.warn(`💀 ${key}: controller offline (last will), commands to its gates are refused`)
+  } else if (wasOffline) {
+    console.info(`✅ ${key}: controller back online, RSSI ${health.rssi} dBm, keepalive ${health.keepAliveS} s`)
+  }
+}
+
+/**
+ * true si el controlador del portón está caído (última voluntad o latidos
+ * vencidos): no tiene sentido publicarle un comando que nadie va a recibir.
+ */
+export const isGateControllerOffline = (address: GateAddress | null) => {
+  return address ? isControllerOffline(controllerKey(address.coloniaId, address.controllerId)) : false
+}
+
+const nextQrVersion = (key: string) => {
+  const current = qrVersions.get(key)
+  // Sin historial se arranca en un valor aleatorio para no coincidir con lo
+  // que el controlador tenga de una ejecución anterior de la API
+  return current === undefined ? randomInt(1, 0x7fffffff) : (current + 1) >>> 0 || 1
+}
+
+// Con inbox, una lista completa va en un solo mensaje y se aplica entera
+const qrOpsPerDelta = (key: string) => {
+  const inbox = inboxSizes.get(key) ?? 0
+  const fit = Math.floor((inbox - QR_DELTA_HEADER_SIZE - QR_DELTA_MAC_SIZE) / QR_DELTA_OP_SIZE)
+  return Math.max(QR_DELTA_MAX_OPS, Math.min(QR_ALLOWLIST_MAX, fit))
+}
+
+const publishQrOps = (client: mqtt.MqttClient, key: string, ops: QrDeltaOp[], reset: boolean) => {
+  const topic = `portones/${key}/qr/delta`
+  const issuedAt = Math.floor(Date.now() / 1000)
+  const perDelta = qrOpsPerDelta(key)
+  let base = qrVersions.get(key) ?? 0
+  // Una lista vacía también se envía: deja al controlador sin códigos
+  for (let i = 0; i === 0 || i < ops.length; i += perDelta) {
+    const version = nextQrVersion(key)
+    const chunk = ops.slice(i, i + perDelta)
+    const flags = reset && i === 0 ? QR_DELTA_RESET : 0
+    client.publish(topic, encodeQrDelta(chunk, flags, base, version, issuedAt, QR_ALLOWLIST_KEY), { qos: 1 })
+    qrVersions.set(key, version)
+    base = version
+  }
+}
+
+/** Reemplaza la allowlist de un controlador con `entries`. */
+export const publishQrAllowlist = (
+  client: mqtt.MqttClient,
+  coloniaId: string,
+  controllerId: string,
+  entries: QrAllowlistEntry[]
+) => {
+  const key = controllerKey(coloniaId, controllerId)
+  publishQrOps(
+    client,
+    key,
+    entries.map((entry) => ({ kind: 'upsert', entry })),
+    true
+  )
+  console.info(`✅ QR allowlist for ${key}: ${entries.length} codes`)
+}
+
+const syncQrAllowlist = async (client: mqtt.MqttClient, coloniaId: string, controllerId: string) => {
+  if (!qrAllowlistLoader) return
+  try {
+    publishQrAllowlist(client, coloniaId, controllerId, await qrAllowlistLoader(coloniaId, controllerId))
+  } catch (err) {
+    console.error(`Failed to load QR allowlist for ${controllerKey(coloniaId, controllerId)}`, err)
+  }
+}
+
+/**
+ * Envía cambios puntuales a un controlador con allowlist local. Si no se
+ * conoce su versión, manda la lista completa en su lugar.
+ */
+export const publishQrDelta = (
+  client: mqtt.MqttClient,
+  coloniaId: string,
+  controllerId: string,
+  ops: QrDeltaOp[]
+) => {
+  const key = controllerKey(coloniaId, controllerId)
+  if (!qrControllers.has(key)) return
+  if (!qrVersions.has(key)) {
+    void syncQrAllowlist(client, coloniaId, controllerId)
+    return
+  }
+  publishQrOps(client, key, ops, false)
+}
+
+const handleQrSync = (client: mqtt.MqttClient, coloniaId: string, controllerId: string, payload: string) => {
+  let version: number | undefined
+  try {
+    version = Number(JSON.parse(payload).version)
+  } catch (err) {
+    console.error('Invalid MQTT qr/sync message', err)
+  }
+  // Al día con lo último que le enviamos: nada que hacer
+  if (version !== undefined && qrVersions.get(controllerKey(coloniaId, controllerId)) === version) return
+  void syncQrAllowlist(client, coloniaId, controllerId)
+}
+
+/**
+ * Envía campos de configuración (p. ej. `{ 'mqtt.password': '...' }`) a un
+ * controlador que anunció 'config1'. Los que no se envían conservan su
+ * valor. Devuelve la versión publicada, o null si el controlador no la
+ * soporta o un campo no es válido. El resultado llega en .../config/ack.
+ */
+export const publishControllerConfig = (
+  client: mqtt.MqttClient,
+  coloniaId: string,
+  controllerId: string,
+  fields: Record<string, string>
+): number | null => {
+  const key = controllerKey(coloniaId, controllerId)
+  if (!configControllers.has(key)) return null
+  const version = Math.max(Math.floor(Date.now() / 1000), (configVersions.get(key) ?? 0) + 1)
+  const frame = encodeConfigFrame(fields, version, Math.floor(Date.now() / 1000), CONTROLLER_CONFIG_KEY)
+  if (!frame) return null
+  // Sin retener: lleva credenciales y solo le sirve al controlador conectado
+  client.publish(`portones/${key}/config.bin`, frame, { qos: 1 })
+  configVersions.set(key, version)
+  console.info(`⚙️  Config v${version} for ${key}: ${Object.keys(fields).join(', ')}`)
+  return version
+}
+
+const handleConfigAck = (key: string, payload: string) => {
+  try {
+    const ack = JSON.parse(payload)
+    if (ack.result === 'APPLIED') {
+      console.info(`✅ Config v${ack.version} applied on ${key}`)
+    } else {
+      console.warn(`⚠️  Config v${ack.version} rejected by ${key}: ${ack.reason}`)
+    }
+  } catch (err) {
+    console.error('Invalid MQTT config/ack message', err)
+  }
+}
+
+/**
+ * Ofrece una imagen de firmware a un controlador que anunció 'ota1'. La
+ * oferta queda retenida en .../ota.bin: el controlador la descarga por su
+ * cuenta cuando sus portones están en reposo, y una que ya corre o que antes
+ * falló se ignora. El avance llega en .../ota/status. Devuelve false si el
+ * controlador no la soporta o la oferta no cabe en la trama.
+ */
+export const publishOtaOffer = (
+  client: mqtt.MqttClient,
+  coloniaId: string,
+  controllerId: string,
+  offer: OtaOffer
+): boolean => {
+  const key = controllerKey(coloniaId, controllerId)
+  if (!otaControllers.has(key)) return false
+  const frame = encodeOtaOffer(offer, Math.floor(Date.now() / 1000), CONTROLLER_CONFIG_KEY)
+  if (!frame) return false
+  client.publish(`portones/${key}/ota.bin`, frame, { qos: 1, retain: true })
+  console.info(`📦 OTA ${offer.version} offered to ${key} (${offer.size} bytes, format ${offer.format})`)
+  return true
+}
+
+const handleOtaStatus = (key: string, payload: string) => {
+  let data: any
+  try {
+    data = JSON.parse(payload)
+  } catch (err) {
+    console.error('Invalid MQTT ota/status message', err)
+    return
+  }
+  setControllerOta(key, { ...data, receivedAt: new Date().toISOString() })
+  if (data.state === 'failed' || data.state === 'rolledback' || data.state === 'skipped') {
+    console.warn(`⚠️  OTA ${data.version} on ${key}: ${data.state} ${data.detail || ''}`)
+  } else if (data.state !== 'downloading') {
+    console.info(`📦 OTA ${data.version} on ${key}: ${data.state} (running ${data.running})`)
+  }
+}
+
+const ingestJournal = async (
+  client: mqtt.MqttClient,
+  coloniaId: string,
+  controllerId: string,
+  frame: JournalFrame
+) => {
+  const key = controllerKey(coloniaId, controllerId)
+  let progress = journalProgress.get(key)
+  // Sin historial (p. ej. tras reiniciar la API) se acepta desde donde empiece
+  if (!progress || progress.journalId !== frame.journalId) {
+    progress = { journalId: frame.journalId, seq: frame.fromSeq - 1 }
+  }
+
+  // Falta un mensaje anterior: confirmar lo último hace que el controlador
+  // reenvíe desde ahí
+  if (frame.fromSeq <= progress.seq + 1 && frame.throughSeq > progress.seq) {
+    const fresh = frame.records.filter((record) => record.seq > progress!.seq)
+    const statuses = fresh.filter((record) => record.type === 'STATUS')
+    if (statuses.length > 0) {
+      applyStatusEntries(
+        statuses.map((record) => ({ gateId: record.gateId, status: record.value })),
+        key
+      )
+    }
+    const accesses: AccessUpload[] = fresh
+      .filter((record) => record.type === 'ACCESS')
+      .map((record) => ({
+        code: record.code,
+        gateId: record.gateId,
+        result: record.value,
+        at: record.at,
+        uses: record.uses,
+        source: record.source,
+        offline: record.offline,
+        clockKnown: record.clockKnown
+      }))
+    if (accesses.length > 0) await accessUploadHandler?.(coloniaId, controllerId, accesses)
+    progress.seq = frame.throughSeq
+    journalProgress.set(key, progress)
+  }
+
+  client.publish(`portones/${key}/journal/ack`, JSON.stringify({ seq: progress.seq }), { qos: 1 })
+}
+
+const handleJournal = (client: mqtt.MqttClient, coloniaId: string, controllerId: string, message: Buffer) => {
+  const frame = decodeJournalFrame(message)
+  if (!frame) {
+    console.warn('Invalid journal frame')
+    return
+  }
+  const key = controllerKey(coloniaId, controllerId)
+  const previous = journalQueues.get(key) ?? Promise.resolve()
+  const next = previous
+    .then(() => ingestJournal(client, coloniaId, controllerId, frame))
+    .catch((err) => console.error(`Failed to ingest journal from ${key}`, err))
+  journalQueues.set(key, next)
+}
+
 // Hacer el cliente disponible globalmente para shutdown
 declare global {
   var mqttClient: mqtt.MqttClient | null
@@ -29,11 +748,32 @@ export const connectMQTT = (): Promise<mqtt.MqttClient> => {
 
     mqttClient.on('connect', () => {
       console.info('✅ Connected to MQTT broker')
-      mqttClient!.subscribe('portones/gate/status', (err) => {
+      const topics = [
+        'portones/gate/status',
+        'portones/gate/status.bin',
+        'portones/gate/caps',
+        'portones/+/+/gate/+/status',
+        'portones/+/+/gate/+/status.bin',
+        'portones/+/+/status',
+        'portones/+/+/status.bin',
+        'portones/+/+/caps',
+        'portones/gate/ack',
+        'portones/gate/ack.bin',
+        'portones/+/+/ack',
+        'portones/+/+/ack.bin',
+        'portones/+/+/metrics',
+        'portones/+/+/qr/sync',
+        'portones/+/+/journal.bin',
+        'portones/+/+/state',
+        'portones/+/+/config/ack',
+        'portones/+/+/ota/status',
+        'portones/+/+/health'
+      ]
+      mqttClient!.subscribe(topics, (err) => {
         if (err) {
           console.error('Failed to subscribe to status topic', err)
         } else {
-          console.info('✅ Subscribed to portones/gate/status')
+          console.info(`✅ Subscribed to ${topics.join(', ')}`)
         }
       })
       resolve(mqttClient!)
@@ -53,29 +793,188 @@ export const connectMQTT = (): Promise<mqtt.MqttClient> => {
     })
 
     mqttClient.on('message', (topic, message) => {
-      const payload = message.toString()
-      //console.log('📨 MQTT message received:', { topic, payload })
-
-      if (topic === 'portones/gate/status') {
-        try {
-          const data = JSON.parse(payload)
-
-          const gateId = Number(data.gateId)
-          const status = data.status
-          if (!gateId || !status) {
-            console.warn('Invalid gate status payload', data)
-            return
-          }
+      //console.log('📨 MQTT message received:', { topic, payload: message.toString() })
 
-          setGateStatus(gateId, status)
+      const gateMatch = GATE_TOPIC.exec(topic)
+      if (gateMatch) {
+        const [, coloniaId, controllerId, channel, kind] = gateMatch
+        const entries = parseStatusEntries(message, kind === 'status.bin')
+        // En el topic por portón el número lo da el topic, no el payload
+        entries?.forEach((entry) => (entry.gateId = Number(channel)))
+        applyStatusEntries(entries, controllerKey(coloniaId, controllerId))
+        return
+      }
+
+      const statusMatch = CONTROLLER_STATUS_TOPIC.exec(topic)
+      if (statusMatch) {
+        const [, coloniaId, controllerId, kind] = statusMatch
+        applyStatusEntries(parseStatusEntries(message, kind === 'status.bin'), controllerKey(coloniaId, controllerId))
+        return
+      }
 
-          console.info(`✅ Gate ${gateId} status updated to ${status}`)
-        } catch (err) {
-          console.error('Invalid MQTT status message', err)
+      const ackMatch = ACK_TOPIC.exec(topic)
+      if (ackMatch) {
+        if (ackMatch[1] === 'ack.bin') {
+          handleAck(decodeAckFrame(message))
+        } else {
+          try {
+            const data = JSON.parse(message.toString())
+            handleAck({
+              commandId: Number(data.commandId),
+              gateId: Number(data.gateId),
+              result: String(data.result),
+              latencyUs: Number(data.latencyUs),
+              ...(typeof data.oneWayUs === 'number' ? { oneWayUs: data.oneWayUs } : {})
+            })
+          } catch (err) {
+            console.error('Invalid MQTT ack message', err)
+          }
         }
+        return
+      }
+
+      const capsMatch = CAPS_TOPIC.exec(topic)
+      if (capsMatch) {
+        handleCaps(controllerKey(capsMatch[1], capsMatch[2]), message.toString())
+        return
+      }
+
+      const metricsMatch = METRICS_TOPIC.exec(topic)
+      if (metricsMatch) {
+        handleMetrics(controllerKey(metricsMatch[1], metricsMatch[2]), message.toString())
+        return
+      }
+
+      const qrSyncMatch = QR_SYNC_TOPIC.exec(topic)
+      if (qrSyncMatch) {
+        handleQrSync(mqttClient!, qrSyncMatch[1], qrSyncMatch[2], message.toString())
+        return
+      }
+
+      const stateMatch = STATE_TOPIC.exec(topic)
+      if (stateMatch) {
+        handleState(controllerKey(stateMatch[1], stateMatch[2]), message.toString())
+        return
+      }
+
+      const configAckMatch = CONFIG_ACK_TOPIC.exec(topic)
+      if (configAckMatch) {
+        handleConfigAck(controllerKey(configAckMatch[1], configAckMatch[2]), message.toString())
+        return
+      }
+
+      const otaStatusMatch = OTA_STATUS_TOPIC.exec(topic)
+      if (otaStatusMatch) {
+        handleOtaStatus(controllerKey(otaStatusMatch[1], otaStatusMatch[2]), message.toString())
+        return
+      }
+
+      const healthMatch = HEALTH_TOPIC.exec(topic)
+      if (healthMatch) {
+        handleHealth(controllerKey(healthMatch[1], healthMatch[2]), message.toString())
+        return
+      }
+
+      const journalMatch = JOURNAL_TOPIC.exec(topic)
+      if (journalMatch) {
+        handleJournal(mqttClient!, journalMatch[1], journalMatch[2], message)
+        return
+      }
+
+      if (topic === 'portones/gate/caps') {
+        handleCaps('', message.toString())
+        return
+      }
+
+      if (topic === 'portones/gate/status' || topic === 'portones/gate/status.bin') {
+        applyStatusEntries(parseStatusEntries(message, topic.endsWith('.bin')), null)
       }
     })
   })
 }
 
+/**
+ * Publica un comando de portón. Si el portón tiene dirección, va a su topic
+ * propio en la jerarquía del controlador; si no, al topic compartido. Usa la
+ * trama binaria de 8 bytes si ese destino anunció 'bin1' y la acción tiene
+ * código; si no, el JSON de siempre. Acciones: OPEN, CLOSE, STOP y
+ * HOLD_OPEN, que lleva payload.holdSeconds; EMERGENCY (abre todos y los deja
+ * abiertos) y RESUME van con gateId 0 al canal 0 del controlador.
+ * payload.priority (VISITOR, RESIDENT, ADMIN o EMERGENCY) decide el orden en
+ * la cola del firmware; RESUME exige ADMIN.
+ *
+ * Cada comando lleva un commandId. Si el controlador confirma con acks
+ * ('ack1'), el comando se reenvía con el mismo id mientras no llegue el ack.
+ */
+export const publishGateCommand = (
+  client: mqtt.MqttClient,
+  payload: { action: string; gateId: number; [key: string]: unknown },
+  address: GateAddress | null,
+  callback?: (error?: Error) => void
+) => {
+  let base = 'portones/gate/command'
+  let key = ''
+  let frameGate = payload.gateId
+  if (address) {
+    key = controllerKey(address.coloniaId, address.controllerId)
+    base = `portones/${key}/gate/${address.channel}/command`
+    frameGate = address.channel
+    gateIdsByChannel.set(`${key}/${address.channel}`, payload.gateId)
+  }
 
+  const commandId = nextCommandId()
+  // La hora de envío mide la latencia de un sentido en el controlador: en
+  // JSON va en "timestamp" (ms), en binario con 'time1' en µs
+  const sentAtUs = Math.round((performance.timeOrigin + performance.now()) * 1000)
+  let message: Record<string, unknown> = {
+    ...payload,
+    timestamp: payload.timestamp ?? new Date(sentAtUs / 1000).toISOString(),
+    commandId
+  }
+  if (Buffer.byteLength(JSON.stringify(message)) > COMMAND_JSON_MAX) {
+    // Los campos descriptivos (visitante, código QR...) quedan en access_logs
+    message = Object.fromEntries(Object.entries(message).filter(([field]) => COMMAND_FIELDS.includes(field)))
+    console.warn(`Command ${commandId} trimmed to ${COMMAND_FIELDS.join(', ')} to fit the firmware buffer`)
+  }
+  const holdSeconds = typeof payload.holdSeconds === 'number' ? payload.holdSeconds : 0
+  const priority = typeof payload.priority === 'string' ? payload.priority : 'VISITOR'
+  const frame = binaryControllers.has(key)
+    ? encodeCommandFrame(
+        frameGate,
+        payload.action,
+        commandId,
+        holdSeconds,
+        priority,
+        timeControllers.has(key) ? sentAtUs : undefined
+      )
+    : null
+  const send = (cb?: (error?: Error) => void) => {
+    if (frame) {
+      client.publish(`${base}.bin`, frame, { qos: 1 }, cb)
+    } else {
+      client.publish(base, JSON.stringify(message), { qos: 1 }, cb)
+    }
+  }
+
+  startRoundTrip(`${key}/${frameGate}`, commandId, payload.action)
+  send(callback)
+  if (address && stateControllers.has(key) && !CONTROLLER_ACTIONS.includes(payload.action)) {
+    // El estado deseado sigue al último comando: un CLOSE o STOP no debe
+    // verse revertido por un OPEN retenido tras una reconexión
+    const open = desiredOpenUntil.get(key) ?? new Map<number, number>()
+    const now = Math.floor(Date.now() / 1000)
+    if (payload.action === 'OPEN') {
+      open.set(address.channel, now + DESIRED_OPEN_TTL_S)
+    } else if (payload.action === 'HOLD_OPEN' && holdSeconds > 0) {
+      open.set(address.channel, now + holdSeconds)
+    } else if (payload.action === 'CLOSE' || payload.action === 'STOP') {
+      open.delete(address.channel)
+    }
+    desiredOpenUntil.set(key, open)
+    publishDesiredState(key)
+  }
+  if (ackControllers.has(key)) {
+    pendingCommands.set(commandId, { attempts: 1, send: () => send() })
+    scheduleRetry(commandId)
+  }
+}
@@ -0,0 +1,465 @@
+import { createHmac } from 'crypto'
+
+// Protocolo binario compacto entre la API y el firmware (topics *.bin).
+// Los códigos deben coincidir con portones-fc-firmware/lib/GateProtocol.
+
+export const PROTOCOL_VERSION = 1
+export const COMMAND_FRAME_SIZE = 8
+export const COMMAND_HOLD_FRAME_SIZE = 10
+export const STATUS_FRAME_SIZE = 4
+export const COMMAND_SENT_AT_SIZE = 8
+export const ACK_FRAME_SIZE = 12
+export const ACK_ONE_WAY_FRAME_SIZE = 16
+export const QR_DELTA_HEADER_SIZE = 16
+export const QR_DELTA_OP_SIZE = 17
+export const QR_DELTA_MAC_SIZE = 32
+export const QR_DELTA_RESET = 0x01
+export const JOURNAL_FRAME_HEADER_SIZE = 16
+export const JOURNAL_RECORD_SIZE = 32
+export const DESIRED_HEADER_SIZE = 8
+export const DESIRED_ENTRY_SIZE = 6
+export const CONFIG_HEADER_SIZE = 12
+export const OTA_OFFER_HEADER_SIZE = 92
+export const OTA_VERSION_SIZE = 16
+
+const FRAME_COMMAND = 1
+const FRAME_STATUS = 2
+const FRAME_ACK = 3
+const FRAME_QR_DELTA = 4
+const FRAME_JOURNAL = 5
+const FRAME_DESIRED = 6
+const FRAME_CONFIG = 7
+const FRAME_OTA = 8
+
+const JOURNAL_STATUS = 1
+const JOURNAL_ACCESS = 2
+const JOURNAL_FLAG_CLOCK_KNOWN = 0x01
+const JOURNAL_FLAG_OFFLINE = 0x02
+
+const COMMAND_FLAG_SENT_AT = 0x04
+const ACK_FLAG_ONE_WAY = 0x01
+
+const QR_OP_UPSERT = 1
+const QR_OP_REMOVE = 2
+
+const ACTION_CODES: Record<string, number> = {
+  OPEN: 1,
+  CLOSE: 2,
+  STOP: 3,
+  HOLD_OPEN: 4,
+  EMERGENCY: 5,
+  RESUME: 6
+}
+
+// Acciones del controlador entero: van al canal 0
+export const CONTROLLER_ACTIONS = ['EMERGENCY', 'RESUME']
+
+// Igual que CommandPriority en portones-fc-firmware/lib/GateProtocol; viaja
+// en los bits 0-1 del byte de flags. Sin prioridad, el firmware asume VISITOR.
+export const PRIORITY_CODES: Record<string, number> = {
+  VISITOR: 0,
+  RESIDENT: 1,
+  ADMIN: 2,
+  EMERGENCY: 3
+}
+
+const HOLD_OPEN_MAX_S = 12 * 3600
+
+const STATUS_NAMES: Record<number, string> = {
+  0: 'UNKNOWN',
+  1: 'OPEN',
+  2: 'CLOSED',
+  3: 'OPENING',
+  4: 'CLOSING',
+  5: 'STOPPED',
+  6: 'OBSTRUCTED'
+}
+
+const STATUS_CODES: Record<string, number> = Object.fromEntries(
+  Object.entries(STATUS_NAMES).map(([code, name]) => [name, Number(code)])
+)
+
+const ACK_RESULTS: Record<number, string> = {
+  1: 'EXECUTED',
+  2: 'MERGED',
+  3: 'DUPLICATE',
+  4: 'REJECTED',
+  5: 'DROPPED'
+}
+
+// Igual que QrDecision en portones-fc-firmware/lib/QrAllowlist
+const QR_DECISIONS: Record<number, string> = {
+  1: 'GRANTED_ENTRY',
+  2: 'GRANTED_EXIT',
+  3: 'UNKNOWN',
+  4: 'NOT_YET_VALID',
+  5: 'EXPIRED',
+  6: 'USED_UP',
+  7: 'WRONG_DIRECTION',
+  8: 'BUSY'
+}
+
+// Igual que AccessSource en portones-fc-firmware/lib/GateProtocol
+const ACCESS_SOURCES: Record<number, string> = {
+  0: 'QR',
+  1: 'KEYPAD',
+  2: 'CARD',
+  3: 'BUTTON'
+}
+
+// Igual que ConfigKey en portones-fc-firmware/lib/DeviceConfig, con los
+// nombres de su consola. Máximo de bytes de cada valor entre paréntesis.
+export const CONFIG_FIELDS: Record<string, { key: number; maxLength: number }> = {
+  'wifi.ssid': { key: 1, maxLength: 32 },
+  'wifi.password': { key: 2, maxLength: 64 },
+  'mqtt.host': { key: 3, maxLength: 64 },
+  'mqtt.port': { key: 4, maxLength: 5 },
+  'mqtt.user': { key: 5, maxLength: 32 },
+  'mqtt.password': { key: 6, maxLength: 64 },
+  colonia: { key: 7, maxLength: 32 },
+  controller: { key: 8, maxLength: 23 },
+  'qr.key': { key: 9, maxLength: 64 },
+  'config.key': { key: 10, maxLength: 64 }
+}
+
+const header = (type: number) => (PROTOCOL_VERSION << 4) | (type & 0x0f)
+
+/**
+ * Codifica un comando en 8 bytes (10 con HOLD_OPEN, que lleva sus segundos);
+ * el commandId viaja como secuencia y la prioridad en las flags. Con
+ * sentAtUs (epoch µs, solo a controladores con 'time1') la trama termina en
+ * la hora de envío y el ack trae la latencia de un sentido. Devuelve null si
+ * la acción no tiene código binario, en cuyo caso se debe usar JSON.
+ */
+export const encodeCommandFrame = (
+  gateId: number,
+  action: string,
+  commandId: number,
+  holdSeconds = 0,
+  priority = 'VISITOR',
+  sentAtUs?: number
+): Buffer | null => {
+  const code = ACTION_CODES[action]
+  const minGate = CONTROLLER_ACTIONS.includes(action) ? 0 : 1
+  if (!code || gateId < minGate || gateId > 255) return null
+  const hold = action === 'HOLD_OPEN'
+  if (hold && !(Number.isInteger(holdSeconds) && holdSeconds >= 1 && holdSeconds <= HOLD_OPEN_MAX_S)) return null
+
+  const base = hold ? COMMAND_HOLD_FRAME_SIZE : COMMAND_FRAME_SIZE
+  const sentAt = sentAtUs !== undefined && Number.isSafeInteger(sentAtUs) && sentAtUs > 0
+  const frame = Buffer.alloc(base + (sentAt ? COMMAND_SENT_AT_SIZE : 0))
+  frame[0] = header(FRAME_COMMAND)
+  frame[1] = gateId
+  frame[2] = code
+  frame[3] = (PRIORITY_CODES[priority] ?? 0) | (sentAt ? COMMAND_FLAG_SENT_AT : 0)
+  frame.writeUInt32LE(commandId >>> 0, 4)
+  if (hold) frame.writeUInt16LE(holdSeconds, 8)
+  if (sentAt) frame.writeBigUInt64LE(BigInt(sentAtUs), base)
+  return frame
+}
+
+/**
+ * Decodifica uno o varios estados: el firmware concatena una trama de 4 bytes
+ * por portón cuando varios cambian en el mismo tick.
+ */
+export const decodeStatusFrames = (
+  message: Buffer
+): { gateId: number; status: string }[] | null => {
+  if (message.length === 0 || message.length % STATUS_FRAME_SIZE !== 0) return null
+
+  const entries: { gateId: number; status: string }[] = []
+  for (let offset = 0; offset < message.length; offset += STATUS_FRAME_SIZE) {
+    const status = STATUS_NAMES[message[offset + 2]]
+    if (message[offset] !== header(FRAME_STATUS) || !status) return null
+    entries.push({ gateId: message[offset + 1], status })
+  }
+  return entries
+}
+
+/**
+ * oneWayUs (envío en la API -> actuación, con la hora SNTP del controlador)
+ * solo viene en la trama de 16 bytes, respuesta a un comando con sentAtUs.
+ */
+export const decodeAckFrame = (
+  frame: Buffer
+): { commandId: number; gateId: number; result: string; latencyUs: number; oneWayUs?: number } | null => {
+  if (frame.length < ACK_FRAME_SIZE || frame[0] !== header(FRAME_ACK)) return null
+  const oneWay = (frame[3] & ACK_FLAG_ONE_WAY) !== 0
+  if (frame.length !== (oneWay ? ACK_ONE_WAY_FRAME_SIZE : ACK_FRAME_SIZE)) return null
+  const result = ACK_RESULTS[frame[2]]
+  if (!result) return null
+  return {
+    gateId: frame[1],
+    result,
+    commandId: frame.readUInt32LE(4),
+    latencyUs: frame.readUInt32LE(8),
+    ...(oneWay ? { oneWayUs: frame.readInt32LE(12) } : {})
+  }
+}
+
+// Lado del controlador, como en GateProtocol.cpp: lo usa el simulador de
+// carga (src/loadtest.ts) para hacerse pasar por firmware
+
+const ACTION_NAMES: Record<number, string> = Object.fromEntries(
+  Object.entries(ACTION_CODES).map(([name, code]) => [code, name])
+)
+const ACK_CODES: Record<string, number> = Object.fromEntries(
+  Object.entries(ACK_RESULTS).map(([code, name]) => [name, Number(code)])
+)
+
+export const decodeCommandFrame = (
+  frame: Buffer
+): { gateId: number; action: string; commandId: number; holdSeconds: number; sentAtUs?: number } | null => {
+  if (frame.length < COMMAND_FRAME_SIZE || frame[0] !== header(FRAME_COMMAND)) return null
+  const action = ACTION_NAMES[frame[2]]
+  if (!action) return null
+  const hold = action === 'HOLD_OPEN'
+  const sentAt = (frame[3] & COMMAND_FLAG_SENT_AT) !== 0
+  const base = hold ? COMMAND_HOLD_FRAME_SIZE : COMMAND_FRAME_SIZE
+  if (frame.length !== base + (sentAt ? COMMAND_SENT_AT_SIZE : 0)) return null
+  return {
+    gateId: frame[1],
+    action,
+    commandId: frame.readUInt32LE(4),
+    holdSeconds: hold ? frame.readUInt16LE(8) : 0,
+    ...(sentAt ? { sentAtUs: Number(frame.readBigUInt64LE(base)) } : {})
+  }
+}
+
+/** Estados concatenados, uno de 4 bytes por portón. */
+export const encodeStatusFrames = (entries: { gateId: number; status: string }[]): Buffer => {
+  const frames = Buffer.alloc(entries.length * STATUS_FRAME_SIZE)
+  entries.forEach((entry, i) => {
+    const offset = i * STATUS_FRAME_SIZE
+    frames[offset] = header(FRAME_STATUS)
+    frames[offset + 1] = entry.gateId
+    frames[offset + 2] = STATUS_CODES[entry.status] ?? 0
+  })
+  return frames
+}
+
+export const encodeAckFrame = (gateId: number, result: string, commandId: number, latencyUs: number): Buffer => {
+  const frame = Buffer.alloc(ACK_FRAME_SIZE)
+  frame[0] = header(FRAME_ACK)
+  frame[1] = gateId
+  frame[2] = ACK_CODES[result] ?? 0
+  frame.writeUInt32LE(commandId >>> 0, 4)
+  frame.writeUInt32LE(Math.min(latencyUs, 0xffffffff) >>> 0, 8)
+  return frame
+}
+
+/** Entrada de la allowlist local del controlador; fechas en epoch (s). */
+export interface QrAllowlistEntry {
+  code: number
+  validFrom: number
+  expiresAt: number
+  uses: number
+  maxUses: number
+}
+
+export type QrDeltaOp = { kind: 'upsert'; entry: QrAllowlistEntry } | { kind: 'remove'; code: number }
+
+/**
+ * Codifica una delta de allowlist firmada con HMAC-SHA256. Solo se aplica en
+ * el controlador si su versión actual es `baseVersion`, salvo con
+ * QR_DELTA_RESET, que reemplaza la lista completa.
+ */
+export const encodeQrDelta = (
+  ops: QrDeltaOp[],
+  flags: number,
+  baseVersion: number,
+  newVersion: number,
+  issuedAt: number,
+  key: string
+): Buffer => {
+  const body = Buffer.alloc(QR_DELTA_HEADER_SIZE + ops.length * QR_DELTA_OP_SIZE)
+  body[0] = header(FRAME_QR_DELTA)
+  body[1] = flags
+  body.writeUInt16LE(ops.length, 2)
+  body.writeUInt32LE(baseVersion >>> 0, 4)
+  body.writeUInt32LE(newVersion >>> 0, 8)
+  body.writeUInt32LE(issuedAt >>> 0, 12)
+
+  ops.forEach((op, i) => {
+    const offset = QR_DELTA_HEADER_SIZE + i * QR_DELTA_OP_SIZE
+    if (op.kind === 'remove') {
+      body[offset] = QR_OP_REMOVE
+      body.writeUInt32LE(op.code >>> 0, offset + 1)
+      return
+    }
+    const { entry } = op
+    body[offset] = QR_OP_UPSERT
+    body.writeUInt32LE(entry.code >>> 0, offset + 1)
+    body.writeUInt32LE(entry.validFrom >>> 0, offset + 5)
+    body.writeUInt32LE(entry.expiresAt >>> 0, offset + 9)
+    body.writeUInt16LE(Math.min(entry.uses, 0xffff), offset + 13)
+    body.writeUInt16LE(Math.min(entry.maxUses, 0xffff), offset + 15)
+  })
+
+  const mac = createHmac('sha256', key).update(body).digest()
+  return Buffer.concat([body, mac])
+}
+
+/**
+ * Evento del diario del controlador; `value` es el estado o la decisión QR.
+ * `source` dice de dónde vino un acceso: lector QR, teclado o tarjeta
+ * (autorizados con la misma allowlist) o el botón, que no lleva código.
+ */
+export interface JournalRecord {
+  seq: number
+  type: 'STATUS' | 'ACCESS'
+  gateId: number
+  value: string
+  at: number
+  code: number
+  uses: number
+  source: string
+  offline: boolean
+  clockKnown: boolean
+}
+
+export interface JournalFrame {
+  journalId: number
+  fromSeq: number
+  throughSeq: number
+  records: JournalRecord[]
+}
+
+/**
+ * Decodifica un reenvío del diario. El mensaje cubre de `fromSeq` a
+ * `throughSeq`; las secuencias sin registro son huecos que el controlador no
+ * pudo recuperar. El CRC de cada registro ya se validó al leer la flash.
+ */
+export const decodeJournalFrame = (message: Buffer): JournalFrame | null => {
+  if (message.length < JOURNAL_FRAME_HEADER_SIZE || message[0] !== header(FRAME_JOURNAL)) return null
+  const count = message.readUInt16LE(2)
+  if (message.length !== JOURNAL_FRAME_HEADER_SIZE + count * JOURNAL_RECORD_SIZE) return null
+
+  const frame: JournalFrame = {
+    journalId: message.readUInt32LE(4),
+    fromSeq: message.readUInt32LE(8),
+    throughSeq: message.readUInt32LE(12),
+    records: []
+  }
+  for (let i = 0; i < count; i++) {
+    const offset = JOURNAL_FRAME_HEADER_SIZE + i * JOURNAL_RECORD_SIZE
+    const type = message[offset + 4]
+    const value = type === JOURNAL_STATUS ? STATUS_NAMES[message[offset + 6]] : QR_DECISIONS[message[offset + 6]]
+    if ((type !== JOURNAL_STATUS && type !== JOURNAL_ACCESS) || !value) continue
+    const flags = message[offset + 7]
+    frame.records.push({
+      seq: message.readUInt32LE(offset),
+      type: type === JOURNAL_STATUS ? 'STATUS' : 'ACCESS',
+      gateId: message[offset + 5],
+      value,
+      at: message.readUInt32LE(offset + 8),
+      code: message.readUInt32LE(offset + 12),
+      uses: message.readUInt16LE(offset + 16),
+      source: ACCESS_SOURCES[message[offset + 18]] ?? 'QR',
+      offline: (flags & JOURNAL_FLAG_OFFLINE) !== 0,
+      clockKnown: (flags & JOURNAL_FLAG_CLOCK_KNOWN) !== 0
+    })
+  }
+  return frame
+}
+
+/** Estado en que debería estar un portón (número local) hasta `until` (epoch s, 0 = sin límite). */
+export interface DesiredGateState {
+  gateId: number
+  status: string
+  until: number
+}
+
+/**
+ * Codifica el estado deseado de un controlador. Se publica retenido, así un
+ * controlador que reinicia lo recibe al suscribirse.
+ */
+export const encodeDesiredFrame = (entries: DesiredGateState[], issuedAt: number): Buffer => {
+  const valid = entries.filter((e) => STATUS_CODES[e.status] !== undefined && e.gateId >= 1 && e.gateId <= 255)
+  const frame = Buffer.alloc(DESIRED_HEADER_SIZE + valid.length * DESIRED_ENTRY_SIZE)
+  frame[0] = header(FRAME_DESIRED)
+  frame[1] = valid.length
+  frame.writeUInt32LE(issuedAt >>> 0, 4)
+  valid.forEach((entry, i) => {
+    const offset = DESIRED_HEADER_SIZE + i * DESIRED_ENTRY_SIZE
+    frame[offset] = entry.gateId
+    frame[offset + 1] = STATUS_CODES[entry.status]
+    frame.writeUInt32LE(entry.until >>> 0, offset + 2)
+  })
+  return frame
+}
+
+/**
+ * Codifica una actualización de configuración firmada con HMAC-SHA256. El
+ * controlador la aplica completa o la rechaza completa, y solo si `version`
+ * supera la que tiene. Devuelve null si algún campo no existe o no cabe.
+ */
+export const encodeConfigFrame = (
+  fields: Record<string, string>,
+  version: number,
+  issuedAt: number,
+  key: string
+): Buffer | null => {
+  const entries: Buffer[] = []
+  for (const [name, value] of Object.entries(fields)) {
+    const field = CONFIG_FIELDS[name]
+    const bytes = Buffer.from(String(value), 'utf8')
+    if (!field || bytes.length > field.maxLength) return null
+    entries.push(Buffer.from([field.key, bytes.length]), bytes)
+  }
+  const head = Buffer.alloc(CONFIG_HEADER_SIZE)
+  head[0] = header(FRAME_CONFIG)
+  head[1] = 0
+  head.writeUInt16LE(Object.keys(fields).length, 2)
+  head.writeUInt32LE(version >>> 0, 4)
+  head.writeUInt32LE(issuedAt >>> 0, 8)
+
+  const body = Buffer.concat([head, ...entries])
+  const mac = createHmac('sha256', key).update(body).digest()
+  return Buffer.concat([body, mac])
+}
+
+// Igual que OtaFormat en portones-fc-firmware/lib/OtaImage
+export const OTA_FORMATS: Record<string, number> = {
+  raw: 0,
+  zlib: 1,
+  delta: 2
+}
+
+export interface OtaOffer {
+  format: number
+  version: string
+  url: string // http(s); la integridad la da sha256, no el transporte
+  size: number // de la imagen final, no de la descarga
+  sha256: string // hex: el digest que ESP-IDF agrega al final de la app
+  baseSha256?: string // hex, solo para deltas: la imagen que debe correr
+}
+
+/**
+ * Codifica una oferta de actualización OTA firmada con HMAC-SHA256
+ * (la clave de configuración). Los datos salen de tools/ota_image.py del
+ * firmware. Devuelve null si la URL, la versión o algún digest no caben.
+ */
+export const encodeOtaOffer = (offer: OtaOffer, issuedAt: number, key: string): Buffer | null => {
+  const url = Buffer.from(offer.url, 'utf8')
+  const version = Buffer.from(offer.version, 'utf8')
+  const sha = Buffer.from(offer.sha256, 'hex')
+  const baseSha = offer.baseSha256 ? Buffer.from(offer.baseSha256, 'hex') : Buffer.alloc(32)
+  if (url.length === 0 || url.length > 255 || version.length > OTA_VERSION_SIZE) return null
+  if (sha.length !== 32 || baseSha.length !== 32) return null
+
+  const head = Buffer.alloc(OTA_OFFER_HEADER_SIZE)
+  head[0] = header(FRAME_OTA)
+  head[1] = offer.format
+  head[2] = url.length
+  head[3] = 0
+  head.writeUInt32LE(offer.size >>> 0, 4)
+  head.writeUInt32LE(issuedAt >>> 0, 8)
+  sha.copy(head, 12)
+  baseSha.copy(head, 44)
+  version.copy(head, 76)
+
+  const body = Buffer.concat([head, url])
+  const mac = createHmac('sha256', key).update(body).digest()
+  return Buffer.concat([body, mac])
+}
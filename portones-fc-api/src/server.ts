@@ -2,8 +2,21 @@ import Fastify from 'fastify'
 import cors from '@fastify/cors'
 import { createClient } from '@supabase/supabase-js'
 import { config } from './config/env'
-import { connectMQTT } from './plugins/mqtt'
-import { getAllGatesStatus } from './state/gates'
+import {
+  connectMQTT,
+  publishGateCommand,
+  gateAddress,
+  publishQrDelta,
+  onQrAllowlistRequest,
+  onAccessUpload,
+  registerGateChannels,
+  publishControllerConfig,
+  publishOtaOffer,
+  isGateControllerOffline
+} from './plugins/mqtt'
+import { QrAllowlistEntry, QrDeltaOp, CONFIG_FIELDS, OTA_FORMATS, OTA_VERSION_SIZE } from './protocol/binary'
+import { getAllGatesStatus, getObstructionHoldoff } from './state/gates'
+import { CONTROLLER_OFFLINE_RETRY_S } from './state/controllers'
 
 // Initialize Fastify
 const fastify = Fastify({
@@ -595,6 +608,222 @@ fastify.get('/admin/maintenance-report', async (request, reply) => {
   }
 })
 
+// Admin con colonia y los controladores de sus portones a los que va una
+// orden: todos, o solo controllerId si viene. Sin admin o sin destino
+// responde aquí (403/400/404) y devuelve null; un error de la base se lanza.
+const resolveAdminControllers = async (
+  userId: string,
+  controllerId: unknown,
+  reply: any
+): Promise<{ profile: { role: string; colonia_id: string }; targets: string[] } | null> => {
+  const { data: profile, error: profileError } = await supabaseAdmin
+    .from('profiles')
+    .select('role, colonia_id')
+    .eq('id', userId)
+    .single()
+
+  if (profileError || !profile) {
+    reply.status(403).send({
+      error: 'Forbidden',
+      message: 'User profile not found'
+    })
+    return null
+  }
+
+  if (profile.role !== 'admin') {
+    reply.status(403).send({
+      error: 'Forbidden',
+      message: 'Admin access required'
+    })
+    return null
+  }
+
+  if (!profile.colonia_id) {
+    reply.status(400).send({
+      error: 'Bad Request',
+      message: 'Admin must belong to a colonia'
+    })
+    return null
+  }
+
+  const { data: gates, error: gatesError } = await supabaseAdmin
+    .from('gates')
+    .select('controller_id')
+    .eq('colonia_id', profile.colonia_id)
+    .not('controller_id', 'is', null)
+
+  if (gatesError) throw gatesError
+
+  const known = [...new Set((gates || []).map((g: any) => g.controller_id as string))]
+  const targets = controllerId ? known.filter((id) => id === controllerId) : known
+  if (targets.length === 0) {
+    reply.status(404).send({
+      error: 'Not Found',
+      message: 'No controllers found for this colonia'
+    })
+    return null
+  }
+  return { profile, targets }
+}
+
+// Configuración remota de los controladores de la colonia del admin: red,
+// broker, credenciales o claves, sin reflashear. Sin controllerId va a todos.
+fastify.post('/admin/controllers/config', async (request, reply) => {
+  try {
+    const user = (request as any).user
+    const { controllerId, fields } = (request.body as any) || {}
+
+    if (
+      typeof fields !== 'object' ||
+      fields === null ||
+      Object.keys(fields).length === 0 ||
+      Object.entries(fields).some(([name, value]) => !CONFIG_FIELDS[name] || typeof value !== 'string')
+    ) {
+      reply.status(400).send({
+        error: 'Bad Request',
+        message: `fields must map any of ${Object.keys(CONFIG_FIELDS).join(', ')} to strings`
+      })
+      return
+    }
+
+    const admin = await resolveAdminControllers(user.id, controllerId, reply)
+    if (!admin) return
+    const { profile, targets } = admin
+
+    const client = await connectMQTT()
+    const published = targets.map((id) => ({
+      controllerId: id,
+      version: publishControllerConfig(client, profile.colonia_id, id, fields)
+    }))
+
+    reply.send({
+      success: true,
+      // version null: el controlador no anunció 'config1' o un valor no cabe
+      controllers: published,
+      timestamp: new Date().toISOString()
+    })
+  } catch (error) {
+    fastify.log.error({ error }, 'Error in /admin/controllers/config')
+    reply.status(500).send({
+      error: 'Server Error',
+      message: 'Failed to publish controller config'
+    })
+  }
+})
+
+// Actualización de firmware de los controladores de la colonia del admin. La
+// imagen se sube aparte (cualquier URL http/https); los datos de la oferta
+// los imprime tools/ota_image.py del firmware. Sin controllerId va a todos.
+fastify.post('/admin/controllers/ota', async (request, reply) => {
+  try {
+    const user = (request as any).user
+    const { controllerId, version, url, size, sha256, format, baseSha256 } = (request.body as any) || {}
+    const formatCode = typeof format === 'string' ? OTA_FORMATS[format] : format
+    const isDigest = (value: unknown) => typeof value === 'string' && /^[0-9a-f]{64}$/i.test(value)
+
+    if (
+      typeof version !== 'string' ||
+      version.length === 0 ||
+      Buffer.byteLength(version) > OTA_VERSION_SIZE ||
+      typeof url !== 'string' ||
+      !/^https?:\/\/[^/]+/.test(url) ||
+      Buffer.byteLength(url) > 255 ||
+      !Number.isInteger(size) ||
+      size <= 0 ||
+      !isDigest(sha256) ||
+      !Object.values(OTA_FORMATS).includes(formatCode) ||
+      (formatCode === OTA_FORMATS.delta && !isDigest(baseSha256))
+    ) {
+      reply.status(400).send({
+        error: 'Bad Request',
+        message:
+          'version (≤16 bytes), url (http/https, ≤255 bytes), size, sha256 (hex) and format ' +
+          `(${Object.keys(OTA_FORMATS).join(', ')}) are required; delta also needs baseSha256`
+      })
+      return
+    }
+
+    const admin = await resolveAdminControllers(user.id, controllerId, reply)
+    if (!admin) return
+    const { profile, targets } = admin
+
+    const client = await connectMQTT()
+    const offer = { format: formatCode, version, url, size, sha256, baseSha256 }
+    const published = targets.map((id) => ({
+      controllerId: id,
+      offered: publishOtaOffer(client, profile.colonia_id, id, offer)
+    }))
+
+    reply.send({
+      success: true,
+      // offered false: el controlador no anunció 'ota1'
+      controllers: published,
+      timestamp: new Date().toISOString()
+    })
+  } catch (error) {
+    fastify.log.error({ error }, 'Error in /admin/controllers/ota')
+    reply.status(500).send({
+      error: 'Server Error',
+      message: 'Failed to publish OTA offer'
+    })
+  }
+})
+
+// Emergencia en los controladores de la colonia del admin: OPEN_ALL abre
+// todos los portones y los deja abiertos (sin cierre automático ni CLOSE de
+// menor prioridad) hasta un RESUME. Sin controllerId va a todos.
+fastify.post('/admin/gates/emergency', async (request, reply) => {
+  try {
+    const user = (request as any).user
+    const { controllerId, action } = (request.body as any) || {}
+
+    if (action !== 'OPEN_ALL' && action !== 'RESUME') {
+      reply.status(400).send({
+        error: 'Bad Request',
+        message: 'action must be OPEN_ALL or RESUME'
+      })
+      return
+    }
+
+    const admin = await resolveAdminControllers(user.id, controllerId, reply)
+    if (!admin) return
+    const { profile, targets } = admin
+
+    const client = await connectMQTT()
+    const command =
+      action === 'OPEN_ALL'
+        ? { action: 'EMERGENCY', gateId: 0, priority: 'EMERGENCY' }
+        : { action: 'RESUME', gateId: 0, priority: 'ADMIN' }
+    await Promise.all(
+      targets.map(
+        (id) =>
+          new Promise<void>((resolve, reject) => {
+            publishGateCommand(
+              client,
+              { ...command, timestamp: new Date().toISOString(), userId: user.id },
+              { coloniaId: profile.colonia_id, controllerId: id, channel: 0 },
+              (error) => (error ? reject(error) : resolve())
+            )
+          })
+      )
+    )
+
+    fastify.log.warn(`Emergency ${action} sent by ${user.id} to ${targets.join(', ')}`)
+    reply.send({
+      success: true,
+      action,
+      controllers: targets,
+      timestamp: new Date().toISOString()
+    })
+  } catch (error) {
+    fastify.log.error({ error }, 'Error in /admin/gates/emergency')
+    reply.status(500).send({
+      error: 'Server Error',
+      message: 'Failed to publish emergency command'
+    })
+  }
+})
+
 // Ruta de prueba MQTT
 fastify.post('/dev/test-mqtt', async (request, reply) => {
   try {
@@ -1337,7 +1566,7 @@ fastify.post('/gate/open', async (request, reply) => {
     // 3. Validate gate exists and is enabled
     const { data: gate, error: gateError } = await supabaseAdmin
       .from('gates')
-      .select('id, enabled, colonia_id')
+      .select('id, enabled, colonia_id, controller_id, channel')
       .eq('id', gateId)
       .single()
 
@@ -1396,6 +1625,31 @@ fastify.post('/gate/open', async (request, reply) => {
       return
     }
 
+    // Atascado: no insistir hasta que venza el margen
+    const obstructedMs = getObstructionHoldoff(gateId)
+    if (obstructedMs > 0) {
+      fastify.log.warn(`Gate ${gateId} is obstructed, rejecting open`)
+      reply.header('Retry-After', Math.ceil(obstructedMs / 1000))
+      reply.status(409).send({
+        error: 'Conflict',
+        message: 'Gate is obstructed. Check it before retrying.',
+        retryAfterMs: obstructedMs
+      })
+      return
+    }
+
+    // Controlador caído (última voluntad o sin latidos): nadie recibiría el comando
+    if (isGateControllerOffline(gateAddress(gate))) {
+      fastify.log.warn(`Controller of gate ${gateId} is offline, rejecting open`)
+      reply.header('Retry-After', CONTROLLER_OFFLINE_RETRY_S)
+      reply.status(503).send({
+        error: 'Service Unavailable',
+        message: 'Gate controller is offline. Try again shortly.',
+        retryAfterMs: CONTROLLER_OFFLINE_RETRY_S * 1000
+      })
+      return
+    }
+
     // Connect to MQTT if not already connected
     const client = await connectMQTT()
 
@@ -1403,16 +1657,17 @@ fastify.post('/gate/open', async (request, reply) => {
     const payload = {
       action: 'OPEN',
       gateId,
+      priority: profile.role === 'admin' ? 'ADMIN' : 'RESIDENT',
       timestamp: new Date().toISOString(),
       userId: user.id
     }
 
     // Publish to MQTT topic with callback
     await new Promise<void>((resolve, reject) => {
-      client.publish(
-        'portones/gate/command',
-        JSON.stringify(payload),
-        { qos: 1 },
+      publishGateCommand(
+        client,
+        payload,
+        gateAddress(gate),
         (error) => {
           if (error) {
             fastify.log.error({ error }, 'MQTT publish error')
@@ -1519,7 +1774,7 @@ fastify.post('/gate/close', async (request, reply) => {
     // 3. Validate gate exists and is enabled
     const { data: gate, error: gateError } = await supabaseAdmin
       .from('gates')
-      .select('id, enabled, colonia_id')
+      .select('id, enabled, colonia_id, controller_id, channel')
       .eq('id', gateId)
       .single()
 
@@ -1578,6 +1833,31 @@ fastify.post('/gate/close', async (request, reply) => {
       return
     }
 
+    // Atascado: no insistir hasta que venza el margen
+    const obstructedMs = getObstructionHoldoff(gateId)
+    if (obstructedMs > 0) {
+      fastify.log.warn(`Gate ${gateId} is obstructed, rejecting close`)
+      reply.header('Retry-After', Math.ceil(obstructedMs / 1000))
+      reply.status(409).send({
+        error: 'Conflict',
+        message: 'Gate is obstructed. Check it before retrying.',
+        retryAfterMs: obstructedMs
+      })
+      return
+    }
+
+    // Controlador caído (última voluntad o sin latidos): nadie recibiría el comando
+    if (isGateControllerOffline(gateAddress(gate))) {
+      fastify.log.warn(`Controller of gate ${gateId} is offline, rejecting close`)
+      reply.header('Retry-After', CONTROLLER_OFFLINE_RETRY_S)
+      reply.status(503).send({
+        error: 'Service Unavailable',
+        message: 'Gate controller is offline. Try again shortly.',
+        retryAfterMs: CONTROLLER_OFFLINE_RETRY_S * 1000
+      })
+      return
+    }
+
     // Connect to MQTT if not already connected
     const client = await connectMQTT()
 
@@ -1585,16 +1865,17 @@ fastify.post('/gate/close', async (request, reply) => {
     const payload = {
       action: 'CLOSE',
       gateId,
+      priority: profile.role === 'admin' ? 'ADMIN' : 'RESIDENT',
       timestamp: new Date().toISOString(),
       userId: user.id
     }
 
     // Publish to MQTT topic with callback
     await new Promise<void>((resolve, reject) => {
-      client.publish(
-        'portones/gate/command',
-        JSON.stringify(payload),
-        { qos: 1 },
+      publishGateCommand(
+        client,
+        payload,
+        gateAddress(gate),
         (error) => {
           if (error) {
             fastify.log.error({ error }, 'MQTT publish error')
@@ -1644,6 +1925,139 @@ fastify.post('/gate/close', async (request, reply) => {
 // QR CODE MANAGEMENT ENDPOINTS
 // ==========================================
 
+// ==================== ALLOWLIST QR LOCAL ====================
+// Los controladores que anuncian 'qr1' guardan los QR activos de su colonia
+// y autorizan sin pasar por aquí; luego suben los accesos por MQTT.
+
+const toEpochSeconds = (value: string | null | undefined) =>
+  value ? Math.floor(new Date(value).getTime() / 1000) : 0
+
+const toAllowlistEntry = (qr: any): QrAllowlistEntry => ({
+  code: Number(qr.short_code),
+  validFrom: toEpochSeconds(qr.valid_from),
+  expiresAt: toEpochSeconds(qr.expires_at),
+  uses: qr.uses ?? 0,
+  maxUses: qr.max_uses ?? 0
+})
+
+const loadColoniaAllowlist = async (coloniaId: string): Promise<QrAllowlistEntry[]> => {
+  const { data, error } = await supabaseAdmin
+    .from('visitor_qr')
+    .select('short_code, valid_from, expires_at, uses, max_uses, houses!inner(colonia_id)')
+    .eq('status', 'active')
+    .eq('houses.colonia_id', coloniaId)
+    .gt('expires_at', new Date().toISOString())
+
+  if (error) throw error
+  return (data || []).filter((qr: any) => qr.uses < qr.max_uses).map(toAllowlistEntry)
+}
+
+/**
+ * Propaga el estado actual de un QR a los controladores de su colonia: alta
+ * o actualización si sigue usable, baja si no.
+ */
+const syncQrToControllers = async (qrId: string) => {
+  try {
+    const { data: qr } = await supabaseAdmin
+      .from('visitor_qr')
+      .select('short_code, valid_from, expires_at, uses, max_uses, status, houses(colonia_id)')
+      .eq('id', qrId)
+      .single()
+
+    const coloniaId = (qr as any)?.houses?.colonia_id
+    if (!qr || !coloniaId) return
+
+    const { data: gates } = await supabaseAdmin
+      .from('gates')
+      .select('controller_id')
+      .eq('colonia_id', coloniaId)
+      .not('controller_id', 'is', null)
+
+    const controllers = [...new Set((gates || []).map((g: any) => g.controller_id as string))]
+    if (controllers.length === 0) return
+
+    const usable = qr.status === 'active' && qr.uses < qr.max_uses && new Date(qr.expires_at) > new Date()
+    const op: QrDeltaOp = usable
+      ? { kind: 'upsert', entry: toAllowlistEntry(qr) }
+      : { kind: 'remove', code: Number(qr.short_code) }
+
+    const client = await connectMQTT()
+    controllers.forEach((controllerId) => publishQrDelta(client, coloniaId, controllerId, [op]))
+  } catch (error) {
+    fastify.log.error({ error, qrId }, 'Failed to sync QR code to controllers')
+  }
+}
+
+onQrAllowlistRequest((coloniaId) => loadColoniaAllowlist(coloniaId))
+
+// Accesos autorizados (o negados) por el controlador sin la API. Solo se
+// registran los de QR conocidos: access_logs exige qr_id.
+onAccessUpload(async (coloniaId, controllerId, accesses) => {
+  for (const access of accesses) {
+    try {
+      const { data: gate } = await supabaseAdmin
+        .from('gates')
+        .select('id')
+        .eq('controller_id', controllerId)
+        .eq('channel', access.gateId)
+        .maybeSingle()
+
+      // El botón abre sin código: queda como apertura manual
+      if (access.source === 'BUTTON') {
+        await supabaseAdmin.from('access_logs').insert({
+          user_id: null,
+          qr_id: null,
+          action: 'OPEN_GATE',
+          status: 'SUCCESS',
+          method: 'MANUAL',
+          gate_id: gate?.id ?? null,
+          ...(access.clockKnown ? { timestamp: new Date(access.at * 1000).toISOString() } : {})
+        })
+        continue
+      }
+
+      // Teclado y tarjeta usan los mismos códigos que el QR
+      const { data: qr } = await supabaseAdmin
+        .from('visitor_qr')
+        .select('id, uses, max_uses, houses!inner(colonia_id)')
+        .eq('short_code', access.code)
+        .eq('houses.colonia_id', coloniaId)
+        .maybeSingle()
+
+      if (!qr) {
+        fastify.log.warn({ coloniaId, controllerId, access }, 'Offline access with unknown QR code')
+        continue
+      }
+
+      const granted = access.result.startsWith('GRANTED')
+      await supabaseAdmin.from('access_logs').insert({
+        user_id: null,
+        qr_id: qr.id,
+        action: 'OPEN_GATE',
+        status: granted ? 'SUCCESS' : 'DENIED_NO_ACCESS',
+        method: 'QR',
+        gate_id: gate?.id ?? null,
+        ...(access.clockKnown ? { timestamp: new Date(access.at * 1000).toISOString() } : {})
+      })
+
+      // El controlador cuenta sus propios usos; nos quedamos con el mayor
+      if (granted && access.uses > qr.uses) {
+        await supabaseAdmin
+          .from('visitor_qr')
+          .update({ uses: access.uses, ...(access.uses >= qr.max_uses ? { status: 'expired' } : {}) })
+          .eq('id', qr.id)
+      }
+
+      fastify.log.info(
+        `Offline ${access.source} access ${access.code} on ${coloniaId}/${controllerId} gate ${access.gateId}: ${access.result}` +
+          (access.offline ? ' (link down)' : '')
+      )
+    } catch (error) {
+      fastify.log.error({ error, access }, 'Failed to record offline QR access')
+    }
+  }
+})
+
 // Policy definitions
 const QR_POLICIES = {
   delivery_app: {
@@ -1823,6 +2237,7 @@ fastify.post('/qr/generate', async (request, reply) => {
     }
 
     fastify.log.info(`QR code generated: ${shortCode} for user ${user.id}, policy: ${policyType}`)
+    void syncQrToControllers(qrCode.id)
 
     reply.send({
       success: true,
@@ -1977,6 +2392,8 @@ fastify.post('/qr/delete', async (request, reply) => {
       return
     }
 
+    void syncQrToControllers(qrId)
+
     reply.send({
       success: true,
       message: 'QR code deleted successfully'
@@ -2047,6 +2464,7 @@ fastify.post('/qr/revoke', async (request, reply) => {
     }
 
     fastify.log.info({ qrId, data }, 'QR code successfully deleted')
+    void syncQrToControllers(qrId)
 
     reply.send({
       success: true,
@@ -2150,6 +2568,7 @@ fastify.post('/qr/force-exit', async (request, reply) => {
       })
       return
     }
+    void syncQrToControllers(qrId)
 
     // Log the forced exit in access_logs
     await supabaseAdmin
@@ -2273,7 +2692,7 @@ fastify.post('/gate/open-with-qr', async (request, reply) => {
     // Find appropriate gate based on visitor status and colonia
     const { data: availableGates, error: gatesError } = await supabaseAdmin
       .from('gates')
-      .select('id, name, type, enabled, colonia_id')
+      .select('id, name, type, enabled, colonia_id, controller_id, channel')
       .eq('type', requiredGateType)
       .eq('enabled', true)
 
@@ -2304,18 +2723,45 @@ fastify.post('/gate/open-with-qr', async (request, reply) => {
 
     const gateId = gate.id
 
+    // Atascado: no insistir ni gastar un uso del QR
+    const obstructedMs = getObstructionHoldoff(gateId)
+    if (obstructedMs > 0) {
+      fastify.log.warn(`Gate ${gateId} is obstructed, rejecting QR open`)
+      reply.header('Retry-After', Math.ceil(obstructedMs / 1000))
+      reply.status(409).send({
+        error: 'Conflict',
+        message: 'Gate is obstructed. Check it before retrying.',
+        retryAfterMs: obstructedMs
+      })
+      return
+    }
+
+    // Controlador caído (última voluntad o sin latidos): nadie recibiría el comando
+    if (isGateControllerOffline(gateAddress(gate))) {
+      fastify.log.warn(`Controller of gate ${gateId} is offline, rejecting QR open`)
+      reply.header('Retry-After', CONTROLLER_OFFLINE_RETRY_S)
+      reply.status(503).send({
+        error: 'Service Unavailable',
+        message: 'Gate controller is offline. Try again shortly.',
+        retryAfterMs: CONTROLLER_OFFLINE_RETRY_S * 1000
+      })
+      return
+    }
+
     // Increment QR usage
     const newUses = qrCode.uses + 1
     await supabaseAdmin
       .from('visitor_qr')
       .update({ uses: newUses })
       .eq('id', qrCode.id)
+    void syncQrToControllers(qrCode.id)
 
     // Publish MQTT command
     const client = await connectMQTT()
     const payload = {
       action: 'OPEN',
       gateId,
+      priority: 'VISITOR',
       timestamp: new Date().toISOString(),
       qrCode: shortCode,
       visitorName: qrCode.invitado,
@@ -2323,10 +2769,10 @@ fastify.post('/gate/open-with-qr', async (request, reply) => {
     }
 
     await new Promise<void>((resolve, reject) => {
-      client.publish(
-        'portones/gate/command',
-        JSON.stringify(payload),
-        { qos: 1 },
+      publishGateCommand(
+        client,
+        payload,
+        gateAddress(gate),
         (error) => {
           if (error) {
             fastify.log.error({ error }, 'MQTT publish error')
@@ -3585,6 +4031,18 @@ process.on('SIGINT', gracefulShutdown)
 // Start server
 const start = async () => {
   try {
+    // Los snapshots retenidos llegan al suscribirse: el mapa de canales debe
+    // estar listo antes de conectar
+    const { data: gates, error: gatesError } = await supabaseAdmin
+      .from('gates')
+      .select('id, colonia_id, controller_id, channel')
+      .not('controller_id', 'is', null)
+    if (gatesError) {
+      fastify.log.warn({ error: gatesError }, 'Could not preload gate channels')
+    } else {
+      registerGateChannels(gates ?? [])
+    }
+
     // Initialize MQTT connection on startup
     await connectMQTT()
 
@@ -0,0 +1,205 @@
+export interface LatencySummary {
+  n: number
+  p50: number
+  p90: number
+  p99: number
+  max: number
+}
+
+/**
+ * Último mensaje de `portones/{coloniaId}/{controllerId}/metrics`. Los
+ * contadores son acumulados desde el arranque del controlador; los
+ * percentiles (µs) describen solo el intervalo `intervalMs`.
+ */
+export interface ControllerMetrics {
+  receivedAt: string
+  uptimeMs: number
+  intervalMs: number
+  // minMaxAlloc: el menor bloque libre más grande visto desde el arranque;
+  // si baja semana a semana con free estable, el heap se fragmenta.
+  // stackFree: bytes de pila nunca usados por tarea (0 = la tarea no existe)
+  heap: {
+    free: number
+    min: number
+    maxAlloc: number
+    minMaxAlloc?: number
+    fragPct?: number
+    internalMin?: number
+    allocFailures?: number
+  }
+  stackFree?: { net: number; gate: number; log: number; wake: number }
+  // streamed: deltas QR por la partición inbox; oversize: mensajes que no
+  // cupieron en el buffer y se descartaron
+  mqtt?: { buffer: number; streamed: number; oversize: number; qrRejected: number }
+  emergency?: boolean
+  // Hora SNTP del controlador: deriva estimada del cristal, última corrección
+  // y acks cuya actuación quedó "antes" del envío (relojes desfasados)
+  clock?: {
+    synced: boolean
+    syncs: number
+    steps: number
+    driftPpb: number
+    lastErrorUs: number
+    sinceSyncS: number
+    negativeOneWay: number
+  }
+  counters: Record<string, number>
+  loopMaxUs: { net: number; gate: number }
+  deadlineLateMaxUs: number
+  // Etapa más larga de cada tarea (red: del intervalo; portones: desde el
+  // arranque) y cierres forzados por tener la tarea de portones detenida
+  stall?: {
+    net: { stage: string; us: number }
+    gate: { stage: string; us: number }
+    failsafeCloses: number
+  }
+  // Fracciones del intervalo en ‰; estimatedMa sale de un modelo fijo, no de
+  // una medición. latencyUs.wake: llegada al socket -> callback MQTT;
+  // latencyUs.oneWay: envío en la API -> actuación
+  power?: {
+    saver: boolean
+    lightSleep: boolean
+    listenInterval: number
+    keepAliveS: number
+    gatesAwakePermille: number
+    busyPermille: number
+    estimatedMa: number
+  }
+  latencyUs: Record<string, LatencySummary>
+  // Recepción -> ejecución por prioridad (visitor, resident, admin, emergency)
+  priorityUs?: Record<string, LatencySummary>
+}
+
+const controllers = new Map<string, ControllerMetrics>()
+
+export const setControllerMetrics = (key: string, metrics: ControllerMetrics) => {
+  controllers.set(key, metrics)
+}
+
+export const getControllerMetrics = (key: string) => {
+  return controllers.get(key) ?? null
+}
+
+export const getAllControllerMetrics = () => {
+  return Object.fromEntries(controllers)
+}
+
+/**
+ * Último snapshot retenido de `portones/{coloniaId}/{controllerId}/state`.
+ * `boot` mide el arranque: enlace listo y estado deseado resuelto (ms desde
+ * el encendido, 0 si aún no ocurre). `reset` es la causa de este arranque
+ * (esp_reset_reason: poweron, sw, panic, task_wdt, brownout...) y el último
+ * reinicio inesperado, con la etapa en la que estaba cada tarea.
+ */
+export interface ControllerState {
+  receivedAt: string
+  fw: string
+  config?: number // versión de configuración remota aplicada, 0 = ninguna
+  uptimeMs: number
+  boot: { readyMs: number; consistentMs: number; restored: number }
+  reset?: {
+    reason: string
+    boots: number
+    crashes: number
+    lastCrash: { reason: string; uptimeS: number; net: string; gate: string } | null
+  }
+  // EMERGENCY vigente: todo abierto hasta un RESUME
+  emergency?: boolean
+  // kind: vehicular | pedestrian; type: ENTRADA | SALIDA, como gates.type
+  gates: { gateId: number; kind?: string; type?: string; status: string }[]
+}
+
+const states = new Map<string, ControllerState>()
+
+export const setControllerState = (key: string, state: ControllerState) => {
+  states.set(key, state)
+}
+
+export const getControllerState = (key: string) => {
+  return states.get(key) ?? null
+}
+
+export const getAllControllerStates = () => {
+  return Object.fromEntries(states)
+}
+
+/**
+ * Último `portones/{coloniaId}/{controllerId}/ota/status` (retenido). state:
+ * pending | downloading | retrying | staged | rebooting | applied | current |
+ * skipped | failed | rolledback. `written` son bytes ya escritos de `size`.
+ */
+export interface ControllerOtaStatus {
+  receivedAt: string
+  state: string
+  version: string
+  running: string
+  received: number
+  written: number
+  size: number
+  detail: string
+}
+
+const otaStatuses = new Map<string, ControllerOtaStatus>()
+
+export const setControllerOta = (key: string, status: ControllerOtaStatus) => {
+  otaStatuses.set(key, status)
+}
+
+export const getControllerOta = (key: string) => {
+  return otaStatuses.get(key) ?? null
+}
+
+export const getAllControllerOta = () => {
+  return Object.fromEntries(otaStatuses)
+}
+
+/**
+ * Último `portones/{coloniaId}/{controllerId}/health` (retenido): el latido
+ * del controlador o, si su sesión murió, la última voluntad que publicó el
+ * broker (`online: false`, sin más campos). `loopMaxUs` es el peor tick
+ * desde el latido anterior (red) o desde el arranque (portones); `queues`,
+ * lo que esperaba en cada cola al enviarlo.
+ */
+export interface ControllerHealth {
+  receivedAt: string
+  online: boolean
+  uptimeS?: number
+  intervalS?: number
+  rssi?: number
+  keepAliveS?: number
+  loopMaxUs?: { net: number; gate: number }
+  queues?: { command: number; status: number; ack: number; access: number; log: number }
+  at?: number // epoch µs del controlador, si tiene hora SNTP
+}
+
+// Latidos perdidos antes de dar por caído a un controlador sin última voluntad
+const HEALTH_MISSED_BEATS = 3
+// Retry-After al rechazar un comando para un controlador caído: del orden
+// de lo que tarda en reconectar
+export const CONTROLLER_OFFLINE_RETRY_S = 10
+
+const healths = new Map<string, ControllerHealth>()
+
+export const setControllerHealth = (key: string, health: ControllerHealth) => {
+  healths.set(key, health)
+}
+
+export const getControllerHealth = (key: string) => {
+  return healths.get(key) ?? null
+}
+
+export const getAllControllerHealth = () => {
+  return Object.fromEntries(healths)
+}
+
+/**
+ * Caído: el broker publicó su última voluntad o dejó de latir. Sin ningún
+ * mensaje de salud (firmware sin 'health1') no se sabe, y no se bloquea.
+ */
+export const isControllerOffline = (key: string) => {
+  const health = healths.get(key)
+  if (!health) return false
+  if (!health.online) return true
+  if (!health.intervalS) return false
+  return Date.now() - Date.parse(health.receivedAt) > HEALTH_MISSED_BEATS * health.intervalS * 1000
+}
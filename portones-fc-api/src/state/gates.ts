@@ -3,6 +3,8 @@ export type GateStatus =
   | 'CLOSED'
   | 'OPENING'
   | 'CLOSING'
+  | 'STOPPED'
+  | 'OBSTRUCTED'
   | 'UNKNOWN'
 
 type GatesState = Record<number, GateStatus>
@@ -14,10 +16,33 @@ const gates: GatesState = {
   4: 'UNKNOWN'
 }
 
+/**
+ * Un portón que el controlador reporta atascado (OBSTRUCTED: motor sin
+ * potencia por consumo sostenido o sin final de carrera) no recibe comandos
+ * durante OBSTRUCTED_HOLDOFF_MS: reintentar solo lo vuelve a forzar. Pasado
+ * el margen se permite un intento, por si alguien lo despejó; si sigue
+ * atascado vuelve a reportarlo y el margen empieza de nuevo.
+ */
+export const OBSTRUCTED_HOLDOFF_MS = 30000
+
+const obstructedAt = new Map<number, number>()
+
 export const setGateStatus = (gateId: number, status: GateStatus) => {
+  if (status !== 'OBSTRUCTED') {
+    obstructedAt.delete(gateId)
+  } else if (gates[gateId] !== 'OBSTRUCTED') {
+    obstructedAt.set(gateId, Date.now())
+  }
   gates[gateId] = status
 }
 
+// ms que faltan para volver a aceptar comandos, 0 si no está atascado
+export const getObstructionHoldoff = (gateId: number) => {
+  const since = obstructedAt.get(gateId)
+  if (since === undefined) return 0
+  return Math.max(0, OBSTRUCTED_HOLDOFF_MS - (Date.now() - since))
+}
+
 export const getGateStatus = (gateId: number) => {
   return gates[gateId] ?? 'UNKNOWN'
 }
@@ -0,0 +1,48 @@
+/**
+ * Ida y vuelta de los comandos: desde que la API publica un comando hasta
+ * que llega a plugins/mqtt.ts el estado que produce (OPENING u OPEN tras un
+ * OPEN, CLOSING o CLOSED tras un CLOSE, STOPPED tras un STOP). Cubre broker,
+ * red y firmware. Guarda las últimas ROUND_TRIP_SAMPLES muestras (ms).
+ */
+export interface RoundTripSummary {
+  n: number
+  lost: number // comandos sin estado dentro de ROUND_TRIP_TIMEOUT_MS
+  p50: number
+  p99: number
+  p999: number
+  max: number
+}
+
+export const ROUND_TRIP_TIMEOUT_MS = 30000
+const ROUND_TRIP_SAMPLES = 100000
+
+const samples = new Float64Array(ROUND_TRIP_SAMPLES)
+let count = 0
+let lost = 0
+
+export const recordRoundTrip = (ms: number) => {
+  samples[count % ROUND_TRIP_SAMPLES] = ms
+  count++
+}
+
+export const recordRoundTripLost = () => {
+  lost++
+}
+
+export const getRoundTripSummary = (): RoundTripSummary => {
+  const sorted = samples.slice(0, Math.min(count, ROUND_TRIP_SAMPLES)).sort()
+  const at = (p: number) => (sorted.length ? sorted[Math.min(sorted.length - 1, Math.floor(sorted.length * p))]! : 0)
+  return {
+    n: count,
+    lost,
+    p50: at(0.5),
+    p99: at(0.99),
+    p999: at(0.999),
+    max: sorted.length ? sorted[sorted.length - 1]! : 0
+  }
+}
+
+export const resetRoundTrips = () => {
+  count = 0
+  lost = 0
+}
@@ -24,7 +24,7 @@ const supabaseAnonKey = process.env.EXPO_PUBLIC_SUPABASE_ANON_KEY || ''
 const supabase = createClient(supabaseUrl, supabaseAnonKey)
 
 interface GateState {
-  [key: string]: 'OPEN' | 'CLOSED' | 'OPENING' | 'CLOSING' | 'UNKNOWN'
+  [key: string]: 'OPEN' | 'CLOSED' | 'OPENING' | 'CLOSING' | 'STOPPED' | 'OBSTRUCTED' | 'UNKNOWN'
 }
 
 interface Colonia {
@@ -35,7 +35,7 @@ interface Colonia {
 interface Gate {
   id: number
   name: string
-  status: 'OPEN' | 'CLOSED' | 'OPENING' | 'CLOSING' | 'UNKNOWN'
+  status: 'OPEN' | 'CLOSED' | 'OPENING' | 'CLOSING' | 'STOPPED' | 'OBSTRUCTED' | 'UNKNOWN'
   enabled: boolean
   type: string
   colonia_id: string | null
@@ -179,6 +179,10 @@ const GateCard: React.FC<GateCardProps> = ({
         return '$green10'
       case 'CLOSED':
         return '$blue10'
+      case 'STOPPED':
+        return '$orange10'
+      case 'OBSTRUCTED':
+        return '$red10'
       default:
         return '$gray10'
     }
@@ -194,6 +198,10 @@ const GateCard: React.FC<GateCardProps> = ({
         return 'Abriendo...'
       case 'CLOSING':
         return 'Cerrando...'
+      case 'STOPPED':
+        return 'Detenido'
+      case 'OBSTRUCTED':
+        return 'Atascado'
       default:
         return 'Cerrado'
     }
@@ -220,7 +228,7 @@ const GateCard: React.FC<GateCardProps> = ({
             elevate
             $heightSm={{ size: 50 }}
           >
-            {effectiveStatus === 'OPEN' ? (
+            {effectiveStatus === 'OPEN' || effectiveStatus === 'STOPPED' ? (
               <Unlock size={32} color='white' />
             ) : (
               <Lock size={32} color='white' />
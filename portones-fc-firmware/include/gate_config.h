@@ -0,0 +1,133 @@
+#pragma once
+
+#include <stdint.h>
+#include <MotionProfile.h>
+
+// ==================== TABLA DE PORTONES ====================
+// Un renglón por portón físico de esta placa; el portón n es GATES[n - 1].
+// Todo es constante de compilación: con forEachGate() el bucle de control se
+// despliega y cada campo se resuelve como inmediato, sin cargas ni saltos
+// por índice. Cambiar la instalación es editar esta tabla y recompilar.
+
+enum GateKind : uint8_t {
+  GATE_VEHICULAR,
+  GATE_PEDESTRIAN,
+};
+
+// Igual que `gates.type` en la API (ENTRADA / SALIDA)
+enum GateDirection : uint8_t {
+  GATE_ENTRY,
+  GATE_EXIT,
+};
+
+// Realimentación opcional: finales de carrera (contacto a GND con el pull-up
+// interno, activo en bajo; los GPIO 34-39 no tienen pull-up y necesitan uno
+// externo) y un sensor de corriente del motor en un canal de ADC1 (ADC2 no
+// convive con WiFi). GATE_NO_SENSOR es "no instalado". Sin final de carrera
+// el portón se da por llegado al terminar la trayectoria; sin sensor de
+// corriente no hay detección de atasco por consumo.
+const uint8_t GATE_NO_SENSOR = 0xFF;
+
+struct GateSensors {
+  uint8_t openSwitchPin;
+  uint8_t closedSwitchPin;
+  uint8_t currentChannel;  // ADC1_CHANNEL_n
+  uint16_t currentZero;    // cuentas del ADC con el motor parado
+  float maPerCount;        // mA por cuenta de diferencia con currentZero
+  uint16_t stallMa;        // consumo que, sostenido, se toma por atasco
+};
+
+constexpr GateSensors NO_SENSORS = {GATE_NO_SENSOR, GATE_NO_SENSOR, GATE_NO_SENSOR, 0, 0.0f, 0};
+
+// Por ejemplo, finales en GPIO 32 y 33 y un sensor Hall de 185 mV/A centrado
+// en ~1.6 V, en GPIO 36 (ADC1_CHANNEL_0) a 11 dB: {32, 33, 0, 2000, 4.3f, 2500}
+
+// Entradas locales del portón, sin pasar por la nube: un botón (caseta de
+// vigilancia; contacto a GND, activo en bajo) que abre sin más, y un lector
+// Wiegand (tarjeta o teclado; D0/D1 en colector abierto) cuyas lecturas se
+// autorizan contra la allowlist local. GATE_NO_SENSOR es "no instalado".
+struct GateInputs {
+  uint8_t buttonPin;
+  uint8_t wiegandD0Pin;
+  uint8_t wiegandD1Pin;
+};
+
+constexpr GateInputs NO_INPUTS = {GATE_NO_SENSOR, GATE_NO_SENSOR, GATE_NO_SENSOR};
+
+struct GateConfig {
+  uint8_t pin;
+  GateKind kind;
+  GateDirection direction;
+  float closedAngle;
+  float openAngle;
+  uint32_t openMs;     // tiempo abierto tras llegar al tope
+  uint32_t maxOpenMs;  // tope de las extensiones por OPEN repetido
+  MotionProfile motion;
+  GateSensors sensors;
+  GateInputs inputs;
+};
+
+constexpr GateConfig GATES[] = {
+  {13, GATE_VEHICULAR, GATE_ENTRY, 0.0f, 90.0f, 5000, 30000, {PROFILE_SCURVE, 60.0f, 120.0f}, NO_SENSORS, NO_INPUTS},
+  {12, GATE_VEHICULAR, GATE_EXIT, 0.0f, 90.0f, 5000, 30000, {PROFILE_SCURVE, 60.0f, 120.0f}, NO_SENSORS, NO_INPUTS},
+  {14, GATE_PEDESTRIAN, GATE_ENTRY, 0.0f, 90.0f, 5000, 30000, {PROFILE_SCURVE, 60.0f, 120.0f}, NO_SENSORS, NO_INPUTS},
+  {27, GATE_PEDESTRIAN, GATE_EXIT, 0.0f, 90.0f, 5000, 30000, {PROFILE_SCURVE, 60.0f, 120.0f}, NO_SENSORS, NO_INPUTS},
+};
+
+constexpr int GATE_COUNT = sizeof(GATES) / sizeof(GATES[0]);
+static_assert(GATE_COUNT >= 1 && GATE_COUNT <= 8, "entre 1 y 8 portones (un canal LEDC por portón)");
+
+// Primer portón (1-based) con esa dirección, o 0 si no hay
+constexpr int firstGate(GateDirection direction, int i = 0) {
+  return i >= GATE_COUNT ? 0 : GATES[i].direction == direction ? i + 1 : firstGate(direction, i + 1);
+}
+
+constexpr bool gatesValid(int i = 0) {
+  return i >= GATE_COUNT || (GATES[i].openMs > 0 && GATES[i].openMs <= GATES[i].maxOpenMs &&
+                             GATES[i].closedAngle >= 0 && GATES[i].openAngle <= 180 && gatesValid(i + 1));
+}
+static_assert(gatesValid(), "GATES: openMs debe estar en (0, maxOpenMs] y los ángulos en [0, 180]");
+
+constexpr bool sensorsValid(int i = 0) {
+  return i >= GATE_COUNT ||
+         ((GATES[i].sensors.currentChannel == GATE_NO_SENSOR ||
+           (GATES[i].sensors.currentChannel < 8 && GATES[i].sensors.maPerCount > 0 && GATES[i].sensors.stallMa > 0)) &&
+          sensorsValid(i + 1));
+}
+static_assert(sensorsValid(), "GATES: el sensor de corriente va en ADC1 (canal 0-7) con maPerCount y stallMa");
+
+constexpr bool inputsValid(int i = 0) {
+  return i >= GATE_COUNT ||
+         ((GATES[i].inputs.wiegandD0Pin == GATE_NO_SENSOR) == (GATES[i].inputs.wiegandD1Pin == GATE_NO_SENSOR) &&
+          inputsValid(i + 1));
+}
+static_assert(inputsValid(), "GATES: un lector Wiegand necesita D0 y D1");
+
+// forEachGate(f) llama f(0) ... f(GATE_COUNT - 1) desplegado en compilación
+template <int N>
+struct GateLoop {
+  template <typename F>
+  static inline __attribute__((always_inline)) void run(F& f) {
+    GateLoop<N - 1>::run(f);
+    f(N - 1);
+  }
+};
+
+template <>
+struct GateLoop<0> {
+  template <typename F>
+  static inline __attribute__((always_inline)) void run(F&) {}
+};
+
+template <typename F>
+inline __attribute__((always_inline)) void forEachGate(F f) {
+  GateLoop<GATE_COUNT>::run(f);
+}
+
+inline const char* gateKindName(GateKind kind) {
+  return kind == GATE_PEDESTRIAN ? "pedestrian" : "vehicular";
+}
+
+inline const char* gateDirectionName(GateDirection direction) {
+  return direction == GATE_EXIT ? "SALIDA" : "ENTRADA";
+}
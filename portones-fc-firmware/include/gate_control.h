@@ -0,0 +1,150 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <CommandDedup.h>
+#include <CommandParser.h>
+#include <DeadlineHeap.h>
+#include <GateProtocol.h>
+#include <MotionProfile.h>
+#include <PriorityQueue.h>
+#include "gate_config.h"
+
+// ==================== LÓGICA DE PORTONES ====================
+// Estados, despacho de comandos, plazos de cierre y trayectorias, sin
+// Arduino ni ESP-IDF: el hardware entra por gate_hal.h. En la placa corre
+// en la tarea de portones; en el entorno native, bajo los benchmarks de
+// test/test_bench. Todo lo de aquí lo escribe solo la tarea de portones;
+// gate_failsafe solo lo lee y mueve el servo por la HAL.
+
+inline int64_t msToUs(unsigned long ms) { return (int64_t)ms * 1000; }
+
+struct GateCommand {
+  int gateId;
+  GateAction action;  // ya resuelta en la red: el actuador no compara cadenas
+  CommandPriority priority;
+  uint32_t holdS;     // HOLD_OPEN
+  uint32_t commandId;
+  int64_t sentAtUs;          // epoch µs de envío en la API; 0 si no se sabe
+  unsigned long receivedAt;  // micros() al entrar a mqttCallback
+};
+
+// IDLE es cerrado y en reposo; OPENING/CLOSING duran lo que dure la
+// trayectoria (y, con final de carrera, hasta que el contacto lo confirme);
+// STOPPED es detenido a mitad de recorrido por un STOP; OBSTRUCTED es
+// detenido y sin potencia por un atasco, hasta el próximo comando
+enum GateState { IDLE, OPENING, OPEN, CLOSING, STOPPED, OBSTRUCTED };
+
+// Estado de cada portón; la configuración fija está en GATES[]
+struct GateRuntime {
+  GateState state;
+  int64_t openTimer;  // último armado del cierre (µs)
+  int64_t openSince;  // llegada a abierto (µs)
+  int64_t closeAt;    // plazo de cierre armado (µs), con OPEN o STOPPED
+  uint32_t holdMs;    // HOLD_OPEN vigente: sustituye a openMs y a maxOpenMs
+  Trajectory trajectory;
+  uint32_t servoDuty;
+  uint8_t limits;            // LIMIT_*, ya sin rebote
+  uint16_t currentMa;        // consumo del motor en el último tick
+  int64_t overCurrentSince;  // µs desde que supera stallMa, 0 si no
+};
+
+// ==================== MOVIMIENTO ====================
+// Servos por LEDC a 50 Hz; la trayectoria se evalúa cada MOTION_TICK_MS
+// mientras algo se mueve. Los arranques simultáneos se escalonan
+// MOTION_STAGGER_MS para no sumar la corriente de arranque.
+const uint32_t SERVO_PWM_FREQ = 50;
+const uint8_t SERVO_PWM_BITS = 16;
+const uint32_t SERVO_PWM_PERIOD_US = 1000000 / SERVO_PWM_FREQ;
+const int SERVO_MIN_US = 544;   // mismos límites por defecto que ESP32Servo
+const int SERVO_MAX_US = 2400;
+const unsigned long MOTION_STAGGER_MS = 150;
+const unsigned long MOTION_TICK_MS = 20;  // un periodo de PWM
+
+// ==================== REALIMENTACIÓN ====================
+// Finales de carrera y consumo del motor (GateSensors) entran cada tick por
+// noteFeedback(). Un consumo sobre stallMa durante STALL_CURRENT_MS, pasado
+// el pico de arranque, es un atasco; también lo es un final de carrera que
+// no se activa LIMIT_CONFIRM_MS después de terminar la trayectoria. El
+// portón atascado queda sin pulso en OBSTRUCTED y no cierra solo.
+const uint8_t LIMIT_OPEN = 1;
+const uint8_t LIMIT_CLOSED = 2;
+const unsigned long STALL_INRUSH_MS = 300;
+const unsigned long STALL_CURRENT_MS = 200;
+const unsigned long LIMIT_CONFIRM_MS = 1500;
+
+// ==================== COALESCENCIA DE COMANDOS ====================
+// Un OPEN repetido para un portón ya abierto dentro de la ventana se funde con
+// el anterior. Fuera de la ventana, con REPEAT_EXTEND, reinicia el temporizador
+// de cierre sin pasar de maxOpenMs (GATES[]) desde la apertura.
+enum RepeatPolicy { REPEAT_IGNORE, REPEAT_EXTEND };
+const RepeatPolicy OPEN_REPEAT_POLICY = REPEAT_EXTEND;
+const unsigned long COALESCE_WINDOW_MS = 500;
+
+// ==================== ACCIONES ====================
+// processCommand() despacha por GateAction en COMMAND_HANDLERS; el nombre
+// del JSON se resuelve a GateAction en la red (gateActionCode). CLOSE y
+// STOP interrumpen la trayectoria en curso desde la posición actual.
+// HOLD_OPEN fija el plazo de cierre a holdSeconds, sin el tope maxOpenMs,
+// hasta HOLD_OPEN_MAX_S; un CLOSE lo cancela. Un STOP deja el portón donde
+// está y cierra por su plazo normal.
+const uint32_t HOLD_OPEN_MAX_S = 12 * 3600;
+
+// ==================== EMERGENCIA ====================
+// ACTION_EMERGENCY abre todos los portones a la vez, sin el escalonado de
+// MOTION_STAGGER_MS, y los deja abiertos sin plazo de cierre hasta un
+// ACTION_RESUME de PRIORITY_ADMIN o más; entonces cada portón cierra por su
+// plazo normal. Mientras dura, CLOSE y STOP por debajo de PRIORITY_EMERGENCY
+// se rechazan, las aperturas se funden y el failsafe no cierra nada. Sobrevive
+// a un reinicio por software (halRememberEmergency).
+inline bool controllerAction(GateAction action) {
+  return action == ACTION_EMERGENCY || action == ACTION_RESUME;
+}
+
+extern GateRuntime gates[GATE_COUNT];
+extern DeadlineHeap<GATE_COUNT> gateDeadlines;
+extern uint32_t coalescedCommands;
+extern uint32_t extendedOpens;
+extern int64_t deadlineLatenessMaxUs;  // peor retraso observado al cerrar
+extern uint32_t gateObstructions;
+extern bool emergencyActive;  // la red solo lo lee, para métricas y snapshot
+
+// Payload de un comando (JSON o trama binaria) -> GateCommand, sin el
+// portón del topic ni receivedAt. Una trama inválida es PARSE_MALFORMED.
+ParseResult decodeCommand(const uint8_t* payload, size_t length, bool binary, GateCommand& out);
+AckResult processCommand(const GateCommand& cmd);
+
+// Admisión en la red: repetido, portón inválido o cola llena se rechazan
+// con `rejection` y no entran. El id se recuerda solo si el comando quedó
+// en la cola: tras un ACK_DROPPED la API reintenta con el mismo id, y ese
+// reintento tiene que ejecutarse, no salir como ACK_DUPLICATE.
+template <size_t D, size_t N, size_t LEVELS>
+bool admitCommand(CommandDedup<D>& recent, PriorityQueue<GateCommand, N, LEVELS>& queue, const GateCommand& cmd,
+                  AckResult& rejection) {
+  if (recent.contains(cmd.commandId)) {
+    rejection = ACK_DUPLICATE;
+    return false;
+  }
+  if (!controllerAction(cmd.action) && (cmd.gateId < 1 || cmd.gateId > GATE_COUNT)) {
+    rejection = ACK_REJECTED;
+    return false;
+  }
+  if (!queue.push(cmd, cmd.priority)) {
+    rejection = ACK_DROPPED;
+    return false;
+  }
+  recent.insert(cmd.commandId);
+  return true;
+}
+// Cierra los portones cuyo plazo venció; no recorre los que siguen abiertos
+void updateGates();
+// Tick de control: avanza las trayectorias y cierra las transiciones
+void updateMotion(int64_t now);
+// Lecturas de los sensores del portón idx; detecta el atasco por consumo
+void noteFeedback(int idx, uint8_t limits, uint16_t currentMa, int64_t now);
+void armClose(int idx, int64_t now, uint32_t delayMs);
+void writeServo(int idx, float angle);
+// Duty de LEDC para un ángulo, sin tocar el estado
+uint32_t servoDutyFor(float angle);
+// staggered = false arranca ya aunque otro portón acabe de arrancar
+void startMotion(int idx, bool open, int64_t now, bool staggered = true);
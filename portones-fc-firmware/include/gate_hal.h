@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+#include <GateProtocol.h>
+#include "log_events.h"
+
+// ==================== HAL DE PORTONES ====================
+// Todo lo que gate_control.cpp necesita de fuera. En la placa lo implementa
+// main.cpp (esp_timer, LEDC, RTC, registro y lote de estados); en
+// test/test_bench, un reloj simulado y contadores.
+
+// Reloj monótono en µs
+int64_t halNowUs();
+// Duty de LEDC del portón idx (un canal por portón, mismo índice)
+void halServoWrite(int idx, uint32_t duty);
+// Sin pulso: el servo o el driver del motor deja de hacer fuerza
+void halServoRelease(int idx);
+// Tick de control periódico mientras algo se mueve, con el muestreo de
+// corriente; idempotente
+void halMotionTimer(bool run);
+// Destino del portón, para retomarlo tras un reinicio por software
+void halRememberTarget(int idx, bool open);
+// Emergencia vigente, para retomarla tras un reinicio por software
+void halRememberEmergency(bool active);
+// Registro del lado de portones (un productor: la tarea de portones)
+void halLogGate(LogEvent event, uint8_t gate, int32_t a = 0, int32_t b = 0);
+// Cambio de estado hacia la red, en el lote del tick
+void publishStatus(int gateId, GateStatusCode status);
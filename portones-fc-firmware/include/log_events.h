@@ -0,0 +1,164 @@
+#pragma once
+
+#include <EventLog.h>
+
+// Eventos del firmware. El orden de LogEvent debe coincidir con LOG_EVENTS;
+// el static_assert del final detecta un descriptor faltante.
+enum LogEvent : uint16_t {
+  EV_RTOS_CORES,
+  EV_LOG_DROPPED,
+  EV_SERVO_INIT,
+  EV_CONTROLLER_ID,
+  EV_BIN_FRAME_INVALID,
+  EV_COMMAND_DISCARDED,
+  EV_GATE_OPENING,
+  EV_GATE_AUTO_CLOSE,
+  EV_NET_RETRY,
+  EV_WIFI_CONNECTING,
+  EV_WIFI_CONNECTED,
+  EV_WIFI_TIMEOUT,
+  EV_WIFI_LOST,
+  EV_TLS_CONNECTING,
+  EV_TLS_HANDSHAKE,
+  EV_TLS_FAILED,
+  EV_MQTT_CONNECTING,
+  EV_MQTT_CONNECTED,
+  EV_MQTT_SUBSCRIBED,
+  EV_MQTT_FAILED,
+  EV_MQTT_LOST,
+  EV_NET_READY,
+  EV_METRICS_FAILED,
+  EV_QR_LOADED,
+  EV_QR_DELTA_APPLIED,
+  EV_QR_DELTA_REJECTED,
+  EV_QR_SYNC_REQUEST,
+  EV_QR_ACCESS,
+  EV_JOURNAL_LOADED,
+  EV_JOURNAL_UNAVAILABLE,
+  EV_JOURNAL_REWIND,
+  EV_JOURNAL_LOST,
+  EV_GATES_RESTORED,
+  EV_DESIRED_OPEN,
+  EV_STATE_CONSISTENT,
+  EV_CONFIG_LOADED,
+  EV_CONFIG_PROVISIONING,
+  EV_CONFIG_APPLIED,
+  EV_CONFIG_REJECTED,
+  EV_OTA_OFFERED,
+  EV_OTA_SKIPPED,
+  EV_OTA_DOWNLOADING,
+  EV_OTA_FAILED,
+  EV_OTA_STAGED,
+  EV_OTA_REBOOTING,
+  EV_OTA_VERIFYING,
+  EV_OTA_CONFIRMED,
+  EV_OTA_ROLLBACK,
+  EV_OTA_ROLLED_BACK,
+  EV_POWER_MODE,
+  EV_RESET_REASON,
+  EV_RESET_CRASH,
+  EV_RESTORE_CLOSING,
+  EV_NET_STALL,
+  EV_GATE_STALL,
+  EV_FAILSAFE_CLOSE,
+  EV_GATE_CLOSE_COMMAND,
+  EV_GATE_STOPPED,
+  EV_GATE_HOLD_OPEN,
+  EV_GATE_OBSTRUCTED,
+  EV_GATE_LIMIT_MISSING,
+  EV_GATE_LIMIT,
+  EV_INPUT_OPEN,
+  EV_INPUT_DENIED,
+  EV_INPUT_INVALID,
+  EV_STACK_LOW,
+  EV_HEAP_ALLOC_FAILED,
+  EV_MQTT_OVERSIZE,
+  EV_INBOX_UNAVAILABLE,
+  EV_EMERGENCY_OPEN,
+  EV_EMERGENCY_RESUME,
+  EV_EMERGENCY_RESTORED,
+  EV_CLOCK_SYNCED,
+  EV_CLOCK_STEP,
+  EV_MQTT_KEEPALIVE,
+  LOG_EVENT_COUNT
+};
+
+constexpr LogEventInfo LOG_EVENTS[] = {
+  {LOG_LEVEL_INFO, "RTOS", "Red en core %ld, portones en core %ld", 0, 2},
+  {LOG_LEVEL_WARN, "LOG", "✗ %ld registros descartados", 0, 1},
+  {LOG_LEVEL_INFO, "SERVO", "Inicializado en pin %ld", 0, 1},
+  {LOG_LEVEL_INFO, "MQTT", "Controlador %s (%ld portones)", 1, 1},
+  {LOG_LEVEL_WARN, "MQTT", "✗ Trama binaria inválida (%ld bytes)", 0, 1},
+  {LOG_LEVEL_WARN, "MQTT", "✗ Comando descartado (%s, %ld bytes)", 1, 1},
+  {LOG_LEVEL_INFO, "GATE", "Abriendo...", 0, 0},
+  {LOG_LEVEL_INFO, "GATE", "Cerrando automáticamente...", 0, 0},
+  {LOG_LEVEL_INFO, "NET", "Reintento en %ld ms", 0, 1},
+  {LOG_LEVEL_INFO, "WiFi", "Conectando a %s...", 1, 0},
+  {LOG_LEVEL_INFO, "WiFi", "Conectado", 0, 0},
+  {LOG_LEVEL_WARN, "WiFi", "✗ Tiempo de conexión agotado", 0, 0},
+  {LOG_LEVEL_WARN, "WiFi", "✗ Enlace perdido", 0, 0},
+  {LOG_LEVEL_INFO, "TLS", "Conectando a %s:%ld...", 1, 1},
+  {LOG_LEVEL_INFO, "TLS", "✓ Handshake %s en %ld ms (%ld reanudados)", 1, 2},
+  {LOG_LEVEL_ERROR, "TLS", "✗ Handshake fallido (mbedtls: %ld)", 0, 1},
+  {LOG_LEVEL_DEBUG, "MQTT", "Intentando conectar...", 0, 0},
+  {LOG_LEVEL_INFO, "MQTT", "✓ Conectado al broker como %s", 1, 0},
+  {LOG_LEVEL_INFO, "MQTT", "Suscrito a los topics: %s, %s", 2, 0},
+  {LOG_LEVEL_ERROR, "MQTT", "✗ Error de conexión (código: %ld)", 0, 1},
+  {LOG_LEVEL_WARN, "MQTT", "✗ Desconectado del broker", 0, 0},
+  {LOG_LEVEL_INFO, "NET", "✓ Enlace listo en %ld ms", 0, 1},
+  {LOG_LEVEL_WARN, "METRICS", "✗ No se pudo publicar (%ld bytes)", 0, 1},
+  {LOG_LEVEL_INFO, "QR", "Allowlist cargada: v%ld, %ld códigos", 0, 2},
+  {LOG_LEVEL_INFO, "QR", "✓ Allowlist v%ld (%ld códigos)", 0, 2},
+  {LOG_LEVEL_WARN, "QR", "✗ Delta rechazada (%s)", 1, 0},
+  {LOG_LEVEL_INFO, "QR", "Sincronizando allowlist desde v%ld", 0, 1},
+  {LOG_LEVEL_INFO, "QR", "%s (código %ld)", 1, 1},
+  {LOG_LEVEL_INFO, "JOURNAL", "Diario en seq %ld, %ld sin confirmar", 0, 2},
+  {LOG_LEVEL_ERROR, "JOURNAL", "✗ Sin partición de diario: los eventos sin enlace se pierden", 0, 0},
+  {LOG_LEVEL_WARN, "JOURNAL", "Sin confirmación, reenviando desde seq %ld", 0, 1},
+  {LOG_LEVEL_WARN, "JOURNAL", "✗ %ld eventos sobrescritos antes de reenviarse", 0, 1},
+  {LOG_LEVEL_WARN, "GATE", "%ld portones retomados abiertos tras el reinicio", 0, 1},
+  {LOG_LEVEL_INFO, "STATE", "Estado deseado: abrir", 0, 0},
+  {LOG_LEVEL_INFO, "STATE", "✓ Consistente a los %ld ms del arranque (enlace a los %ld ms)", 0, 2},
+  {LOG_LEVEL_INFO, "CONFIG", "Configuración desde %s, v%ld", 1, 1},
+  {LOG_LEVEL_WARN, "CONFIG", "Sin red o broker: aprovisionar por consola (config set <campo> <valor>)", 0, 0},
+  {LOG_LEVEL_INFO, "CONFIG", "✓ Configuración v%ld aplicada (alcance %ld)", 0, 2},
+  {LOG_LEVEL_WARN, "CONFIG", "✗ Actualización rechazada (%s)", 1, 0},
+  {LOG_LEVEL_INFO, "OTA", "Oferta %s (%ld bytes, formato %ld)", 1, 2},
+  {LOG_LEVEL_INFO, "OTA", "Oferta %s ignorada: %s", 2, 0},
+  {LOG_LEVEL_INFO, "OTA", "Descargando %s (intento %ld)", 1, 1},
+  {LOG_LEVEL_WARN, "OTA", "✗ %s: %s", 2, 0},
+  {LOG_LEVEL_INFO, "OTA", "✓ %s lista en la otra partición (%ld bytes, %ld ms)", 1, 2},
+  {LOG_LEVEL_WARN, "OTA", "Reiniciando para arrancar %s", 1, 0},
+  {LOG_LEVEL_INFO, "OTA", "Imagen %s pendiente de verificar", 1, 0},
+  {LOG_LEVEL_INFO, "OTA", "✓ Imagen %s confirmada", 1, 0},
+  {LOG_LEVEL_ERROR, "OTA", "✗ %s no quedó consistente: volviendo a la imagen anterior", 1, 0},
+  {LOG_LEVEL_ERROR, "OTA", "✗ La imagen nueva no se confirmó; se volvió a %s", 1, 0},
+  {LOG_LEVEL_INFO, "POWER", "Energía: %s (listen interval %ld, keepalive %ld s)", 1, 2},
+  {LOG_LEVEL_INFO, "BOOT", "Arranque por %s (%ld arranques, %ld reinicios inesperados)", 1, 2},
+  {LOG_LEVEL_ERROR, "BOOT", "✗ Reinicio inesperado: red en %s, portones en %s", 2, 0},
+  {LOG_LEVEL_WARN, "GATE", "%ld reinicios inesperados seguidos: los portones retomados cierran ya", 0, 1},
+  {LOG_LEVEL_WARN, "WDT", "Tick de red lento: %s tomó %ld de %ld ms", 1, 2},
+  {LOG_LEVEL_WARN, "WDT", "Tick de portones lento: %s tomó %ld de %ld ms", 1, 2},
+  {LOG_LEVEL_ERROR, "GATE", "✗ Cerrado por seguridad: la tarea de portones no corrió en %ld ms", 0, 1},
+  {LOG_LEVEL_INFO, "GATE", "Cerrando por comando...", 0, 0},
+  {LOG_LEVEL_INFO, "GATE", "Detenido en %ld°", 0, 1},
+  {LOG_LEVEL_INFO, "GATE", "Abierto por %ld s", 0, 1},
+  {LOG_LEVEL_ERROR, "GATE", "✗ Atasco en %ld°: %ld mA sostenidos, motor sin potencia", 0, 2},
+  {LOG_LEVEL_ERROR, "GATE", "✗ Atasco en %ld°: sin final de carrera tras %ld ms, motor sin potencia", 0, 2},
+  {LOG_LEVEL_DEBUG, "GATE", "Final de carrera %s: %s", 2, 0},
+  {LOG_LEVEL_INFO, "INPUT", "✓ %s: abierto en %ld us (código %ld)", 1, 2},
+  {LOG_LEVEL_WARN, "INPUT", "✗ %s: %s", 2, 0},
+  {LOG_LEVEL_WARN, "INPUT", "✗ Lectura Wiegand inválida", 0, 0},
+  {LOG_LEVEL_WARN, "MEM", "Pila de %s: quedan %ld bytes", 1, 1},
+  {LOG_LEVEL_ERROR, "MEM", "✗ %ld reservas de heap fallidas (la última de %ld bytes)", 0, 2},
+  {LOG_LEVEL_WARN, "MQTT", "✗ %s de %ld bytes descartado (buffer de %ld)", 1, 2},
+  {LOG_LEVEL_ERROR, "MQTT", "✗ Sin partición inbox: las deltas QR grandes se descartan", 0, 0},
+  {LOG_LEVEL_WARN, "GATE", "Emergencia: abriendo todos los portones (prioridad %ld)", 0, 1},
+  {LOG_LEVEL_WARN, "GATE", "Fin de la emergencia (prioridad %ld): cierre por plazo normal", 0, 1},
+  {LOG_LEVEL_WARN, "GATE", "Emergencia vigente tras el reinicio: sin cierre automático", 0, 0},
+  {LOG_LEVEL_INFO, "CLOCK", "Hora SNTP: corrección de %ld us, deriva %ld ppb", 0, 2},
+  {LOG_LEVEL_WARN, "CLOCK", "Hora SNTP: salto de %ld ms", 0, 1},
+  {LOG_LEVEL_INFO, "MQTT", "Keepalive de %ld s para la próxima sesión (RSSI %ld dBm)", 0, 2},
+};
+
+static_assert(sizeof(LOG_EVENTS) / sizeof(LOG_EVENTS[0]) == LOG_EVENT_COUNT, "falta un descriptor en LOG_EVENTS");
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <Arduino.h>
+#include <esp_partition.h>
+
+// Payloads MQTT más grandes que el buffer de PubSubClient. Con setStream()
+// PubSubClient escribe aquí, byte a byte, el payload de cada PUBLISH
+// mientras lo lee; al callback solo le llega lo que cupo en su buffer. Los
+// primeros `skip` bytes siempre caben (MQTT_PAYLOAD_MAX en main.cpp) y no
+// se guardan; el resto pasa por una ventana de una página hacia la partición
+// "inbox", de modo que el mensaje completo nunca está en RAM. Un mensaje
+// que cabe en el buffer no llega a tocar la flash salvo que pase de `skip`.
+//
+// Un PUBLISH a la vez: reset() antes de cada mqttClient.loop().
+const size_t INBOX_WINDOW = 256;  // una página de flash
+const size_t INBOX_SECTOR = 4096;
+
+class MqttInbox : public Stream {
+ public:
+  bool begin(const char* label, size_t skip);
+  void reset();
+
+  size_t write(uint8_t b) override;
+  size_t write(const uint8_t* data, size_t length) override;
+  // Solo se escribe: PubSubClient no lee de su stream
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+  void flush() override {}
+
+  // Bytes del payload recibido, quepan o no en el buffer
+  size_t length() const { return length_; }
+  // false si el payload excedió la partición o falló la flash
+  bool complete() const { return !failed_; }
+  size_t capacity() const { return partition_ ? skip_ + partition_->size : 0; }
+  size_t skip() const { return skip_; }
+  // offset desde el inicio del payload, >= skip(); baja antes lo que quede
+  // en la ventana
+  bool read(size_t offset, uint8_t* out, size_t length);
+
+ private:
+  bool flushWindow();
+
+  const esp_partition_t* partition_ = nullptr;
+  size_t skip_ = 0;
+  uint8_t window_[INBOX_WINDOW];
+  size_t length_ = 0;
+  size_t flushed_ = 0;  // bytes ya en flash, a partir de skip_
+  bool failed_ = false;
+};
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <esp_ota_ops.h>
+#include <esp32/rom/miniz.h>
+#include <mbedtls/sha256.h>
+#include <OtaImage.h>
+
+// Etapas de la imagen OTA que dependen del ESP32: inflado zlib con el tinfl
+// de la ROM, lectura de la imagen en ejecución (base de las deltas) y
+// escritura en la partición app inactiva. Se encadenan como
+// descarga -> [OtaInflater] -> [OtaDeltaDecoder] -> OtaPartitionWriter.
+
+// El tinfl de la ROM con su ventana circular de 32 KB; la memoria solo se
+// reserva mientras dura la descarga
+class OtaInflater : public OtaSink {
+ public:
+  ~OtaInflater() { end(); }
+
+  bool begin(OtaSink* out) {
+    end();
+    out_ = out;
+    done_ = false;
+    dictOffset_ = 0;
+    inflator_ = (tinfl_decompressor*)malloc(sizeof(tinfl_decompressor));
+    dict_ = (uint8_t*)malloc(TINFL_LZ_DICT_SIZE);
+    if (!inflator_ || !dict_) {
+      end();
+      return false;
+    }
+    tinfl_init(inflator_);
+    return true;
+  }
+
+  void end() {
+    free(inflator_);
+    free(dict_);
+    inflator_ = nullptr;
+    dict_ = nullptr;
+  }
+
+  bool write(const uint8_t* data, size_t length) override {
+    if (!inflator_ || done_) return length == 0;
+    while (length > 0 || !done_) {
+      size_t in = length;
+      size_t out = TINFL_LZ_DICT_SIZE - dictOffset_;
+      tinfl_status status = tinfl_decompress(inflator_, data, &in, dict_, dict_ + dictOffset_, &out,
+                                             TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_HAS_MORE_INPUT);
+      if (out > 0 && !out_->write(dict_ + dictOffset_, out)) return false;
+      dictOffset_ = (dictOffset_ + out) & (TINFL_LZ_DICT_SIZE - 1);
+      data += in;
+      length -= in;
+      if (status == TINFL_STATUS_DONE) {
+        done_ = true;
+        return length == 0;  // nada después del flujo zlib
+      }
+      if (status < TINFL_STATUS_DONE) return false;
+      // Sin entrada y sin salida pendiente: esperar el siguiente trozo
+      if (status == TINFL_STATUS_NEEDS_MORE_INPUT && length == 0) return true;
+    }
+    return true;
+  }
+
+  bool finished() const { return done_; }
+
+ private:
+  OtaSink* out_ = nullptr;
+  tinfl_decompressor* inflator_ = nullptr;
+  uint8_t* dict_ = nullptr;
+  size_t dictOffset_ = 0;
+  bool done_ = false;
+};
+
+// La imagen en ejecución, para los COPY de una delta
+class OtaRunningImage : public OtaSource {
+ public:
+  bool begin() {
+    partition_ = esp_ota_get_running_partition();
+    return partition_ != nullptr;
+  }
+  bool read(uint32_t offset, uint8_t* out, size_t length) override {
+    return esp_partition_read(partition_, offset, out, length) == ESP_OK;
+  }
+  uint32_t size() const { return partition_ ? partition_->size : 0; }
+
+ private:
+  const esp_partition_t* partition_ = nullptr;
+};
+
+// Escribe en la partición app inactiva y calcula el digest de la app: el
+// SHA-256 de todo menos los 32 bytes finales, que esp_ota_end() comprueba
+// contra ese mismo contenido. Con OTA_WITH_SEQUENTIAL_WRITES cada sector se
+// borra al llegar a él, así que begin() no bloquea borrando la partición.
+class OtaPartitionWriter : public OtaSink {
+ public:
+  bool begin(uint32_t imageSize) {
+    if (imageSize <= OTA_DIGEST_SIZE) return false;
+    partition_ = esp_ota_get_next_update_partition(nullptr);
+    written_ = 0;
+    imageSize_ = imageSize;
+    if (!partition_ || imageSize > partition_->size ||
+        esp_ota_begin(partition_, OTA_WITH_SEQUENTIAL_WRITES, &handle_) != ESP_OK) {
+      partition_ = nullptr;
+      return false;
+    }
+    mbedtls_sha256_init(&sha_);
+    mbedtls_sha256_starts_ret(&sha_, 0);
+    return true;
+  }
+
+  bool write(const uint8_t* data, size_t length) override {
+    if (!partition_ || length > imageSize_ - written_) return false;
+    if (esp_ota_write(handle_, data, length) != ESP_OK) return false;
+    uint32_t hashedEnd = imageSize_ - OTA_DIGEST_SIZE;
+    if (written_ < hashedEnd) {
+      size_t hashed = hashedEnd - written_ < length ? hashedEnd - written_ : length;
+      mbedtls_sha256_update_ret(&sha_, data, hashed);
+    }
+    written_ += length;
+    return true;
+  }
+
+  // Cierra la escritura (esp_ota_end valida la cabecera y el checksum de la
+  // imagen) y, si el digest coincide, la deja como la del próximo arranque
+  bool commit(const uint8_t* expectedSha) {
+    if (!partition_) return false;
+    if (written_ != imageSize_) {
+      abort();
+      return false;
+    }
+    uint8_t digest[OTA_DIGEST_SIZE];
+    mbedtls_sha256_finish_ret(&sha_, digest);
+    mbedtls_sha256_free(&sha_);
+    const esp_partition_t* partition = partition_;
+    partition_ = nullptr;
+    if (memcmp(digest, expectedSha, sizeof(digest)) != 0) {
+      esp_ota_abort(handle_);
+      return false;
+    }
+    return esp_ota_end(handle_) == ESP_OK && esp_ota_set_boot_partition(partition) == ESP_OK;
+  }
+
+  void abort() {
+    if (!partition_) return;
+    mbedtls_sha256_free(&sha_);
+    esp_ota_abort(handle_);
+    partition_ = nullptr;
+  }
+
+  uint32_t written() const { return written_; }
+
+ private:
+  static const uint32_t OTA_DIGEST_SIZE = 32;
+
+  const esp_partition_t* partition_ = nullptr;
+  esp_ota_handle_t handle_ = 0;
+  mbedtls_sha256_context sha_;
+  uint32_t written_ = 0;
+  uint32_t imageSize_ = 0;
+};
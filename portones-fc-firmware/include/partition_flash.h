@@ -0,0 +1,28 @@
+#pragma once
+
+#include <esp_partition.h>
+#include <EventJournal.h>
+
+// Región del diario sobre una partición de datos cruda (ver partitions.csv).
+// Sin sistema de archivos: EventJournal ya reparte el desgaste en anillo.
+class PartitionFlash : public JournalFlash {
+ public:
+  bool begin(const char* label) {
+    partition_ = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+    return partition_ != nullptr;
+  }
+
+  bool read(size_t offset, void* out, size_t length) override {
+    return esp_partition_read(partition_, offset, out, length) == ESP_OK;
+  }
+  bool write(size_t offset, const void* data, size_t length) override {
+    return esp_partition_write(partition_, offset, data, length) == ESP_OK;
+  }
+  bool eraseSector(size_t offset) override {
+    return esp_partition_erase_range(partition_, offset, JOURNAL_SECTOR_SIZE) == ESP_OK;
+  }
+  size_t size() const override { return partition_ ? partition_->size : 0; }
+
+ private:
+  const esp_partition_t* partition_ = nullptr;
+};
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/x509_crt.h>
+
+// Cliente TLS sobre mbedTLS con reanudación de sesión. A diferencia de
+// WiFiClientSecure, guarda la sesión negociada (en RAM y en memoria RTC, que
+// sobrevive a un reinicio por software) y la ofrece en el siguiente
+// handshake, de modo que una reconexión tras un corte de WiFi evita el
+// intercambio de claves completo. Verifica siempre contra la CA configurada
+// y, si se da, contra el SHA-256 del certificado hoja.
+class TlsSessionClient : public Client {
+ public:
+  TlsSessionClient();
+  ~TlsSessionClient();
+
+  void setCACert(const char* pem) { caCert_ = pem; }
+  void setFingerprint(const uint8_t* sha256) { fingerprint_ = sha256; }  // 32 bytes o nullptr
+  void setHandshakeTimeout(uint32_t ms) { handshakeTimeoutMs_ = ms; }
+  void clearSession();
+
+  int connect(IPAddress ip, uint16_t port) override;
+  int connect(const char* host, uint16_t port) override;
+  size_t write(uint8_t b) override;
+  size_t write(const uint8_t* buf, size_t size) override;
+  int available() override;
+  int read() override;
+  int read(uint8_t* buf, size_t size) override;
+  int peek() override;
+  void flush() override;
+  void stop() override;
+  uint8_t connected() override;
+  operator bool() override { return connected(); }
+
+  // Socket de la conexión (-1 sin conexión), para esperar datos con select()
+  int fd() const { return connected_ ? tcp_.fd() : -1; }
+  // Datos ya descifrados o leídos que select() sobre el socket no ve
+  bool buffered() const { return connected_ && (peekByte_ >= 0 || mbedtls_ssl_get_bytes_avail(&ssl_) > 0); }
+
+  // Métricas del último handshake
+  uint32_t lastHandshakeMs() const { return lastHandshakeMs_; }
+  bool lastResumed() const { return lastResumed_; }
+  int lastError() const { return lastError_; }
+
+ private:
+  bool setupContext();
+  void freeContext();
+  bool verifyFingerprint();
+  void storeSession();
+  bool loadSession();
+
+  WiFiClient tcp_;
+  mbedtls_ssl_context ssl_;
+  mbedtls_ssl_config conf_;
+  mbedtls_entropy_context entropy_;
+  mbedtls_ctr_drbg_context drbg_;
+  mbedtls_x509_crt ca_;
+  mbedtls_ssl_session session_;
+
+  const char* caCert_ = nullptr;
+  const uint8_t* fingerprint_ = nullptr;
+  uint32_t handshakeTimeoutMs_ = 5000;
+  bool caParsed_ = false;
+  bool drbgSeeded_ = false;
+  bool hasSession_ = false;
+  bool contextReady_ = false;  // inicializado: hay que liberarlo
+  bool contextSetUp_ = false;  // listo para reutilizar entre conexiones
+  bool connected_ = false;
+  int peekByte_ = -1;
+
+  uint32_t lastHandshakeMs_ = 0;
+  bool lastResumed_ = false;
+  int lastError_ = 0;
+};
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Anillo con los últimos N commandId vistos. Con QoS 1 el broker puede
+// reentregar un comando; si el id ya está en el anillo no se vuelve a
+// ejecutar. N es pequeño, así que la búsqueda lineal es lo más rápido.
+template <size_t N>
+class CommandDedup {
+ public:
+  // Devuelve true si el id es nuevo (y lo registra), false si es repetido.
+  // El id 0 significa "sin id" y siempre se considera nuevo.
+  bool insert(uint32_t id) {
+    if (contains(id)) return false;
+    if (id == 0) return true;
+    ids_[next_] = id;
+    next_ = (next_ + 1) % N;
+    return true;
+  }
+
+  // Solo consulta: el id 0 nunca está
+  bool contains(uint32_t id) const {
+    if (id == 0) return false;
+    for (size_t i = 0; i < N; i++) {
+      if (ids_[i] == id) return true;
+    }
+    return false;
+  }
+
+ private:
+  uint32_t ids_[N] = {0};
+  size_t next_ = 0;
+};
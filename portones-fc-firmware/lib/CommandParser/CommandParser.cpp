@@ -0,0 +1,249 @@
+#include "CommandParser.h"
+
+#include <string.h>
+
+namespace {
+
+struct Cursor {
+  const uint8_t* p;
+  const uint8_t* end;
+};
+
+void skipSpace(Cursor& c) {
+  while (c.p < c.end && (*c.p == ' ' || *c.p == '\t' || *c.p == '\n' || *c.p == '\r')) c.p++;
+}
+
+bool consume(Cursor& c, char ch) {
+  skipSpace(c);
+  if (c.p < c.end && *c.p == (uint8_t)ch) {
+    c.p++;
+    return true;
+  }
+  return false;
+}
+
+// Lee una cadena JSON. Si dst es nullptr solo la recorre. Para las claves y
+// los campos que copiamos no hace falta decodificar escapes: \" se respeta
+// para no cortar la cadena y el resto se copia literal.
+ParseResult readString(Cursor& c, char* dst, size_t dstSize) {
+  if (!consume(c, '"')) return PARSE_MALFORMED;
+  size_t n = 0;
+  bool overflow = false;
+  while (c.p < c.end) {
+    uint8_t ch = *c.p++;
+    if (ch == '"') {
+      if (dst) dst[n] = '\0';
+      return overflow ? PARSE_FIELD_TOO_LONG : PARSE_OK;
+    }
+    if (ch == '\\') {
+      if (c.p >= c.end) break;
+      ch = *c.p++;
+    }
+    if (dst) {
+      if (n + 1 < dstSize) {
+        dst[n++] = (char)ch;
+      } else {
+        overflow = true;
+      }
+    }
+  }
+  return PARSE_MALFORMED;
+}
+
+bool readInt(Cursor& c, int& value) {
+  skipSpace(c);
+  bool negative = false;
+  if (c.p < c.end && *c.p == '-') {
+    negative = true;
+    c.p++;
+  }
+  if (c.p >= c.end || *c.p < '0' || *c.p > '9') return false;
+  long v = 0;
+  while (c.p < c.end && *c.p >= '0' && *c.p <= '9') {
+    if (v < 100000) v = v * 10 + (*c.p - '0');
+    c.p++;
+  }
+  // Un gateId con decimales o exponente no es válido
+  if (c.p < c.end && (*c.p == '.' || *c.p == 'e' || *c.p == 'E')) return false;
+  value = negative ? -(int)v : (int)v;
+  return true;
+}
+
+bool readUint32(Cursor& c, uint32_t& value) {
+  skipSpace(c);
+  if (c.p >= c.end || *c.p < '0' || *c.p > '9') return false;
+  uint64_t v = 0;
+  while (c.p < c.end && *c.p >= '0' && *c.p <= '9') {
+    v = v * 10 + (*c.p - '0');
+    if (v > 0xFFFFFFFFull) return false;
+    c.p++;
+  }
+  if (c.p < c.end && (*c.p == '.' || *c.p == 'e' || *c.p == 'E')) return false;
+  value = (uint32_t)v;
+  return true;
+}
+
+// Descarta cualquier valor JSON (cadena, número, literal, objeto o arreglo)
+ParseResult skipValue(Cursor& c) {
+  skipSpace(c);
+  if (c.p >= c.end) return PARSE_MALFORMED;
+
+  uint8_t depth = 0;
+  do {
+    skipSpace(c);
+    if (c.p >= c.end) return PARSE_MALFORMED;
+    uint8_t ch = *c.p;
+    if (ch == '"') {
+      ParseResult r = readString(c, nullptr, 0);
+      if (r != PARSE_OK) return r;
+    } else if (ch == '{' || ch == '[') {
+      if (++depth > COMMAND_MAX_DEPTH) return PARSE_TOO_DEEP;
+      c.p++;
+    } else if (ch == '}' || ch == ']') {
+      if (depth == 0) return PARSE_MALFORMED;
+      depth--;
+      c.p++;
+    } else if (ch == ',' || ch == ':') {
+      if (depth == 0) return PARSE_MALFORMED;
+      c.p++;
+    } else {
+      // número o literal (true/false/null)
+      const uint8_t* start = c.p;
+      while (c.p < c.end && *c.p != ',' && *c.p != '}' && *c.p != ']' && *c.p != ' ' &&
+             *c.p != '\t' && *c.p != '\n' && *c.p != '\r') {
+        c.p++;
+      }
+      if (c.p == start) return PARSE_MALFORMED;
+    }
+  } while (depth > 0);
+  return PARSE_OK;
+}
+
+bool readDigits(const char*& s, int count, int& value) {
+  value = 0;
+  for (int i = 0; i < count; i++, s++) {
+    if (*s < '0' || *s > '9') return false;
+    value = value * 10 + (*s - '0');
+  }
+  return true;
+}
+
+// Días desde 1970-01-01 del calendario gregoriano (algoritmo de H. Hinnant)
+int64_t daysFromCivil(int year, int month, int day) {
+  year -= month <= 2;
+  int64_t era = (year >= 0 ? year : year - 399) / 400;
+  int64_t yoe = year - era * 400;
+  int64_t doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + doe - 719468;
+}
+
+// "2026-10-14T12:34:56.789Z", lo que da toISOString(): hasta 6 decimales y
+// siempre en UTC
+bool parseIsoTimestamp(const char* s, int64_t& epochUs) {
+  int year, month, day, hour, minute, second;
+  if (!readDigits(s, 4, year) || *s++ != '-' || !readDigits(s, 2, month) || *s++ != '-' ||
+      !readDigits(s, 2, day) || *s++ != 'T' || !readDigits(s, 2, hour) || *s++ != ':' ||
+      !readDigits(s, 2, minute) || *s++ != ':' || !readDigits(s, 2, second)) {
+    return false;
+  }
+  if (month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60) return false;
+  int64_t fraction = 0;
+  int digits = 0;
+  if (*s == '.') {
+    for (s++; *s >= '0' && *s <= '9'; s++) {
+      if (digits < 6) {
+        fraction = fraction * 10 + (*s - '0');
+        digits++;
+      }
+    }
+    if (digits == 0) return false;
+  }
+  for (; digits < 6; digits++) fraction *= 10;
+  if (s[0] != 'Z' || s[1] != '\0') return false;
+  int64_t seconds = daysFromCivil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second;
+  epochUs = seconds * 1000000 + fraction;
+  return true;
+}
+
+}  // namespace
+
+ParseResult parseCommand(const uint8_t* payload, size_t length, CommandFields& out) {
+  out.gateId = 0;
+  out.action[0] = '\0';
+  out.commandId = 0;
+  out.holdS = 0;
+  out.priority[0] = '\0';
+  out.sentAtUs = 0;
+  if (payload == nullptr || length == 0) return PARSE_EMPTY;
+
+  Cursor c = {payload, payload + length};
+  if (!consume(c, '{')) return PARSE_MALFORMED;
+
+  bool hasAction = false;
+  char key[16];
+
+  if (!consume(c, '}')) {
+    for (;;) {
+      ParseResult r = readString(c, key, sizeof(key));
+      // Una clave larga no es de las nuestras: basta con descartar su valor
+      if (r != PARSE_OK && r != PARSE_FIELD_TOO_LONG) return r;
+      bool known = r == PARSE_OK;
+      if (!consume(c, ':')) return PARSE_MALFORMED;
+
+      if (known && strcmp(key, "gateId") == 0) {
+        if (!readInt(c, out.gateId)) return PARSE_BAD_TYPE;
+      } else if (known && strcmp(key, "commandId") == 0) {
+        if (!readUint32(c, out.commandId)) return PARSE_BAD_TYPE;
+      } else if (known && strcmp(key, "holdSeconds") == 0) {
+        if (!readUint32(c, out.holdS)) return PARSE_BAD_TYPE;
+      } else if (known && strcmp(key, "action") == 0) {
+        skipSpace(c);
+        if (c.p >= c.end || *c.p != '"') return PARSE_BAD_TYPE;
+        r = readString(c, out.action, sizeof(out.action));
+        if (r != PARSE_OK) return r;
+        hasAction = true;
+      } else if (known && strcmp(key, "priority") == 0) {
+        skipSpace(c);
+        if (c.p >= c.end || *c.p != '"') return PARSE_BAD_TYPE;
+        r = readString(c, out.priority, sizeof(out.priority));
+        if (r != PARSE_OK) return r;
+      } else if (known && strcmp(key, "timestamp") == 0) {
+        // Solo para medir: una hora que no se entiende no invalida el comando
+        skipSpace(c);
+        if (c.p < c.end && *c.p == '"') {
+          char timestamp[COMMAND_TIMESTAMP_MAX];
+          r = readString(c, timestamp, sizeof(timestamp));
+          if (r == PARSE_OK && !parseIsoTimestamp(timestamp, out.sentAtUs)) out.sentAtUs = 0;
+          if (r != PARSE_OK && r != PARSE_FIELD_TOO_LONG) return r;
+        } else {
+          r = skipValue(c);
+          if (r != PARSE_OK) return r;
+        }
+      } else {
+        r = skipValue(c);
+        if (r != PARSE_OK) return r;
+      }
+
+      if (consume(c, ',')) continue;
+      if (consume(c, '}')) break;
+      return PARSE_MALFORMED;
+    }
+  }
+
+  if (!hasAction) return PARSE_MISSING_FIELD;
+  return PARSE_OK;
+}
+
+const char* parseResultName(ParseResult result) {
+  switch (result) {
+    case PARSE_OK: return "ok";
+    case PARSE_EMPTY: return "empty";
+    case PARSE_MALFORMED: return "malformed";
+    case PARSE_TOO_DEEP: return "too_deep";
+    case PARSE_MISSING_FIELD: return "missing_field";
+    case PARSE_BAD_TYPE: return "bad_type";
+    case PARSE_FIELD_TOO_LONG: return "field_too_long";
+    default: return "unknown";
+  }
+}
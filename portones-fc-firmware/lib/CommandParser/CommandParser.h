@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Parser de comandos sin heap para el esquema que publica la API:
+//   {"gateId": 1, "action": "OPEN", "commandId": 123, "timestamp": "...", ...}
+// HOLD_OPEN lleva además "holdSeconds"; "priority" (VISITOR, RESIDENT, ADMIN,
+// EMERGENCY) es opcional. "timestamp" (ISO-8601 UTC, el toISOString() de la
+// API) da la hora de envío para medir la latencia de un sentido.
+// Solo extrae los campos que usa el firmware; el resto de claves (qrCode,
+// visitorName, accessType, objetos anidados) se recorren y descartan sin
+// copiarse. El coste es lineal en el tamaño del payload y no depende de
+// una capacidad fija de documento como StaticJsonDocument.
+
+const size_t COMMAND_ACTION_MAX = 12;  // incluye el terminador
+const size_t COMMAND_TIMESTAMP_MAX = 32;
+const uint8_t COMMAND_MAX_DEPTH = 8;   // anidamiento máximo al descartar valores
+
+enum ParseResult : uint8_t {
+  PARSE_OK = 0,
+  PARSE_EMPTY,           // payload vacío
+  PARSE_MALFORMED,       // JSON inválido o truncado
+  PARSE_TOO_DEEP,        // anidamiento mayor que COMMAND_MAX_DEPTH
+  PARSE_MISSING_FIELD,   // falta action
+  PARSE_BAD_TYPE,        // gateId/commandId/holdSeconds no numéricos o action/priority no son cadena
+  PARSE_FIELD_TOO_LONG,  // action o priority no caben en COMMAND_ACTION_MAX
+  PARSE_RESULT_COUNT
+};
+
+struct CommandFields {
+  int gateId;  // 0 si no viene: en los topics por portón lo fija el topic
+  char action[COMMAND_ACTION_MAX];
+  uint32_t commandId;  // 0 si no viene: sin deduplicación ni ack
+  uint32_t holdS;      // 0 si no viene
+  char priority[COMMAND_ACTION_MAX];  // vacía si no viene
+  int64_t sentAtUs;  // epoch µs de "timestamp"; 0 si no viene o no se entiende
+};
+
+ParseResult parseCommand(const uint8_t* payload, size_t length, CommandFields& out);
+const char* parseResultName(ParseResult result);
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Min-heap de plazos (µs) de capacidad fija, uno por id (0..N-1).
+// schedule() sobre un id ya presente mueve su plazo en O(log N), así que
+// extender una apertura no deja entradas viejas en el heap.
+template <size_t N>
+class DeadlineHeap {
+ public:
+  DeadlineHeap() {
+    for (size_t i = 0; i < N; i++) pos_[i] = NONE;
+  }
+
+  void schedule(uint8_t id, int64_t deadline) {
+    if (id >= N) return;
+    size_t i = pos_[id];
+    if (i == NONE) {
+      i = size_++;
+      heap_[i] = {deadline, id};
+      pos_[id] = i;
+      siftUp(i);
+      return;
+    }
+    int64_t previous = heap_[i].deadline;
+    heap_[i].deadline = deadline;
+    if (deadline < previous) {
+      siftUp(i);
+    } else {
+      siftDown(i);
+    }
+  }
+
+  bool cancel(uint8_t id) {
+    if (id >= N || pos_[id] == NONE) return false;
+    removeAt(pos_[id]);
+    return true;
+  }
+
+  bool contains(uint8_t id) const { return id < N && pos_[id] != NONE; }
+  bool empty() const { return size_ == 0; }
+  size_t size() const { return size_; }
+
+  // Solo válido si !empty()
+  int64_t nextDeadline() const { return heap_[0].deadline; }
+
+  // Saca el plazo más próximo si ya venció
+  bool popExpired(int64_t now, uint8_t& id, int64_t& deadline) {
+    if (size_ == 0 || heap_[0].deadline > now) return false;
+    id = heap_[0].id;
+    deadline = heap_[0].deadline;
+    removeAt(0);
+    return true;
+  }
+
+ private:
+  struct Entry {
+    int64_t deadline;
+    uint8_t id;
+  };
+
+  static constexpr size_t NONE = (size_t)-1;
+
+  void swapAt(size_t a, size_t b) {
+    Entry tmp = heap_[a];
+    heap_[a] = heap_[b];
+    heap_[b] = tmp;
+    pos_[heap_[a].id] = a;
+    pos_[heap_[b].id] = b;
+  }
+
+  void siftUp(size_t i) {
+    while (i > 0) {
+      size_t parent = (i - 1) / 2;
+      if (heap_[parent].deadline <= heap_[i].deadline) break;
+      swapAt(i, parent);
+      i = parent;
+    }
+  }
+
+  void siftDown(size_t i) {
+    for (;;) {
+      size_t smallest = i;
+      size_t left = 2 * i + 1;
+      size_t right = left + 1;
+      if (left < size_ && heap_[left].deadline < heap_[smallest].deadline) smallest = left;
+      if (right < size_ && heap_[right].deadline < heap_[smallest].deadline) smallest = right;
+      if (smallest == i) break;
+      swapAt(i, smallest);
+      i = smallest;
+    }
+  }
+
+  void removeAt(size_t i) {
+    pos_[heap_[i].id] = NONE;
+    size_--;
+    if (i == size_) return;
+    heap_[i] = heap_[size_];
+    pos_[heap_[i].id] = i;
+    siftUp(i);
+    siftDown(i);
+  }
+
+  Entry heap_[N];
+  size_t pos_[N];
+  size_t size_ = 0;
+};
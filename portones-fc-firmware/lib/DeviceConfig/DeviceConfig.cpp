@@ -0,0 +1,139 @@
+#include "DeviceConfig.h"
+
+#include <stdio.h>
+#include <string.h>
+
+const ConfigFieldInfo CONFIG_FIELDS[CONFIG_FIELD_COUNT] = {
+  {CONFIG_WIFI_SSID, "wifi.ssid", CONFIG_SCOPE_WIFI, false},
+  {CONFIG_WIFI_PASSWORD, "wifi.password", CONFIG_SCOPE_WIFI, true},
+  {CONFIG_MQTT_HOST, "mqtt.host", CONFIG_SCOPE_BROKER, false},
+  {CONFIG_MQTT_PORT, "mqtt.port", CONFIG_SCOPE_BROKER, false},
+  {CONFIG_MQTT_USER, "mqtt.user", CONFIG_SCOPE_BROKER, false},
+  {CONFIG_MQTT_PASSWORD, "mqtt.password", CONFIG_SCOPE_BROKER, true},
+  {CONFIG_COLONIA_ID, "colonia", CONFIG_SCOPE_ADDRESS, false},
+  {CONFIG_CONTROLLER_ID, "controller", CONFIG_SCOPE_ADDRESS, false},
+  {CONFIG_QR_KEY, "qr.key", CONFIG_SCOPE_NONE, true},
+  {CONFIG_CONFIG_KEY, "config.key", CONFIG_SCOPE_NONE, true},
+};
+
+namespace {
+
+// Campo de texto correspondiente a key; nullptr para el puerto
+char* textField(DeviceConfig& config, ConfigKey key, size_t& size) {
+  switch (key) {
+    case CONFIG_WIFI_SSID: size = sizeof(config.wifiSsid); return config.wifiSsid;
+    case CONFIG_WIFI_PASSWORD: size = sizeof(config.wifiPassword); return config.wifiPassword;
+    case CONFIG_MQTT_HOST: size = sizeof(config.mqttHost); return config.mqttHost;
+    case CONFIG_MQTT_USER: size = sizeof(config.mqttUser); return config.mqttUser;
+    case CONFIG_MQTT_PASSWORD: size = sizeof(config.mqttPassword); return config.mqttPassword;
+    case CONFIG_COLONIA_ID: size = sizeof(config.coloniaId); return config.coloniaId;
+    case CONFIG_CONTROLLER_ID: size = sizeof(config.controllerId); return config.controllerId;
+    case CONFIG_QR_KEY: size = sizeof(config.qrKey); return config.qrKey;
+    case CONFIG_CONFIG_KEY: size = sizeof(config.configKey); return config.configKey;
+    default: size = 0; return nullptr;
+  }
+}
+
+const char* textField(const DeviceConfig& config, ConfigKey key) {
+  size_t size;
+  return textField(const_cast<DeviceConfig&>(config), key, size);
+}
+
+// Los identificadores forman parte de los topics
+bool validTopicLevel(const char* value, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    if (value[i] == '/' || value[i] == '+' || value[i] == '#' || value[i] == ' ') return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+const ConfigFieldInfo* configField(ConfigKey key) {
+  for (size_t i = 0; i < CONFIG_FIELD_COUNT; i++) {
+    if (CONFIG_FIELDS[i].key == key) return &CONFIG_FIELDS[i];
+  }
+  return nullptr;
+}
+
+const ConfigFieldInfo* configFieldByName(const char* name, size_t length) {
+  for (size_t i = 0; i < CONFIG_FIELD_COUNT; i++) {
+    if (strlen(CONFIG_FIELDS[i].name) == length && strncmp(CONFIG_FIELDS[i].name, name, length) == 0) {
+      return &CONFIG_FIELDS[i];
+    }
+  }
+  return nullptr;
+}
+
+void clearDeviceConfig(DeviceConfig& config) {
+  memset(&config, 0, sizeof(config));
+  config.schema = DEVICE_CONFIG_SCHEMA;
+}
+
+bool setConfigField(DeviceConfig& config, ConfigKey key, const char* value, size_t length) {
+  if (memchr(value, '\0', length) != nullptr) return false;
+
+  if (key == CONFIG_MQTT_PORT) {
+    uint32_t port = 0;
+    if (length == 0 || length > 5) return false;
+    for (size_t i = 0; i < length; i++) {
+      if (value[i] < '0' || value[i] > '9') return false;
+      port = port * 10 + (value[i] - '0');
+    }
+    if (port == 0 || port > 65535) return false;
+    config.mqttPort = (uint16_t)port;
+    return true;
+  }
+
+  size_t size;
+  char* field = textField(config, key, size);
+  if (!field || length >= size) return false;
+  if ((key == CONFIG_COLONIA_ID || key == CONFIG_CONTROLLER_ID) && !validTopicLevel(value, length)) return false;
+  if (key == CONFIG_COLONIA_ID && length == 0) return false;
+  memcpy(field, value, length);
+  field[length] = '\0';
+  return true;
+}
+
+size_t formatConfigField(const DeviceConfig& config, ConfigKey key, char* out, size_t size) {
+  if (size == 0) return 0;
+  const ConfigFieldInfo* info = configField(key);
+  int written;
+  if (key == CONFIG_MQTT_PORT) {
+    written = snprintf(out, size, "%u", (unsigned)config.mqttPort);
+  } else {
+    const char* value = textField(config, key);
+    if (!info || !value) {
+      out[0] = '\0';
+      return 0;
+    }
+    written = snprintf(out, size, "%s", info->secret && value[0] != '\0' ? "***" : value);
+  }
+  if (written < 0) return 0;
+  return (size_t)written < size ? (size_t)written : size - 1;
+}
+
+bool deviceConfigValid(const DeviceConfig& config) {
+  if (config.schema != DEVICE_CONFIG_SCHEMA) return false;
+  for (size_t i = 0; i < CONFIG_FIELD_COUNT; i++) {
+    size_t size;
+    const char* value = textField(const_cast<DeviceConfig&>(config), CONFIG_FIELDS[i].key, size);
+    if (value && memchr(value, '\0', size) == nullptr) return false;
+  }
+  return true;
+}
+
+bool configComplete(const DeviceConfig& config) {
+  return config.wifiSsid[0] != '\0' && config.mqttHost[0] != '\0' && config.mqttPort != 0 &&
+         config.coloniaId[0] != '\0';
+}
+
+uint8_t configChanges(const DeviceConfig& before, const DeviceConfig& after) {
+  uint8_t scope = before.mqttPort != after.mqttPort ? CONFIG_SCOPE_BROKER : CONFIG_SCOPE_NONE;
+  for (size_t i = 0; i < CONFIG_FIELD_COUNT; i++) {
+    const char* a = textField(before, CONFIG_FIELDS[i].key);
+    const char* b = textField(after, CONFIG_FIELDS[i].key);
+    if (a && b && strcmp(a, b) != 0) scope |= CONFIG_FIELDS[i].scope;
+  }
+  return scope;
+}
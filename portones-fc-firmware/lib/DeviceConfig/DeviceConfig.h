@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Configuración propia de cada placa: red, broker, credenciales, dirección y
+// claves. Se guarda en NVS como un único blob y se carga una vez al
+// arrancar; en el camino caliente solo se leen estos campos, sin parsear.
+// Los cambios (remotos o por consola) se validan sobre una copia y se
+// adoptan completos o no se adoptan.
+
+const uint16_t DEVICE_CONFIG_SCHEMA = 1;  // cambia si cambia el layout
+
+struct DeviceConfig {
+  uint16_t schema;
+  uint16_t mqttPort;
+  uint32_t version;  // de la última actualización remota aplicada; 0 = ninguna
+  char wifiSsid[33];
+  char wifiPassword[65];
+  char mqttHost[65];
+  char mqttUser[33];
+  char mqttPassword[65];
+  char coloniaId[33];
+  char controllerId[24];  // vacío: se deriva de la MAC
+  char qrKey[65];         // firma de las deltas de allowlist
+  char configKey[65];     // firma de las actualizaciones de configuración
+};
+
+// Identificador de cada campo en la trama de configuración; no reutilizar
+enum ConfigKey : uint8_t {
+  CONFIG_WIFI_SSID = 1,
+  CONFIG_WIFI_PASSWORD = 2,
+  CONFIG_MQTT_HOST = 3,
+  CONFIG_MQTT_PORT = 4,
+  CONFIG_MQTT_USER = 5,
+  CONFIG_MQTT_PASSWORD = 6,
+  CONFIG_COLONIA_ID = 7,
+  CONFIG_CONTROLLER_ID = 8,
+  CONFIG_QR_KEY = 9,
+  CONFIG_CONFIG_KEY = 10,
+};
+
+// Qué hay que rehacer para que un cambio tenga efecto (máscara de bits)
+enum ConfigScope : uint8_t {
+  CONFIG_SCOPE_NONE = 0,     // se usa en la siguiente lectura
+  CONFIG_SCOPE_ADDRESS = 1,  // topics e ID de cliente: nueva sesión MQTT
+  CONFIG_SCOPE_BROKER = 2,   // nueva conexión TLS y MQTT
+  CONFIG_SCOPE_WIFI = 4,     // nueva asociación WiFi
+};
+
+struct ConfigFieldInfo {
+  ConfigKey key;
+  const char* name;  // el de la consola y la API
+  uint8_t scope;
+  bool secret;       // no se muestra
+};
+
+const size_t CONFIG_FIELD_COUNT = 10;
+extern const ConfigFieldInfo CONFIG_FIELDS[CONFIG_FIELD_COUNT];
+
+const ConfigFieldInfo* configField(ConfigKey key);
+const ConfigFieldInfo* configFieldByName(const char* name, size_t length);
+
+// Deja la configuración vacía con el schema actual
+void clearDeviceConfig(DeviceConfig& config);
+// value es texto sin terminador. Devuelve false si no cabe, el puerto no es
+// un número válido o un identificador trae caracteres reservados de MQTT.
+bool setConfigField(DeviceConfig& config, ConfigKey key, const char* value, size_t length);
+// Escribe el valor como texto terminado; los secretos salen como "***" si
+// tienen valor
+size_t formatConfigField(const DeviceConfig& config, ConfigKey key, char* out, size_t size);
+// Schema actual y todos los campos de texto terminados: lo mínimo para
+// adoptar un blob leído de NVS
+bool deviceConfigValid(const DeviceConfig& config);
+// Hay red y broker a los que intentar conectar
+bool configComplete(const DeviceConfig& config);
+// Unión de los ConfigScope de los campos que difieren
+uint8_t configChanges(const DeviceConfig& before, const DeviceConfig& after);
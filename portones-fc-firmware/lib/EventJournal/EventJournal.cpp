@@ -0,0 +1,160 @@
+#include "EventJournal.h"
+
+#include <string.h>
+
+namespace {
+
+const uint32_t ERASED_SEQ = 0xFFFFFFFF;
+
+uint32_t readSeq(const uint8_t* record) {
+  return (uint32_t)record[0] | ((uint32_t)record[1] << 8) | ((uint32_t)record[2] << 16) | ((uint32_t)record[3] << 24);
+}
+
+void writeUint32(uint8_t* out, uint32_t value) {
+  out[0] = (uint8_t)value;
+  out[1] = (uint8_t)(value >> 8);
+  out[2] = (uint8_t)(value >> 16);
+  out[3] = (uint8_t)(value >> 24);
+}
+
+bool recordValid(const uint8_t* record) {
+  uint32_t seq = readSeq(record);
+  if (seq == ERASED_SEQ || seq == 0) return false;
+  return journalCrc32(record, JOURNAL_RECORD_SIZE - 4) == readSeq(record + JOURNAL_RECORD_SIZE - 4);
+}
+
+}  // namespace
+
+uint32_t journalCrc32(const uint8_t* data, size_t length) {
+  uint32_t crc = 0xFFFFFFFF;
+  for (size_t i = 0; i < length; i++) {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+  }
+  return ~crc;
+}
+
+bool EventJournal::slotErased(size_t slot) {
+  uint8_t record[JOURNAL_RECORD_SIZE];
+  if (!flash_->read(slot * JOURNAL_RECORD_SIZE, record, sizeof(record))) return false;
+  for (size_t i = 0; i < sizeof(record); i++) {
+    if (record[i] != 0xFF) return false;
+  }
+  return true;
+}
+
+bool EventJournal::begin(JournalFlash* flash) {
+  flash_ = flash;
+  pendingCount_ = 0;
+  if (!flash_ || flash_->size() < 2 * JOURNAL_SECTOR_SIZE) {
+    flash_ = nullptr;
+    return false;
+  }
+
+  // Un recorrido completo: 64 KB se leen en pocos ms y solo ocurre al arrancar
+  uint32_t maxSeq = 0;
+  uint32_t minSeq = ERASED_SEQ;
+  size_t maxSlot = 0;
+  uint8_t record[JOURNAL_RECORD_SIZE];
+  for (size_t slot = 0; slot < capacity(); slot++) {
+    if (!flash_->read(slot * JOURNAL_RECORD_SIZE, record, sizeof(record)) || !recordValid(record)) continue;
+    uint32_t seq = readSeq(record);
+    if (seq > maxSeq) {
+      maxSeq = seq;
+      maxSlot = slot;
+    }
+    if (seq < minSeq) minSeq = seq;
+  }
+
+  if (maxSeq == 0) {
+    headSlot_ = 0;
+    nextSeq_ = 1;
+    oldestSeq_ = 1;
+  } else {
+    headSlot_ = (maxSlot + 1) % capacity();
+    nextSeq_ = maxSeq + 1;
+    oldestSeq_ = minSeq;
+  }
+  // Un lote cortado por un apagón deja basura tras la cabeza: se salta al
+  // siguiente sector, que se borrará antes de escribirlo. Las secuencias de
+  // los huecos saltados se consumen para que secuencia y posición sigan
+  // alineadas.
+  if (headSlot_ % recordsPerSector() != 0 && !slotErased(headSlot_)) {
+    size_t skipped = recordsPerSector() - headSlot_ % recordsPerSector();
+    headSlot_ = (headSlot_ + skipped) % capacity();
+    nextSeq_ += skipped;
+  }
+  return true;
+}
+
+uint32_t EventJournal::append(const uint8_t* payload) {
+  if (!flash_) return 0;
+  if (pendingCount_ == JOURNAL_BATCH) flush();
+  if (pendingCount_ == JOURNAL_BATCH) return 0;  // la flash falló y el lote sigue lleno
+
+  uint8_t* record = pending_ + pendingCount_ * JOURNAL_RECORD_SIZE;
+  uint32_t seq = nextSeq_++;
+  writeUint32(record, seq);
+  memcpy(record + 4, payload, JOURNAL_PAYLOAD_SIZE);
+  writeUint32(record + JOURNAL_RECORD_SIZE - 4, journalCrc32(record, JOURNAL_RECORD_SIZE - 4));
+  pendingCount_++;
+  if (pendingCount_ == JOURNAL_BATCH) flush();
+  return seq;
+}
+
+bool EventJournal::flush() {
+  if (!flash_ || pendingCount_ == 0) return true;
+
+  size_t written = 0;
+  while (written < pendingCount_) {
+    if (headSlot_ % recordsPerSector() == 0) {
+      // El sector guardaba lo más antiguo: esos registros se pierden
+      if (!flash_->eraseSector(headSlot_ * JOURNAL_RECORD_SIZE)) {
+        writeErrors_++;
+        break;
+      }
+      uint32_t firstPending = nextSeq_ - pendingCount_ + written;
+      uint32_t retainedAfterErase = (uint32_t)(capacity() - recordsPerSector());
+      if (firstPending - oldestSeq_ > retainedAfterErase) oldestSeq_ = firstPending - retainedAfterErase;
+    }
+    // Tramo contiguo hasta el final del sector o del lote
+    size_t run = recordsPerSector() - headSlot_ % recordsPerSector();
+    if (run > pendingCount_ - written) run = pendingCount_ - written;
+    if (!flash_->write(headSlot_ * JOURNAL_RECORD_SIZE, pending_ + written * JOURNAL_RECORD_SIZE,
+                       run * JOURNAL_RECORD_SIZE)) {
+      writeErrors_++;
+      break;
+    }
+    written += run;
+    headSlot_ = (headSlot_ + run) % capacity();
+  }
+
+  memmove(pending_, pending_ + written * JOURNAL_RECORD_SIZE, (pendingCount_ - written) * JOURNAL_RECORD_SIZE);
+  pendingCount_ -= written;
+  return pendingCount_ == 0;
+}
+
+size_t EventJournal::read(uint32_t fromSeq, uint8_t* out, size_t maxRecords, uint32_t& nextSeq) {
+  nextSeq = fromSeq;
+  if (!flash_) return 0;
+  uint32_t flushedEnd = nextSeq_ - pendingCount_;  // primera secuencia aún en RAM
+  if (fromSeq < oldestSeq_) fromSeq = oldestSeq_;
+  nextSeq = fromSeq;
+  if (fromSeq >= flushedEnd) return 0;
+
+  // Secuencia y posición avanzan juntas detrás de la cabeza
+  size_t back = flushedEnd - fromSeq;
+  size_t slot = (headSlot_ + capacity() - back % capacity()) % capacity();
+  size_t copied = 0;
+  while (nextSeq < flushedEnd && copied < maxRecords) {
+    uint8_t* record = out + copied * JOURNAL_RECORD_SIZE;
+    // Los huecos (lote cortado, CRC roto) se saltan sin detener la lectura
+    if (flash_->read(slot * JOURNAL_RECORD_SIZE, record, JOURNAL_RECORD_SIZE) && recordValid(record) &&
+        readSeq(record) == nextSeq) {
+      copied++;
+    }
+    nextSeq++;
+    slot = (slot + 1) % capacity();
+  }
+  return copied;
+}
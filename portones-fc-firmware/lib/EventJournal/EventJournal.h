@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Diario de eventos de solo-añadir sobre flash NOR, en anillo. Cada
+// registro ocupa 32 bytes (secuencia + carga útil de 24 + CRC32) y se
+// escriben por lotes de una página; un sector solo se borra cuando la
+// cabeza de escritura llega a él, así que todos los sectores se desgastan
+// por igual. Tras un reinicio begin() reconstruye la cabeza buscando la
+// secuencia más alta con CRC válido.
+//
+// La secuencia es contigua y empieza en 1: la API deduplica con ella y el
+// firmware sabe qué reenviar a partir del último número confirmado.
+
+const size_t JOURNAL_RECORD_SIZE = 32;
+const size_t JOURNAL_PAYLOAD_SIZE = 24;
+const size_t JOURNAL_SECTOR_SIZE = 4096;
+const size_t JOURNAL_BATCH = 8;  // registros por escritura (256 bytes, una página)
+
+// Acceso a la región de flash del diario. Los desplazamientos son relativos
+// al inicio de la región; write() solo puede pasar bits de 1 a 0.
+class JournalFlash {
+ public:
+  virtual ~JournalFlash() {}
+  virtual bool read(size_t offset, void* out, size_t length) = 0;
+  virtual bool write(size_t offset, const void* data, size_t length) = 0;
+  virtual bool eraseSector(size_t offset) = 0;
+  virtual size_t size() const = 0;
+};
+
+class EventJournal {
+ public:
+  // La región debe tener al menos dos sectores
+  bool begin(JournalFlash* flash);
+  bool ready() const { return flash_ != nullptr; }
+
+  // Asigna la secuencia y deja el registro en el lote en RAM; escribe en
+  // flash al completar JOURNAL_BATCH. Devuelve la secuencia (0 si no hay flash).
+  uint32_t append(const uint8_t* payload);
+  // Escribe el lote pendiente. Se llama antes de leer o cuando pasó el
+  // tiempo de agrupamiento.
+  bool flush();
+  size_t pendingWrites() const { return pendingCount_; }
+
+  uint32_t lastSeq() const { return nextSeq_ - 1; }
+  // Secuencia más antigua que sigue en flash (lastSeq() + 1 si está vacío)
+  uint32_t oldestSeq() const { return oldestSeq_; }
+
+  // Copia hasta maxRecords registros ya escritos desde fromSeq, en formato
+  // de flash (32 bytes cada uno). Devuelve cuántos copió; nextSeq queda en
+  // la secuencia desde la que seguir leyendo.
+  size_t read(uint32_t fromSeq, uint8_t* out, size_t maxRecords, uint32_t& nextSeq);
+
+  uint32_t writeErrors() const { return writeErrors_; }
+
+ private:
+  size_t capacity() const { return flash_ ? flash_->size() / JOURNAL_RECORD_SIZE : 0; }
+  size_t recordsPerSector() const { return JOURNAL_SECTOR_SIZE / JOURNAL_RECORD_SIZE; }
+  bool slotErased(size_t slot);
+
+  JournalFlash* flash_ = nullptr;
+  size_t headSlot_ = 0;    // próximo registro a escribir en flash
+  uint32_t nextSeq_ = 1;   // próxima secuencia a asignar
+  uint32_t oldestSeq_ = 1;
+  uint8_t pending_[JOURNAL_BATCH * JOURNAL_RECORD_SIZE];
+  size_t pendingCount_ = 0;
+  uint32_t writeErrors_ = 0;
+};
+
+uint32_t journalCrc32(const uint8_t* data, size_t length);
@@ -0,0 +1,93 @@
+#include "EventLog.h"
+
+#include <stdio.h>
+
+namespace {
+
+size_t clampWritten(int written, size_t size) {
+  if (written < 0) return 0;
+  return (size_t)written < size ? (size_t)written : size - 1;
+}
+
+// Fecha UTC de un día desde 1970-01-01 (algoritmo de H. Hinnant)
+void civilFromDays(int64_t days, int& year, unsigned& month, unsigned& day) {
+  days += 719468;
+  int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+  unsigned doe = (unsigned)(days - era * 146097);
+  unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  unsigned mp = (5 * doy + 2) / 153;
+  day = doy - (153 * mp + 2) / 5 + 1;
+  month = mp < 10 ? mp + 3 : mp - 9;
+  year = (int)(yoe + era * 400) + (month <= 2);
+}
+
+int formatStamp(const LogRecord& record, int64_t epochMs, char* out, size_t size) {
+  if (epochMs == 0) {
+    unsigned long ms = record.ms;
+    unsigned long secs = ms / 1000;
+    unsigned long mins = secs / 60;
+    unsigned long hours = mins / 60;
+    return snprintf(out, size, "%02lu:%02lu:%02lu.%03lu", hours, mins % 60, secs % 60, ms % 1000);
+  }
+  int64_t secs = epochMs / 1000;
+  int year;
+  unsigned month, day;
+  civilFromDays(secs / 86400, year, month, day);
+  unsigned daySecs = (unsigned)(secs % 86400);
+  return snprintf(out, size, "%04d-%02u-%02uT%02u:%02u:%02u.%03uZ", year, month, day, daySecs / 3600,
+                  daySecs / 60 % 60, daySecs % 60, (unsigned)(epochMs % 1000));
+}
+
+}  // namespace
+
+size_t formatLogRecord(const LogRecord& record, const LogEventInfo& info, int64_t epochMs, char* out, size_t size) {
+  if (size == 0) return 0;
+  char stamp[64];  // de sobra para -Wformat-truncation: la hora ocupa 25
+  formatStamp(record, epochMs, stamp, sizeof(stamp));
+
+  int written;
+  if (record.gate > 0) {
+    written = snprintf(out, size, "[%s] [%s %u] ", stamp, info.tag, record.gate);
+  } else {
+    written = snprintf(out, size, "[%s] [%s] ", stamp, info.tag);
+  }
+  size_t length = clampWritten(written, size);
+
+  const char* s0 = record.text[0] ? record.text[0] : "";
+  const char* s1 = record.text[1] ? record.text[1] : "";
+  long a0 = record.args[0];
+  long a1 = record.args[1];
+  char* p = out + length;
+  size_t left = size - length;
+  switch (info.strings * 3 + info.ints) {
+    case 0: written = snprintf(p, left, "%s", info.format); break;
+    case 1: written = snprintf(p, left, info.format, a0); break;
+    case 2: written = snprintf(p, left, info.format, a0, a1); break;
+    case 3: written = snprintf(p, left, info.format, s0); break;
+    case 4: written = snprintf(p, left, info.format, s0, a0); break;
+    case 5: written = snprintf(p, left, info.format, s0, a0, a1); break;
+    case 6: written = snprintf(p, left, info.format, s0, s1); break;
+    case 7: written = snprintf(p, left, info.format, s0, s1, a0); break;
+    default: written = snprintf(p, left, info.format, s0, s1, a0, a1); break;
+  }
+  length += clampWritten(written, left);
+
+  if (length < size - 1) {
+    out[length++] = '\n';
+    out[length] = '\0';
+  } else {
+    out[size - 2] = '\n';
+  }
+  return length;
+}
+
+const char* logLevelName(uint8_t level) {
+  switch (level) {
+    case LOG_LEVEL_ERROR: return "ERROR";
+    case LOG_LEVEL_WARN: return "WARN";
+    case LOG_LEVEL_INFO: return "INFO";
+    case LOG_LEVEL_DEBUG: return "DEBUG";
+    default: return "?";
+  }
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Registro de eventos en dos fases: el productor guarda un LogRecord binario
+// de tamaño fijo (sin formatear, sin heap) y un consumidor de baja prioridad
+// lo convierte a texto más tarde. Así una ráfaga de logs nunca retrasa la
+// escritura de un servo: en la ruta crítica solo se copian 24 bytes.
+//
+// Cada evento tiene un descriptor constexpr con su nivel; los LOG_* de
+// main.cpp comparan ese nivel con LOG_LEVEL en compilación y el compilador
+// elimina por completo (argumentos incluidos) los eventos filtrados.
+
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+const size_t LOG_LINE_MAX = 160;  // línea formateada, incluido "\n"
+
+// El formato consume primero `strings` argumentos %s y luego `ints`
+// argumentos %ld, en ese orden.
+struct LogEventInfo {
+  uint8_t level;
+  const char* tag;
+  const char* format;
+  uint8_t strings;  // 0-2
+  uint8_t ints;     // 0-2
+};
+
+// Los textos deben tener duración estática (literales o buffers globales
+// que no cambian tras setup()): solo se guarda el puntero.
+struct LogRecord {
+  uint32_t ms;  // millis() al registrar
+  uint16_t event;
+  uint8_t gate;  // 0 = sin portón; si no, la etiqueta sale como "[TAG n]"
+  uint8_t reserved;
+  int32_t args[2];
+  const char* text[2];
+};
+
+// Escribe "[HH:MM:SS.mmm] [TAG] mensaje\n" en out, con el tiempo desde el
+// arranque, o "[2026-10-14T12:34:56.789Z] ..." si epochMs (la hora de pared
+// de record.ms) no es 0. Devuelve la longitud escrita (truncada a size - 1).
+size_t formatLogRecord(const LogRecord& record, const LogEventInfo& info, int64_t epochMs, char* out, size_t size);
+const char* logLevelName(uint8_t level);
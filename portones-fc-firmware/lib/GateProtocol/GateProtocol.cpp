@@ -0,0 +1,263 @@
+#include "GateProtocol.h"
+
+#include <string.h>
+
+namespace {
+
+inline uint8_t frameHeader(FrameType type) {
+  return (uint8_t)((PROTOCOL_VERSION << 4) | (type & 0x0F));
+}
+
+void writeUint32(uint8_t* out, uint32_t value) {
+  out[0] = (uint8_t)value;
+  out[1] = (uint8_t)(value >> 8);
+  out[2] = (uint8_t)(value >> 16);
+  out[3] = (uint8_t)(value >> 24);
+}
+
+// FNV-1a de 32 bits; recursivo para poder usarse como constexpr en C++11
+constexpr uint32_t fnv1a(const char* s, uint32_t hash = 2166136261u) {
+  return *s ? fnv1a(s + 1, (hash ^ (uint8_t)*s) * 16777619u) : hash;
+}
+
+uint16_t readUint16(const uint8_t* in) {
+  return (uint16_t)(in[0] | (in[1] << 8));
+}
+
+uint32_t readUint32(const uint8_t* in) {
+  return (uint32_t)in[0] | ((uint32_t)in[1] << 8) | ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+}  // namespace
+
+bool decodeCommandFrame(const uint8_t* data, size_t length, CommandFrame& out) {
+  if (data == nullptr || length < COMMAND_FRAME_SIZE) return false;
+  if (data[0] != frameHeader(FRAME_COMMAND)) return false;
+  // La duración solo viaja con HOLD_OPEN, y HOLD_OPEN no va sin ella
+  bool hold = data[2] == ACTION_HOLD_OPEN;
+  bool sentAt = data[3] & COMMAND_FLAG_SENT_AT;
+  size_t base = hold ? COMMAND_HOLD_FRAME_SIZE : COMMAND_FRAME_SIZE;
+  if (length != base + (sentAt ? COMMAND_SENT_AT_SIZE : 0)) return false;
+
+  out.gateId = data[1];
+  out.action = (GateAction)data[2];
+  out.flags = data[3];
+  out.sequence = readUint32(data + 4);
+  out.holdS = hold ? readUint16(data + 8) : 0;
+  out.sentAtUs = sentAt ? (int64_t)((uint64_t)readUint32(data + base) | (uint64_t)readUint32(data + base + 4) << 32) : 0;
+  return true;
+}
+
+bool decodeQrDeltaHeader(const uint8_t* data, size_t length, QrDeltaHeader& out) {
+  if (data == nullptr || length < QR_DELTA_HEADER_SIZE + QR_DELTA_MAC_SIZE) return false;
+  if (data[0] != frameHeader(FRAME_QR_DELTA)) return false;
+
+  out.flags = data[1];
+  out.count = readUint16(data + 2);
+  out.baseVersion = readUint32(data + 4);
+  out.newVersion = readUint32(data + 8);
+  out.issuedAt = readUint32(data + 12);
+  return length == QR_DELTA_HEADER_SIZE + (size_t)out.count * QR_DELTA_OP_SIZE + QR_DELTA_MAC_SIZE;
+}
+
+QrDeltaOp decodeQrDeltaOp(const uint8_t* data, size_t index) {
+  return decodeQrDeltaOpAt(data + QR_DELTA_HEADER_SIZE + index * QR_DELTA_OP_SIZE);
+}
+
+QrDeltaOp decodeQrDeltaOpAt(const uint8_t* p) {
+  QrDeltaOp op;
+  op.kind = (QrDeltaKind)p[0];
+  op.code = readUint32(p + 1);
+  op.validFrom = readUint32(p + 5);
+  op.expiresAt = readUint32(p + 9);
+  op.uses = readUint16(p + 13);
+  op.maxUses = readUint16(p + 15);
+  return op;
+}
+
+bool decodeDesiredHeader(const uint8_t* data, size_t length, DesiredHeader& out) {
+  if (data == nullptr || length < DESIRED_HEADER_SIZE) return false;
+  if (data[0] != frameHeader(FRAME_DESIRED)) return false;
+
+  out.count = data[1];
+  out.issuedAt = readUint32(data + 4);
+  return length == DESIRED_HEADER_SIZE + (size_t)out.count * DESIRED_ENTRY_SIZE;
+}
+
+DesiredEntry decodeDesiredEntry(const uint8_t* data, size_t index) {
+  const uint8_t* p = data + DESIRED_HEADER_SIZE + index * DESIRED_ENTRY_SIZE;
+  DesiredEntry entry;
+  entry.gateId = p[0];
+  entry.status = (GateStatusCode)p[1];
+  entry.until = readUint32(p + 2);
+  return entry;
+}
+
+bool decodeConfigHeader(const uint8_t* data, size_t length, ConfigHeader& out) {
+  if (data == nullptr || length < CONFIG_HEADER_SIZE + CONFIG_MAC_SIZE) return false;
+  if (data[0] != frameHeader(FRAME_CONFIG)) return false;
+
+  out.count = readUint16(data + 2);
+  out.version = readUint32(data + 4);
+  out.issuedAt = readUint32(data + 8);
+  size_t end = length - CONFIG_MAC_SIZE;
+  size_t offset = CONFIG_HEADER_SIZE;
+  for (uint16_t i = 0; i < out.count; i++) {
+    if (offset + 2 > end || offset + 2 + data[offset + 1] > end) return false;
+    offset += 2 + data[offset + 1];
+  }
+  return offset == end;
+}
+
+size_t decodeConfigField(const uint8_t* data, size_t offset, ConfigFieldValue& out) {
+  out.key = data[offset];
+  out.length = data[offset + 1];
+  out.value = data + offset + 2;
+  return offset + 2 + out.length;
+}
+
+bool decodeOtaOffer(const uint8_t* data, size_t length, OtaOffer& out) {
+  if (data == nullptr || length < OTA_OFFER_HEADER_SIZE + OTA_OFFER_MAC_SIZE) return false;
+  if (data[0] != frameHeader(FRAME_OTA)) return false;
+  size_t urlLength = data[2];
+  if (urlLength == 0 || length != OTA_OFFER_HEADER_SIZE + urlLength + OTA_OFFER_MAC_SIZE) return false;
+
+  out.format = data[1];
+  out.imageSize = readUint32(data + 4);
+  out.issuedAt = readUint32(data + 8);
+  memcpy(out.sha256, data + 12, sizeof(out.sha256));
+  memcpy(out.baseSha256, data + 44, sizeof(out.baseSha256));
+  memcpy(out.version, data + 76, OTA_VERSION_SIZE);
+  out.version[OTA_VERSION_SIZE] = '\0';
+  memcpy(out.url, data + OTA_OFFER_HEADER_SIZE, urlLength);
+  out.url[urlLength] = '\0';
+  return true;
+}
+
+void encodeJournalEvent(const JournalEvent& event, uint8_t* out) {
+  memset(out, 0, JOURNAL_EVENT_SIZE);
+  out[0] = event.type;
+  out[1] = event.gateId;
+  out[2] = event.value;
+  out[3] = event.flags;
+  writeUint32(out + 4, event.at);
+  writeUint32(out + 8, event.code);
+  out[12] = (uint8_t)event.uses;
+  out[13] = (uint8_t)(event.uses >> 8);
+  out[14] = event.source;
+}
+
+size_t encodeJournalFrameHeader(uint16_t count, uint32_t journalId, uint32_t fromSeq, uint32_t throughSeq,
+                                uint8_t* out, size_t outSize) {
+  if (out == nullptr || outSize < JOURNAL_FRAME_HEADER_SIZE) return 0;
+  out[0] = frameHeader(FRAME_JOURNAL);
+  out[1] = 0;
+  out[2] = (uint8_t)count;
+  out[3] = (uint8_t)(count >> 8);
+  writeUint32(out + 4, journalId);
+  writeUint32(out + 8, fromSeq);
+  writeUint32(out + 12, throughSeq);
+  return JOURNAL_FRAME_HEADER_SIZE;
+}
+
+size_t encodeStatusFrame(uint8_t gateId, GateStatusCode status, uint8_t* out, size_t outSize) {
+  if (out == nullptr || outSize < STATUS_FRAME_SIZE) return 0;
+  out[0] = frameHeader(FRAME_STATUS);
+  out[1] = gateId;
+  out[2] = status;
+  out[3] = 0;
+  return STATUS_FRAME_SIZE;
+}
+
+size_t encodeAckFrame(uint8_t gateId, AckResult result, uint32_t commandId, uint32_t latencyUs, int32_t oneWayUs,
+                      uint8_t* out, size_t outSize) {
+  bool oneWay = oneWayUs != ONE_WAY_UNKNOWN;
+  size_t size = oneWay ? ACK_ONE_WAY_FRAME_SIZE : ACK_FRAME_SIZE;
+  if (out == nullptr || outSize < size) return 0;
+  out[0] = frameHeader(FRAME_ACK);
+  out[1] = gateId;
+  out[2] = result;
+  out[3] = oneWay ? ACK_FLAG_ONE_WAY : 0;
+  writeUint32(out + 4, commandId);
+  writeUint32(out + 8, latencyUs);
+  if (oneWay) writeUint32(out + 12, (uint32_t)oneWayUs);
+  return size;
+}
+
+const char* gateActionName(GateAction action) {
+  switch (action) {
+    case ACTION_OPEN: return "OPEN";
+    case ACTION_CLOSE: return "CLOSE";
+    case ACTION_STOP: return "STOP";
+    case ACTION_HOLD_OPEN: return "HOLD_OPEN";
+    case ACTION_EMERGENCY: return "EMERGENCY";
+    case ACTION_RESUME: return "RESUME";
+    default: return nullptr;
+  }
+}
+
+// El hash de cada nombre se calcula al compilar: un switch sobre el hash y
+// una sola comparación para descartar colisiones
+GateAction gateActionCode(const char* name) {
+  GateAction action;
+  switch (fnv1a(name)) {
+    case fnv1a("OPEN"): action = ACTION_OPEN; break;
+    case fnv1a("CLOSE"): action = ACTION_CLOSE; break;
+    case fnv1a("STOP"): action = ACTION_STOP; break;
+    case fnv1a("HOLD_OPEN"): action = ACTION_HOLD_OPEN; break;
+    case fnv1a("EMERGENCY"): action = ACTION_EMERGENCY; break;
+    case fnv1a("RESUME"): action = ACTION_RESUME; break;
+    default: return ACTION_NONE;
+  }
+  return strcmp(name, gateActionName(action)) == 0 ? action : ACTION_NONE;
+}
+
+const char* commandPriorityName(CommandPriority priority) {
+  switch (priority) {
+    case PRIORITY_VISITOR: return "VISITOR";
+    case PRIORITY_RESIDENT: return "RESIDENT";
+    case PRIORITY_ADMIN: return "ADMIN";
+    case PRIORITY_EMERGENCY: return "EMERGENCY";
+    default: return "UNKNOWN";
+  }
+}
+
+CommandPriority commandPriorityCode(const char* name) {
+  for (uint8_t p = PRIORITY_COUNT; p-- > 0;) {
+    if (strcmp(name, commandPriorityName((CommandPriority)p)) == 0) return (CommandPriority)p;
+  }
+  return PRIORITY_VISITOR;
+}
+
+const char* gateStatusName(GateStatusCode status) {
+  switch (status) {
+    case STATUS_OPEN: return "OPEN";
+    case STATUS_CLOSED: return "CLOSED";
+    case STATUS_OPENING: return "OPENING";
+    case STATUS_CLOSING: return "CLOSING";
+    case STATUS_STOPPED: return "STOPPED";
+    case STATUS_OBSTRUCTED: return "OBSTRUCTED";
+    default: return "UNKNOWN";
+  }
+}
+
+GateStatusCode gateStatusCode(const char* status) {
+  if (strcmp(status, "OPEN") == 0) return STATUS_OPEN;
+  if (strcmp(status, "CLOSED") == 0) return STATUS_CLOSED;
+  if (strcmp(status, "OPENING") == 0) return STATUS_OPENING;
+  if (strcmp(status, "CLOSING") == 0) return STATUS_CLOSING;
+  if (strcmp(status, "STOPPED") == 0) return STATUS_STOPPED;
+  if (strcmp(status, "OBSTRUCTED") == 0) return STATUS_OBSTRUCTED;
+  return STATUS_UNKNOWN;
+}
+
+const char* ackResultName(AckResult result) {
+  switch (result) {
+    case ACK_EXECUTED: return "EXECUTED";
+    case ACK_MERGED: return "MERGED";
+    case ACK_DUPLICATE: return "DUPLICATE";
+    case ACK_REJECTED: return "REJECTED";
+    case ACK_DROPPED: return "DROPPED";
+    default: return "UNKNOWN";
+  }
+}
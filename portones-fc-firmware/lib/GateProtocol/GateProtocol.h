@@ -0,0 +1,307 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Protocolo binario compacto, paralelo al JSON, para los topics *.bin.
+//
+// Comando (8 bytes, portones/gate/command.bin):
+//   [0] versión (4 bits altos) | tipo FRAME_COMMAND (4 bits bajos)
+//   [1] gateId
+//   [2] acción (GateAction)
+//   [3] flags: bits 0-1 prioridad (CommandPriority), bit 2
+//       COMMAND_FLAG_SENT_AT, el resto reservado, 0
+//   [4..7] secuencia uint32 little-endian
+//   [8..9] solo con ACTION_HOLD_OPEN (trama de 10 bytes): segundos que el
+//          portón se mantiene abierto, uint16 little-endian
+//   [+8] solo con COMMAND_FLAG_SENT_AT, al final: hora de envío en la API
+//        (epoch µs) uint64 little-endian
+//
+// Estado (4 bytes, portones/gate/status.bin):
+//   [0] versión | tipo FRAME_STATUS
+//   [1] gateId
+//   [2] estado (GateStatusCode)
+//   [3] flags (reservado, 0)
+// Un lote de estados son N tramas de estado concatenadas en un solo mensaje.
+//
+// Ack (12 bytes, .../ack.bin):
+//   [0] versión | tipo FRAME_ACK
+//   [1] gateId
+//   [2] resultado (AckResult)
+//   [3] flags: ACK_FLAG_ONE_WAY, el resto reservado, 0
+//   [4..7] commandId uint32 little-endian (la secuencia del comando binario)
+//   [8..11] latencia recepción -> actuación en µs, uint32 little-endian
+//   [12..15] solo con ACK_FLAG_ONE_WAY (trama de 16 bytes): envío en la API
+//            -> actuación en µs, int32 little-endian, con la hora SNTP
+//
+// Delta de allowlist QR (.../qr/delta), de longitud variable:
+//   [0] versión | tipo FRAME_QR_DELTA
+//   [1] flags (QR_DELTA_RESET: vaciar la lista antes de aplicar)
+//   [2..3] número de operaciones uint16 little-endian
+//   [4..7] versión base uint32: la delta solo aplica sobre esa versión
+//   [8..11] versión nueva uint32
+//   [12..15] emitido en (epoch s) uint32, la referencia de hora del controlador
+//   N x 17 bytes de operación:
+//     [0] QrDeltaKind  [1..4] código  [5..8] válido desde (epoch s)
+//     [9..12] expira (epoch s)  [13..14] usos  [15..16] usos máximos
+//   [fin-32..fin] HMAC-SHA256 de todo lo anterior con la clave del controlador
+//
+// Reenvío del diario (.../journal.bin), de longitud variable:
+//   [0] versión | tipo FRAME_JOURNAL
+//   [1] flags (reservado, 0)
+//   [2..3] número de registros uint16 little-endian
+//   [4..7] id del diario uint32: cambia si el diario se reinicia desde cero
+//   [8..11] primera secuencia que cubre el mensaje uint32
+//   [12..15] última secuencia que cubre uint32, incluidos los huecos sin
+//            registro; es lo que la API confirma
+//   N x 32 bytes de registro, tal cual están en flash:
+//     [0..3] secuencia uint32  [4..27] evento  [28..31] CRC32 de [0..27]
+//   Evento (24 bytes):
+//     [0] JournalEventType  [1] gateId  [2] estado o QrDecision
+//     [3] flags (JOURNAL_FLAG_*)  [4..7] en (epoch s)  [8..11] código QR
+//     [12..13] usos  [14] AccessSource (accesos)  [15..23] reservado, 0
+//
+// Estado deseado (.../desired.bin, retenido), de longitud variable:
+//   [0] versión | tipo FRAME_DESIRED
+//   [1] número de portones
+//   [2..3] reservado, 0
+//   [4..7] emitido en (epoch s) uint32
+//   N x 6 bytes: [0] gateId  [1] estado (GateStatusCode)
+//                [2..5] vigente hasta (epoch s) uint32, 0 = sin límite
+//
+// Configuración (.../config.bin), de longitud variable:
+//   [0] versión | tipo FRAME_CONFIG
+//   [1] flags (reservado, 0)
+//   [2..3] número de campos uint16 little-endian
+//   [4..7] versión de configuración uint32: solo aplica si supera la actual
+//   [8..11] emitido en (epoch s) uint32
+//   N campos: [0] ConfigKey  [1] longitud L  [2..2+L] valor en texto
+//   [fin-32..fin] HMAC-SHA256 de todo lo anterior con la clave de configuración
+//
+// Oferta de actualización OTA (.../ota.bin, retenida), de longitud variable:
+//   [0] versión | tipo FRAME_OTA
+//   [1] formato de la imagen (OtaFormat de lib/OtaImage)
+//   [2] longitud de la URL
+//   [3] reservado, 0
+//   [4..7] tamaño de la imagen final uint32
+//   [8..11] emitido en (epoch s) uint32
+//   [12..43] digest de la imagen final: el SHA-256 que ESP-IDF agrega al
+//            final de la app (todo menos esos 32 bytes); el mismo que
+//            esp_partition_get_sha256() da para la imagen en ejecución
+//   [44..75] digest de la imagen base de una delta (ceros si no es delta)
+//   [76..91] versión de firmware, texto rellenado con ceros
+//   [92..] URL http(s) de la imagen
+//   [fin-32..fin] HMAC-SHA256 de todo lo anterior con la clave de configuración
+//
+// Los códigos deben coincidir con portones-fc-api/src/protocol/binary.ts.
+
+const uint8_t PROTOCOL_VERSION = 1;
+const size_t COMMAND_FRAME_SIZE = 8;
+const size_t COMMAND_HOLD_FRAME_SIZE = 10;
+const size_t STATUS_FRAME_SIZE = 4;
+const size_t COMMAND_SENT_AT_SIZE = 8;
+const size_t ACK_FRAME_SIZE = 12;
+const size_t ACK_ONE_WAY_FRAME_SIZE = 16;
+const uint8_t ACK_FLAG_ONE_WAY = 0x01;
+const size_t QR_DELTA_HEADER_SIZE = 16;
+const size_t QR_DELTA_OP_SIZE = 17;
+const size_t QR_DELTA_MAC_SIZE = 32;
+const uint8_t QR_DELTA_RESET = 0x01;
+// Operaciones por delta que caben en el buffer MQTT (igual que mqtt.ts); las
+// deltas más grandes llegan por la partición "inbox"
+const size_t QR_DELTA_MAX_OPS = 48;
+const size_t JOURNAL_FRAME_HEADER_SIZE = 16;
+const size_t JOURNAL_EVENT_SIZE = 24;
+const uint8_t JOURNAL_FLAG_CLOCK_KNOWN = 0x01;
+const uint8_t JOURNAL_FLAG_OFFLINE = 0x02;  // ocurrió sin enlace
+const size_t DESIRED_HEADER_SIZE = 8;
+const size_t DESIRED_ENTRY_SIZE = 6;
+const size_t CONFIG_HEADER_SIZE = 12;
+const size_t CONFIG_MAC_SIZE = 32;
+const size_t OTA_OFFER_HEADER_SIZE = 92;
+const size_t OTA_OFFER_MAC_SIZE = 32;
+const size_t OTA_VERSION_SIZE = 16;
+
+enum FrameType : uint8_t {
+  FRAME_COMMAND = 1,
+  FRAME_STATUS = 2,
+  FRAME_ACK = 3,
+  FRAME_QR_DELTA = 4,
+  FRAME_JOURNAL = 5,
+  FRAME_DESIRED = 6,
+  FRAME_CONFIG = 7,
+  FRAME_OTA = 8,
+};
+
+enum GateAction : uint8_t {
+  ACTION_NONE = 0,
+  ACTION_OPEN = 1,
+  ACTION_CLOSE = 2,
+  ACTION_STOP = 3,       // detiene la trayectoria en curso donde esté
+  ACTION_HOLD_OPEN = 4,  // abre y mantiene abierto N segundos
+  ACTION_EMERGENCY = 5,  // de todo el controlador: abre todos y no cierra
+  ACTION_RESUME = 6,     // de todo el controlador: termina la emergencia
+  ACTION_COUNT
+};
+
+// Orden en que la tarea de portones atiende los comandos pendientes. Sin
+// prioridad, un comando es de visitante: quien no la declara no pasa delante
+// de nadie. ACTION_EMERGENCY es siempre PRIORITY_EMERGENCY.
+enum CommandPriority : uint8_t {
+  PRIORITY_VISITOR = 0,
+  PRIORITY_RESIDENT = 1,
+  PRIORITY_ADMIN = 2,
+  PRIORITY_EMERGENCY = 3,
+  PRIORITY_COUNT
+};
+const uint8_t COMMAND_PRIORITY_MASK = 0x03;  // en los flags de la trama de comando
+const uint8_t COMMAND_FLAG_SENT_AT = 0x04;   // la trama termina en la hora de envío
+// Latencia de un sentido desconocida: sin hora en el comando o en el controlador
+const int32_t ONE_WAY_UNKNOWN = INT32_MIN;
+
+enum GateStatusCode : uint8_t {
+  STATUS_UNKNOWN = 0,
+  STATUS_OPEN = 1,
+  STATUS_CLOSED = 2,
+  STATUS_OPENING = 3,
+  STATUS_CLOSING = 4,
+  STATUS_STOPPED = 5,     // detenido a mitad de recorrido
+  STATUS_OBSTRUCTED = 6,  // detenido sin potencia por un atasco
+};
+
+enum AckResult : uint8_t {
+  ACK_EXECUTED = 1,   // el comando movió el portón
+  ACK_MERGED = 2,     // fundido con uno anterior o extendió el temporizador
+  ACK_DUPLICATE = 3,  // commandId ya visto: reentrega idempotente
+  ACK_REJECTED = 4,   // portón o acción inválidos
+  ACK_DROPPED = 5,    // cola llena, la API debe reintentar
+};
+
+enum QrDeltaKind : uint8_t {
+  QR_OP_UPSERT = 1,
+  QR_OP_REMOVE = 2,
+};
+
+struct QrDeltaHeader {
+  uint8_t flags;
+  uint16_t count;
+  uint32_t baseVersion;
+  uint32_t newVersion;
+  uint32_t issuedAt;
+};
+
+struct QrDeltaOp {
+  QrDeltaKind kind;
+  uint32_t code;
+  uint32_t validFrom;
+  uint32_t expiresAt;
+  uint16_t uses;
+  uint16_t maxUses;
+};
+
+enum JournalEventType : uint8_t {
+  JOURNAL_STATUS = 1,  // value: GateStatusCode
+  JOURNAL_ACCESS = 2,  // value: QrDecision
+};
+
+// De dónde vino un acceso local. El código es el del QR (o tecleado) o el
+// número de la tarjeta; un botón no lleva código.
+enum AccessSource : uint8_t {
+  ACCESS_QR = 0,
+  ACCESS_KEYPAD = 1,
+  ACCESS_CARD = 2,
+  ACCESS_BUTTON = 3,
+};
+
+struct JournalEvent {
+  JournalEventType type;
+  uint8_t gateId;
+  uint8_t value;
+  uint8_t flags;
+  uint32_t at;
+  uint32_t code;
+  uint16_t uses;
+  AccessSource source;
+};
+
+struct DesiredHeader {
+  uint8_t count;
+  uint32_t issuedAt;
+};
+
+struct DesiredEntry {
+  uint8_t gateId;
+  GateStatusCode status;
+  uint32_t until;
+};
+
+struct ConfigHeader {
+  uint16_t count;
+  uint32_t version;
+  uint32_t issuedAt;
+};
+
+struct ConfigFieldValue {
+  uint8_t key;  // ConfigKey de DeviceConfig
+  const uint8_t* value;
+  uint8_t length;
+};
+
+struct OtaOffer {
+  uint8_t format;
+  uint32_t imageSize;
+  uint32_t issuedAt;
+  uint8_t sha256[32];
+  uint8_t baseSha256[32];
+  char version[OTA_VERSION_SIZE + 1];
+  char url[256];
+};
+
+struct CommandFrame {
+  uint8_t gateId;
+  GateAction action;
+  uint8_t flags;
+  uint32_t sequence;
+  uint16_t holdS;     // 0 salvo en ACTION_HOLD_OPEN
+  int64_t sentAtUs;   // 0 sin COMMAND_FLAG_SENT_AT
+};
+
+// Devuelve false si el tamaño, la versión o el tipo no coinciden
+bool decodeCommandFrame(const uint8_t* data, size_t length, CommandFrame& out);
+size_t encodeStatusFrame(uint8_t gateId, GateStatusCode status, uint8_t* out, size_t outSize);
+// Con oneWayUs conocido la trama es de 16 bytes: solo lo está si el comando
+// traía su hora de envío, y una API que la manda entiende la trama larga
+size_t encodeAckFrame(uint8_t gateId, AckResult result, uint32_t commandId, uint32_t latencyUs, int32_t oneWayUs,
+                      uint8_t* out, size_t outSize);
+// Valida cabecera y longitud total (incluido el HMAC, que no verifica)
+bool decodeQrDeltaHeader(const uint8_t* data, size_t length, QrDeltaHeader& out);
+// index < header.count; data es el mensaje completo
+QrDeltaOp decodeQrDeltaOp(const uint8_t* data, size_t index);
+// op apunta a los QR_DELTA_OP_SIZE bytes de una operación
+QrDeltaOp decodeQrDeltaOpAt(const uint8_t* op);
+// Valida cabecera y longitud total
+bool decodeDesiredHeader(const uint8_t* data, size_t length, DesiredHeader& out);
+// index < header.count; data es el mensaje completo
+DesiredEntry decodeDesiredEntry(const uint8_t* data, size_t index);
+// Valida cabecera y que los campos cubran exactamente el mensaje antes del HMAC
+bool decodeConfigHeader(const uint8_t* data, size_t length, ConfigHeader& out);
+// Lee el campo en offset (CONFIG_HEADER_SIZE para el primero) y devuelve el
+// offset del siguiente; solo sobre un mensaje ya validado
+size_t decodeConfigField(const uint8_t* data, size_t offset, ConfigFieldValue& out);
+// Valida la longitud total (incluido el HMAC, que no verifica) y copia la
+// URL y la versión terminadas
+bool decodeOtaOffer(const uint8_t* data, size_t length, OtaOffer& out);
+// Escribe JOURNAL_EVENT_SIZE bytes en out
+void encodeJournalEvent(const JournalEvent& event, uint8_t* out);
+size_t encodeJournalFrameHeader(uint16_t count, uint32_t journalId, uint32_t fromSeq, uint32_t throughSeq,
+                                uint8_t* out, size_t outSize);
+
+const char* gateActionName(GateAction action);
+// Acción del JSON por su nombre; ACTION_NONE si no es ninguna
+GateAction gateActionCode(const char* name);
+const char* gateStatusName(GateStatusCode status);
+const char* ackResultName(AckResult result);
+const char* commandPriorityName(CommandPriority priority);
+// Prioridad del JSON por su nombre; PRIORITY_VISITOR si no es ninguna
+CommandPriority commandPriorityCode(const char* name);
+GateStatusCode gateStatusCode(const char* status);
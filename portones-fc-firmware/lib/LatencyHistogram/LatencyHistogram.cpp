@@ -0,0 +1,53 @@
+#include "LatencyHistogram.h"
+
+#include <string.h>
+
+size_t LatencyHistogram::bucketFor(uint32_t value) {
+  if (value < SUB_COUNT) return value;
+  uint8_t msb = 31 - __builtin_clz(value);
+  if (msb >= MAX_BITS) return BUCKET_COUNT - 1;
+  uint8_t shift = msb - SUB_BITS;
+  // Octava (shift + 1) y los SUB_BITS bits que siguen al más significativo
+  return (size_t)(shift + 1) * SUB_COUNT + ((value >> shift) & (SUB_COUNT - 1));
+}
+
+uint32_t LatencyHistogram::bucketUpperBound(size_t bucket) {
+  if (bucket < SUB_COUNT) return bucket;
+  uint8_t shift = bucket / SUB_COUNT - 1;
+  uint32_t sub = bucket % SUB_COUNT;
+  return ((SUB_COUNT + sub + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(uint32_t valueUs) {
+  buckets_[bucketFor(valueUs)]++;
+  count_++;
+  sum_ += valueUs;
+  if (valueUs < min_) min_ = valueUs;
+  if (valueUs > max_) max_ = valueUs;
+}
+
+void LatencyHistogram::reset() {
+  memset(buckets_, 0, sizeof(buckets_));
+  count_ = 0;
+  min_ = UINT32_MAX;
+  max_ = 0;
+  sum_ = 0;
+}
+
+uint32_t LatencyHistogram::percentile(uint8_t pct) const {
+  if (count_ == 0) return 0;
+  if (pct > 100) pct = 100;
+  // Rango del valor buscado, redondeado hacia arriba y al menos 1
+  uint32_t rank = (uint32_t)(((uint64_t)count_ * pct + 99) / 100);
+  if (rank == 0) rank = 1;
+  uint32_t seen = 0;
+  for (size_t i = 0; i < BUCKET_COUNT; i++) {
+    seen += buckets_[i];
+    if (seen >= rank) {
+      if (i == BUCKET_COUNT - 1) return max_;  // cubeta abierta
+      uint32_t bound = bucketUpperBound(i);
+      return bound < max_ ? bound : max_;
+    }
+  }
+  return max_;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Histograma de latencias al estilo HDR: cubetas lineales dentro de cada
+// potencia de 2, con 8 subcubetas por octava (error relativo <= 12,5 %).
+// record() es O(1), sin heap ni coma flotante, apto para la ruta de comandos.
+// Cubre de 1 µs a ~16,7 s; lo mayor cae en la última cubeta, pero max() es
+// exacto.
+class LatencyHistogram {
+ public:
+  static const uint8_t SUB_BITS = 3;
+  static const uint32_t SUB_COUNT = 1u << SUB_BITS;
+  static const uint8_t MAX_BITS = 24;  // valores < 2^24 µs
+  static const size_t BUCKET_COUNT = (MAX_BITS - SUB_BITS + 1) * SUB_COUNT;
+
+  void record(uint32_t valueUs);
+  void reset();
+
+  uint32_t count() const { return count_; }
+  uint32_t min() const { return count_ ? min_ : 0; }
+  uint32_t max() const { return max_; }
+  uint32_t mean() const { return count_ ? (uint32_t)(sum_ / count_) : 0; }
+  // Límite superior de la cubeta que contiene el percentil (0-100)
+  uint32_t percentile(uint8_t pct) const;
+
+ private:
+  static size_t bucketFor(uint32_t value);
+  static uint32_t bucketUpperBound(size_t bucket);
+
+  uint32_t buckets_[BUCKET_COUNT] = {0};
+  uint32_t count_ = 0;
+  uint32_t min_ = UINT32_MAX;
+  uint32_t max_ = 0;
+  uint64_t sum_ = 0;
+};
@@ -0,0 +1,63 @@
+#include "MotionProfile.h"
+
+#include <math.h>
+
+void Trajectory::start(float from, float to, int64_t startUs, const MotionProfile& profile) {
+  from_ = from;
+  to_ = to;
+  startUs_ = startUs;
+  shape_ = profile.shape;
+
+  float distance = fabsf(to - from);
+  if (distance == 0.0f || profile.maxSpeed <= 0.0f) {
+    shape_ = PROFILE_STEP;
+  }
+
+  switch (shape_) {
+    case PROFILE_TRAPEZOID: {
+      accel_ = profile.accel > 0.0f ? profile.accel : profile.maxSpeed * 4.0f;
+      accelTime_ = profile.maxSpeed / accel_;
+      if (distance < profile.maxSpeed * accelTime_) {
+        // No llega a la velocidad de crucero: perfil triangular
+        accelTime_ = sqrtf(distance / accel_);
+        peakSpeed_ = accel_ * accelTime_;
+        totalTime_ = 2.0f * accelTime_;
+      } else {
+        peakSpeed_ = profile.maxSpeed;
+        totalTime_ = distance / peakSpeed_ + accelTime_;
+      }
+      break;
+    }
+    case PROFILE_SCURVE:
+      // La pendiente máxima de 6u^5 - 15u^4 + 10u^3 es 15/8
+      totalTime_ = 15.0f * distance / (8.0f * profile.maxSpeed);
+      break;
+    default:
+      totalTime_ = 0.0f;
+      break;
+  }
+  durationUs_ = (int64_t)(totalTime_ * 1e6f);
+}
+
+float Trajectory::positionAt(int64_t nowUs) const {
+  if (nowUs < startUs_) return from_;
+  if (nowUs >= startUs_ + durationUs_) return to_;
+
+  float t = (float)(nowUs - startUs_) * 1e-6f;
+  float distance = fabsf(to_ - from_);
+  float s;
+  if (shape_ == PROFILE_TRAPEZOID) {
+    if (t < accelTime_) {
+      s = 0.5f * accel_ * t * t;
+    } else if (t < totalTime_ - accelTime_) {
+      s = 0.5f * accel_ * accelTime_ * accelTime_ + peakSpeed_ * (t - accelTime_);
+    } else {
+      float r = totalTime_ - t;
+      s = distance - 0.5f * accel_ * r * r;
+    }
+  } else {
+    float u = t / totalTime_;
+    s = distance * u * u * u * (10.0f + u * (-15.0f + 6.0f * u));
+  }
+  return to_ >= from_ ? from_ + s : from_ - s;
+}
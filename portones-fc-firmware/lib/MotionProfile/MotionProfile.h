@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+
+// Generador de trayectorias para los servos de los portones. Calcula la
+// posición (grados) en cualquier instante sin estado incremental, así que el
+// tick de control solo evalúa positionAt(ahora).
+
+enum ProfileShape : uint8_t {
+  PROFILE_STEP,       // salto directo al destino (comportamiento original)
+  PROFILE_TRAPEZOID,  // aceleración constante, crucero, desaceleración
+  PROFILE_SCURVE,     // polinomio de quinto grado: aceleración continua
+};
+
+struct MotionProfile {
+  ProfileShape shape;
+  float maxSpeed;  // °/s
+  float accel;     // °/s², solo PROFILE_TRAPEZOID
+};
+
+class Trajectory {
+ public:
+  // startUs puede estar en el futuro: hasta entonces la posición es `from`
+  void start(float from, float to, int64_t startUs, const MotionProfile& profile);
+
+  float positionAt(int64_t nowUs) const;
+  bool finishedAt(int64_t nowUs) const { return nowUs >= startUs_ + durationUs_; }
+  bool startedAt(int64_t nowUs) const { return nowUs >= startUs_; }
+  int64_t startUs() const { return startUs_; }
+  int64_t endUs() const { return startUs_ + durationUs_; }
+  float target() const { return to_; }
+
+ private:
+  float from_ = 0;
+  float to_ = 0;
+  int64_t startUs_ = 0;
+  int64_t durationUs_ = 0;
+  ProfileShape shape_ = PROFILE_STEP;
+  float accel_ = 0;
+  float peakSpeed_ = 0;
+  float accelTime_ = 0;  // s
+  float totalTime_ = 0;  // s
+};
@@ -0,0 +1,100 @@
+#include "OtaImage.h"
+
+#include <string.h>
+
+namespace {
+
+const uint8_t DELTA_MAGIC[4] = {'P', 'F', 'D', '1'};
+const size_t COPY_CHUNK = 256;
+
+uint32_t readUint32(const uint8_t* in) {
+  return (uint32_t)in[0] | ((uint32_t)in[1] << 8) | ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+}  // namespace
+
+void OtaDeltaDecoder::begin(OtaSource* base, uint32_t baseSize, OtaSink* out) {
+  base_ = base;
+  baseSize_ = baseSize;
+  out_ = out;
+  state_ = base && out ? STATE_MAGIC : STATE_ERROR;
+  argsLength_ = 0;
+  argsNeeded_ = sizeof(DELTA_MAGIC);
+  insertLeft_ = 0;
+}
+
+bool OtaDeltaDecoder::runOp() {
+  if (op_ == OTA_DELTA_INSERT) {
+    insertLeft_ = readUint32(args_);
+    state_ = insertLeft_ ? STATE_INSERT : STATE_OP;
+    return true;
+  }
+  // COPY: la base se lee por trozos para no reservar la región entera
+  uint32_t offset = readUint32(args_);
+  uint32_t length = readUint32(args_ + 4);
+  if (offset > baseSize_ || length > baseSize_ - offset) return false;
+  uint8_t chunk[COPY_CHUNK];
+  while (length > 0) {
+    size_t n = length < COPY_CHUNK ? length : COPY_CHUNK;
+    if (!base_->read(offset, chunk, n) || !out_->write(chunk, n)) return false;
+    offset += n;
+    length -= n;
+  }
+  state_ = STATE_OP;
+  return true;
+}
+
+bool OtaDeltaDecoder::write(const uint8_t* data, size_t length) {
+  size_t i = 0;
+  while (i < length) {
+    switch (state_) {
+      case STATE_MAGIC:
+        if (data[i++] != DELTA_MAGIC[argsLength_++]) {
+          state_ = STATE_ERROR;
+          return false;
+        }
+        if (argsLength_ == sizeof(DELTA_MAGIC)) state_ = STATE_OP;
+        break;
+
+      case STATE_OP:
+        op_ = data[i++];
+        if (op_ == OTA_DELTA_END) {
+          state_ = STATE_DONE;
+        } else if (op_ == OTA_DELTA_COPY || op_ == OTA_DELTA_INSERT) {
+          argsLength_ = 0;
+          argsNeeded_ = op_ == OTA_DELTA_COPY ? 8 : 4;
+          state_ = STATE_ARGS;
+        } else {
+          state_ = STATE_ERROR;
+          return false;
+        }
+        break;
+
+      case STATE_ARGS:
+        args_[argsLength_++] = data[i++];
+        if (argsLength_ == argsNeeded_ && !runOp()) {
+          state_ = STATE_ERROR;
+          return false;
+        }
+        break;
+
+      case STATE_INSERT: {
+        size_t n = length - i < insertLeft_ ? length - i : insertLeft_;
+        if (!out_->write(data + i, n)) {
+          state_ = STATE_ERROR;
+          return false;
+        }
+        i += n;
+        insertLeft_ -= n;
+        if (insertLeft_ == 0) state_ = STATE_OP;
+        break;
+      }
+
+      case STATE_DONE:  // nada después de END
+      case STATE_ERROR:
+        state_ = STATE_ERROR;
+        return false;
+    }
+  }
+  return true;
+}
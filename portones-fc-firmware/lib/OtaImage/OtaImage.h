@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Imágenes de actualización por OTA. Una imagen llega cruda, comprimida con
+// zlib o como delta comprimida contra la imagen en ejecución; la etapa de
+// zlib va aparte (ROM del ESP32), aquí solo está el formato de la delta:
+//
+//   "PFD1"
+//   N operaciones:
+//     [0] OTA_DELTA_COPY    [1..4] offset en la base  [5..8] longitud
+//     [0] OTA_DELTA_INSERT  [1..4] longitud, seguida de esos bytes
+//   [0] OTA_DELTA_END
+//
+// Los enteros son uint32 little-endian. La genera tools/ota_image.py; las
+// regiones que no cambian entre versiones viajan como un COPY de 9 bytes.
+
+enum OtaFormat : uint8_t {
+  OTA_FORMAT_RAW = 0,
+  OTA_FORMAT_ZLIB = 1,
+  OTA_FORMAT_DELTA = 2,  // delta, también comprimida con zlib
+};
+
+enum OtaDeltaOp : uint8_t {
+  OTA_DELTA_END = 0,
+  OTA_DELTA_COPY = 1,
+  OTA_DELTA_INSERT = 2,
+};
+
+// Destino de cada etapa: recibe el flujo en trozos de cualquier tamaño
+class OtaSink {
+ public:
+  virtual ~OtaSink() {}
+  virtual bool write(const uint8_t* data, size_t length) = 0;
+};
+
+// De dónde salen los COPY: la imagen en ejecución
+class OtaSource {
+ public:
+  virtual ~OtaSource() {}
+  virtual bool read(uint32_t offset, uint8_t* out, size_t length) = 0;
+};
+
+// Aplica una delta en streaming: no guarda más que la operación en curso
+class OtaDeltaDecoder : public OtaSink {
+ public:
+  void begin(OtaSource* base, uint32_t baseSize, OtaSink* out);
+  // false ante una delta mal formada, un COPY fuera de la base o un error
+  // de lectura o escritura; a partir de ahí todo falla
+  bool write(const uint8_t* data, size_t length) override;
+  bool finished() const { return state_ == STATE_DONE; }
+
+ private:
+  enum State : uint8_t { STATE_MAGIC, STATE_OP, STATE_ARGS, STATE_INSERT, STATE_DONE, STATE_ERROR };
+
+  bool runOp();
+
+  OtaSource* base_ = nullptr;
+  uint32_t baseSize_ = 0;
+  OtaSink* out_ = nullptr;
+  State state_ = STATE_ERROR;
+  uint8_t op_ = 0;
+  uint8_t args_[8];
+  size_t argsLength_ = 0;
+  size_t argsNeeded_ = 0;
+  uint32_t insertLeft_ = 0;
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <SpscQueue.h>
+
+// Cola con LEVELS niveles de prioridad para un productor y un consumidor:
+// una SpscQueue de N por nivel. pop() saca del nivel más alto que tenga
+// algo y, dentro de un nivel, en orden de llegada. Cada nivel tiene su
+// propio cupo, así una ráfaga de un nivel bajo no deja sin lugar a uno
+// alto. Sin locks ni heap, igual que SpscQueue.
+template <typename T, size_t N, size_t LEVELS>
+class PriorityQueue {
+  static_assert(LEVELS >= 1, "al menos un nivel");
+
+ public:
+  // Solo el productor. Devuelve false si el nivel está lleno o no existe.
+  bool push(const T& item, size_t level) {
+    if (level >= LEVELS) return false;
+    return levels_[level].push(item);
+  }
+
+  // Solo el consumidor. Devuelve false si todos los niveles están vacíos.
+  bool pop(T& item) {
+    for (size_t level = LEVELS; level-- > 0;) {
+      if (levels_[level].pop(item)) return true;
+    }
+    return false;
+  }
+
+  size_t size(size_t level) const { return level < LEVELS ? levels_[level].size() : 0; }
+
+  size_t size() const {
+    size_t total = 0;
+    for (size_t level = 0; level < LEVELS; level++) total += levels_[level].size();
+    return total;
+  }
+
+  bool empty() const {
+    for (size_t level = 0; level < LEVELS; level++) {
+      if (!levels_[level].empty()) return false;
+    }
+    return true;
+  }
+
+  static constexpr size_t capacity() { return N * LEVELS; }
+
+ private:
+  SpscQueue<T, N> levels_[LEVELS];
+};
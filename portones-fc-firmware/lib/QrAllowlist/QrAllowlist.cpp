@@ -0,0 +1,89 @@
+#include "QrAllowlist.h"
+
+#include <string.h>
+
+size_t QrAllowlist::lowerBound(uint32_t code) const {
+  size_t lo = 0;
+  size_t hi = count_;
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if (entries_[mid].code < code) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+bool QrAllowlist::upsert(const QrEntry& entry) {
+  size_t i = lowerBound(entry.code);
+  if (i < count_ && entries_[i].code == entry.code) {
+    entries_[i] = entry;
+    return true;
+  }
+  if (count_ >= QR_ALLOWLIST_MAX) return false;
+  memmove(&entries_[i + 1], &entries_[i], (count_ - i) * sizeof(QrEntry));
+  entries_[i] = entry;
+  count_++;
+  return true;
+}
+
+bool QrAllowlist::remove(uint32_t code) {
+  size_t i = lowerBound(code);
+  if (i >= count_ || entries_[i].code != code) return false;
+  memmove(&entries_[i], &entries_[i + 1], (count_ - i - 1) * sizeof(QrEntry));
+  count_--;
+  return true;
+}
+
+const QrEntry* QrAllowlist::find(uint32_t code) const {
+  size_t i = lowerBound(code);
+  return i < count_ && entries_[i].code == code ? &entries_[i] : nullptr;
+}
+
+QrDecision QrAllowlist::check(uint32_t code, uint32_t now, bool clockKnown) const {
+  const QrEntry* entry = find(code);
+  if (!entry) return QR_UNKNOWN;
+  if (clockKnown && now < entry->validFrom) return QR_NOT_YET_VALID;
+  if (now >= entry->expiresAt) return QR_EXPIRED;
+  if (entry->uses >= entry->maxUses) return QR_USED_UP;
+
+  // Misma regla que /gate/open-with-qr: con usos impares el visitante está dentro
+  return entry->uses % 2 == 1 ? QR_GRANTED_EXIT : QR_GRANTED_ENTRY;
+}
+
+void QrAllowlist::countUse(uint32_t code) {
+  size_t i = lowerBound(code);
+  if (i < count_ && entries_[i].code == code) entries_[i].uses++;
+}
+
+QrDecision QrAllowlist::authorize(uint32_t code, uint32_t now, bool clockKnown) {
+  QrDecision decision = check(code, now, clockKnown);
+  if (decision == QR_GRANTED_ENTRY || decision == QR_GRANTED_EXIT) countUse(code);
+  return decision;
+}
+
+bool QrAllowlist::adopt(size_t count) {
+  count_ = 0;
+  if (count > QR_ALLOWLIST_MAX) return false;
+  for (size_t i = 1; i < count; i++) {
+    if (entries_[i - 1].code >= entries_[i].code) return false;
+  }
+  count_ = count;
+  return true;
+}
+
+const char* qrDecisionName(QrDecision decision) {
+  switch (decision) {
+    case QR_GRANTED_ENTRY: return "GRANTED_ENTRY";
+    case QR_GRANTED_EXIT: return "GRANTED_EXIT";
+    case QR_UNKNOWN: return "UNKNOWN";
+    case QR_NOT_YET_VALID: return "NOT_YET_VALID";
+    case QR_EXPIRED: return "EXPIRED";
+    case QR_USED_UP: return "USED_UP";
+    case QR_WRONG_DIRECTION: return "WRONG_DIRECTION";
+    case QR_BUSY: return "BUSY";
+    default: return "?";
+  }
+}
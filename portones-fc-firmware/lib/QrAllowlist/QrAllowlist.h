@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Copia local de los QR activos del controlador, para autorizar sin ir a la
+// nube. Es un arreglo ordenado por código: la búsqueda binaria sobre 16
+// bytes por entrada recorre memoria contigua y, con la capacidad máxima,
+// son 9 comparaciones. Las altas y bajas (deltas de la API, poco
+// frecuentes) desplazan el arreglo con memmove.
+
+const size_t QR_ALLOWLIST_MAX = 512;  // 8 KB, cabe en un blob de NVS
+
+struct QrEntry {
+  uint32_t code;       // shortCode de visitor_qr
+  uint32_t validFrom;  // epoch s
+  uint32_t expiresAt;  // epoch s
+  uint16_t uses;       // impar = el visitante está dentro
+  uint16_t maxUses;
+};
+
+enum QrDecision : uint8_t {
+  QR_GRANTED_ENTRY = 1,
+  QR_GRANTED_EXIT,
+  QR_UNKNOWN,       // no está en la lista (o fue revocado)
+  QR_NOT_YET_VALID,
+  QR_EXPIRED,
+  QR_USED_UP,
+  QR_WRONG_DIRECTION,  // válido, pero le toca el otro sentido (tarjeta o PIN en su lector)
+  QR_BUSY,             // válido, pero la cola del actuador estaba llena: ni abre ni cuenta el uso
+};
+
+class QrAllowlist {
+ public:
+  void clear() { count_ = 0; }
+  // false si la lista está llena
+  bool upsert(const QrEntry& entry);
+  bool remove(uint32_t code);
+  const QrEntry* find(uint32_t code) const;
+
+  // Con clockKnown=false `now` es solo una cota inferior de la hora (la
+  // última referencia recibida): se comprueba la expiración pero no el
+  // inicio de vigencia. Si concede, cuenta el uso.
+  QrDecision authorize(uint32_t code, uint32_t now, bool clockKnown);
+  // Lo mismo sin contar el uso, para quien todavía tiene que validar el
+  // sentido; countUse() lo cuenta después
+  QrDecision check(uint32_t code, uint32_t now, bool clockKnown) const;
+  void countUse(uint32_t code);
+
+  // Carga de la copia persistida directamente sobre el arreglo interno:
+  // se escriben hasta QR_ALLOWLIST_MAX entradas en buffer() y adopt(n) las
+  // valida. Si no están ordenadas o n excede la capacidad, queda vacía.
+  QrEntry* buffer() { return entries_; }
+  bool adopt(size_t count);
+
+  const QrEntry* entries() const { return entries_; }
+  size_t size() const { return count_; }
+  uint32_t version() const { return version_; }
+  void setVersion(uint32_t version) { version_ = version; }
+
+ private:
+  size_t lowerBound(uint32_t code) const;
+
+  QrEntry entries_[QR_ALLOWLIST_MAX];
+  size_t count_ = 0;
+  uint32_t version_ = 0;
+};
+
+const char* qrDecisionName(QrDecision decision);
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// Cola circular sin locks para exactamente un productor y un consumidor.
+// Los índices avanzan libremente y se enmascaran con N - 1, por lo que N
+// debe ser potencia de 2. push() y pop() nunca bloquean ni reservan memoria,
+// y quedan siempre inline: se pueden llamar desde un ISR en IRAM.
+template <typename T, size_t N>
+class SpscQueue {
+  static_assert(N >= 2 && (N & (N - 1)) == 0, "N debe ser potencia de 2");
+
+ public:
+  // Solo el productor. Devuelve false si la cola está llena.
+  inline __attribute__((always_inline)) bool push(const T& item) {
+    uint32_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) >= N) return false;
+    buffer_[tail & (N - 1)] = item;
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Solo el consumidor. Devuelve false si la cola está vacía.
+  inline __attribute__((always_inline)) bool pop(T& item) {
+    uint32_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) return false;
+    item = buffer_[head & (N - 1)];
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  size_t size() const {
+    return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+  }
+
+  bool empty() const { return size() == 0; }
+
+  static constexpr size_t capacity() { return N; }
+
+ private:
+  T buffer_[N];
+  std::atomic<uint32_t> head_{0};
+  std::atomic<uint32_t> tail_{0};
+};
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+
+// Antirrebote de un contacto por silencio: el nivel leído pasa a ser el
+// estable solo cuando lleva quietUs sin flancos. Los flancos los anota quien
+// ve la interrupción (edge); update() lo llama quien puede leer el pin. Sin
+// flancos pendientes update() no cambia nada, así que una lectura espuria
+// entre rebotes no se cuela.
+class SwitchDebounce {
+ public:
+  void reset(bool active) {
+    stable_ = active;
+    settling_ = false;
+  }
+
+  void edge(uint32_t atUs) {
+    lastEdgeUs_ = atUs;
+    settling_ = true;
+  }
+
+  // Devuelve true si cambió el estado estable
+  bool update(bool active, uint32_t nowUs, uint32_t quietUs) {
+    if (!settling_ || nowUs - lastEdgeUs_ < quietUs) return false;
+    settling_ = false;
+    if (active == stable_) return false;
+    stable_ = active;
+    return true;
+  }
+
+  bool active() const { return stable_; }
+  bool settling() const { return settling_; }
+
+ private:
+  bool stable_ = false;
+  bool settling_ = false;
+  uint32_t lastEdgeUs_ = 0;
+};
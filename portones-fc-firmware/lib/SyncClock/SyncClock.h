@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdint.h>
+
+// Hora de pared a partir del reloj local (µs desde el arranque) y muestras
+// de un servidor de hora. Cada muestra fija el ancla (local, epoch); entre
+// muestras se suma lo transcurrido corregido por la deriva estimada del
+// cristal, así que convertir es una multiplicación y no una llamada al
+// sistema. La deriva se promedia (1/4 por muestra) solo entre muestras
+// separadas al menos SYNC_CLOCK_MIN_SPAN_US, para que el jitter de red de
+// dos muestras cercanas no la domine; un error mayor que
+// SYNC_CLOCK_MAX_DRIFT_PPB es un salto de hora, no deriva, y no la toca.
+//
+// Sin locks: quien la comparte entre tareas decide cómo se lee.
+const int64_t SYNC_CLOCK_MIN_SPAN_US = 60LL * 1000000;
+const int64_t SYNC_CLOCK_MAX_DRIFT_PPB = 500000;  // 500 ppm
+
+class SyncClock {
+ public:
+  // Devuelve cuánto se equivocaba la hora estimada en localUs (real -
+  // estimada, µs); 0 en la primera muestra
+  int64_t sync(int64_t localUs, int64_t epochUs) {
+    if (!synced()) {
+      anchor(localUs, epochUs);
+      return 0;
+    }
+    int64_t error = epochUs - toEpochUs(localUs);
+    int64_t span = localUs - anchorLocal_;
+    bool step = error > span / (1000000000 / SYNC_CLOCK_MAX_DRIFT_PPB) ||
+                error < -span / (1000000000 / SYNC_CLOCK_MAX_DRIFT_PPB);
+    if (span >= SYNC_CLOCK_MIN_SPAN_US && !step) {
+      // La que ya se corregía más la que faltó en este tramo
+      int64_t observed = driftPpb_ + error * 1000000000 / span;
+      if (observed > SYNC_CLOCK_MAX_DRIFT_PPB) observed = SYNC_CLOCK_MAX_DRIFT_PPB;
+      if (observed < -SYNC_CLOCK_MAX_DRIFT_PPB) observed = -SYNC_CLOCK_MAX_DRIFT_PPB;
+      driftPpb_ = driftKnown_ ? driftPpb_ + (observed - driftPpb_) / 4 : observed;
+      driftKnown_ = true;
+    }
+    if (step) steps_++;
+    anchor(localUs, epochUs);
+    return error;
+  }
+
+  // Solo con synced()
+  int64_t toEpochUs(int64_t localUs) const {
+    int64_t elapsed = localUs - anchorLocal_;
+    return anchorEpoch_ + elapsed + elapsed * driftPpb_ / 1000000000;
+  }
+
+  bool synced() const { return syncs_ > 0; }
+  uint32_t syncs() const { return syncs_; }
+  uint32_t steps() const { return steps_; }  // muestras tomadas como salto
+  int32_t driftPpb() const { return (int32_t)driftPpb_; }
+  int64_t anchoredAt() const { return anchorLocal_; }  // local de la última muestra
+
+ private:
+  void anchor(int64_t localUs, int64_t epochUs) {
+    anchorLocal_ = localUs;
+    anchorEpoch_ = epochUs;
+    syncs_++;
+  }
+
+  int64_t anchorLocal_ = 0;
+  int64_t anchorEpoch_ = 0;
+  int64_t driftPpb_ = 0;  // positiva: el cristal atrasa
+  bool driftKnown_ = false;
+  uint32_t syncs_ = 0;
+  uint32_t steps_ = 0;
+};
@@ -0,0 +1,76 @@
+#include "Wiegand.h"
+
+namespace {
+
+const WiegandRead NOTHING = {WIEGAND_NONE, 0};
+const WiegandRead INVALID = {WIEGAND_INVALID, 0};
+const uint8_t KEY_ESC = 10;  // '*'
+const uint8_t KEY_ENT = 11;  // '#'
+
+bool evenParity(uint64_t bits) { return (__builtin_popcountll(bits) & 1) == 0; }
+
+// Mitad alta, con su bit de paridad, par; mitad baja impar
+bool cardParity(uint64_t bits, uint8_t count) {
+  uint8_t half = count / 2;
+  uint64_t low = bits & ((1ULL << half) - 1);
+  return evenParity(bits >> half) && !evenParity(low);
+}
+
+}  // namespace
+
+WiegandRead WiegandReader::bit(uint8_t value, uint32_t atUs) {
+  WiegandRead previous = poll(atUs);
+  if (count_ < WIEGAND_MAX_BITS) bits_ = bits_ << 1 | (value & 1);
+  count_++;  // una trama de más de 64 bits se descarta al cerrarla
+  lastBitUs_ = atUs;
+  return previous;
+}
+
+WiegandRead WiegandReader::poll(uint32_t nowUs) {
+  if (count_ == 0 || nowUs - lastBitUs_ < WIEGAND_FRAME_GAP_US) return NOTHING;
+  return finish();
+}
+
+WiegandRead WiegandReader::finish() {
+  uint64_t bits = bits_;
+  uint8_t count = count_;
+  bits_ = 0;
+  count_ = 0;
+  if (digits_ > 0 && lastBitUs_ - lastKeyUs_ >= WIEGAND_KEY_TIMEOUT_US) {
+    code_ = 0;
+    digits_ = 0;
+  }
+
+  switch (count) {
+    case 4:
+      return key(bits & 0x0F);
+    case 8:
+      if (((bits >> 4) ^ bits ^ 0x0F) & 0x0F) return INVALID;
+      return key(bits & 0x0F);
+    case 26:
+    case 34:
+      if (!cardParity(bits, count)) return INVALID;
+      return {WIEGAND_CARD, (uint32_t)((bits >> 1) & ((1ULL << (count - 2)) - 1))};
+    default:
+      return INVALID;
+  }
+}
+
+WiegandRead WiegandReader::key(uint8_t key) {
+  lastKeyUs_ = lastBitUs_;
+  if (key == KEY_ESC || key > KEY_ENT) {
+    code_ = 0;
+    digits_ = 0;
+    return key == KEY_ESC ? NOTHING : INVALID;
+  }
+  if (key == KEY_ENT) {
+    WiegandRead read = {digits_ > 0 ? WIEGAND_PIN : WIEGAND_NONE, code_};
+    code_ = 0;
+    digits_ = 0;
+    return read;
+  }
+  if (digits_ >= WIEGAND_CODE_MAX_DIGITS) return NOTHING;  // lo de más no cuenta
+  code_ = code_ * 10 + key;
+  digits_++;
+  return NOTHING;
+}
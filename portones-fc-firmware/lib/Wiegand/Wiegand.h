@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+
+// Lector Wiegand: tarjetas de 26 o 34 bits (paridad par en la primera
+// mitad, impar en la segunda) y teclados que mandan cada tecla como trama
+// de 4 bits, o de 8 con el nibble alto complementado. Los bits llegan de uno
+// en uno con su instante; una trama termina tras WIEGAND_FRAME_GAP_US sin
+// bits. Las teclas se juntan en un código que '#' envía y '*' borra; a los
+// WIEGAND_KEY_TIMEOUT_US sin teclas se descarta lo tecleado. Los lectores
+// separan los bits unos 2 ms (pulso de 50 us cada ~2 ms): el silencio que
+// cierra la trama es lo que tarda una tarjeta en llegar a abrir.
+const uint32_t WIEGAND_FRAME_GAP_US = 6000;
+const uint32_t WIEGAND_KEY_TIMEOUT_US = 10000000;
+const uint8_t WIEGAND_CODE_MAX_DIGITS = 9;
+const uint8_t WIEGAND_MAX_BITS = 64;
+
+enum WiegandKind : uint8_t {
+  WIEGAND_NONE,     // nada que autorizar todavía
+  WIEGAND_CARD,     // code: facility y número (26 bits) o los 32 bits
+  WIEGAND_PIN,      // code: lo tecleado antes de '#'
+  WIEGAND_INVALID,  // paridad o longitud inválida
+};
+
+struct WiegandRead {
+  WiegandKind kind;
+  uint32_t code;
+};
+
+class WiegandReader {
+ public:
+  // Un bit de D0 (0) o D1 (1). Si la trama anterior ya había vencido, la
+  // cierra primero y devuelve su lectura.
+  WiegandRead bit(uint8_t value, uint32_t atUs);
+  // Cierra la trama en curso si lleva WIEGAND_FRAME_GAP_US sin bits
+  WiegandRead poll(uint32_t nowUs);
+  bool pending() const { return count_ > 0; }
+  uint32_t lastBitUs() const { return lastBitUs_; }
+
+ private:
+  WiegandRead finish();
+  WiegandRead key(uint8_t key);
+
+  uint64_t bits_ = 0;  // el primero recibido queda en el bit más alto
+  uint8_t count_ = 0;
+  uint32_t lastBitUs_ = 0;
+  uint32_t code_ = 0;
+  uint8_t digits_ = 0;
+  uint32_t lastKeyUs_ = 0;
+};
@@ -0,0 +1,298 @@
+#include "gate_control.h"
+
+#include "gate_hal.h"
+
+// Mismo filtrado en compilación que LOG_GATE en main.cpp
+#define LOG_GATE(ev, ...) \
+  do { if (LOG_EVENTS[ev].level <= LOG_LEVEL) halLogGate(ev, __VA_ARGS__); } while (0)
+
+GateRuntime gates[GATE_COUNT] = {};
+DeadlineHeap<GATE_COUNT> gateDeadlines;
+uint32_t coalescedCommands = 0;
+uint32_t extendedOpens = 0;
+int64_t deadlineLatenessMaxUs = 0;
+uint32_t gateObstructions = 0;
+bool emergencyActive = false;
+int64_t lastMoveStart = 0;
+
+ParseResult decodeCommand(const uint8_t* payload, size_t length, bool binary, GateCommand& out) {
+  out.receivedAt = 0;
+  if (binary) {
+    CommandFrame frame;
+    if (!decodeCommandFrame(payload, length, frame)) return PARSE_MALFORMED;
+    out.gateId = frame.gateId;
+    out.action = frame.action;
+    out.priority = (CommandPriority)(frame.flags & COMMAND_PRIORITY_MASK);
+    out.holdS = frame.holdS;
+    out.commandId = frame.sequence;
+    out.sentAtUs = frame.sentAtUs;
+  } else {
+    CommandFields fields;
+    ParseResult result = parseCommand(payload, length, fields);
+    if (result != PARSE_OK) return result;
+    out.gateId = fields.gateId;
+    out.action = gateActionCode(fields.action);
+    out.priority = commandPriorityCode(fields.priority);
+    out.holdS = fields.holdS;
+    out.commandId = fields.commandId;
+    out.sentAtUs = fields.sentAtUs;
+  }
+  if (out.action == ACTION_EMERGENCY) out.priority = PRIORITY_EMERGENCY;
+  return PARSE_OK;
+}
+
+// En emergencia no hay plazo: closeAt lejano también aparta al failsafe
+void armClose(int idx, int64_t now, uint32_t delayMs) {
+  gates[idx].openTimer = now;
+  if (emergencyActive) {
+    gates[idx].closeAt = INT64_MAX;
+    return;
+  }
+  gates[idx].closeAt = now + msToUs(delayMs);
+  gateDeadlines.schedule(idx, gates[idx].closeAt);
+}
+
+AckResult openGate(int idx, const GateCommand& cmd, int64_t now) {
+  GateRuntime& gate = gates[idx];
+  if (gate.state == IDLE || gate.state == CLOSING || gate.state == STOPPED || gate.state == OBSTRUCTED) {
+    // Desde CLOSING, STOPPED u OBSTRUCTED la trayectoria arranca desde la
+    // posición actual
+    LOG_GATE(EV_GATE_OPENING, cmd.gateId);
+    gateDeadlines.cancel(idx);
+    startMotion(idx, true, now);
+    gate.state = OPENING;
+    publishStatus(cmd.gateId, STATUS_OPENING);
+    return ACK_EXECUTED;
+  }
+  if (gate.state == OPENING) {
+    coalescedCommands++;
+    return ACK_MERGED;
+  }
+
+  // Ya abierto: la ráfaga dentro de la ventana no genera trabajo extra, y
+  // un HOLD_OPEN vigente o una emergencia no se acortan
+  if (OPEN_REPEAT_POLICY == REPEAT_IGNORE || gate.holdMs > 0 || emergencyActive ||
+      now - gate.openTimer < msToUs(COALESCE_WINDOW_MS)) {
+    coalescedCommands++;
+    return ACK_MERGED;
+  }
+
+  const GateConfig& config = GATES[idx];
+  int64_t latestArm = gate.openSince + msToUs(config.maxOpenMs - config.openMs);
+  gate.openTimer = now > latestArm ? latestArm : now;
+  gate.closeAt = gate.openTimer + msToUs(config.openMs);
+  gateDeadlines.schedule(idx, gate.closeAt);
+  extendedOpens++;
+  return ACK_MERGED;
+}
+
+void beginClose(int idx, int64_t now) {
+  gateDeadlines.cancel(idx);
+  gates[idx].holdMs = 0;
+  startMotion(idx, false, now);
+  gates[idx].state = CLOSING;
+  publishStatus(idx + 1, STATUS_CLOSING);
+}
+
+AckResult closeGate(int idx, const GateCommand& cmd, int64_t now) {
+  GateState state = gates[idx].state;
+  if (state == IDLE || state == CLOSING) {
+    coalescedCommands++;
+    return ACK_MERGED;
+  }
+  // Desde OPENING invierte la trayectoria sin esperar a que llegue arriba
+  LOG_GATE(EV_GATE_CLOSE_COMMAND, cmd.gateId);
+  beginClose(idx, now);
+  return ACK_EXECUTED;
+}
+
+AckResult stopGate(int idx, const GateCommand& cmd, int64_t now) {
+  GateRuntime& gate = gates[idx];
+  if (gate.state != OPENING && gate.state != CLOSING) return ACK_MERGED;
+  const GateConfig& config = GATES[idx];
+  float position = gate.trajectory.positionAt(now);
+  gate.trajectory.start(position, position, now, config.motion);
+  writeServo(idx, position);
+  gate.state = STOPPED;
+  gate.holdMs = 0;
+  armClose(idx, now, config.openMs);
+  LOG_GATE(EV_GATE_STOPPED, cmd.gateId, (int32_t)position);
+  publishStatus(cmd.gateId, STATUS_STOPPED);
+  return ACK_EXECUTED;
+}
+
+AckResult holdGateOpen(int idx, const GateCommand& cmd, int64_t now) {
+  if (cmd.holdS == 0 || cmd.holdS > HOLD_OPEN_MAX_S) return ACK_REJECTED;
+  GateRuntime& gate = gates[idx];
+  gate.holdMs = cmd.holdS * 1000;
+  LOG_GATE(EV_GATE_HOLD_OPEN, cmd.gateId, (int32_t)cmd.holdS);
+  // Si aún no está arriba, el plazo se arma al llegar (updateMotion)
+  if (gate.state != OPEN) return openGate(idx, cmd, now);
+  armClose(idx, now, gate.holdMs);
+  return ACK_EXECUTED;
+}
+
+// Un atasco no se insiste solo: sin pulso (el motor deja de empujar), la
+// trayectoria congelada donde iba y sin plazo de cierre, hasta otro comando
+void obstructGate(int idx, int64_t now, LogEvent event, int32_t detail) {
+  GateRuntime& gate = gates[idx];
+  float position = gate.trajectory.positionAt(now);
+  gate.trajectory.start(position, position, now, GATES[idx].motion);
+  gateDeadlines.cancel(idx);
+  gate.holdMs = 0;
+  gate.overCurrentSince = 0;
+  gate.servoDuty = 0;  // el próximo writeServo vuelve a dar pulso
+  halServoRelease(idx);
+  gate.state = OBSTRUCTED;
+  gateObstructions++;
+  LOG_GATE(event, idx + 1, (int32_t)position, detail);
+  publishStatus(idx + 1, STATUS_OBSTRUCTED);
+}
+
+// Todos a la vez: el pico de corriente de arrancar juntos se acepta. Un
+// portón atascado también se intenta; si sigue trabado vuelve a OBSTRUCTED.
+AckResult emergencyOpenAll(const GateCommand& cmd, int64_t now) {
+  bool wasActive = emergencyActive;
+  emergencyActive = true;
+  halRememberEmergency(true);
+  forEachGate([&](int i) {
+    GateRuntime& gate = gates[i];
+    gateDeadlines.cancel(i);
+    gate.holdMs = 0;
+    gate.closeAt = INT64_MAX;
+    if (gate.state == OPEN) return;
+    startMotion(i, true, now, false);
+    gate.state = OPENING;
+    publishStatus(i + 1, STATUS_OPENING);
+  });
+  if (!wasActive) LOG_GATE(EV_EMERGENCY_OPEN, 0, cmd.priority);
+  return wasActive ? ACK_MERGED : ACK_EXECUTED;
+}
+
+AckResult resumeFromEmergency(const GateCommand& cmd, int64_t now) {
+  if (cmd.priority < PRIORITY_ADMIN) return ACK_REJECTED;
+  if (!emergencyActive) return ACK_MERGED;
+  emergencyActive = false;
+  halRememberEmergency(false);
+  forEachGate([&](int i) {
+    if (gates[i].state == OPEN || gates[i].state == STOPPED) armClose(i, now, GATES[i].openMs);
+  });
+  LOG_GATE(EV_EMERGENCY_RESUME, 0, cmd.priority);
+  return ACK_EXECUTED;
+}
+
+typedef AckResult (*CommandHandler)(int idx, const GateCommand& cmd, int64_t now);
+// Indexada por GateAction; las acciones de todo el controlador van aparte
+const CommandHandler COMMAND_HANDLERS[ACTION_COUNT] = {nullptr, openGate, closeGate, stopGate, holdGateOpen,
+                                                       nullptr, nullptr};
+
+AckResult processCommand(const GateCommand& cmd) {
+  int64_t now = halNowUs();
+  if (cmd.action == ACTION_EMERGENCY) return emergencyOpenAll(cmd, now);
+  if (cmd.action == ACTION_RESUME) return resumeFromEmergency(cmd, now);
+  int idx = cmd.gateId - 1; // convertimos a índice 0-based
+  if (idx < 0 || idx >= GATE_COUNT) return ACK_REJECTED;
+  if (cmd.action >= ACTION_COUNT || !COMMAND_HANDLERS[cmd.action]) return ACK_REJECTED;
+  if (emergencyActive && cmd.priority < PRIORITY_EMERGENCY &&
+      (cmd.action == ACTION_CLOSE || cmd.action == ACTION_STOP)) {
+    return ACK_REJECTED;
+  }
+  return COMMAND_HANDLERS[cmd.action](idx, cmd, now);
+}
+
+void updateGates() {
+  int64_t now = halNowUs();
+  uint8_t idx;
+  int64_t deadline;
+  while (gateDeadlines.popExpired(now, idx, deadline)) {
+    if (now - deadline > deadlineLatenessMaxUs) deadlineLatenessMaxUs = now - deadline;
+    if (gates[idx].state != OPEN && gates[idx].state != STOPPED) continue;
+
+    LOG_GATE(EV_GATE_AUTO_CLOSE, idx + 1);
+    beginClose(idx, now);
+  }
+}
+
+void noteFeedback(int idx, uint8_t limits, uint16_t currentMa, int64_t now) {
+  GateRuntime& gate = gates[idx];
+  gate.limits = limits;
+  gate.currentMa = currentMa;
+  const GateSensors& sensors = GATES[idx].sensors;
+  if (sensors.currentChannel == GATE_NO_SENSOR || (gate.state != OPENING && gate.state != CLOSING)) return;
+  // Antes de arrancar (escalonado) y durante el pico de arranque no cuenta
+  if (now - gate.trajectory.startUs() < msToUs(STALL_INRUSH_MS) || currentMa < sensors.stallMa) {
+    gate.overCurrentSince = 0;
+    return;
+  }
+  if (gate.overCurrentSince == 0) gate.overCurrentSince = now;
+  if (now - gate.overCurrentSince >= msToUs(STALL_CURRENT_MS)) obstructGate(idx, now, EV_GATE_OBSTRUCTED, currentMa);
+}
+
+// Ángulo -> ancho de pulso -> duty de LEDC; solo escribe si cambia
+uint32_t servoDutyFor(float angle) {
+  if (angle < 0) angle = 0;
+  if (angle > 180) angle = 180;
+  uint32_t pulseUs = SERVO_MIN_US + (uint32_t)(angle * (SERVO_MAX_US - SERVO_MIN_US) / 180.0f);
+  return (pulseUs * ((1UL << SERVO_PWM_BITS) - 1)) / SERVO_PWM_PERIOD_US;
+}
+
+void writeServo(int idx, float angle) {
+  uint32_t duty = servoDutyFor(angle);
+  if (duty == gates[idx].servoDuty) return;
+  gates[idx].servoDuty = duty;
+  halServoWrite(idx, duty);
+}
+
+void startMotion(int idx, bool open, int64_t now, bool staggered) {
+  const GateConfig& config = GATES[idx];
+  float from = gates[idx].trajectory.positionAt(now);
+  int64_t start = lastMoveStart + msToUs(MOTION_STAGGER_MS);
+  if (start < now || !staggered) start = now;
+  if (start > lastMoveStart) lastMoveStart = start;
+  gates[idx].trajectory.start(from, open ? config.openAngle : config.closedAngle, start, config.motion);
+  gates[idx].overCurrentSince = 0;
+  halRememberTarget(idx, open);
+  halMotionTimer(true);
+}
+
+// Desplegado por portón: el índice y su GATES[] son constantes
+void updateMotion(int64_t now) {
+  bool moving = false;
+  forEachGate([&](int i) {
+    GateRuntime& gate = gates[i];
+    if (gate.state != OPENING && gate.state != CLOSING) return;
+
+    writeServo(i, gate.trajectory.positionAt(now));
+    if (!gate.trajectory.finishedAt(now)) {
+      moving = true;
+      return;
+    }
+
+    // Con final de carrera, llegar es que el contacto lo confirme
+    const GateSensors& sensors = GATES[i].sensors;
+    bool opening = gate.state == OPENING;
+    uint8_t limitPin = opening ? sensors.openSwitchPin : sensors.closedSwitchPin;
+    if (limitPin != GATE_NO_SENSOR && !(gate.limits & (opening ? LIMIT_OPEN : LIMIT_CLOSED))) {
+      int64_t waited = now - gate.trajectory.endUs();
+      if (waited >= msToUs(LIMIT_CONFIRM_MS)) {
+        obstructGate(i, now, EV_GATE_LIMIT_MISSING, (int32_t)(waited / 1000));
+      } else {
+        moving = true;
+      }
+      return;
+    }
+
+    int gateId = i + 1;
+    if (opening) {
+      gate.state = OPEN;
+      gate.openSince = now;
+      armClose(i, now, gate.holdMs > 0 ? gate.holdMs : GATES[i].openMs);
+      publishStatus(gateId, STATUS_OPEN);
+    } else {
+      gate.state = IDLE;
+      publishStatus(gateId, STATUS_CLOSED);
+    }
+  });
+
+  if (!moving) halMotionTimer(false);
+}
@@ -1,144 +1,3495 @@
 #include <Arduino.h>
 #include <WiFi.h>
-#include <PubSubClient.h>
-#include <ESP32Servo.h>
-#include <ArduinoJson.h>
 #include <WiFiClientSecure.h>
+#include <PubSubClient.h>
+#include "tls_client.h"
+#include "certs.h"
+#include "log_events.h"
+#include "gate_config.h"
+#include "gate_hal.h"
+#include "gate_control.h"
+#include <SpscQueue.h>
+#include <PriorityQueue.h>
+#include <SwitchDebounce.h>
+#include <Wiegand.h>
+#include <CommandParser.h>
+#include <GateProtocol.h>
+#include <CommandDedup.h>
+#include <DeadlineHeap.h>
+#include <MotionProfile.h>
+#include <EventLog.h>
+#include <LatencyHistogram.h>
+#include <SyncClock.h>
+#include <QrAllowlist.h>
+#include <EventJournal.h>
+#include <DeviceConfig.h>
+#include <OtaImage.h>
+#include "partition_flash.h"
+#include "ota_update.h"
+#include "mqtt_inbox.h"
+#include <Preferences.h>
+#include <mbedtls/md.h>
+#include <esp_timer.h>
+#include <esp_task_wdt.h>
+#include <esp_system.h>
+#include <esp_pm.h>
+#include <esp_wifi.h>
+#include <freertos/semphr.h>
+#include <driver/adc.h>
+#include <driver/gpio.h>
+#include <esp_sleep.h>
+#include <atomic>
+#include <esp_heap_caps.h>
+#include <lwip/sockets.h>
+#include <esp_sntp.h>
+#include <sys/time.h>
+
+// ==================== MODO DE EJECUCIÓN ====================
+// DUAL_CORE_TASKS=1 separa la red (core 0) del control de portones (core 1).
+// Con 0 todo corre en loop(), pasando igualmente por las colas.
+#ifndef DUAL_CORE_TASKS
+#define DUAL_CORE_TASKS 0
+#endif
+// LOG_MQTT_SINK=1 publica además los eventos WARN/ERROR en {prefijo}/log.
+// Como PubSubClient no es reentrante, entonces el registro lo vacía la tarea
+// de red en lugar de logTask.
+#ifndef LOG_MQTT_SINK
+#define LOG_MQTT_SINK 0
+#endif
+// POWER_SAVE=1 (placas con batería o solar): WiFi en modem-sleep con listen
+// interval largo y light sleep automático mientras ningún portón está fuera
+// de reposo. Ver ENERGÍA.
+#ifndef POWER_SAVE
+#define POWER_SAVE 0
+#endif
+// Se anuncia en el snapshot de estado; el build puede fijarla con -DFIRMWARE_VERSION
+#ifndef FIRMWARE_VERSION
+#define FIRMWARE_VERSION "1.0.0"
+#endif
 
 // ==================== CONFIGURACIÓN DE PINES ====================
-const int NUM_GATES = 4;
-const int SERVO_PINS[NUM_GATES] = {13, 12, 14, 27}; // Pines para Portón 1, 2, 3, 4
-
-// ==================== WIFI & MQTT ====================
-const char* WIFI_SSID = "Wokwi-GUEST";
-const char* WIFI_PASSWORD = "";
-const char* MQTT_BROKER = "9c1124975c2646a1956d1f7c409b5ec7.s1.eu.hivemq.cloud";
-const int MQTT_PORT = 8883;
+// Pines, ángulos, tiempos y perfil de cada portón: ver GATES en gate_config.h
+// Lector QR serie (módulos tipo GM65: una línea ASCII por lectura)
+const int QR_READER_RX_PIN = 16;
+const unsigned long QR_READER_BAUD = 9600;
+
+// ==================== CONFIGURACIÓN ====================
+// Red, broker, credenciales, dirección y claves se leen de NVS (DeviceConfig)
+// y se cambian por consola o por {prefijo}/config.bin sin reflashear. Estos
+// valores solo siembran una placa sin configuración guardada; las
+// credenciales no viven en el código, se pasan con -D al compilar o se
+// cargan al aprovisionar.
+#ifndef DEFAULT_WIFI_SSID
+#define DEFAULT_WIFI_SSID "Wokwi-GUEST"
+#endif
+#ifndef DEFAULT_WIFI_PASSWORD
+#define DEFAULT_WIFI_PASSWORD ""
+#endif
+#ifndef DEFAULT_MQTT_HOST
+#define DEFAULT_MQTT_HOST "9c1124975c2646a1956d1f7c409b5ec7.s1.eu.hivemq.cloud"
+#endif
+#ifndef DEFAULT_MQTT_PORT
+#define DEFAULT_MQTT_PORT "8883"
+#endif
+#ifndef DEFAULT_MQTT_USER
+#define DEFAULT_MQTT_USER ""
+#endif
+#ifndef DEFAULT_MQTT_PASSWORD
+#define DEFAULT_MQTT_PASSWORD ""
+#endif
+#ifndef DEFAULT_COLONIA_ID
+#define DEFAULT_COLONIA_ID "default"
+#endif
+#ifndef DEFAULT_QR_KEY
+#define DEFAULT_QR_KEY "portones-qr-dev-key"  // = QR_ALLOWLIST_KEY de la API
+#endif
+#ifndef DEFAULT_CONFIG_KEY
+#define DEFAULT_CONFIG_KEY "portones-config-dev-key"  // = CONTROLLER_CONFIG_KEY de la API
+#endif
+// Consola de aprovisionamiento por Serial: "config set <campo> <valor>",
+// "config show", "config commit", "config discard"
+const size_t CONSOLE_LINE_MAX = 128;
+
+// ==================== MQTT ====================
 const char* MQTT_TOPIC = "portones/gate/command";
+const char* MQTT_TOPIC_BIN = "portones/gate/command.bin";
+const char* STATUS_TOPIC = "portones/gate/status";
+const char* STATUS_TOPIC_BIN = "portones/gate/status.bin";
+const char* ACK_TOPIC = "portones/gate/ack";
+// QoS de la suscripción a comandos: con 1 el broker reentrega hasta el PUBACK
+const uint8_t COMMAND_QOS = 1;
+// Anuncio retenido de protocolos: la API solo usa command.bin si lo ve aquí
+const char* CAPS_TOPIC = "portones/gate/caps";
+const char* CAPS_PAYLOAD = "{\"protocols\": [\"json\", \"bin1\", \"ack1\"]}";
+// Métricas periódicas en portones/{colonia}/{controlador}/metrics
+const unsigned long METRICS_INTERVAL = 60000;
+// El buffer de PubSubClient (256 bytes por defecto) recibe entero el mensaje
+// más grande que se procesa desde RAM, más la cabecera fija (hasta 5 bytes),
+// el largo del topic (2), el topic y el id de mensaje QoS 1 (2). Una delta QR
+// más grande sigue por mqttInbox, en flash; cualquier otro mensaje que no
+// quepa se descarta entero. Hacia afuera, lo que no cabe sale por
+// publishStream() sin pasar por el buffer.
+const size_t MQTT_TOPIC_MAX = 112;    // todos los topics propios
+const size_t MQTT_COMMAND_MAX = 512;  // JSON de comando: COMMAND_JSON_MAX en mqtt.ts
+const size_t MQTT_CONFIG_VALUE_MAX = sizeof(DeviceConfig::wifiPassword) - 1;  // el campo más largo
+constexpr size_t mqttMax(size_t a, size_t b) {
+  return a > b ? a : b;
+}
+const size_t MQTT_PAYLOAD_MAX =
+    mqttMax(mqttMax(QR_DELTA_HEADER_SIZE + QR_DELTA_MAX_OPS * QR_DELTA_OP_SIZE + QR_DELTA_MAC_SIZE,
+                    CONFIG_HEADER_SIZE + CONFIG_FIELD_COUNT * (2 + MQTT_CONFIG_VALUE_MAX) + CONFIG_MAC_SIZE),
+            mqttMax(mqttMax(MQTT_COMMAND_MAX, OTA_OFFER_HEADER_SIZE + 255 + OTA_OFFER_MAC_SIZE),
+                    DESIRED_HEADER_SIZE + GATE_COUNT * DESIRED_ENTRY_SIZE));
+const uint16_t MQTT_BUFFER_SIZE = MQTT_PAYLOAD_MAX + 5 + 2 + MQTT_TOPIC_MAX + 2;
+const char* INBOX_PARTITION = "inbox";
+// Snapshot retenido de todos los portones en portones/{colonia}/{controlador}/state,
+// al conectar y en cada cambio. El estado deseado llega retenido en
+// .../desired.bin; si tras conectar no hay ninguno, no hay nada que converger.
+const unsigned long DESIRED_STATE_WAIT = 2000;
+
+// ==================== DIRECCIONAMIENTO ====================
+// Jerarquía por placa: portones/{colonia}/{controlador}/gate/{n}/command[.bin]
+// Cada placa se suscribe solo a su rama con comodín, así el broker no reparte
+// a todas las placas los comandos de las demás.
+// La colonia y el controlador vienen de DeviceConfig
+const bool LEGACY_SHARED_TOPIC = true; // sigue escuchando portones/gate/command
+
+// ==================== AUTORIZACIÓN LOCAL QR ====================
+// La API empuja deltas firmadas de la allowlist a {prefijo}/qr/delta; el
+// lector autoriza contra la copia local aunque no haya internet, y los
+// accesos quedan en el diario de eventos. La clave es config.qrKey.
+// Igual que la API: usos pares entran, impares salen
+constexpr int QR_ENTRY_GATE = firstGate(GATE_ENTRY);
+constexpr int QR_EXIT_GATE = firstGate(GATE_EXIT);
+static_assert(QR_ENTRY_GATE && QR_EXIT_GATE, "el lector QR necesita un portón de entrada y uno de salida");
+const unsigned long QR_PERSIST_DELAY = 5000;   // agrupa los trozos de una sincronización completa
+const unsigned long QR_SYNC_MIN_INTERVAL = 10000;
+const size_t QR_CODE_MAX_DIGITS = 9;
+const uint16_t QR_DELTA_BATCH = 16;  // operaciones aplicadas por toma del lock
+
+// ==================== ENTRADAS LOCALES ====================
+// Botón y lector Wiegand por portón (GateInputs en gate_config.h). Los ISR
+// en IRAM dejan cada flanco en inputEvents y despiertan a la tarea de
+// portones, que arma las tramas, autoriza contra la allowlist y abre por
+// processCommand, el mismo camino que un comando MQTT, sin esperar a la red
+// (que puede estar minutos en un handshake). El acceso sigue hacia el diario
+// por accessQueue. El botón abre en el primer flanco; lo que sigue dentro de
+// BUTTON_DEBOUNCE_US es rebote.
+const uint32_t BUTTON_DEBOUNCE_US = 30000;
+const uint32_t ALLOWLIST_LOCK_WAIT_MS = 5;
+
+// ==================== DIARIO DE EVENTOS ====================
+// Los accesos, y los estados que no pudieron publicarse en vivo, se anotan
+// en un diario en flash (partición "journal"). Con enlace se reenvía en
+// lotes a {prefijo}/journal.bin; la API confirma en {prefijo}/journal/ack
+// la secuencia más alta recibida y deduplica por secuencia.
+const char* JOURNAL_PARTITION = "journal";
+const unsigned long JOURNAL_FLUSH_DELAY = 10000;  // sin enlace: tiempo máximo de un lote en RAM
+const size_t JOURNAL_REPLAY_BATCH = 24;           // registros por mensaje: 16 + 24 * 32 bytes
+const int JOURNAL_REPLAY_BATCHES = 4;             // mensajes por tick de red
+const uint32_t JOURNAL_REPLAY_WINDOW = 96;        // registros enviados sin confirmar
+const unsigned long JOURNAL_ACK_TIMEOUT = 5000;   // sin avance: se reenvía desde lo confirmado
+const unsigned long JOURNAL_PERSIST_DELAY = 5000;
+
+// ==================== HORA DE PARED (SNTP) ====================
+// Los registros, estados y acks llevan hora epoch para cruzarlos con la API
+// y access_logs. SNTP corre en segundo plano (lwIP) desde el primer enlace
+// WiFi; cada sincronización ancla wallClock y estima la deriva del cristal,
+// y marcar un evento es una multiplicación, no una llamada a gettimeofday().
+// La hora SNTP no va firmada: solo sirve para trazar. La validez de los QR
+// sigue con la hora de las deltas firmadas (epochNow()).
+#ifndef NTP_SERVER
+#define NTP_SERVER "pool.ntp.org"
+#endif
+const uint32_t SNTP_SYNC_INTERVAL_MS = 15 * 60 * 1000;
+const int64_t CLOCK_STEP_LOG_US = 1000000;  // correcciones mayores se registran como salto
+
+// ==================== ACTUALIZACIÓN OTA ====================
+// La API retiene en {prefijo}/ota.bin una oferta firmada con config.configKey
+// (versión, URL, tamaño y digest). La imagen se descarga por HTTP(S) a la
+// partición app inactiva (app0/app1 en partitions.csv) en trozos acotados
+// por tick: cruda, comprimida con zlib o como delta contra la que corre.
+// Solo empieza, y solo reinicia, con los portones en reposo. La imagen nueva
+// arranca pendiente de verificar y se confirma al quedar consistente con el
+// broker; si no lo logra en OTA_VERIFY_TIMEOUT se vuelve a la anterior.
+const unsigned long OTA_QUIET_MS = 3000;          // portones en reposo antes de empezar o reiniciar
+const unsigned long OTA_STALL_TIMEOUT = 20000;    // sin datos: se corta y se reintenta
+const unsigned long OTA_RETRY_DELAY = 30000;
+const uint8_t OTA_MAX_ATTEMPTS = 3;               // después espera a la oferta del próximo enlace
+const unsigned long OTA_VERIFY_TIMEOUT = 300000;  // para que la imagen nueva quede consistente
+const unsigned long OTA_PROGRESS_INTERVAL = 5000;
+const size_t OTA_READ_CHUNK = 1024;
+const int OTA_READS_PER_TICK = 4;
+const uint32_t OTA_HANDSHAKE_TIMEOUT_S = 10;
+
+// ==================== RECONEXIÓN NO BLOQUEANTE ====================
+// La conexión avanza una fase por iteración de loop() para que updateGates()
+// nunca deje de ejecutarse mientras el enlace está caído.
+// NET_PROVISION: sin red o broker configurados, espera a la consola
+enum NetState { NET_WIFI_START, NET_WIFI_WAIT, NET_TLS_CONNECT, NET_MQTT_CONNECT, NET_READY, NET_BACKOFF, NET_PROVISION };
+const unsigned long WIFI_CONNECT_TIMEOUT = 15000;
+const unsigned long NET_BACKOFF_MIN = 1000;
+const unsigned long NET_BACKOFF_MAX = 60000;
+const uint32_t TLS_HANDSHAKE_TIMEOUT_MS = 5000;  // acota el bloqueo de la fase TLS
+const uint16_t MQTT_SOCKET_TIMEOUT_S = 5;       // acota la espera del CONNACK
+
+// ==================== ENERGÍA ====================
+// La red no sondea a ritmo fijo: entre eventos duerme NET_IDLE_TICK y la
+// despiertan el socket del broker (netWakeTask), un estado o ack del
+// actuador o un plazo. El tick corto queda para cuando hay trabajo en curso
+// (reconexión, reenvío del diario, OTA). Lo que solo se sondea (lector QR,
+// consola) espera en el buffer de su UART a lo sumo NET_IDLE_TICK.
+// Con POWER_SAVE, además:
+//  - modem-sleep con listen interval largo: la radio despierta cada
+//    WIFI_LISTEN_INTERVAL beacons y el AP guarda lo que llegue entretanto;
+//    el keepalive MQTT de partida se alarga para no despertarla solo a
+//    hacer ping (ver SALUD para cómo se ajusta en cada conexión).
+//  - light sleep automático (si el sdkconfig trae tickless idle), salvo con
+//    un portón fuera de reposo: en light sleep el LEDC deja de generar el
+//    pulso del servo.
+const TickType_t NET_IDLE_TICK = pdMS_TO_TICKS(POWER_SAVE ? 250 : 50);
+const uint16_t WIFI_LISTEN_INTERVAL = 3;  // beacons de ~102 ms: hasta ~300 ms de espera en el AP
+const uint16_t MQTT_KEEPALIVE_S = POWER_SAVE ? 60 : 15;
+const int POWER_MAX_FREQ_MHZ = 240;
+const int POWER_MIN_FREQ_MHZ = 80;  // el APB sigue a 80 MHz: LEDC y UART no cambian de ritmo
+// Modelo de consumo para estimatedMa en métricas (mA típicos de la hoja de
+// datos del ESP32 con WiFi asociado). No es una medición: sirve para
+// comparar ajustes; las fracciones de tiempo van aparte en las métricas.
+const uint32_t POWER_BUSY_MA = 60;   // CPU ejecutando tareas
+const uint32_t POWER_IDLE_MA = 25;   // CPU en espera, radio en modem-sleep
+const uint32_t POWER_SLEEP_MA = 3;   // light sleep, con las escuchas de beacon
+
+// ==================== SALUD (LWT Y LATIDO) ====================
+// portones/{colonia}/{controlador}/health, retenido. El CONNECT deja como
+// última voluntad HEALTH_OFFLINE: si el controlador no vuelve a hablar en
+// 1,5 keepalives el broker la publica y la API deja de mandarle comandos.
+// Al conectar y cada HEARTBEAT_INTERVAL se reemplaza por un latido corto
+// (RSSI, peor tick, colas), que además sirve de respaldo cuando el broker
+// tarda en dar por muerta la sesión.
+//
+// El keepalive se fija en el CONNECT, así que se elige en cada conexión:
+// parte de MQTT_KEEPALIVE_S y se divide por dos por cada sesión seguida que
+// duró menos de MQTT_SESSION_STABLE_MS (hasta MQTT_SHORT_SESSIONS_MAX), y
+// con señal débil no pasa de un tercio. En un enlace que se corta, pings
+// más frecuentes destapan antes la sesión medio abierta y mantienen viva la
+// traducción NAT; en uno estable no se gasta radio en pings.
+const char* HEALTH_OFFLINE = "{\"online\": false}";
+const uint8_t HEALTH_WILL_QOS = 1;
+const unsigned long HEARTBEAT_INTERVAL = POWER_SAVE ? 300000 : 60000;
+const uint16_t MQTT_KEEPALIVE_MIN_S = 5;
+const unsigned long MQTT_SESSION_STABLE_MS = 600000;
+const uint8_t MQTT_SHORT_SESSIONS_MAX = 3;
+const int8_t RSSI_WEAK_DBM = -75;
+
+// ==================== WATCHDOG Y ESTADO SEGURO ====================
+// El task watchdog vigila la tarea de red y la de portones (loop() con un
+// solo núcleo): si una no completa un tick en WDT_TIMEOUT_S, pánico y
+// reinicio. El plazo cubre con margen los bloqueos ya acotados (conexión y
+// handshake de la OTA, CONNACK). Antes de eso, gate_failsafe (esp_timer,
+// fuera de ambas tareas) cierra los portones vencidos si la de portones
+// lleva GATE_STALL_TIMEOUT sin completar un tick.
+const uint32_t WDT_TIMEOUT_S = 20;
+const unsigned long GATE_STALL_TIMEOUT = 3000;
+const unsigned long FAILSAFE_PERIOD_MS = 500;
+const uint32_t NET_STALL_WARN_US = 1000000;  // ticks más largos se registran con su etapa
+const uint32_t GATE_STALL_WARN_US = 50000;
+// Reinicios inesperados seguidos a partir de los cuales los portones
+// retomados cierran en cuanto arranca, en lugar de esperar su plazo
+const uint8_t RESTORE_MAX_CRASHES = 2;
+const char* RESET_NAMESPACE = "reset";
+
+// ==================== TAREAS Y COLAS ====================
+const BaseType_t NET_TASK_CORE = 0;
+const BaseType_t GATE_TASK_CORE = 1;
+const UBaseType_t NET_TASK_PRIORITY = 1;
+const UBaseType_t GATE_TASK_PRIORITY = 3;  // por encima de la red: el cierre no espera al TLS
+const uint32_t NET_TASK_STACK = 8192;
+const uint32_t GATE_TASK_STACK = 4096;
+// La tarea de portones duerme hasta un comando o un plazo; este tope solo
+// cubre una notificación perdida
+const TickType_t GATE_IDLE_WAIT = pdMS_TO_TICKS(1000);
+const TickType_t NET_TICK = pdMS_TO_TICKS(10);
+const uint32_t LOG_TASK_STACK = 3072;
+const UBaseType_t LOG_TASK_PRIORITY = 0;  // solo con la CPU ociosa
+const TickType_t LOG_TASK_WAIT = pdMS_TO_TICKS(50);
+const size_t LOG_SERIAL_TX_BUFFER = 1024;
+const uint32_t WAKE_TASK_STACK = 2048;
+const UBaseType_t WAKE_TASK_PRIORITY = 2;  // solo espera en select()
+const int LOG_DRAIN_BATCH = 8;  // registros por llamada a drainLog()
+const uint8_t LOG_MQTT_LEVEL = LOG_LEVEL_WARN;
+
+// Confirmación de aplicación de un comando con su latencia recepción -> actuación
+struct CommandAck {
+  uint32_t commandId;
+  uint8_t gateId;
+  AckResult result;
+  CommandPriority priority;
+  uint32_t latencyUs;
+  int32_t oneWayUs;  // envío en la API -> actuación; ONE_WAY_UNKNOWN sin hora
+  int64_t atUs;      // epoch µs de la actuación; 0 sin hora SNTP
+};
+
+struct StatusEntry {
+  uint8_t gateId;
+  GateStatusCode status;
+};
+
+// Todos los portones que cambiaron en un mismo tick, publicados en un mensaje
+struct StatusBatch {
+  uint8_t count;
+  StatusEntry entries[GATE_COUNT];
+  unsigned long receivedAt;  // micros() del primer comando que lo causó; 0 si fue automático
+  int64_t atUs;              // epoch µs al cerrar el lote; 0 sin hora SNTP
+};
 
 // ==================== OBJETOS Y ESTADOS ====================
-WiFiClientSecure espClient;
+// Se carga en setupConfig() y solo la lee y cambia la tarea de red
+DeviceConfig config;
+Preferences configStore;
+uint8_t configPendingScope = CONFIG_SCOPE_NONE;  // cambios adoptados por rehacer
+uint32_t configRejected = 0;
+// Cambios de consola pendientes de "config commit"
+DeviceConfig consoleConfig;
+bool consoleStaged = false;
+char consoleLine[CONSOLE_LINE_MAX];
+size_t consoleLineLength = 0;
+
+// Reanuda la sesión TLS en cada reconexión; ver tls_client.h
+TlsSessionClient espClient;
 PubSubClient mqttClient(espClient);
-Servo gateServos[NUM_GATES];
+MqttInbox mqttInbox;
+uint32_t mqttStreamed = 0;  // deltas QR recibidas por la partición inbox
+uint32_t mqttOversize = 0;  // mensajes descartados por no caber
+
+// Un mensaje recibido: los primeros `buffered` bytes están en el buffer de
+// PubSubClient y, si no cupo entero, el resto en mqttInbox. Vale solo
+// dentro de mqttCallback.
+struct MqttPayload {
+  const uint8_t* data;
+  size_t buffered;
+  size_t length;
+
+  bool read(size_t offset, uint8_t* out, size_t count) const;
+};
+
+// Destino de cada portón; RTC_NOINIT sobrevive a un reinicio por software,
+// así un watchdog o un pánico no cierran de golpe un portón abierto
+const uint32_t RTC_GATES_MAGIC = 0x47415432;  // "GAT2"
+struct RtcGates {
+  uint32_t magic;
+  uint8_t open[GATE_COUNT];
+  uint8_t emergency;  // ACTION_EMERGENCY sin RESUME
+};
+RTC_NOINIT_ATTR RtcGates rtcGates;
+
+// ==================== ETAPAS Y REINICIOS ====================
+// Cada tick marca la etapa en la que entra: así se sabe cuál fue la más
+// larga y, como la etapa en curso se copia a RTC, dónde se quedó cada tarea
+// cuando el watchdog la reinicia.
+enum LoopStage : uint8_t {
+  STAGE_IDLE,
+  // tarea de red
+  STAGE_QR, STAGE_CONSOLE, STAGE_CONFIG, STAGE_LINK, STAGE_MQTT, STAGE_PUBLISH, STAGE_JOURNAL, STAGE_METRICS, STAGE_OTA,
+  // tarea de portones
+  STAGE_COMMANDS, STAGE_DEADLINES, STAGE_MOTION, STAGE_STATUS, STAGE_SENSORS,
+  STAGE_COUNT
+};
+const char* const LOOP_STAGE_NAMES[STAGE_COUNT] = {"idle", "qr", "console", "config", "link", "mqtt", "publish",
+                                                   "journal", "metrics", "ota", "commands", "deadlines", "motion",
+                                                   "status", "sensors"};
+
+const uint32_t RTC_DIAG_MAGIC = 0x44494731;  // "DIG1"
+struct RtcDiag {
+  uint32_t magic;
+  uint8_t netStage;
+  uint8_t gateStage;
+  uint8_t crashStreak;  // reinicios inesperados seguidos
+  uint32_t uptimeS;
+};
+RTC_NOINIT_ATTR RtcDiag rtcDiag;
+
+// Lo escribe solo la tarea dueña; la de red lee el de portones para métricas
+struct StageTracker {
+  uint8_t* rtcStage;
+  uint8_t stage;  // etapa en curso
+  uint32_t since;
+  uint8_t tickWorstStage;  // la más larga del tick en curso
+  uint32_t tickWorstUs;
+  uint8_t worstStage;  // red: desde la última publicación; portones: desde el arranque
+  uint32_t worstUs;
+};
+StageTracker netStages = {&rtcDiag.netStage, STAGE_IDLE, 0, STAGE_IDLE, 0, STAGE_IDLE, 0};
+StageTracker gateStages = {&rtcDiag.gateStage, STAGE_IDLE, 0, STAGE_IDLE, 0, STAGE_IDLE, 0};
+
+// Persistido en NVS: el último reinicio inesperado sigue ahí aunque después
+// se corte la alimentación (que sí borra la RTC)
+struct ResetHistory {
+  uint32_t boots;
+  uint32_t crashes;
+  uint8_t crashReason;  // esp_reset_reason_t
+  uint8_t crashNetStage;
+  uint8_t crashGateStage;
+  uint32_t crashUptimeS;
+};
+ResetHistory resetHistory = {};
+esp_reset_reason_t resetReason = ESP_RST_UNKNOWN;
+
+// Estado seguro: lo escribe gate_failsafe y lo concilia la tarea de portones.
+// Una tarea de portones solo lenta sigue corriendo a la par del failsafe:
+// cada bandera pasa de una a otra con orden de memoria, y el failsafe no
+// toca gates[].
+esp_timer_handle_t failsafeTimer = nullptr;
+volatile uint32_t gateTickAliveMs = 0;  // millis() del último tick completo
+std::atomic<bool> failsafeClosed[GATE_COUNT];  // estática: arranca en false
+volatile uint32_t failsafeStalledMs = 0;
+uint32_t failsafeCloses = 0;
+
+// ==================== PLAZOS DE CIERRE ====================
+// Los cierres automáticos viven en un min-heap (gateDeadlines, en
+// gate_control); un único esp_timer one-shot se arma para el más próximo y
+// despierta a la tarea de portones, que es la única que toca servos y estados.
+esp_timer_handle_t deadlineTimer = nullptr;
+TaskHandle_t gateTaskHandle = nullptr;
+TaskHandle_t netTaskHandle = nullptr;
+int64_t armedDeadline = 0;           // 0: timer detenido
+
+// ==================== MOVIMIENTO (LEDC) ====================
+// Los servos se manejan directo con LEDC a 50 Hz (SERVO_* en gate_control.h).
+// Un esp_timer periódico de MOTION_TICK_MS, activo solo mientras algo se
+// mueve, marca el tick de control (halMotionTimer).
+
+esp_timer_handle_t motionTimer = nullptr;
+bool motionTimerRunning = false;
 
-enum GateState { IDLE, OPEN };
-GateState states[NUM_GATES] = {IDLE, IDLE, IDLE, IDLE};
-unsigned long openTimers[NUM_GATES] = {0, 0, 0, 0};
+// ==================== SENSORES ====================
+// Finales de carrera y consumo del motor (GateSensors en gate_config.h). Un
+// ISR en IRAM deja cada flanco de un final en switchEdges (un productor: el
+// ISR de GPIO; un consumidor: la tarea de portones) y despierta a la tarea,
+// que resuelve el rebote (SwitchDebounce) leyendo el pin tras
+// LIMIT_DEBOUNCE_US sin flancos. El consumo se muestrea con ADC1 en modo
+// continuo: el DMA llena el ringbuffer del driver y cada tick lo vacía sin
+// esperar, promediando por canal. El ADC corre solo junto al tick de control.
+struct SwitchEdge {
+  uint8_t sw;  // portón * 2 + (0: final de abierto, 1: de cerrado)
+  uint32_t atUs;
+};
 
-const unsigned long GATE_OPEN_DURATION = 5000;
-const int POS_CLOSED = 0;
-const int POS_OPEN = 90;
+const uint32_t LIMIT_DEBOUNCE_US = 20000;
+const uint32_t ADC_SAMPLE_HZ = 20000;    // mínimo del controlador digital del ESP32
+const uint32_t ADC_FRAME_BYTES = 256;    // por interrupción de DMA
+const uint32_t ADC_STORE_BYTES = 2048;   // ringbuffer del driver: más de un tick
+const uint8_t ADC1_CHANNELS = 8;
+
+SpscQueue<SwitchEdge, 32> switchEdges;
+volatile uint32_t switchEdgesDropped = 0;
+SwitchDebounce limitSwitches[GATE_COUNT * 2];
+uint16_t gateCurrentMa[GATE_COUNT] = {};
+uint8_t adcFrame[ADC_FRAME_BYTES];
+bool currentSensing = false;  // algún portón con sensor de corriente
+uint32_t adcOverruns = 0;
+esp_timer_handle_t debounceTimer = nullptr;  // despierta a la tarea en reposo
+
+enum InputKind : uint8_t { INPUT_BUTTON, INPUT_WIEGAND };
+
+struct InputEvent {
+  InputKind kind;
+  uint8_t gate;  // índice 0-based
+  uint8_t bit;   // Wiegand: D0 = 0, D1 = 1
+  uint32_t atUs;
+};
+
+struct ButtonState {
+  bool held;
+  uint32_t changedUs;
+  uint32_t edgeUs;  // último flanco, para la latencia
+};
+
+// De la tarea de portones a la de red, para el diario y las métricas
+struct LocalAccess {
+  AccessSource source;
+  uint8_t gateId;
+  QrDecision decision;
+  uint8_t flags;  // JOURNAL_FLAG_CLOCK_KNOWN; la red agrega el de sin conexión
+  uint32_t at;
+  uint32_t code;
+  uint16_t uses;
+  uint32_t latencyUs;  // flanco o último bit -> processCommand, si abrió
+};
+
+SpscQueue<InputEvent, 128> inputEvents;  // un productor: los ISR de GPIO
+volatile uint32_t inputEventsDropped = 0;
+ButtonState buttons[GATE_COUNT] = {};
+WiegandReader wiegandReaders[GATE_COUNT];
+esp_timer_handle_t inputTimer = nullptr;  // cierra tramas y rebotes en reposo
+SpscQueue<LocalAccess, 16> accessQueue;
+uint32_t droppedAccesses = 0;
+uint32_t localOpens = 0;   // los cuenta la red al vaciar accessQueue
+uint32_t localDenied = 0;
+NetState netState = NET_WIFI_START;
+NetState netRetryState = NET_WIFI_START; // fase a reintentar al terminar el backoff
+unsigned long netStateSince = 0;
+unsigned long netBackoffDelay = 0;
+unsigned long netBackoffMs = NET_BACKOFF_MIN;
+
+// Coste de las reconexiones: handshakes completos vs reanudados y tiempo
+// desde la caída del enlace hasta volver a NET_READY
+uint32_t tlsHandshakes = 0;
+uint32_t tlsResumed = 0;
+uint32_t tlsHandshakeMsMax = 0;
+unsigned long netDownSince = 0;
+unsigned long lastReconnectMs = 0;
+uint32_t netReconnects = 0;
+bool netEverReady = false;
+
+// Energía. El lock y su tiempo acumulado los escribe solo la tarea de
+// portones; la red solo los lee para las métricas.
+esp_pm_lock_handle_t gatesAwakeLock = nullptr;
+bool lightSleepEnabled = false;
+volatile bool gatesAwake = false;
+volatile uint32_t gatesAwakeSince = 0;    // millis()
+volatile uint32_t gatesAwakeMsTotal = 0;  // con un portón fuera de reposo
+volatile uint32_t gateBusyUsTotal = 0;    // dentro de runGateTick()
+uint32_t netBusyUsTotal = 0;              // dentro de runNetworkTick()
+TaskHandle_t netWakeTaskHandle = nullptr;
+volatile int netWakeFd = -1;              // socket del broker con NET_READY
+volatile uint32_t netWokeAt = 0;          // micros() de la última llegada al socket
+uint32_t lastGatesAwakeMs = 0;
+uint32_t lastNetBusyUs = 0;
+uint32_t lastGateBusyUs = 0;
+LatencyHistogram wakeLatency;             // llegada al socket -> mqttCallback
+
+// ==================== MEMORIA ====================
+// En régimen nada reserva heap: los mensajes grandes de la red se arman en
+// esta unión estática y no en la pila de la tarea, así cuentan en el reporte
+// de tools/ram_report.py y NET_TASK_STACK solo cubre TLS y las llamadas. Solo
+// la tarea de red la usa, y cada miembro dentro de una función que arma y
+// publica sin llamar a otra que use otro.
+union NetMessageArena {
+  char metrics[2560];  // ~2430 bytes con todos los campos al máximo
+  char snapshot[384 + GATE_COUNT * 128];
+  uint8_t journal[JOURNAL_FRAME_HEADER_SIZE + JOURNAL_REPLAY_BATCH * JOURNAL_RECORD_SIZE];
+  uint8_t ota[OTA_READ_CHUNK];
+};
+NetMessageArena netArena;
+// publish() arma el mensaje en el buffer de PubSubClient: las métricas y el
+// snapshot no caben y van por publishStream()
+static_assert(sizeof(NetMessageArena::journal) <= MQTT_PAYLOAD_MAX, "un lote del diario cabe en el buffer MQTT");
+static_assert(LOG_LINE_MAX <= MQTT_PAYLOAD_MAX, "una línea de log cabe en el buffer MQTT");
+
+const uint32_t STACK_WARN_BYTES = 512;  // margen mínimo de pila antes de avisar
+TaskHandle_t logTaskHandle = nullptr;
+uint8_t stackWarned = 0;  // un aviso por tarea (bit por tarea)
+// El heap solo se mira al publicar métricas: el mínimo de maxAlloc a lo
+// largo de semanas es lo que delata la fragmentación
+uint32_t heapMinMaxAlloc = UINT32_MAX;
+volatile uint32_t heapAllocFailures = 0;  // desde cualquier tarea
+volatile uint32_t heapLastFailedSize = 0;
+uint32_t heapFailuresReported = 0;
+
+// ==================== MÉTRICAS ====================
+// Latencia por etapa, medida desde la entrada a mqttCallback (micros()):
+//   receive:   inicio de mqttClient.loop() -> mqttCallback (lectura TLS + MQTT)
+//   parse:     mqttCallback -> comando decodificado
+//   actuation: mqttCallback -> processCommand aplicado (latencia del ack),
+//              además por CommandPriority: es lo que la cola de prioridades
+//              decide
+//   status:    mqttCallback -> estado resultante publicado
+//   oneWay:    "timestamp" o hora de envío del comando en la API ->
+//              actuación, con la hora SNTP de ambos lados
+// Todos los histogramas los escribe y reinicia solo la tarea de red; se
+// reinician en cada publicación, los contadores son desde el arranque.
+LatencyHistogram receiveLatency;
+LatencyHistogram parseLatency;
+LatencyHistogram actuationLatency;
+LatencyHistogram priorityLatency[PRIORITY_COUNT];
+const char* const PRIORITY_METRIC_NAMES[PRIORITY_COUNT] = {"visitor", "resident", "admin", "emergency"};
+LatencyHistogram inputLatency;  // botón o lector local -> processCommand
+LatencyHistogram statusLatency;
+LatencyHistogram oneWayLatency;
+uint32_t negativeOneWay = 0;  // actuación "antes" del envío: relojes desfasados
+unsigned long netLoopStartUs = 0;
+unsigned long lastMetricsAt = 0;
+uint32_t netTickMaxUs = 0;   // desde la última publicación
+uint32_t gateTickMaxUs = 0;  // desde el arranque (lo escribe la tarea de portones)
+// Latido y keepalive: solo la tarea de red
+unsigned long lastHeartbeatAt = 0;
+uint32_t heartbeatNetMaxUs = 0;  // peor tick de red desde el último latido
+uint16_t mqttKeepAliveS = MQTT_KEEPALIVE_S;  // el de la sesión actual
+uint8_t shortSessions = 0;
+unsigned long mqttSessionSince = 0;
+// Comando que está procesando drainCommands(), para atribuirle sus estados
+unsigned long activeCommandAt = 0;
+
+// Allowlist, lector y registro de accesos: todo vive en la tarea de red
+QrAllowlist qrAllowlist;
+Preferences qrStore;
+bool qrDirty = false;
+unsigned long qrDirtySince = 0;
+unsigned long qrSyncRequestedAt = 0;
+bool qrSyncRequested = false;
+// Hora local: la del emisor de la última delta más lo transcurrido desde
+// entonces. Tras reiniciar solo queda la persistida, que es una cota inferior.
+uint32_t clockRef = 0;   // epoch s
+int64_t clockRefAt = 0;  // esp_timer_get_time() al fijarla
+bool clockKnown = false;
+// Hora SNTP: la escribe la red en applySntpSync(); las demás tareas la leen
+// con wallClockUsAt(), bajo wallClockMux
+SyncClock wallClock;
+portMUX_TYPE wallClockMux = portMUX_INITIALIZER_UNLOCKED;
+volatile bool sntpPending = false;  // lo pone el callback de lwIP
+bool sntpStarted = false;
+int64_t lastSyncErrorUs = 0;
+char qrLine[24];
+size_t qrLineLength = 0;
+// La allowlist y la hora de referencia las escribe la red; las entradas
+// locales las consultan desde la tarea de portones bajo este lock
+SemaphoreHandle_t allowlistLock = nullptr;
+
+uint32_t qrDeltasRejected = 0;
+
+// Estado visto por la red (lo último que salió de statusQueue) y arranque
+GateStatusCode reportedStatus[GATE_COUNT];
+bool stateSnapshotDirty = false;
+DesiredEntry desiredGates[GATE_COUNT];  // pendientes de aplicar, p. ej. sin hora conocida
+uint8_t desiredCount = 0;
+bool desiredReceived = false;
+unsigned long bootReadyMs = 0;       // millis() del primer NET_READY
+unsigned long bootConsistentMs = 0;  // millis() con el estado deseado resuelto y publicado
+uint8_t restoredGates = 0;
+
+// Diario: lo escribe y reenvía solo la tarea de red
+PartitionFlash journalFlash;
+EventJournal journal;
+Preferences journalStore;
+uint32_t journalId = 0;
+uint32_t journalAckedSeq = 0;  // más alta confirmada por la API
+uint32_t journalSendSeq = 1;   // próxima a enviar
+unsigned long journalPendingSince = 0;
+unsigned long journalProgressAt = 0;  // último envío desde lo confirmado o último ack con avance
+bool journalAckDirty = false;
+unsigned long journalAckDirtySince = 0;
+uint32_t journalReplayed = 0;
+uint32_t journalRewinds = 0;
+uint32_t journalLost = 0;  // sobrescritos sin confirmar o sin diario donde anotarlos
+
+// OTA: la descarga y la verificación viven en la tarea de red
+enum OtaState { OTA_IDLE, OTA_PENDING, OTA_HEADERS, OTA_DOWNLOADING, OTA_STAGED };
+OtaState otaState = OTA_IDLE;
+OtaOffer otaOffer = {};
+uint8_t otaAttempts = 0;
+unsigned long otaWaitSince = 0;
+unsigned long otaWaitMs = 0;
+WiFiClient otaHttpClient;
+WiFiClientSecure otaHttpsClient;  // sin CA: la integridad la da el digest firmado
+Client* otaClient = nullptr;
+OtaPartitionWriter otaWriter;
+OtaInflater otaInflater;
+OtaDeltaDecoder otaDelta;
+OtaRunningImage otaBase;
+OtaSink* otaInput = nullptr;  // primera etapa del cuerpo HTTP
+char otaHeaderLine[96];
+size_t otaHeaderLength = 0;
+bool otaStatusLineSeen = false;
+uint32_t otaReceived = 0;  // bytes del cuerpo HTTP
+unsigned long otaStartedAt = 0;
+unsigned long otaLastDataAt = 0;
+unsigned long otaProgressAt = 0;
+Preferences otaStore;
+uint8_t otaRejectedSha[32] = {0};  // imagen inválida o revertida: no se reinstala
+uint8_t runningSha[32];
+bool runningShaKnown = false;
+bool otaVerifying = false;       // esta imagen aún no se confirmó
+bool otaRollbackReport = false;  // se informa con el enlace arriba
+bool gatesResting = false;
+unsigned long gatesRestSince = 0;
+
+// mqttCallback (red) -> actuador, un cupo de 8 por CommandPriority: una
+// ráfaga de visitantes no deja sin lugar a la apertura de emergencia
+PriorityQueue<GateCommand, 8, PRIORITY_COUNT> commandQueue;
+// actuador -> red, un lote por tick con cambios
+SpscQueue<StatusBatch, 16> statusQueue;
+StatusBatch pendingStatus = {0, {}, 0, 0};
+// actuador -> red, acks de los comandos ejecutados
+SpscQueue<CommandAck, 16> ackQueue;
+// Últimos commandId vistos, para que la reentrega QoS 1 sea idempotente
+CommandDedup<32> recentCommands;
+uint32_t droppedCommands = 0;
+uint32_t droppedStatus = 0;
+uint32_t duplicateCommands = 0;
+uint32_t droppedAcks = 0;
+
+// ==================== REGISTRO ASÍNCRONO ====================
+// Un anillo por productor para conservar SPSC: la tarea de red (y setup())
+// y la de portones. drainLog() es el único consumidor de ambos.
+struct LogRing {
+  SpscQueue<LogRecord, 64> queue;
+  uint32_t dropped = 0;   // solo el productor
+  uint32_t reported = 0;  // solo el consumidor
+};
+LogRing netLog;
+LogRing gateLog;
+char logLine[LOG_LINE_MAX];
+size_t logLineLength = 0;  // línea formateada pendiente de caber en el UART
+
+// El nivel del evento es constante en compilación: si supera LOG_LEVEL la
+// llamada y sus argumentos desaparecen
+#define LOG_NET(ev, ...) \
+  do { if (LOG_EVENTS[ev].level <= LOG_LEVEL) logEvent(netLog, ev, __VA_ARGS__); } while (0)
+#define LOG_GATE(ev, ...) \
+  do { if (LOG_EVENTS[ev].level <= LOG_LEVEL) logEvent(gateLog, ev, __VA_ARGS__); } while (0)
+
+// Contadores del parser de comandos (por resultado) y su coste medido
+uint32_t parseCounts[PARSE_RESULT_COUNT] = {0};
+uint32_t invalidGateCommands = 0;
+unsigned long parseMicrosMax = 0;
+unsigned long parseMicrosTotal = 0;
+
+// Los estados se responden en el formato y topic del último comando recibido
+bool binaryStatus = false;
+bool perGateStatus = false;
+
+// Identidad y topics de esta placa, armados una vez en setupAddressing()
+char controllerId[24];
+char clientId[40];
+char gateTopicPrefix[96];   // portones/{colonia}/{controlador}/gate/
+char commandFilter[MQTT_TOPIC_MAX];
+char commandFilterBin[MQTT_TOPIC_MAX];
+char capsTopic[MQTT_TOPIC_MAX];
+char logTopic[MQTT_TOPIC_MAX];
+char metricsTopic[MQTT_TOPIC_MAX];
+char qrDeltaTopic[MQTT_TOPIC_MAX];
+char qrSyncTopic[MQTT_TOPIC_MAX];
+char journalTopic[MQTT_TOPIC_MAX];
+char journalAckTopic[MQTT_TOPIC_MAX];
+char stateTopic[MQTT_TOPIC_MAX];
+char desiredTopic[MQTT_TOPIC_MAX];
+char configTopic[MQTT_TOPIC_MAX];
+char configAckTopic[MQTT_TOPIC_MAX];
+char otaTopic[MQTT_TOPIC_MAX];
+char otaStatusTopic[MQTT_TOPIC_MAX];
+char healthTopic[MQTT_TOPIC_MAX];
+char capsPayload[176];
 
 // Prototipos
-void setupWiFi();
-void reconnectMQTT();
+void updateNetwork();
+void setNetState(NetState next);
+void scheduleNetRetry(NetState retryState);
 void mqttCallback(char* topic, byte* payload, unsigned int length);
-void processCommand(int gateId, const char* action);
-void updateGates();
-void publishStatus(int gateId, const char* status);
-String getTimestamp();
-
-// Función helper para timestamps
-String getTimestamp() {
-  unsigned long ms = millis();
-  unsigned long secs = ms / 1000;
-  unsigned long mins = secs / 60;
-  unsigned long hours = mins / 60;
-  ms = ms % 1000;
-  secs = secs % 60;
-  mins = mins % 60;
-  
-  char timestamp[16];
-  snprintf(timestamp, sizeof(timestamp), "%02lu:%02lu:%02lu.%03lu", hours, mins, secs, ms);
-  return String(timestamp);
+bool enqueueCommand(int gateId, GateAction action, CommandPriority priority, uint32_t holdS, uint32_t commandId,
+                    int64_t sentAtUs, unsigned long receivedAt);
+CommandAck makeAck(const GateCommand& cmd, AckResult result);
+void queueAck(const GateCommand& cmd, AckResult result);
+void sendAck(const CommandAck& ack);
+void flushAcks();
+void setupConfig();
+void handleConfigUpdate(const uint8_t* payload, unsigned int length);
+bool verifyFrameMac(const uint8_t* payload, size_t length, const char* key);
+bool verifyPayloadMac(const MqttPayload& payload, const char* key);
+bool publishStream(const char* topic, const char* payload, size_t length, bool retained);
+bool commitConfig(const DeviceConfig& next);
+void applyConfigChanges();
+void pollConsole();
+void setupAddressing();
+bool parseGateTopic(const char* topic, int& gateId, bool& binary);
+void commitStatus();
+void runNetworkTick();
+void runGateTick();
+void drainCommands();
+void armDeadlineTimer();
+void setupServos();
+void setupSensors();
+void pollSensors();
+void readCurrents();
+void sampleCurrents(bool run);
+void setupInputs();
+void pollInputs();
+void drainLocalAccess();
+bool authorizeLocal(LocalAccess& access);
+void onDeadlineTimer(void* arg);
+void wakeGateTask();
+void wakeNetTask();
+void setupPower();
+void updatePowerLock();
+TickType_t netIdleWait();
+void netWakeTask(void* param);
+void flushStatus();
+void drainLog();
+void publishMetrics();
+void publishHeartbeat();
+void onAllocFailed(size_t size, uint32_t caps, const char* function);
+void setupQrAllowlist();
+void handleQrDelta(const MqttPayload& payload);
+void requestQrSync();
+void pollQrReader();
+void persistQrAllowlist();
+uint32_t epochNow();
+void advanceClock(uint32_t epoch);
+void startSntp();
+void onSntpSync(struct timeval* tv);
+void applySntpSync();
+int64_t wallClockUsAt(int64_t localUs);
+int64_t wallClockUs();
+void setupJournal();
+void journalEvent(const JournalEvent& event);
+void journalStatusBatch(const StatusBatch& batch);
+void journalStatus();
+bool journalBacklog();
+void handleJournalAck(const uint8_t* payload, unsigned int length);
+void replayJournal();
+void persistJournal();
+void noteStatusBatch(const StatusBatch& batch);
+void publishStateSnapshot();
+void handleDesiredState(const uint8_t* payload, unsigned int length);
+void applyDesiredState();
+void updateConsistency();
+void setupOta();
+void handleOtaOffer(const uint8_t* payload, unsigned int length);
+void noteGateRest();
+void updateOta();
+void checkRunningImage();
+const char* resetReasonName(uint8_t reason);
+const char* loopStageName(uint8_t stage);
+void setupResetDiagnostics();
+void setupWatchdog();
+void onFailsafeTimer(void* arg);
+void reconcileFailsafe();
+void startStages(StageTracker& tracker, LoopStage first);
+void markStage(StageTracker& tracker, LoopStage next);
+void finishStages(StageTracker& tracker);
+#if DUAL_CORE_TASKS
+void networkTask(void* param);
+void gateTask(void* param);
+void logTask(void* param);
+#endif
+
+// ==================== REGISTRO: PRODUCTORES ====================
+// Solo copian el registro al anillo; el formateo y el UART van en drainLog()
+void pushLog(LogRing& ring, LogEvent event, uint8_t gate, int32_t a, int32_t b, const char* s0, const char* s1) {
+  LogRecord record = {(uint32_t)millis(), event, gate, 0, {a, b}, {s0, s1}};
+  if (!ring.queue.push(record)) ring.dropped++;
+}
+
+void logEvent(LogRing& ring, LogEvent event, uint8_t gate, int32_t a = 0, int32_t b = 0) {
+  pushLog(ring, event, gate, a, b, nullptr, nullptr);
+}
+
+void logEvent(LogRing& ring, LogEvent event, uint8_t gate, const char* s0, int32_t a = 0, int32_t b = 0) {
+  pushLog(ring, event, gate, a, b, s0, nullptr);
+}
+
+void logEvent(LogRing& ring, LogEvent event, uint8_t gate, const char* s0, const char* s1) {
+  pushLog(ring, event, gate, 0, 0, s0, s1);
 }
 
 void setup() {
+  // Con buffer de TX, Serial.write() no espera al UART mientras haya espacio
+  Serial.setTxBufferSize(LOG_SERIAL_TX_BUFFER);
   Serial.begin(115200);
-  
-  // Inicializar los 4 servos
-  for(int i = 0; i < NUM_GATES; i++) {
-    gateServos[i].attach(SERVO_PINS[i]);
-    gateServos[i].write(POS_CLOSED);
-    Serial.printf("[%s] [SERVO %d] Inicializado en pin %d\n", getTimestamp().c_str(), i + 1, SERVO_PINS[i]);
-  }
+  heap_caps_register_failed_alloc_callback(onAllocFailed);
+
+  // Antes que los servos: el historial de reinicios decide qué se retoma
+  setupResetDiagnostics();
+
+  setupServos();
 
-  setupWiFi();
-  espClient.setInsecure();
-  mqttClient.setServer(MQTT_BROKER, MQTT_PORT);
+  setupSensors();
+
+  setupInputs();
+
+  setupConfig();
+
+  if (!mqttInbox.begin(INBOX_PARTITION, MQTT_PAYLOAD_MAX)) LOG_NET(EV_INBOX_UNAVAILABLE, 0);
+
+  setupAddressing();
+
+  setupQrAllowlist();
+
+  setupJournal();
+
+  setupOta();
+
+  setupPower();
+
+  espClient.setCACert(MQTT_CA_CERT);
+  espClient.setFingerprint(MQTT_CERT_SHA256);
+  espClient.setHandshakeTimeout(TLS_HANDSHAKE_TIMEOUT_MS);
+  mqttClient.setServer(config.mqttHost, config.mqttPort);
+  mqttClient.setBufferSize(MQTT_BUFFER_SIZE);
+  mqttClient.setStream(mqttInbox);
+  mqttClient.setSocketTimeout(MQTT_SOCKET_TIMEOUT_S);
+  mqttClient.setKeepAlive(mqttKeepAliveS);
   mqttClient.setCallback(mqttCallback);
+  setNetState(configComplete(config) ? NET_WIFI_START : NET_PROVISION);
+
+  esp_timer_create_args_t timerArgs = {};
+  timerArgs.callback = onDeadlineTimer;
+  timerArgs.name = "gate_deadline";
+  esp_timer_create(&timerArgs, &deadlineTimer);
+  timerArgs.name = "gate_motion";
+  esp_timer_create(&timerArgs, &motionTimer);
+  timerArgs.name = "gate_debounce";
+  esp_timer_create(&timerArgs, &debounceTimer);
+  timerArgs.name = "gate_input";
+  esp_timer_create(&timerArgs, &inputTimer);
+
+#if DUAL_CORE_TASKS
+  xTaskCreatePinnedToCore(networkTask, "net", NET_TASK_STACK, nullptr, NET_TASK_PRIORITY, &netTaskHandle, NET_TASK_CORE);
+  xTaskCreatePinnedToCore(gateTask, "gates", GATE_TASK_STACK, nullptr, GATE_TASK_PRIORITY, &gateTaskHandle, GATE_TASK_CORE);
+#if !LOG_MQTT_SINK
+  xTaskCreatePinnedToCore(logTask, "log", LOG_TASK_STACK, nullptr, LOG_TASK_PRIORITY, &logTaskHandle, NET_TASK_CORE);
+#endif
+  LOG_NET(EV_RTOS_CORES, 0, NET_TASK_CORE, GATE_TASK_CORE);
+#else
+  // setup() y loop() corren en la misma tarea
+  gateTaskHandle = xTaskGetCurrentTaskHandle();
+  netTaskHandle = gateTaskHandle;
+#endif
+  xTaskCreatePinnedToCore(netWakeTask, "netwake", WAKE_TASK_STACK, nullptr, WAKE_TASK_PRIORITY, &netWakeTaskHandle,
+                          NET_TASK_CORE);
+
+  setupWatchdog();
 }
 
 void loop() {
-  if (!mqttClient.connected()) {
-    Serial.printf("[%s] [MQTT] ✗ Desconectado del broker\n", getTimestamp().c_str());
-    reconnectMQTT();
+#if DUAL_CORE_TASKS
+  // El trabajo vive en networkTask y gateTask
+  vTaskDelete(nullptr);
+#else
+  runNetworkTick();
+  // Se ejecuta en cada tick sin importar el estado del enlace
+  runGateTick();
+  drainLog();
+  esp_task_wdt_reset();
+  // Duerme hasta un plazo, un paquete del broker o el próximo sondeo
+  ulTaskNotifyTake(pdTRUE, netIdleWait());
+#endif
+}
+
+// Lado de red: conexión, lectura TLS/MQTT (encola comandos) y envío de estados
+void runNetworkTick() {
+  unsigned long tickStart = micros();
+  rtcDiag.uptimeS = millis() / 1000;
+  // El lector no depende del enlace: autoriza contra la allowlist local
+  startStages(netStages, STAGE_QR);
+  pollQrReader();
+  drainLocalAccess();
+  persistQrAllowlist();
+  markStage(netStages, STAGE_CONSOLE);
+  pollConsole();
+  markStage(netStages, STAGE_CONFIG);
+  applyConfigChanges();
+  markStage(netStages, STAGE_LINK);
+  updateNetwork();
+  if (sntpPending) applySntpSync();
+  if (netState == NET_READY) {
+    markStage(netStages, STAGE_MQTT);
+    netLoopStartUs = micros();
+    mqttInbox.reset();  // loop() lee a lo sumo un paquete
+    mqttClient.loop();
+    markStage(netStages, STAGE_PUBLISH);
+    flushStatus();
+    flushAcks();
+    markStage(netStages, STAGE_JOURNAL);
+    replayJournal();
+    markStage(netStages, STAGE_PUBLISH);
+    updateConsistency();
+    if (stateSnapshotDirty) publishStateSnapshot();
+    if (millis() - lastMetricsAt >= METRICS_INTERVAL) {
+      markStage(netStages, STAGE_METRICS);
+      publishMetrics();
+    }
+    if (millis() - lastHeartbeatAt >= HEARTBEAT_INTERVAL) publishHeartbeat();
+  } else {
+    // Sin enlace los estados van al diario en lugar de esperar en la cola
+    markStage(netStages, STAGE_JOURNAL);
+    journalStatus();
+  }
+  markStage(netStages, STAGE_JOURNAL);
+  persistJournal();
+  markStage(netStages, STAGE_OTA);
+  noteGateRest();
+  updateOta();
+  checkRunningImage();
+  // Tras leer el socket, netWakeTask puede volver a esperar en él
+  netWakeFd = netState == NET_READY ? espClient.fd() : -1;
+  if (netWakeTaskHandle) xTaskNotifyGive(netWakeTaskHandle);
+  finishStages(netStages);
+  uint32_t elapsed = micros() - tickStart;
+  netBusyUsTotal += elapsed;
+  if (elapsed > netTickMaxUs) netTickMaxUs = elapsed;
+  if (elapsed > heartbeatNetMaxUs) heartbeatNetMaxUs = elapsed;
+  if (elapsed > NET_STALL_WARN_US) {
+    LOG_NET(EV_NET_STALL, 0, LOOP_STAGE_NAMES[netStages.tickWorstStage], (int32_t)(netStages.tickWorstUs / 1000),
+            (int32_t)(elapsed / 1000));
   }
-  mqttClient.loop();
+#if DUAL_CORE_TASKS && LOG_MQTT_SINK
+  drainLog();
+#endif
+}
+
+// Lado de actuación: nunca toca el socket, solo las colas y los servos
+void runGateTick() {
+  unsigned long tickStart = micros();
+  startStages(gateStages, STAGE_COMMANDS);
+  reconcileFailsafe();
+  drainCommands();
+  pollInputs();
+  markStage(gateStages, STAGE_DEADLINES);
   updateGates();
-  delay(10);
+  markStage(gateStages, STAGE_SENSORS);
+  pollSensors();
+  markStage(gateStages, STAGE_MOTION);
+  updateMotion(esp_timer_get_time());
+  markStage(gateStages, STAGE_DEADLINES);
+  armDeadlineTimer();
+  markStage(gateStages, STAGE_STATUS);
+  commitStatus();
+  updatePowerLock();
+  // La red puede estar durmiendo NET_IDLE_TICK: que publique ya
+  if (!statusQueue.empty() || !ackQueue.empty() || !accessQueue.empty()) wakeNetTask();
+  finishStages(gateStages);
+  gateTickAliveMs = millis();
+  uint32_t elapsed = micros() - tickStart;
+  gateBusyUsTotal += elapsed;
+  if (elapsed > gateTickMaxUs) gateTickMaxUs = elapsed;
+  if (elapsed > GATE_STALL_WARN_US) {
+    LOG_GATE(EV_GATE_STALL, 0, LOOP_STAGE_NAMES[gateStages.tickWorstStage], (int32_t)(gateStages.tickWorstUs / 1000),
+             (int32_t)(elapsed / 1000));
+  }
+}
+
+void wakeGateTask() {
+  if (gateTaskHandle) {
+    xTaskNotifyGive(gateTaskHandle);
+  }
+}
+
+void wakeNetTask() {
+  if (netTaskHandle) {
+    xTaskNotifyGive(netTaskHandle);
+  }
+}
+
+// Corre en la tarea de esp_timer (plazos y tick de movimiento): solo
+// despierta, no toca estado
+void onDeadlineTimer(void* arg) {
+  wakeGateTask();
+}
+
+// Rearma el one-shot si cambió el plazo más próximo
+void armDeadlineTimer() {
+  int64_t next = gateDeadlines.empty() ? 0 : gateDeadlines.nextDeadline();
+  if (next == armedDeadline) return;
+
+  esp_timer_stop(deadlineTimer);
+  armedDeadline = next;
+  if (next == 0) return;
+
+  int64_t delayUs = next - esp_timer_get_time();
+  esp_timer_start_once(deadlineTimer, delayUs > 0 ? delayUs : 1);
+}
+
+#if DUAL_CORE_TASKS
+void networkTask(void* param) {
+  esp_task_wdt_add(nullptr);
+  for (;;) {
+    runNetworkTick();
+    esp_task_wdt_reset();
+    ulTaskNotifyTake(pdTRUE, netIdleWait());
+  }
+}
+
+void gateTask(void* param) {
+  esp_task_wdt_add(nullptr);
+  for (;;) {
+    runGateTick();
+    esp_task_wdt_reset();
+    ulTaskNotifyTake(pdTRUE, GATE_IDLE_WAIT);
+  }
+}
+
+void logTask(void* param) {
+  for (;;) {
+    drainLog();
+    vTaskDelay(LOG_TASK_WAIT);
+  }
+}
+#endif
+
+// ==================== REGISTRO: CONSUMIDOR ====================
+// Escribe en Serial solo lo que cabe en el buffer de TX; la línea que no
+// cabe queda pendiente para la siguiente llamada, así que nunca bloquea.
+bool writeLogLine() {
+  if (logLineLength == 0) return true;
+  if (Serial.availableForWrite() < logLineLength) return false;
+  Serial.write((const uint8_t*)logLine, logLineLength);
+  logLineLength = 0;
+  return true;
+}
+
+void emitLog(const LogRecord& record) {
+  const LogEventInfo& info = LOG_EVENTS[record.event];
+  // record.ms es un millis() de hace poco: se lleva a los 64 bits de esp_timer
+  int64_t nowUs = esp_timer_get_time();
+  int64_t atUs = nowUs - (int64_t)(uint32_t)((uint32_t)(nowUs / 1000) - record.ms) * 1000;
+  logLineLength = formatLogRecord(record, info, wallClockUsAt(atUs) / 1000, logLine, sizeof(logLine));
+#if LOG_MQTT_SINK
+  if (info.level <= LOG_MQTT_LEVEL && netState == NET_READY) {
+    logLine[logLineLength - 1] = '\0';  // sin el salto de línea
+    mqttClient.publish(logTopic, logLine);
+    logLine[logLineLength - 1] = '\n';
+  }
+#endif
+}
+
+// Los descartes se reportan como un evento más, una vez por anillo
+bool reportLogDrops(LogRing& ring) {
+  uint32_t dropped = ring.dropped;
+  if (dropped == ring.reported) return false;
+  LogRecord record = {(uint32_t)millis(), EV_LOG_DROPPED, 0, 0, {(int32_t)(dropped - ring.reported), 0}, {nullptr, nullptr}};
+  ring.reported = dropped;
+  emitLog(record);
+  return true;
+}
+
+void drainLog() {
+  LogRecord record;
+  for (int i = 0; i < LOG_DRAIN_BATCH; i++) {
+    if (!writeLogLine()) return;
+    if (reportLogDrops(gateLog) || reportLogDrops(netLog)) continue;
+    // Prioridad al anillo de portones: es el más corto en ráfagas
+    if (gateLog.queue.pop(record) || netLog.queue.pop(record)) {
+      emitLog(record);
+    } else {
+      return;
+    }
+  }
+  writeLogLine();
+}
+
+// Arma el ID de cliente y los topics propios a partir de la MAC
+void setupAddressing() {
+  uint8_t mac[6];
+  WiFi.macAddress(mac);
+  if (config.controllerId[0] != '\0') {
+    strlcpy(controllerId, config.controllerId, sizeof(controllerId));
+  } else {
+    snprintf(controllerId, sizeof(controllerId), "%02x%02x%02x%02x%02x%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+  }
+  snprintf(clientId, sizeof(clientId), "portones-%s", controllerId);
+  snprintf(gateTopicPrefix, sizeof(gateTopicPrefix), "portones/%s/%s/gate/", config.coloniaId, controllerId);
+  snprintf(commandFilter, sizeof(commandFilter), "%s+/command", gateTopicPrefix);
+  snprintf(commandFilterBin, sizeof(commandFilterBin), "%s+/command.bin", gateTopicPrefix);
+  snprintf(capsTopic, sizeof(capsTopic), "portones/%s/%s/caps", config.coloniaId, controllerId);
+  snprintf(logTopic, sizeof(logTopic), "portones/%s/%s/log", config.coloniaId, controllerId);
+  snprintf(metricsTopic, sizeof(metricsTopic), "portones/%s/%s/metrics", config.coloniaId, controllerId);
+  snprintf(qrDeltaTopic, sizeof(qrDeltaTopic), "portones/%s/%s/qr/delta", config.coloniaId, controllerId);
+  snprintf(qrSyncTopic, sizeof(qrSyncTopic), "portones/%s/%s/qr/sync", config.coloniaId, controllerId);
+  snprintf(journalTopic, sizeof(journalTopic), "portones/%s/%s/journal.bin", config.coloniaId, controllerId);
+  snprintf(journalAckTopic, sizeof(journalAckTopic), "portones/%s/%s/journal/ack", config.coloniaId, controllerId);
+  snprintf(stateTopic, sizeof(stateTopic), "portones/%s/%s/state", config.coloniaId, controllerId);
+  snprintf(desiredTopic, sizeof(desiredTopic), "portones/%s/%s/desired.bin", config.coloniaId, controllerId);
+  snprintf(configTopic, sizeof(configTopic), "portones/%s/%s/config.bin", config.coloniaId, controllerId);
+  snprintf(configAckTopic, sizeof(configAckTopic), "portones/%s/%s/config/ack", config.coloniaId, controllerId);
+  snprintf(otaTopic, sizeof(otaTopic), "portones/%s/%s/ota.bin", config.coloniaId, controllerId);
+  snprintf(otaStatusTopic, sizeof(otaStatusTopic), "portones/%s/%s/ota/status", config.coloniaId, controllerId);
+  snprintf(healthTopic, sizeof(healthTopic), "portones/%s/%s/health", config.coloniaId, controllerId);
+  snprintf(capsPayload, sizeof(capsPayload),
+           "{\"protocols\": [\"json\", \"bin1\", \"ack1\", \"qr1\", \"journal1\", \"state1\", \"config1\", "
+           "\"ota1\", \"time1\", \"health1\"], "
+           "\"gates\": %d, \"inbox\": %lu}", GATE_COUNT, (unsigned long)mqttInbox.capacity());
+  LOG_NET(EV_CONTROLLER_ID, 0, controllerId, GATE_COUNT);
+}
+
+// Reconoce {gateTopicPrefix}{n}/command y {n}/command.bin
+bool parseGateTopic(const char* topic, int& gateId, bool& binary) {
+  size_t prefixLen = strlen(gateTopicPrefix);
+  if (strncmp(topic, gateTopicPrefix, prefixLen) != 0) return false;
+
+  const char* p = topic + prefixLen;
+  int n = 0;
+  while (*p >= '0' && *p <= '9' && n < 1000) {
+    n = n * 10 + (*p - '0');
+    p++;
+  }
+  if (strcmp(p, "/command") == 0) {
+    binary = false;
+  } else if (strcmp(p, "/command.bin") == 0) {
+    binary = true;
+  } else {
+    return false;
+  }
+  gateId = n;
+  return true;
+}
+
+// El buffer siempre guarda al menos lo que mqttInbox saltó (MQTT_PAYLOAD_MAX)
+bool MqttPayload::read(size_t offset, uint8_t* out, size_t count) const {
+  if (offset + count > length) return false;
+  size_t fromBuffer = offset < buffered ? std::min(count, buffered - offset) : 0;
+  memcpy(out, data + offset, fromBuffer);
+  return fromBuffer == count || mqttInbox.read(offset + fromBuffer, out + fromBuffer, count - fromBuffer);
 }
 
 void mqttCallback(char* topic, byte* payload, unsigned int length) {
-  StaticJsonDocument<256> doc;
-  deserializeJson(doc, payload, length);
+  unsigned long receivedAt = micros();
+  receiveLatency.record(receivedAt - netLoopStartUs);
+  uint32_t wokeAt = netWokeAt;
+  if (wokeAt != 0) {
+    wakeLatency.record(receivedAt - wokeAt);
+    netWokeAt = 0;
+  }
+  bool qrDelta = strcmp(topic, qrDeltaTopic) == 0;
+  MqttPayload message = {payload, length, mqttInbox.length()};
+  if (message.length > length) {
+    // No cupo en el buffer: solo una delta QR entera en la partición sigue
+    if (!qrDelta || !mqttInbox.complete()) {
+      mqttOversize++;
+      LOG_NET(EV_MQTT_OVERSIZE, 0, qrDelta ? "Delta QR" : "Mensaje", (int32_t)message.length, (int32_t)length);
+      return;
+    }
+    mqttStreamed++;
+  }
+  if (qrDelta) {
+    handleQrDelta(message);
+    return;
+  }
+  if (strcmp(topic, journalAckTopic) == 0) {
+    handleJournalAck(payload, length);
+    return;
+  }
+  if (strcmp(topic, desiredTopic) == 0) {
+    handleDesiredState(payload, length);
+    return;
+  }
+  if (strcmp(topic, configTopic) == 0) {
+    handleConfigUpdate(payload, length);
+    return;
+  }
+  if (strcmp(topic, otaTopic) == 0) {
+    handleOtaOffer(payload, length);
+    return;
+  }
+  int topicGate = 0;
+  bool binary = false;
+  bool perGate = parseGateTopic(topic, topicGate, binary);
+  if (!perGate) {
+    binary = strcmp(topic, MQTT_TOPIC_BIN) == 0;
+  }
+
+  // JSON {"gateId": 1-4, "action": "OPEN", ...} o trama binaria de comando
+  unsigned long start = micros();
+  GateCommand cmd;
+  ParseResult result = decodeCommand(payload, length, binary, cmd);
+  if (!binary) {
+    unsigned long elapsed = micros() - start;
+    parseMicrosTotal += elapsed;
+    if (elapsed > parseMicrosMax) parseMicrosMax = elapsed;
+  }
+  parseCounts[result]++;
+
+  if (result != PARSE_OK) {
+    if (binary) {
+      LOG_NET(EV_BIN_FRAME_INVALID, 0, (int32_t)length);
+    } else {
+      LOG_NET(EV_COMMAND_DISCARDED, 0, parseResultName(result), (int32_t)length);
+    }
+    return;
+  }
+  parseLatency.record(micros() - receivedAt);
+  binaryStatus = binary;
+  perGateStatus = perGate;
+  // Una acción desconocida se rechaza con ack en el actuador
+  enqueueCommand(perGate ? topicGate : cmd.gateId, cmd.action, cmd.priority, cmd.holdS, cmd.commandId, cmd.sentAtUs,
+                 receivedAt);
+}
+
+// Lado de red: los rechazos inmediatos se confirman aquí mismo, sin pasar por
+// ackQueue (que tiene un único productor, el actuador). El payload ya se
+// interpretó, así que publicar desde el callback no pisa nada. Devuelve
+// true si el comando quedó en la cola del actuador.
+bool enqueueCommand(int gateId, GateAction action, CommandPriority priority, uint32_t holdS, uint32_t commandId,
+                    int64_t sentAtUs, unsigned long receivedAt) {
+  GateCommand cmd;
+  cmd.gateId = controllerAction(action) ? 0 : gateId;
+  cmd.action = action;
+  cmd.priority = priority;
+  cmd.holdS = holdS;
+  cmd.commandId = commandId;
+  cmd.sentAtUs = sentAtUs;
+  cmd.receivedAt = receivedAt;
+
+  AckResult rejection;
+  if (!admitCommand(recentCommands, commandQueue, cmd, rejection)) {
+    if (rejection == ACK_DUPLICATE) {
+      duplicateCommands++;
+      sendAck(makeAck(cmd, ACK_DUPLICATE));
+      return false;
+    }
+    if (rejection == ACK_REJECTED) invalidGateCommands++;
+    if (rejection == ACK_DROPPED) droppedCommands++;
+    if (commandId) sendAck(makeAck(cmd, rejection));
+    return false;
+  }
+  wakeGateTask();
+  return true;
+}
+
+// ==================== HAL DE PORTONES (ESP32) ====================
+int64_t halNowUs() {
+  return esp_timer_get_time();
+}
+
+void halServoWrite(int idx, uint32_t duty) {
+  ledcWrite(idx, duty);
+}
+
+void halServoRelease(int idx) {
+  ledcWrite(idx, 0);
+}
+
+void halMotionTimer(bool run) {
+  if (run == motionTimerRunning) return;
+  if (run) {
+    esp_timer_start_periodic(motionTimer, msToUs(MOTION_TICK_MS));
+  } else {
+    esp_timer_stop(motionTimer);
+  }
+  sampleCurrents(run);
+  motionTimerRunning = run;
+}
+
+void halRememberTarget(int idx, bool open) {
+  rtcGates.open[idx] = open;
+}
+
+void halRememberEmergency(bool active) {
+  rtcGates.emergency = active;
+}
+
+void halLogGate(LogEvent event, uint8_t gate, int32_t a, int32_t b) {
+  logEvent(gateLog, event, gate, a, b);
+}
+
+void drainCommands() {
+  GateCommand cmd;
+  while (commandQueue.pop(cmd)) {
+    activeCommandAt = cmd.receivedAt;
+    AckResult result = processCommand(cmd);
+    queueAck(cmd, result);
+  }
+  activeCommandAt = 0;
+}
+
+// Tras un arranque en frío todo parte cerrado. Tras un reinicio por
+// software los portones que iban a abierto se retoman abiertos y cierran
+// por su plazo normal; si el controlador viene de RESTORE_MAX_CRASHES
+// reinicios inesperados seguidos, cierran en cuanto arranca la tarea. Una
+// emergencia vigente gana a las dos cosas: abiertos y sin plazo.
+void setupServos() {
+  bool restore = rtcGates.magic == RTC_GATES_MAGIC;
+  bool closeNow = rtcDiag.crashStreak >= RESTORE_MAX_CRASHES;
+  rtcGates.magic = RTC_GATES_MAGIC;
+  emergencyActive = restore && rtcGates.emergency == 1;
+  rtcGates.emergency = emergencyActive;
+  int64_t now = esp_timer_get_time();
+  forEachGate([&](int i) {
+    const GateConfig& config = GATES[i];
+    bool open = restore && rtcGates.open[i] == 1;
+    rtcGates.open[i] = open;
+    float position = open ? config.openAngle : config.closedAngle;
+    ledcSetup(i, SERVO_PWM_FREQ, SERVO_PWM_BITS);
+    ledcAttachPin(config.pin, i);
+    gates[i].trajectory.start(position, position, 0, config.motion);
+    writeServo(i, position);
+    if (open) {
+      gates[i].state = OPEN;
+      gates[i].openSince = now;
+      armClose(i, now, closeNow ? 0 : config.openMs);
+      restoredGates++;
+    }
+    // Aún no corre ninguna tarea: la red arranca con esto como estado conocido
+    reportedStatus[i] = open ? STATUS_OPEN : STATUS_CLOSED;
+    LOG_GATE(EV_SERVO_INIT, i + 1, config.pin);
+  });
+  if (restoredGates > 0) LOG_GATE(EV_GATES_RESTORED, 0, restoredGates);
+  if (restoredGates > 0 && closeNow && !emergencyActive) LOG_GATE(EV_RESTORE_CLOSING, 0, rtcDiag.crashStreak);
+  if (emergencyActive) LOG_GATE(EV_EMERGENCY_RESTORED, 0);
+}
+
+uint8_t switchPin(int sw) {
+  const GateSensors& sensors = GATES[sw / 2].sensors;
+  return sw % 2 == 0 ? sensors.openSwitchPin : sensors.closedSwitchPin;
+}
+
+// Corre con la caché de flash posiblemente deshabilitada: solo IRAM y DRAM
+void IRAM_ATTR onSwitchEdge(void* arg) {
+  SwitchEdge edge = {(uint8_t)(uintptr_t)arg, (uint32_t)esp_timer_get_time()};
+  if (!switchEdges.push(edge)) switchEdgesDropped++;
+  BaseType_t woken = pdFALSE;
+  if (gateTaskHandle) vTaskNotifyGiveFromISR(gateTaskHandle, &woken);
+  if (woken) portYIELD_FROM_ISR();
+}
+
+// Antes que las tareas: los finales toman su nivel actual como estable
+void setupSensors() {
+  for (int sw = 0; sw < GATE_COUNT * 2; sw++) {
+    uint8_t pin = switchPin(sw);
+    if (pin == GATE_NO_SENSOR) continue;
+    pinMode(pin, INPUT_PULLUP);
+    limitSwitches[sw].reset(digitalRead(pin) == LOW);
+    attachInterruptArg(pin, onSwitchEdge, (void*)(uintptr_t)sw, CHANGE);
+  }
+
+  adc_digi_pattern_config_t patterns[GATE_COUNT] = {};
+  uint32_t patternCount = 0;
+  uint32_t channelMask = 0;
+  forEachGate([&](int i) {
+    uint8_t channel = GATES[i].sensors.currentChannel;
+    if (channel == GATE_NO_SENSOR) return;
+    channelMask |= 1UL << channel;
+    patterns[patternCount].atten = ADC_ATTEN_DB_11;
+    patterns[patternCount].channel = channel;
+    patterns[patternCount].unit = 0;  // ADC1
+    patterns[patternCount].bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+    patternCount++;
+  });
+  if (patternCount == 0) return;
+
+  adc_digi_init_config_t init = {};
+  init.max_store_buf_size = ADC_STORE_BYTES;
+  init.conv_num_each_intr = ADC_FRAME_BYTES;
+  init.adc1_chan_mask = channelMask;
+  adc_digi_configuration_t digi = {};
+  digi.conv_limit_en = true;  // obligatorio en el ESP32
+  digi.conv_limit_num = 250;
+  digi.pattern_num = patternCount;
+  digi.adc_pattern = patterns;
+  digi.sample_freq_hz = ADC_SAMPLE_HZ;
+  digi.conv_mode = ADC_CONV_SINGLE_UNIT_1;
+  digi.format = ADC_DIGI_OUTPUT_FORMAT_TYPE1;
+  currentSensing = adc_digi_initialize(&init) == ESP_OK && adc_digi_controller_configure(&digi) == ESP_OK;
+}
+
+// Desde halMotionTimer: sin movimiento no hay consumo que mirar
+void sampleCurrents(bool run) {
+  if (!currentSensing) return;
+  if (run) {
+    adc_digi_start();
+  } else {
+    adc_digi_stop();
+    memset(gateCurrentMa, 0, sizeof(gateCurrentMa));
+  }
+}
+
+// Vacía lo que el DMA dejó desde el tick anterior, sin esperar
+void readCurrents() {
+  uint32_t sum[ADC1_CHANNELS] = {};
+  uint32_t count[ADC1_CHANNELS] = {};
+  uint32_t length = 0;
+  for (;;) {
+    esp_err_t err = adc_digi_read_bytes(adcFrame, sizeof(adcFrame), &length, 0);
+    if (err == ESP_ERR_INVALID_STATE) {
+      adcOverruns++;  // el ringbuffer se llenó: se perdieron muestras, las leídas valen
+    } else if (err != ESP_OK) {
+      break;
+    }
+    for (uint32_t at = 0; at + SOC_ADC_DIGI_RESULT_BYTES <= length; at += SOC_ADC_DIGI_RESULT_BYTES) {
+      const adc_digi_output_data_t* sample = (const adc_digi_output_data_t*)&adcFrame[at];
+      uint8_t channel = sample->type1.channel;
+      if (channel >= ADC1_CHANNELS) continue;
+      sum[channel] += sample->type1.data;
+      count[channel]++;
+    }
+  }
+  forEachGate([&](int i) {
+    const GateSensors& sensors = GATES[i].sensors;
+    if (sensors.currentChannel == GATE_NO_SENSOR || count[sensors.currentChannel] == 0) return;
+    int32_t counts = (int32_t)(sum[sensors.currentChannel] / count[sensors.currentChannel]) - sensors.currentZero;
+    if (counts < 0) counts = -counts;  // el sentido de giro no importa
+    float ma = counts * sensors.maPerCount;
+    gateCurrentMa[i] = ma > UINT16_MAX ? UINT16_MAX : (uint16_t)ma;
+  });
+}
+
+// Cada tick de la tarea de portones, antes de updateMotion()
+void pollSensors() {
+  SwitchEdge edge;
+  while (switchEdges.pop(edge)) limitSwitches[edge.sw].edge(edge.atUs);
+  uint32_t nowUs = (uint32_t)esp_timer_get_time();
+  for (int sw = 0; sw < GATE_COUNT * 2; sw++) {
+    uint8_t pin = switchPin(sw);
+    if (pin == GATE_NO_SENSOR) continue;
+    if (!limitSwitches[sw].update(digitalRead(pin) == LOW, nowUs, LIMIT_DEBOUNCE_US)) continue;
+    LOG_GATE(EV_GATE_LIMIT, sw / 2 + 1, sw % 2 == 0 ? "abierto" : "cerrado",
+             limitSwitches[sw].active() ? "activo" : "libre");
+  }
+  if (currentSensing && motionTimerRunning) readCurrents();
+
+  int64_t now = esp_timer_get_time();
+  forEachGate([&](int i) {
+    uint8_t limits = (limitSwitches[i * 2].active() ? LIMIT_OPEN : 0) |
+                     (limitSwitches[i * 2 + 1].active() ? LIMIT_CLOSED : 0);
+    noteFeedback(i, limits, gateCurrentMa[i], now);
+  });
+
+  // En reposo no hay tick que vuelva a mirar un final que aún rebota
+  if (motionTimerRunning || !debounceTimer) return;
+  for (int sw = 0; sw < GATE_COUNT * 2; sw++) {
+    if (!limitSwitches[sw].settling()) continue;
+    esp_timer_start_once(debounceTimer, LIMIT_DEBOUNCE_US);
+    break;
+  }
+}
+
+// ==================== ENTRADAS LOCALES ====================
+const char* accessSourceName(AccessSource source) {
+  switch (source) {
+    case ACCESS_KEYPAD:
+      return "teclado";
+    case ACCESS_CARD:
+      return "tarjeta";
+    case ACCESS_BUTTON:
+      return "botón";
+    default:
+      return "QR";
+  }
+}
+
+void IRAM_ATTR pushInput(const InputEvent& event) {
+  if (!inputEvents.push(event)) inputEventsDropped++;
+  BaseType_t woken = pdFALSE;
+  if (gateTaskHandle) vTaskNotifyGiveFromISR(gateTaskHandle, &woken);
+  if (woken) portYIELD_FROM_ISR();
+}
+
+void IRAM_ATTR onButtonEdge(void* arg) {
+  pushInput({INPUT_BUTTON, (uint8_t)(uintptr_t)arg, 0, (uint32_t)esp_timer_get_time()});
+}
+
+// arg = portón * 2 + línea. Cada bit es un pulso a LOW de ~50 us
+void IRAM_ATTR onWiegandBit(void* arg) {
+  uintptr_t line = (uintptr_t)arg;
+  pushInput({INPUT_WIEGAND, (uint8_t)(line / 2), (uint8_t)(line % 2), (uint32_t)esp_timer_get_time()});
+}
+
+void setupInputPin(uint8_t pin, void (*isr)(void*), uintptr_t arg, int mode) {
+  pinMode(pin, INPUT_PULLUP);
+  attachInterruptArg(pin, isr, (void*)arg, mode);
+#if POWER_SAVE
+  // Sin esto el light sleep no ve la línea. El primer bit Wiegand se pierde
+  // mientras despierta: esa trama sale inválida y el lector repite.
+  gpio_wakeup_enable((gpio_num_t)pin, GPIO_INTR_LOW_LEVEL);
+#endif
+}
+
+void setupInputs() {
+  forEachGate([](int i) {
+    const GateInputs& inputs = GATES[i].inputs;
+    if (inputs.buttonPin != GATE_NO_SENSOR) {
+      setupInputPin(inputs.buttonPin, onButtonEdge, i, CHANGE);
+      buttons[i].held = digitalRead(inputs.buttonPin) == LOW;  // apretado al arrancar no abre
+    }
+    if (inputs.wiegandD0Pin != GATE_NO_SENSOR) {
+      setupInputPin(inputs.wiegandD0Pin, onWiegandBit, i * 2, FALLING);
+      setupInputPin(inputs.wiegandD1Pin, onWiegandBit, i * 2 + 1, FALLING);
+    }
+  });
+#if POWER_SAVE
+  esp_sleep_enable_gpio_wakeup();
+#endif
+}
+
+// Consulta y cuenta el uso bajo allowlistLock. Con la red ocupada en la
+// allowlist más de ALLOWLIST_LOCK_WAIT_MS, se deniega: que el visitante
+// vuelva a pasar la tarjeta es mejor que frenar el control de los portones.
+// El lector solo abre su propio portón: si por la paridad de usos al
+// visitante le toca el otro sentido, se deniega sin contar el uso, así
+// dentro/fuera sigue igual que para /gate/open-with-qr.
+bool authorizeLocal(LocalAccess& access, GateDirection direction) {
+  if (xSemaphoreTake(allowlistLock, pdMS_TO_TICKS(ALLOWLIST_LOCK_WAIT_MS)) != pdTRUE) {
+    access.decision = QR_UNKNOWN;
+    return false;
+  }
+  access.at = epochNow();
+  access.flags = clockKnown ? JOURNAL_FLAG_CLOCK_KNOWN : 0;
+  if (access.source != ACCESS_BUTTON) {
+    access.decision = qrAllowlist.check(access.code, access.at, clockKnown);
+    QrDecision expected = direction == GATE_EXIT ? QR_GRANTED_EXIT : QR_GRANTED_ENTRY;
+    if (access.decision == QR_GRANTED_ENTRY || access.decision == QR_GRANTED_EXIT) {
+      if (access.decision == expected) {
+        qrAllowlist.countUse(access.code);
+      } else {
+        access.decision = QR_WRONG_DIRECTION;
+      }
+    }
+    const QrEntry* entry = qrAllowlist.find(access.code);
+    access.uses = entry ? entry->uses : 0;
+  }
+  xSemaphoreGive(allowlistLock);
+  return access.decision == QR_GRANTED_ENTRY || access.decision == QR_GRANTED_EXIT;
+}
+
+// Abre el portón de la entrada por el mismo camino que un comando, sin
+// commandId ni ack. activeCommandAt queda en 0: statusLatency mide la red.
+void openFromInput(int idx, AccessSource source, uint32_t code, uint32_t edgeUs) {
+  LocalAccess access = {source, (uint8_t)(idx + 1), QR_UNKNOWN, 0, 0, code, 0, 0};
+  if (source == ACCESS_BUTTON) {
+    access.decision = GATES[idx].direction == GATE_EXIT ? QR_GRANTED_EXIT : QR_GRANTED_ENTRY;
+  }
+  if (authorizeLocal(access, GATES[idx].direction)) {
+    GateCommand cmd = {idx + 1, ACTION_OPEN, PRIORITY_RESIDENT, 0, 0, 0, (unsigned long)edgeUs};
+    processCommand(cmd);
+    access.latencyUs = (uint32_t)esp_timer_get_time() - edgeUs;
+    LOG_GATE(EV_INPUT_OPEN, idx + 1, accessSourceName(source), (int32_t)access.latencyUs, (int32_t)code);
+  } else {
+    LOG_GATE(EV_INPUT_DENIED, idx + 1, accessSourceName(source), qrDecisionName(access.decision));
+  }
+  if (!accessQueue.push(access)) droppedAccesses++;
+}
 
-  // Esperamos JSON: {"gateId": 1-4, "action": "OPEN"}
-  int gateId = doc["gateId"]; 
-  const char* action = doc["action"];
+void readWiegand(int idx, const WiegandRead& read, uint32_t edgeUs) {
+  if (read.kind == WIEGAND_CARD || read.kind == WIEGAND_PIN) {
+    openFromInput(idx, read.kind == WIEGAND_CARD ? ACCESS_CARD : ACCESS_KEYPAD, read.code, edgeUs);
+  } else if (read.kind == WIEGAND_INVALID) {
+    LOG_GATE(EV_INPUT_INVALID, idx + 1);
+  }
+}
 
-  if (action && gateId >= 1 && gateId <= NUM_GATES) {
-    processCommand(gateId, action);
+// Cada tick de la tarea de portones, tras drainCommands()
+void pollInputs() {
+  InputEvent event;
+  while (inputEvents.pop(event)) {
+    if (event.kind == INPUT_BUTTON) {
+      if (buttons[event.gate].edgeUs == 0) buttons[event.gate].edgeUs = event.atUs;
+      continue;
+    }
+    WiegandReader& reader = wiegandReaders[event.gate];
+    uint32_t lastBitUs = reader.lastBitUs();
+    readWiegand(event.gate, reader.bit(event.bit, event.atUs), lastBitUs);
   }
+
+  uint32_t nowUs = (uint32_t)esp_timer_get_time();
+  uint32_t wakeInUs = 0;  // 0: nada pendiente
+  forEachGate([&](int i) {
+    uint8_t pin = GATES[i].inputs.buttonPin;
+    if (pin != GATE_NO_SENSOR) {
+      ButtonState& button = buttons[i];
+      bool down = digitalRead(pin) == LOW;
+      uint32_t since = nowUs - button.changedUs;
+      if (down != button.held && since >= BUTTON_DEBOUNCE_US) {
+        // El primer flanco vale; lo que sigue dentro de BUTTON_DEBOUNCE_US es rebote
+        bool pressed = down && !button.held;
+        button.held = down;
+        button.changedUs = nowUs;
+        if (pressed) openFromInput(i, ACCESS_BUTTON, 0, button.edgeUs ? button.edgeUs : nowUs);
+        button.edgeUs = 0;
+      } else if (down != button.held) {
+        uint32_t remaining = BUTTON_DEBOUNCE_US - since;
+        if (wakeInUs == 0 || remaining < wakeInUs) wakeInUs = remaining;
+      } else {
+        button.edgeUs = 0;  // volvió solo: ruido
+      }
+    }
+
+    WiegandReader& reader = wiegandReaders[i];
+    if (!reader.pending()) return;
+    uint32_t lastBitUs = reader.lastBitUs();
+    readWiegand(i, reader.poll(nowUs), lastBitUs);
+    if (!reader.pending()) return;
+    uint32_t remaining = WIEGAND_FRAME_GAP_US - (nowUs - lastBitUs);
+    if (wakeInUs == 0 || remaining < wakeInUs) wakeInUs = remaining;
+  });
+
+  // En reposo nadie más despierta a la tarea para cerrar la trama
+  if (wakeInUs == 0 || !inputTimer) return;
+  esp_timer_stop(inputTimer);
+  esp_timer_start_once(inputTimer, wakeInUs);
 }
 
-void processCommand(int gateId, const char* action) {
-  int idx = gateId - 1; // convertimos a índice 0-based
-  if (idx < 0 || idx >= NUM_GATES) return;
+// Desde la red (rechazos inmediatos) o el actuador: la hora es la de la
+// actuación en los dos casos
+CommandAck makeAck(const GateCommand& cmd, AckResult result) {
+  int64_t at = wallClockUs();
+  int32_t oneWay = ONE_WAY_UNKNOWN;
+  if (at != 0 && cmd.sentAtUs != 0) {
+    int64_t elapsed = at - cmd.sentAtUs;
+    oneWay = elapsed > INT32_MAX ? INT32_MAX : elapsed < -INT32_MAX ? -INT32_MAX : (int32_t)elapsed;
+  }
+  return {cmd.commandId, (uint8_t)cmd.gateId, result, cmd.priority, (uint32_t)(micros() - cmd.receivedAt), oneWay, at};
+}
 
-  if (strcmp(action, "OPEN") == 0 && states[idx] == IDLE) {
-    Serial.printf("[%s] [GATE %d] Abriendo...\n", getTimestamp().c_str(), gateId);
-    gateServos[idx].write(POS_OPEN);
-    states[idx] = OPEN;
-    openTimers[idx] = millis();
-    publishStatus(gateId, "OPEN");
+// Lado del actuador. Los comandos sin commandId (API antigua) no llevan ack
+void queueAck(const GateCommand& cmd, AckResult result) {
+  if (cmd.commandId == 0) return;
+  if (!ackQueue.push(makeAck(cmd, result))) {
+    droppedAcks++;
   }
 }
 
-void updateGates() {
-  for (int i = 0; i < NUM_GATES; i++) {
-    if (states[i] == OPEN && (millis() - openTimers[i] >= GATE_OPEN_DURATION)) {
-      int gateId = i + 1;
-      Serial.printf("[%s] [GATE %d] Cerrando automáticamente...\n", getTimestamp().c_str(), gateId);
-      gateServos[i].write(POS_CLOSED);
-      states[i] = IDLE;
-      publishStatus(gateId, "CLOSED");
+// Se llama desde el actuador: solo anota el cambio, commitStatus() lo encola
+void publishStatus(int gateId, GateStatusCode status) {
+  for (uint8_t i = 0; i < pendingStatus.count; i++) {
+    if (pendingStatus.entries[i].gateId == gateId) {
+      pendingStatus.entries[i].status = status;
+      return;
     }
   }
+  if (pendingStatus.count < GATE_COUNT) {
+    pendingStatus.entries[pendingStatus.count++] = {(uint8_t)gateId, status};
+  }
+  if (pendingStatus.receivedAt == 0) pendingStatus.receivedAt = activeCommandAt;
 }
 
-void publishStatus(int gateId, const char* status) {
-  char statusMsg[80];
-  snprintf(statusMsg, sizeof(statusMsg), "{\"gateId\": %d, \"status\": \"%s\"}", gateId, status);
-  mqttClient.publish("portones/gate/status", statusMsg);
+// Fin de tick: a lo sumo un lote por tick hacia la red
+void commitStatus() {
+  if (pendingStatus.count == 0) return;
+  pendingStatus.atUs = wallClockUs();
+  if (!statusQueue.push(pendingStatus)) {
+    droppedStatus++;
+  }
+  pendingStatus.count = 0;
+  pendingStatus.receivedAt = 0;
 }
 
-void setupWiFi() {
-  WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
-  while (WiFi.status() != WL_CONNECTED) { delay(500); Serial.print("."); }
-  Serial.printf("\n[%s] [WiFi] Conectado\n", getTimestamp().c_str());
+void journalStatusBatch(const StatusBatch& batch) {
+  uint8_t flags = (clockKnown ? JOURNAL_FLAG_CLOCK_KNOWN : 0) | (netState != NET_READY ? JOURNAL_FLAG_OFFLINE : 0);
+  for (uint8_t i = 0; i < batch.count; i++) {
+    journalEvent({JOURNAL_STATUS, batch.entries[i].gateId, batch.entries[i].status, flags, epochNow(), 0, 0, ACCESS_QR});
+  }
 }
 
-void reconnectMQTT() {
-  while (!mqttClient.connected()) {
-    Serial.printf("[%s] [MQTT] Intentando conectar...\n", getTimestamp().c_str());
-    if (mqttClient.connect("ESP32_Gate_Multi", "pedropapas", "Pedro9090")) {
-      Serial.printf("[%s] [MQTT] ✓ Conectado al broker\n", getTimestamp().c_str());
-      mqttClient.subscribe(MQTT_TOPIC);
-      Serial.printf("[%s] [MQTT] Suscrito al topic: %s\n", getTimestamp().c_str(), MQTT_TOPIC);
+// Un solo portón conserva el formato de siempre; varios van en un lote
+// {"gates": [...]} (o tramas concatenadas) en el topic del controlador.
+void flushStatus() {
+  StatusBatch batch;
+  char statusMsg[64 + GATE_COUNT * 40];
+  char topic[128];
+  uint8_t frames[STATUS_FRAME_SIZE * GATE_COUNT];
+  while (statusQueue.pop(batch)) {
+    noteStatusBatch(batch);
+    // Con eventos sin confirmar, los estados nuevos van detrás de ellos para
+    // que la API los aplique en orden
+    if (journalBacklog()) {
+      journalStatusBatch(batch);
+      continue;
+    }
+    const char* suffix = binaryStatus ? ".bin" : "";
+    if (!perGateStatus) {
+      snprintf(topic, sizeof(topic), "%s%s", STATUS_TOPIC, suffix);
+    } else if (batch.count == 1) {
+      snprintf(topic, sizeof(topic), "%s%d/status%s", gateTopicPrefix, batch.entries[0].gateId, suffix);
+    } else {
+      snprintf(topic, sizeof(topic), "portones/%s/%s/status%s", config.coloniaId, controllerId, suffix);
+    }
+
+    if (binaryStatus) {
+      size_t len = 0;
+      for (uint8_t i = 0; i < batch.count; i++) {
+        len += encodeStatusFrame(batch.entries[i].gateId, batch.entries[i].status, frames + len, sizeof(frames) - len);
+      }
+      mqttClient.publish(topic, frames, len);
+      if (batch.receivedAt) statusLatency.record(micros() - batch.receivedAt);
+      continue;
+    }
+
+    int len;
+    if (batch.count == 1) {
+      len = snprintf(statusMsg, sizeof(statusMsg), "{\"gateId\": %d, \"status\": \"%s\"",
+                     batch.entries[0].gateId, gateStatusName(batch.entries[0].status));
     } else {
-      Serial.printf("[%s] [MQTT] ✗ Error de conexión (código: %d)\n", getTimestamp().c_str(), mqttClient.state());
-      delay(5000);
+      len = snprintf(statusMsg, sizeof(statusMsg), "{\"gates\": [");
+      for (uint8_t i = 0; i < batch.count; i++) {
+        len += snprintf(statusMsg + len, sizeof(statusMsg) - len, "%s{\"gateId\": %d, \"status\": \"%s\"}",
+                        i ? ", " : "", batch.entries[i].gateId, gateStatusName(batch.entries[i].status));
+      }
+      len += snprintf(statusMsg + len, sizeof(statusMsg) - len, "]");
+    }
+    if (batch.atUs != 0) len += snprintf(statusMsg + len, sizeof(statusMsg) - len, ", \"at\": %lld", (long long)batch.atUs);
+    snprintf(statusMsg + len, sizeof(statusMsg) - len, "}");
+    mqttClient.publish(topic, statusMsg);
+    if (batch.receivedAt) statusLatency.record(micros() - batch.receivedAt);
+  }
+}
+
+void flushAcks() {
+  CommandAck ack;
+  while (ackQueue.pop(ack)) {
+    if (ack.result == ACK_EXECUTED || ack.result == ACK_MERGED) {
+      actuationLatency.record(ack.latencyUs);
+      priorityLatency[ack.priority].record(ack.latencyUs);
+      // EMERGENCY/RESUME (canal 0) cambian el "emergency" del snapshot
+      if (ack.gateId == 0) stateSnapshotDirty = true;
+      if (ack.oneWayUs >= 0) {
+        oneWayLatency.record((uint32_t)ack.oneWayUs);
+      } else if (ack.oneWayUs != ONE_WAY_UNKNOWN) {
+        negativeOneWay++;
+      }
     }
+    sendAck(ack);
+  }
+}
+
+int appendHistogram(char* out, size_t size, const char* name, const LatencyHistogram& h, bool last) {
+  return snprintf(out, size, "\"%s\": {\"n\": %lu, \"p50\": %lu, \"p90\": %lu, \"p99\": %lu, \"max\": %lu}%s", name,
+                  (unsigned long)h.count(), (unsigned long)h.percentile(50), (unsigned long)h.percentile(90),
+                  (unsigned long)h.percentile(99), (unsigned long)h.max(), last ? "" : ", ");
+}
+
+// Fracciones del intervalo (‰) con un portón fuera de reposo (sin light
+// sleep) y con CPU ocupada en las tareas, y el consumo que da el modelo
+int appendPower(char* out, size_t size, unsigned long intervalMs) {
+  uint32_t awakeTotal = gatesAwakeMsTotal + (gatesAwake ? millis() - gatesAwakeSince : 0);
+  uint32_t gateBusyTotal = gateBusyUsTotal;
+  uint32_t awakeMs = awakeTotal - lastGatesAwakeMs;
+  uint32_t busyMs = ((netBusyUsTotal - lastNetBusyUs) + (gateBusyTotal - lastGateBusyUs)) / 1000;
+  lastGatesAwakeMs = awakeTotal;
+  lastNetBusyUs = netBusyUsTotal;
+  lastGateBusyUs = gateBusyTotal;
+
+  uint32_t interval = intervalMs > 0 ? intervalMs : 1;
+  busyMs = min(busyMs, interval);
+  awakeMs = min(awakeMs, interval);
+  uint32_t sleepMs = lightSleepEnabled ? interval - max(awakeMs, busyMs) : 0;
+  uint32_t idleMs = interval - busyMs - sleepMs;
+  uint32_t estimatedMa = (busyMs * POWER_BUSY_MA + idleMs * POWER_IDLE_MA + sleepMs * POWER_SLEEP_MA) / interval;
+  return snprintf(out, size,
+                  "\"power\": {\"saver\": %s, \"lightSleep\": %s, \"listenInterval\": %u, \"keepAliveS\": %u, "
+                  "\"gatesAwakePermille\": %lu, \"busyPermille\": %lu, \"estimatedMa\": %lu}, ",
+                  POWER_SAVE ? "true" : "false", lightSleepEnabled ? "true" : "false",
+                  POWER_SAVE ? WIFI_LISTEN_INTERVAL : 0, mqttKeepAliveS,
+                  (unsigned long)(awakeMs * 1000 / interval), (unsigned long)(busyMs * 1000 / interval),
+                  (unsigned long)estimatedMa);
+}
+
+// Un mensaje por intervalo con contadores, heap y percentiles por etapa.
+// Los histogramas se reinician: cada mensaje describe solo su intervalo.
+// Bytes de pila que la tarea nunca llegó a usar (en el ESP32 la pila se
+// mide en bytes). Sin tarea, 0: con nullptr FreeRTOS mediría la actual.
+uint32_t stackFree(TaskHandle_t task) {
+  return task ? (uint32_t)uxTaskGetStackHighWaterMark(task) : 0;
+}
+
+// Puede correr en cualquier tarea con el heap tomado: solo cuenta
+void onAllocFailed(size_t size, uint32_t caps, const char* function) {
+  heapAllocFailures++;
+  heapLastFailedSize = size;
+}
+
+void checkMemory() {
+  TaskHandle_t tasks[] = {netTaskHandle, gateTaskHandle, logTaskHandle, netWakeTaskHandle};
+  const char* const names[] = {"red", "portones", "registro", "despertador"};
+  for (int i = 0; i < 4; i++) {
+    uint32_t free = stackFree(tasks[i]);
+    if (!tasks[i] || free >= STACK_WARN_BYTES || stackWarned & (1 << i)) continue;
+    stackWarned |= 1 << i;
+    LOG_NET(EV_STACK_LOW, 0, names[i], (int32_t)free);
+  }
+  uint32_t failures = heapAllocFailures;
+  if (failures != heapFailuresReported) {
+    LOG_NET(EV_HEAP_ALLOC_FAILED, 0, (int32_t)(failures - heapFailuresReported), (int32_t)heapLastFailedSize);
+    heapFailuresReported = failures;
+  }
+}
+
+void publishMetrics() {
+  unsigned long now = millis();
+  uint32_t parseFailures = 0;
+  for (int i = PARSE_OK + 1; i < PARSE_RESULT_COUNT; i++) parseFailures += parseCounts[i];
+
+  auto& msg = netArena.metrics;
+  uint32_t freeHeap = ESP.getFreeHeap();
+  uint32_t maxAlloc = ESP.getMaxAllocHeap();
+  if (maxAlloc < heapMinMaxAlloc) heapMinMaxAlloc = maxAlloc;
+  checkMemory();
+  int len = snprintf(msg, sizeof(msg),
+                     "{\"uptimeMs\": %lu, \"intervalMs\": %lu, "
+                     "\"heap\": {\"free\": %lu, \"min\": %lu, \"maxAlloc\": %lu, \"minMaxAlloc\": %lu, \"fragPct\": %lu, "
+                     "\"internalMin\": %lu, \"allocFailures\": %lu}, "
+                     "\"stackFree\": {\"net\": %lu, \"gate\": %lu, \"log\": %lu, \"wake\": %lu}, "
+                     "\"counters\": {\"reconnects\": %lu, \"tlsHandshakes\": %lu, \"tlsResumed\": %lu, "
+                     "\"parseFailures\": %lu, \"invalidGate\": %lu, \"droppedCommands\": %lu, \"droppedStatus\": %lu, "
+                     "\"droppedAcks\": %lu, \"duplicates\": %lu, \"coalesced\": %lu, \"extended\": %lu}, "
+                     "\"journal\": {\"seq\": %lu, \"acked\": %lu, \"replayed\": %lu, \"rewinds\": %lu, "
+                     "\"lost\": %lu, \"writeErrors\": %lu}, "
+                     "\"loopMaxUs\": {\"net\": %lu, \"gate\": %lu}, \"deadlineLateMaxUs\": %lu, "
+                     "\"stall\": {\"net\": {\"stage\": \"%s\", \"us\": %lu}, \"gate\": {\"stage\": \"%s\", \"us\": %lu}, "
+                     "\"failsafeCloses\": %lu}, "
+                     "\"sensors\": {\"obstructions\": %lu, \"edgesDropped\": %lu, \"adcOverruns\": %lu}, "
+                     "\"local\": {\"opens\": %lu, \"denied\": %lu, \"droppedInputs\": %lu, \"droppedAccesses\": %lu}, ",
+                     now, now - lastMetricsAt, (unsigned long)freeHeap, (unsigned long)ESP.getMinFreeHeap(),
+                     (unsigned long)maxAlloc, (unsigned long)heapMinMaxAlloc,
+                     (unsigned long)(freeHeap ? 100 - (uint64_t)maxAlloc * 100 / freeHeap : 0),
+                     (unsigned long)heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL),
+                     (unsigned long)heapAllocFailures, (unsigned long)stackFree(netTaskHandle),
+                     (unsigned long)stackFree(gateTaskHandle), (unsigned long)stackFree(logTaskHandle),
+                     (unsigned long)stackFree(netWakeTaskHandle), (unsigned long)netReconnects, (unsigned long)tlsHandshakes,
+                     (unsigned long)tlsResumed, (unsigned long)parseFailures, (unsigned long)invalidGateCommands,
+                     (unsigned long)droppedCommands, (unsigned long)droppedStatus, (unsigned long)droppedAcks,
+                     (unsigned long)duplicateCommands, (unsigned long)coalescedCommands, (unsigned long)extendedOpens,
+                     (unsigned long)journal.lastSeq(), (unsigned long)journalAckedSeq, (unsigned long)journalReplayed,
+                     (unsigned long)journalRewinds, (unsigned long)journalLost, (unsigned long)journal.writeErrors(),
+                     (unsigned long)netTickMaxUs, (unsigned long)gateTickMaxUs, (unsigned long)deadlineLatenessMaxUs,
+                     loopStageName(netStages.worstStage), (unsigned long)netStages.worstUs,
+                     loopStageName(gateStages.worstStage), (unsigned long)gateStages.worstUs,
+                     (unsigned long)failsafeCloses, (unsigned long)gateObstructions,
+                     (unsigned long)switchEdgesDropped, (unsigned long)adcOverruns, (unsigned long)localOpens,
+                     (unsigned long)localDenied, (unsigned long)inputEventsDropped, (unsigned long)droppedAccesses);
+  len += snprintf(msg + len, sizeof(msg) - len,
+                  "\"mqtt\": {\"buffer\": %u, \"streamed\": %lu, \"oversize\": %lu, \"qrRejected\": %lu}, "
+                  "\"emergency\": %s, ",
+                  (unsigned)MQTT_BUFFER_SIZE, (unsigned long)mqttStreamed, (unsigned long)mqttOversize,
+                  (unsigned long)qrDeltasRejected, emergencyActive ? "true" : "false");
+  // El ancla y la deriva solo las cambia esta tarea: se leen sin el spinlock
+  len += snprintf(msg + len, sizeof(msg) - len,
+                  "\"clock\": {\"synced\": %s, \"syncs\": %lu, \"steps\": %lu, \"driftPpb\": %ld, "
+                  "\"lastErrorUs\": %ld, \"sinceSyncS\": %lu, \"negativeOneWay\": %lu}, ",
+                  wallClock.synced() ? "true" : "false", (unsigned long)wallClock.syncs(),
+                  (unsigned long)wallClock.steps(), (long)wallClock.driftPpb(),
+                  (long)max(min(lastSyncErrorUs, (int64_t)INT32_MAX), (int64_t)-INT32_MAX),
+                  (unsigned long)(wallClock.synced() ? (esp_timer_get_time() - wallClock.anchoredAt()) / 1000000 : 0),
+                  (unsigned long)negativeOneWay);
+  len += appendPower(msg + len, sizeof(msg) - len, now - lastMetricsAt);
+  len += snprintf(msg + len, sizeof(msg) - len, "\"latencyUs\": {");
+  len += appendHistogram(msg + len, sizeof(msg) - len, "wake", wakeLatency, false);
+  len += appendHistogram(msg + len, sizeof(msg) - len, "receive", receiveLatency, false);
+  len += appendHistogram(msg + len, sizeof(msg) - len, "parse", parseLatency, false);
+  len += appendHistogram(msg + len, sizeof(msg) - len, "actuation", actuationLatency, false);
+  len += appendHistogram(msg + len, sizeof(msg) - len, "input", inputLatency, false);
+  len += appendHistogram(msg + len, sizeof(msg) - len, "status", statusLatency, false);
+  len += appendHistogram(msg + len, sizeof(msg) - len, "oneWay", oneWayLatency, true);
+  // Recepción a ejecución por prioridad: lo que la cola ordena
+  len += snprintf(msg + len, sizeof(msg) - len, "}, \"priorityUs\": {");
+  for (int i = 0; i < PRIORITY_COUNT; i++) {
+    len += appendHistogram(msg + len, sizeof(msg) - len, PRIORITY_METRIC_NAMES[i], priorityLatency[i],
+                           i == PRIORITY_COUNT - 1);
+  }
+  snprintf(msg + len, sizeof(msg) - len, "}}");
+
+  if (!publishStream(metricsTopic, msg, strlen(msg), false)) {
+    LOG_NET(EV_METRICS_FAILED, 0, len);
   }
-}
\ No newline at end of file
+  wakeLatency.reset();
+  receiveLatency.reset();
+  parseLatency.reset();
+  actuationLatency.reset();
+  inputLatency.reset();
+  statusLatency.reset();
+  oneWayLatency.reset();
+  for (int i = 0; i < PRIORITY_COUNT; i++) priorityLatency[i].reset();
+  netTickMaxUs = 0;
+  netStages.worstUs = 0;
+  lastMetricsAt = now;
+}
+
+// Latido retenido en healthTopic: lo mínimo para saber, sin esperar a las
+// métricas, que el controlador vive y cómo le va al enlace y a las colas
+void publishHeartbeat() {
+  unsigned long now = millis();
+  char msg[320];
+  int len = snprintf(msg, sizeof(msg),
+                     "{\"online\": true, \"uptimeS\": %lu, \"intervalS\": %lu, \"rssi\": %d, \"keepAliveS\": %u, "
+                     "\"loopMaxUs\": {\"net\": %lu, \"gate\": %lu}, "
+                     "\"queues\": {\"command\": %u, \"status\": %u, \"ack\": %u, \"access\": %u, \"log\": %u}",
+                     now / 1000, HEARTBEAT_INTERVAL / 1000, (int)WiFi.RSSI(), (unsigned)mqttKeepAliveS,
+                     (unsigned long)heartbeatNetMaxUs, (unsigned long)gateTickMaxUs, (unsigned)commandQueue.size(),
+                     (unsigned)statusQueue.size(), (unsigned)ackQueue.size(), (unsigned)accessQueue.size(),
+                     (unsigned)(netLog.queue.size() + gateLog.queue.size()));
+  int64_t at = wallClockUs();
+  if (at != 0) len += snprintf(msg + len, sizeof(msg) - len, ", \"at\": %lld", (long long)at);
+  snprintf(msg + len, sizeof(msg) - len, "}");
+  mqttClient.publish(healthTopic, msg, true);
+  heartbeatNetMaxUs = 0;
+  lastHeartbeatAt = now;
+}
+
+// Antes de cada CONNECT: ver SALUD
+void chooseKeepAlive() {
+  int8_t rssi = WiFi.RSSI();
+  uint16_t keepAlive = MQTT_KEEPALIVE_S >> shortSessions;
+  if (rssi < RSSI_WEAK_DBM) keepAlive = min(keepAlive, (uint16_t)(MQTT_KEEPALIVE_S / 3));
+  keepAlive = max(keepAlive, MQTT_KEEPALIVE_MIN_S);
+  if (keepAlive != mqttKeepAliveS) LOG_NET(EV_MQTT_KEEPALIVE, 0, (int32_t)keepAlive, (int32_t)rssi);
+  mqttKeepAliveS = keepAlive;
+  mqttClient.setKeepAlive(mqttKeepAliveS);
+}
+
+// Al perder una sesión que llegó a NET_READY
+void endMqttSession() {
+  if (millis() - mqttSessionSince < MQTT_SESSION_STABLE_MS) {
+    if (shortSessions < MQTT_SHORT_SESSIONS_MAX) shortSessions++;
+  } else {
+    shortSessions = 0;
+  }
+}
+
+void sendAck(const CommandAck& ack) {
+  char topic[128];
+  const char* suffix = binaryStatus ? ".bin" : "";
+  if (perGateStatus) {
+    snprintf(topic, sizeof(topic), "portones/%s/%s/ack%s", config.coloniaId, controllerId, suffix);
+  } else {
+    snprintf(topic, sizeof(topic), "%s%s", ACK_TOPIC, suffix);
+  }
+
+  if (binaryStatus) {
+    // Con hora sincronizada el ack lleva oneWayUs: el tamaño mayor
+    uint8_t frame[ACK_ONE_WAY_FRAME_SIZE];
+    size_t len = encodeAckFrame(ack.gateId, ack.result, ack.commandId, ack.latencyUs, ack.oneWayUs, frame,
+                                sizeof(frame));
+    if (len > 0) mqttClient.publish(topic, frame, len);
+    return;
+  }
+
+  char msg[192];
+  int len = snprintf(msg, sizeof(msg), "{\"commandId\": %lu, \"gateId\": %d, \"result\": \"%s\", \"latencyUs\": %lu",
+                     (unsigned long)ack.commandId, ack.gateId, ackResultName(ack.result), (unsigned long)ack.latencyUs);
+  if (ack.oneWayUs != ONE_WAY_UNKNOWN) {
+    len += snprintf(msg + len, sizeof(msg) - len, ", \"oneWayUs\": %ld", (long)ack.oneWayUs);
+  }
+  if (ack.atUs != 0) len += snprintf(msg + len, sizeof(msg) - len, ", \"at\": %lld", (long long)ack.atUs);
+  snprintf(msg + len, sizeof(msg) - len, "}");
+  mqttClient.publish(topic, msg);
+}
+
+// Para lo que no cabe en el buffer de PubSubClient: la cabecera sale por el
+// buffer y el payload se escribe directo al socket TLS
+bool publishStream(const char* topic, const char* payload, size_t length, bool retained) {
+  if (!mqttClient.beginPublish(topic, length, retained)) return false;
+  if (mqttClient.write((const uint8_t*)payload, length) != length) return false;
+  return mqttClient.endPublish() == 1;
+}
+
+// ==================== CONFIGURACIÓN ====================
+void seedConfig(ConfigKey key, const char* value) {
+  setConfigField(config, key, value, strlen(value));
+}
+
+// Los valores de compilación son la base; un blob válido en NVS los
+// reemplaza completos. Un schema distinto (otro layout) cuenta como ausente.
+void setupConfig() {
+  clearDeviceConfig(config);
+  seedConfig(CONFIG_WIFI_SSID, DEFAULT_WIFI_SSID);
+  seedConfig(CONFIG_WIFI_PASSWORD, DEFAULT_WIFI_PASSWORD);
+  seedConfig(CONFIG_MQTT_HOST, DEFAULT_MQTT_HOST);
+  seedConfig(CONFIG_MQTT_PORT, DEFAULT_MQTT_PORT);
+  seedConfig(CONFIG_MQTT_USER, DEFAULT_MQTT_USER);
+  seedConfig(CONFIG_MQTT_PASSWORD, DEFAULT_MQTT_PASSWORD);
+  seedConfig(CONFIG_COLONIA_ID, DEFAULT_COLONIA_ID);
+  seedConfig(CONFIG_QR_KEY, DEFAULT_QR_KEY);
+  seedConfig(CONFIG_CONFIG_KEY, DEFAULT_CONFIG_KEY);
+
+  configStore.begin("config", false);
+  DeviceConfig stored;
+  bool loaded = configStore.getBytesLength("device") == sizeof(stored) &&
+                configStore.getBytes("device", &stored, sizeof(stored)) == sizeof(stored) && deviceConfigValid(stored);
+  if (loaded) config = stored;
+  LOG_NET(EV_CONFIG_LOADED, 0, loaded ? "NVS" : "valores de compilación", (int32_t)config.version);
+  if (!configComplete(config)) LOG_NET(EV_CONFIG_PROVISIONING, 0);
+}
+
+// Guarda y adopta una configuración ya validada. El blob se escribe entero
+// en una sola entrada de NVS; la RAM solo cambia si la escritura tuvo éxito.
+bool commitConfig(const DeviceConfig& next) {
+  if (configStore.putBytes("device", &next, sizeof(next)) != sizeof(next)) return false;
+  configPendingScope |= configChanges(config, next);
+  config = next;
+  return true;
+}
+
+// Rehace solo lo que el cambio afecta, fuera de mqttCallback: cortar la
+// sesión desde dentro de mqttClient.loop() no es seguro. Los portones no se
+// enteran; sin enlace siguen cerrando por su plazo.
+void applyConfigChanges() {
+  if (netState == NET_PROVISION) {
+    if (!configComplete(config)) return;
+    configPendingScope |= CONFIG_SCOPE_WIFI;
+  }
+  uint8_t scope = configPendingScope;
+  if (scope == CONFIG_SCOPE_NONE) return;
+  configPendingScope = CONFIG_SCOPE_NONE;
+
+  if (scope & CONFIG_SCOPE_ADDRESS) setupAddressing();
+  if (scope & CONFIG_SCOPE_BROKER) {
+    mqttClient.setServer(config.mqttHost, config.mqttPort);
+    espClient.clearSession();  // el ticket es del broker anterior
+  }
+  if (netState == NET_READY) mqttClient.disconnect();
+  espClient.stop();
+  netBackoffMs = NET_BACKOFF_MIN;
+  if (scope & CONFIG_SCOPE_WIFI) {
+    WiFi.disconnect();
+    setNetState(NET_WIFI_START);
+  } else if (netState != NET_WIFI_START && netState != NET_WIFI_WAIT) {
+    // Una asociación en curso sigue: usará lo nuevo al llegar al broker
+    setNetState(NET_TLS_CONNECT);
+  }
+  LOG_NET(EV_CONFIG_APPLIED, 0, (int32_t)config.version, (int32_t)scope);
+}
+
+void publishConfigAck(uint32_t version, const char* result, const char* reason) {
+  char msg[128];
+  snprintf(msg, sizeof(msg), "{\"version\": %lu, \"result\": \"%s\", \"reason\": \"%s\"}", (unsigned long)version,
+           result, reason);
+  mqttClient.publish(configAckTopic, msg);
+}
+
+void rejectConfig(uint32_t version, const char* reason) {
+  configRejected++;
+  LOG_NET(EV_CONFIG_REJECTED, 0, reason);
+  publishConfigAck(version, "REJECTED", reason);
+}
+
+// Todos los campos se validan sobre una copia: la actualización se adopta
+// completa o no se adopta. La versión debe crecer, así que una trama vieja
+// repetida por el broker no deshace un cambio posterior.
+void handleConfigUpdate(const uint8_t* payload, unsigned int length) {
+  ConfigHeader header;
+  if (!decodeConfigHeader(payload, length, header)) {
+    rejectConfig(0, "trama inválida");
+    return;
+  }
+  if (!verifyFrameMac(payload, length, config.configKey)) {
+    rejectConfig(header.version, "firma inválida");
+    return;
+  }
+  if (header.version == config.version) {
+    publishConfigAck(header.version, "APPLIED", "");  // reentrega QoS 1
+    return;
+  }
+  if (header.version < config.version) {
+    rejectConfig(header.version, "versión anterior");
+    return;
+  }
+
+  DeviceConfig next = config;
+  size_t offset = CONFIG_HEADER_SIZE;
+  for (uint16_t i = 0; i < header.count; i++) {
+    ConfigFieldValue field;
+    offset = decodeConfigField(payload, offset, field);
+    if (!configField((ConfigKey)field.key) ||
+        !setConfigField(next, (ConfigKey)field.key, (const char*)field.value, field.length)) {
+      rejectConfig(header.version, "campo inválido");
+      return;
+    }
+  }
+  if (!configComplete(next)) {
+    rejectConfig(header.version, "falta red o broker");
+    return;
+  }
+  next.version = header.version;
+  if (!commitConfig(next)) {
+    rejectConfig(header.version, "no se pudo guardar");
+    return;
+  }
+  advanceClock(header.issuedAt);
+  // Sale por los topics de siempre: el cambio de dirección se aplica después
+  publishConfigAck(header.version, "APPLIED", "");
+}
+
+// La consola responde directo por Serial: es interactiva y solo se usa al
+// aprovisionar, no compite con el registro en régimen normal
+void handleConsoleLine(const char* line) {
+  if (strncmp(line, "config ", 7) != 0) {
+    Serial.println("? config set <campo> <valor> | config show | config commit | config discard");
+    return;
+  }
+  const char* command = line + 7;
+  if (strncmp(command, "set ", 4) == 0) {
+    const char* name = command + 4;
+    const char* space = strchr(name, ' ');
+    size_t nameLength = space ? (size_t)(space - name) : strlen(name);
+    const char* value = space ? space + 1 : "";
+    const ConfigFieldInfo* field = configFieldByName(name, nameLength);
+    if (!consoleStaged) consoleConfig = config;
+    if (!field || !setConfigField(consoleConfig, field->key, value, strlen(value))) {
+      Serial.printf("✗ %.*s: campo o valor inválido\n", (int)nameLength, name);
+      return;
+    }
+    consoleStaged = true;
+    Serial.printf("%s listo, \"config commit\" para aplicar\n", field->name);
+  } else if (strcmp(command, "show") == 0) {
+    const DeviceConfig& shown = consoleStaged ? consoleConfig : config;
+    char value[72];
+    for (size_t i = 0; i < CONFIG_FIELD_COUNT; i++) {
+      formatConfigField(shown, CONFIG_FIELDS[i].key, value, sizeof(value));
+      Serial.printf("%s = %s\n", CONFIG_FIELDS[i].name, value);
+    }
+    Serial.printf("v%lu%s\n", (unsigned long)shown.version, consoleStaged ? " (cambios sin aplicar)" : "");
+  } else if (strcmp(command, "commit") == 0) {
+    if (!consoleStaged) {
+      Serial.println("Sin cambios");
+    } else if (!configComplete(consoleConfig)) {
+      Serial.println("✗ Falta red o broker");
+    } else if (!commitConfig(consoleConfig)) {
+      Serial.println("✗ No se pudo guardar");
+    } else {
+      consoleStaged = false;
+      Serial.println("✓ Guardada");
+    }
+  } else if (strcmp(command, "discard") == 0) {
+    consoleStaged = false;
+    Serial.println("Cambios descartados");
+  } else {
+    Serial.println("? config set <campo> <valor> | config show | config commit | config discard");
+  }
+}
+
+// Lee lo disponible sin bloquear; una orden por línea
+void pollConsole() {
+  while (Serial.available() > 0) {
+    int c = Serial.read();
+    if (c != '\n' && c != '\r') {
+      if (consoleLineLength < sizeof(consoleLine) - 1) consoleLine[consoleLineLength++] = (char)c;
+      continue;
+    }
+    if (consoleLineLength == 0) continue;
+    consoleLine[consoleLineLength] = '\0';
+    consoleLineLength = 0;
+    handleConsoleLine(consoleLine);
+  }
+}
+
+// ==================== ALLOWLIST QR ====================
+void setupQrAllowlist() {
+  Serial2.begin(QR_READER_BAUD, SERIAL_8N1, QR_READER_RX_PIN, -1);
+
+  qrStore.begin("qr", false);
+  size_t bytes = qrStore.getBytesLength("entries");
+  if (bytes > 0 && bytes % sizeof(QrEntry) == 0 && bytes <= QR_ALLOWLIST_MAX * sizeof(QrEntry) &&
+      qrStore.getBytes("entries", qrAllowlist.buffer(), bytes) == bytes && qrAllowlist.adopt(bytes / sizeof(QrEntry))) {
+    qrAllowlist.setVersion(qrStore.getUInt("version", 0));
+  }
+  clockRef = qrStore.getUInt("issuedAt", 0);
+  clockRefAt = 0;  // el arranque: la hora real es al menos ref + uptime
+  allowlistLock = xSemaphoreCreateMutex();
+  LOG_NET(EV_QR_LOADED, 0, (int32_t)qrAllowlist.version(), (int32_t)qrAllowlist.size());
+}
+
+uint32_t epochNow() {
+  return clockRef + (uint32_t)((esp_timer_get_time() - clockRefAt) / 1000000);
+}
+
+// La hora de un emisor solo adelanta la referencia, nunca la atrasa.
+// clockRefAt es de 64 bits: la tarea de portones no debe verla a medias.
+void advanceClock(uint32_t epoch) {
+  if (epoch <= epochNow()) return;
+  xSemaphoreTake(allowlistLock, portMAX_DELAY);
+  clockRef = epoch;
+  clockRefAt = esp_timer_get_time();
+  xSemaphoreGive(allowlistLock);
+}
+
+// ==================== HORA DE PARED ====================
+// Una vez, con el primer enlace WiFi: lwIP sigue sincronizando solo
+void startSntp() {
+  if (sntpStarted) return;
+  sntpStarted = true;
+  sntp_setoperatingmode(SNTP_OPMODE_POLL);
+  sntp_setservername(0, NTP_SERVER);
+  sntp_set_sync_interval(SNTP_SYNC_INTERVAL_MS);
+  sntp_set_time_sync_notification_cb(onSntpSync);
+  sntp_init();
+}
+
+// Corre en la tarea de lwIP: solo avisa a la red
+void onSntpSync(struct timeval* tv) {
+  sntpPending = true;
+  wakeNetTask();
+}
+
+// gettimeofday() sigue al reloj local desde que SNTP la fijó, así que la
+// muestra vale aunque se tome unos ticks después del aviso
+void applySntpSync() {
+  sntpPending = false;
+  struct timeval tv;
+  gettimeofday(&tv, nullptr);
+  int64_t localUs = esp_timer_get_time();
+  int64_t epochUs = (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+  portENTER_CRITICAL(&wallClockMux);
+  int64_t error = wallClock.sync(localUs, epochUs);
+  portEXIT_CRITICAL(&wallClockMux);
+  lastSyncErrorUs = error;
+  if (error > CLOCK_STEP_LOG_US || error < -CLOCK_STEP_LOG_US) {
+    LOG_NET(EV_CLOCK_STEP, 0, (int32_t)(error / 1000));
+  } else {
+    LOG_NET(EV_CLOCK_SYNCED, 0, (int32_t)error, wallClock.driftPpb());
+  }
+}
+
+// Epoch µs de un instante de esp_timer_get_time(); 0 sin sincronizar.
+// Desde cualquier tarea: la copia del ancla se toma bajo el spinlock
+int64_t wallClockUsAt(int64_t localUs) {
+  portENTER_CRITICAL(&wallClockMux);
+  int64_t epochUs = wallClock.synced() ? wallClock.toEpochUs(localUs) : 0;
+  portEXIT_CRITICAL(&wallClockMux);
+  return epochUs;
+}
+
+int64_t wallClockUs() {
+  return wallClockUsAt(esp_timer_get_time());
+}
+
+// Deltas QR y configuración: el mensaje termina en el HMAC-SHA256 de lo anterior
+static_assert(QR_DELTA_MAC_SIZE == CONFIG_MAC_SIZE, "ambas tramas firman con HMAC-SHA256");
+
+bool verifyFrameMac(const uint8_t* payload, size_t length, const char* key) {
+  MqttPayload frame = {payload, length, length};
+  return verifyPayloadMac(frame, key);
+}
+
+// Lo que está en el buffer se firma en su lugar; lo de mqttInbox, por trozos
+bool verifyPayloadMac(const MqttPayload& payload, const char* key) {
+  if (key[0] == '\0') return false;  // sin clave no se acepta nada firmado
+  if (payload.length < QR_DELTA_MAC_SIZE) return false;
+  size_t signedLength = payload.length - QR_DELTA_MAC_SIZE;
+  size_t inBuffer = std::min(signedLength, payload.buffered);
+  uint8_t mac[QR_DELTA_MAC_SIZE];
+  uint8_t expected[QR_DELTA_MAC_SIZE];
+  uint8_t chunk[INBOX_WINDOW];
+
+  mbedtls_md_context_t ctx;
+  mbedtls_md_init(&ctx);
+  bool ok = mbedtls_md_setup(&ctx, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 1) == 0 &&
+            mbedtls_md_hmac_starts(&ctx, (const unsigned char*)key, strlen(key)) == 0 &&
+            mbedtls_md_hmac_update(&ctx, payload.data, inBuffer) == 0;
+  for (size_t offset = inBuffer; ok && offset < signedLength; offset += sizeof(chunk)) {
+    size_t count = std::min(sizeof(chunk), signedLength - offset);
+    ok = payload.read(offset, chunk, count) && mbedtls_md_hmac_update(&ctx, chunk, count) == 0;
+  }
+  ok = ok && mbedtls_md_hmac_finish(&ctx, mac) == 0 && payload.read(signedLength, expected, sizeof(expected));
+  mbedtls_md_free(&ctx);
+  if (!ok) return false;
+  // Comparación en tiempo constante
+  uint8_t diff = 0;
+  for (size_t i = 0; i < QR_DELTA_MAC_SIZE; i++) diff |= mac[i] ^ expected[i];
+  return diff == 0;
+}
+
+// Una delta que llegó por mqttInbox se lee dos veces de la flash: primero
+// para la firma, después por lotes para aplicarla
+void handleQrDelta(const MqttPayload& payload) {
+  uint8_t head[QR_DELTA_HEADER_SIZE];
+  QrDeltaHeader header;
+  if (!payload.read(0, head, sizeof(head)) || !decodeQrDeltaHeader(head, payload.length, header)) {
+    qrDeltasRejected++;
+    LOG_NET(EV_QR_DELTA_REJECTED, 0, "trama inválida");
+    return;
+  }
+  if (!verifyPayloadMac(payload, config.qrKey)) {
+    qrDeltasRejected++;
+    LOG_NET(EV_QR_DELTA_REJECTED, 0, "firma inválida");
+    return;
+  }
+  bool reset = header.flags & QR_DELTA_RESET;
+  if (!reset && header.baseVersion != qrAllowlist.version()) {
+    // Nos perdimos una delta: solo una lista completa nos pone al día
+    LOG_NET(EV_QR_DELTA_REJECTED, 0, "versión base distinta");
+    requestQrSync();
+    return;
+  }
+
+  // Las altas y bajas desplazan el arreglo: authorizeLocal() espera. Cada
+  // lote se lee antes de tomar el lock, así la flash no alarga la espera.
+  uint8_t ops[QR_DELTA_BATCH * QR_DELTA_OP_SIZE];
+  // Con QR_DELTA_RESET, entre lotes la lista está a medio llenar: un código
+  // de un lote aún no aplicado se niega durante esos microsegundos.
+  for (size_t first = 0; first < header.count || (first == 0 && reset); first += QR_DELTA_BATCH) {
+    size_t count = std::min<size_t>(QR_DELTA_BATCH, header.count - first);
+    if (!payload.read(QR_DELTA_HEADER_SIZE + first * QR_DELTA_OP_SIZE, ops, count * QR_DELTA_OP_SIZE)) {
+      // Ya firmada, solo falla la flash: lo aplicado no es ninguna versión
+      xSemaphoreTake(allowlistLock, portMAX_DELAY);
+      qrAllowlist.setVersion(0);
+      xSemaphoreGive(allowlistLock);
+      qrDeltasRejected++;
+      LOG_NET(EV_QR_DELTA_REJECTED, 0, "lectura de inbox");
+      requestQrSync();
+      return;
+    }
+    xSemaphoreTake(allowlistLock, portMAX_DELAY);
+    if (reset && first == 0) qrAllowlist.clear();
+    for (size_t i = 0; i < count; i++) {
+      QrDeltaOp op = decodeQrDeltaOpAt(ops + i * QR_DELTA_OP_SIZE);
+      if (op.kind == QR_OP_REMOVE) {
+        qrAllowlist.remove(op.code);
+      } else if (op.kind == QR_OP_UPSERT) {
+        if (!qrAllowlist.upsert({op.code, op.validFrom, op.expiresAt, op.uses, op.maxUses})) {
+          LOG_NET(EV_QR_DELTA_REJECTED, 0, "allowlist llena");
+        }
+      }
+    }
+    xSemaphoreGive(allowlistLock);
+  }
+  xSemaphoreTake(allowlistLock, portMAX_DELAY);
+  qrAllowlist.setVersion(header.newVersion);
+  clockKnown = true;
+  xSemaphoreGive(allowlistLock);
+  advanceClock(header.issuedAt);
+  applyDesiredState();  // lo que esperaba a tener hora
+  qrSyncRequested = false;
+  if (!qrDirty) qrDirtySince = millis();
+  qrDirty = true;
+  LOG_NET(EV_QR_DELTA_APPLIED, 0, (int32_t)header.newVersion, (int32_t)qrAllowlist.size());
+}
+
+// Pide a la API las deltas desde nuestra versión (o la lista completa)
+void requestQrSync() {
+  if (netState != NET_READY && netState != NET_MQTT_CONNECT) return;
+  if (qrSyncRequested && millis() - qrSyncRequestedAt < QR_SYNC_MIN_INTERVAL) return;
+  char msg[48];
+  snprintf(msg, sizeof(msg), "{\"version\": %lu}", (unsigned long)qrAllowlist.version());
+  mqttClient.publish(qrSyncTopic, msg);
+  qrSyncRequested = true;
+  qrSyncRequestedAt = millis();
+  LOG_NET(EV_QR_SYNC_REQUEST, 0, (int32_t)qrAllowlist.version());
+}
+
+// Escribir 8 KB en NVS tarda; se hace una vez pasada la ráfaga de deltas.
+// Sin allowlistLock: solo esta tarea mueve entradas, y lo único que cambia
+// la de portones es `uses`, que a lo sumo queda uno atrás y se vuelve a
+// guardar con el acceso que lo marcó sucio.
+void persistQrAllowlist() {
+  if (!qrDirty || millis() - qrDirtySince < QR_PERSIST_DELAY) return;
+  qrStore.putBytes("entries", qrAllowlist.entries(), qrAllowlist.size() * sizeof(QrEntry));
+  qrStore.putUInt("version", qrAllowlist.version());
+  qrStore.putUInt("issuedAt", epochNow());
+  qrDirty = false;
+}
+
+// El uso se cuenta solo si la apertura quedó en la cola: con el nivel
+// VISITOR lleno, el visitante no pierde un uso ni se le invierte el sentido.
+// enqueueCommand no bloquea, así que va dentro de allowlistLock y nadie más
+// cuenta un uso del mismo código entre la consulta y el conteo.
+void authorizeQr(uint32_t code) {
+  uint32_t now = epochNow();
+  int gateId = 0;
+  xSemaphoreTake(allowlistLock, portMAX_DELAY);
+  QrDecision decision = qrAllowlist.check(code, now, clockKnown);
+  if (decision == QR_GRANTED_ENTRY || decision == QR_GRANTED_EXIT) {
+    int target = decision == QR_GRANTED_ENTRY ? QR_ENTRY_GATE : QR_EXIT_GATE;
+    // Mismo camino que un comando MQTT, sin commandId (no hay ack)
+    if (enqueueCommand(target, ACTION_OPEN, PRIORITY_VISITOR, 0, 0, 0, micros())) {
+      qrAllowlist.countUse(code);
+      gateId = target;
+    } else {
+      decision = QR_BUSY;
+    }
+  }
+  const QrEntry* entry = qrAllowlist.find(code);
+  uint16_t uses = entry ? entry->uses : 0;
+  xSemaphoreGive(allowlistLock);
+  if (gateId != 0) {
+    if (!qrDirty) qrDirtySince = millis();
+    qrDirty = true;  // el conteo de usos sobrevive a un reinicio
+  }
+  uint8_t flags = (clockKnown ? JOURNAL_FLAG_CLOCK_KNOWN : 0) | (netState != NET_READY ? JOURNAL_FLAG_OFFLINE : 0);
+  journalEvent({JOURNAL_ACCESS, (uint8_t)gateId, decision, flags, now, code, uses, ACCESS_QR});
+  LOG_NET(EV_QR_ACCESS, gateId, qrDecisionName(decision), (int32_t)code);
+}
+
+// Lee lo disponible del UART sin bloquear; el código es el último grupo
+// de dígitos de la línea (el QR puede traer una URL)
+void pollQrReader() {
+  while (Serial2.available() > 0) {
+    int c = Serial2.read();
+    if (c != '\n' && c != '\r') {
+      if (qrLineLength < sizeof(qrLine) - 1) qrLine[qrLineLength++] = (char)c;
+      continue;
+    }
+    if (qrLineLength == 0) continue;
+    qrLine[qrLineLength] = '\0';
+    size_t end = qrLineLength;
+    qrLineLength = 0;
+
+    while (end > 0 && (qrLine[end - 1] < '0' || qrLine[end - 1] > '9')) end--;
+    size_t start = end;
+    while (start > 0 && qrLine[start - 1] >= '0' && qrLine[start - 1] <= '9') start--;
+    if (end == start || end - start > QR_CODE_MAX_DIGITS) continue;
+
+    uint32_t code = 0;
+    for (size_t i = start; i < end; i++) code = code * 10 + (qrLine[i] - '0');
+    authorizeQr(code);
+  }
+}
+
+// Los accesos del botón y los lectores locales, ya resueltos en la tarea de
+// portones: acá solo quedan en el diario
+void drainLocalAccess() {
+  LocalAccess access;
+  while (accessQueue.pop(access)) {
+    bool granted = access.decision == QR_GRANTED_ENTRY || access.decision == QR_GRANTED_EXIT;
+    if (granted) {
+      localOpens++;
+      inputLatency.record(access.latencyUs);
+    } else {
+      localDenied++;
+    }
+    if (granted && access.source != ACCESS_BUTTON) {
+      if (!qrDirty) qrDirtySince = millis();
+      qrDirty = true;
+    }
+    uint8_t flags = access.flags | (netState != NET_READY ? JOURNAL_FLAG_OFFLINE : 0);
+    journalEvent({JOURNAL_ACCESS, granted ? access.gateId : (uint8_t)0, access.decision, flags, access.at, access.code,
+                  access.uses, access.source});
+  }
+}
+
+// ==================== DIARIO ====================
+void setupJournal() {
+  journalStore.begin("journal", false);
+  if (!journalFlash.begin(JOURNAL_PARTITION) || !journal.begin(&journalFlash)) {
+    LOG_NET(EV_JOURNAL_UNAVAILABLE, 0);
+    return;
+  }
+  journalId = journalStore.getUInt("id", 0);
+  journalAckedSeq = journalStore.getUInt("acked", 0);
+  // Partición nueva o borrada: la API debe olvidar las secuencias anteriores
+  if (journalId == 0 || journal.lastSeq() < journalAckedSeq) {
+    journalId = esp_random() | 1;
+    journalAckedSeq = 0;
+    journalStore.putUInt("id", journalId);
+    journalStore.putUInt("acked", journalAckedSeq);
+  }
+  journalSendSeq = journalAckedSeq + 1;
+  LOG_NET(EV_JOURNAL_LOADED, 0, (int32_t)journal.lastSeq(), (int32_t)(journal.lastSeq() - journalAckedSeq));
+}
+
+void journalEvent(const JournalEvent& event) {
+  uint8_t payload[JOURNAL_EVENT_SIZE];
+  encodeJournalEvent(event, payload);
+  if (journal.pendingWrites() == 0) journalPendingSince = millis();
+  if (journal.append(payload) == 0) journalLost++;
+}
+
+void journalStatus() {
+  if (!journal.ready()) return;  // sin diario esperan en la cola como siempre
+  StatusBatch batch;
+  while (statusQueue.pop(batch)) {
+    noteStatusBatch(batch);
+    journalStatusBatch(batch);
+  }
+}
+
+bool journalBacklog() {
+  return journal.ready() && journal.lastSeq() > journalAckedSeq;
+}
+
+// {"seq": n}: la API recibió e ingirió todo hasta n. Repetir lo ya
+// confirmado con envíos en vuelo significa que a la API le faltó un mensaje
+// (la publicación es QoS 0): se reenvía desde ahí sin esperar al timeout.
+void handleJournalAck(const uint8_t* payload, unsigned int length) {
+  char msg[48];
+  size_t n = length < sizeof(msg) - 1 ? length : sizeof(msg) - 1;
+  memcpy(msg, payload, n);
+  msg[n] = '\0';
+  const char* p = strstr(msg, "\"seq\"");
+  if (!p || !(p = strchr(p, ':'))) return;
+  uint32_t seq = strtoul(p + 1, nullptr, 10);
+  if (seq == journalAckedSeq && journalSendSeq > seq + 1) {
+    journalSendSeq = seq + 1;
+    journalRewinds++;
+    return;
+  }
+  if (seq <= journalAckedSeq || seq > journal.lastSeq()) return;
+
+  journalAckedSeq = seq;
+  if (journalSendSeq <= seq) journalSendSeq = seq + 1;
+  journalProgressAt = millis();
+  if (!journalAckDirty) journalAckDirtySince = millis();
+  journalAckDirty = true;
+}
+
+// Reenvía lo no confirmado en lotes, con una ventana acotada en vuelo. Si la
+// API deja de confirmar, se vuelve a lo último confirmado: la API descarta
+// las secuencias repetidas.
+void replayJournal() {
+  if (!journal.ready()) return;
+  if (journal.pendingWrites() > 0) journal.flush();  // con enlace no hay motivo para esperar
+
+  if (journalSendSeq > journalAckedSeq + 1 && millis() - journalProgressAt >= JOURNAL_ACK_TIMEOUT) {
+    journalSendSeq = journalAckedSeq + 1;
+    journalRewinds++;
+    LOG_NET(EV_JOURNAL_REWIND, 0, (int32_t)journalSendSeq);
+  }
+  if (journalSendSeq < journal.oldestSeq()) {
+    // El anillo dio la vuelta durante el corte
+    journalLost += journal.oldestSeq() - journalSendSeq;
+    LOG_NET(EV_JOURNAL_LOST, 0, (int32_t)(journal.oldestSeq() - journalSendSeq));
+    journalSendSeq = journal.oldestSeq();
+  }
+
+  auto& msg = netArena.journal;
+  for (int i = 0; i < JOURNAL_REPLAY_BATCHES; i++) {
+    if (journalSendSeq > journal.lastSeq()) break;
+    if (journalSendSeq - journalAckedSeq - 1 >= JOURNAL_REPLAY_WINDOW) break;
+    uint32_t nextSeq;
+    size_t count = journal.read(journalSendSeq, msg + JOURNAL_FRAME_HEADER_SIZE, JOURNAL_REPLAY_BATCH, nextSeq);
+    if (nextSeq == journalSendSeq) break;
+    encodeJournalFrameHeader(count, journalId, journalSendSeq, nextSeq - 1, msg, sizeof(msg));
+    if (!mqttClient.publish(journalTopic, msg, JOURNAL_FRAME_HEADER_SIZE + count * JOURNAL_RECORD_SIZE)) break;
+    if (journalSendSeq == journalAckedSeq + 1) journalProgressAt = millis();
+    journalSendSeq = nextSeq;
+    journalReplayed += count;
+  }
+}
+
+// Sin enlace el lote espera en RAM hasta llenarse o JOURNAL_FLUSH_DELAY;
+// la secuencia confirmada se guarda pasada la ráfaga de acks
+void persistJournal() {
+  if (journal.pendingWrites() > 0 && millis() - journalPendingSince >= JOURNAL_FLUSH_DELAY) journal.flush();
+  if (journalAckDirty && millis() - journalAckDirtySince >= JOURNAL_PERSIST_DELAY) {
+    journalStore.putUInt("acked", journalAckedSeq);
+    journalAckDirty = false;
+  }
+}
+
+// ==================== ESTADO RETENIDO ====================
+void noteStatusBatch(const StatusBatch& batch) {
+  for (uint8_t i = 0; i < batch.count; i++) {
+    if (batch.entries[i].gateId >= 1 && batch.entries[i].gateId <= GATE_COUNT) {
+      reportedStatus[batch.entries[i].gateId - 1] = batch.entries[i].status;
+    }
+  }
+  stateSnapshotDirty = true;
+}
+
+// Un mensaje retenido con todos los portones: la API (o cualquier
+// suscriptor nuevo) queda al día con solo suscribirse
+// Posición según los finales de carrera, como valor JSON; null sin finales
+const char* limitName(int idx) {
+  const GateSensors& sensors = GATES[idx].sensors;
+  if (sensors.openSwitchPin == GATE_NO_SENSOR && sensors.closedSwitchPin == GATE_NO_SENSOR) return "null";
+  uint8_t limits = gates[idx].limits;
+  return limits & LIMIT_OPEN ? "\"open\"" : limits & LIMIT_CLOSED ? "\"closed\"" : "\"between\"";
+}
+
+void publishStateSnapshot() {
+  auto& msg = netArena.snapshot;
+  int len = snprintf(msg, sizeof(msg),
+                     "{\"fw\": \"%s\", \"config\": %lu, \"uptimeMs\": %lu, "
+                     "\"boot\": {\"readyMs\": %lu, \"consistentMs\": %lu, \"restored\": %u}, "
+                     "\"reset\": {\"reason\": \"%s\", \"boots\": %lu, \"crashes\": %lu, ",
+                     FIRMWARE_VERSION, (unsigned long)config.version, millis(), bootReadyMs, bootConsistentMs,
+                     restoredGates, resetReasonName(resetReason), (unsigned long)resetHistory.boots,
+                     (unsigned long)resetHistory.crashes);
+  if (resetHistory.crashes > 0) {
+    len += snprintf(msg + len, sizeof(msg) - len,
+                    "\"lastCrash\": {\"reason\": \"%s\", \"uptimeS\": %lu, \"net\": \"%s\", \"gate\": \"%s\"}}, ",
+                    resetReasonName(resetHistory.crashReason), (unsigned long)resetHistory.crashUptimeS,
+                    loopStageName(resetHistory.crashNetStage), loopStageName(resetHistory.crashGateStage));
+  } else {
+    len += snprintf(msg + len, sizeof(msg) - len, "\"lastCrash\": null}, ");
+  }
+  len += snprintf(msg + len, sizeof(msg) - len, "\"emergency\": %s, \"gates\": [", emergencyActive ? "true" : "false");
+  for (int i = 0; i < GATE_COUNT; i++) {
+    len += snprintf(msg + len, sizeof(msg) - len,
+                    "%s{\"gateId\": %d, \"kind\": \"%s\", \"type\": \"%s\", \"status\": \"%s\", \"limit\": %s, "
+                    "\"currentMa\": %u}",
+                    i ? ", " : "", i + 1, gateKindName(GATES[i].kind), gateDirectionName(GATES[i].direction),
+                    gateStatusName(reportedStatus[i]), limitName(i), (unsigned)gates[i].currentMa);
+  }
+  len += snprintf(msg + len, sizeof(msg) - len, "]}");
+  if (publishStream(stateTopic, msg, std::min((size_t)len, sizeof(msg) - 1), true)) stateSnapshotDirty = false;
+}
+
+void handleDesiredState(const uint8_t* payload, unsigned int length) {
+  DesiredHeader header;
+  if (!decodeDesiredHeader(payload, length, header)) {
+    LOG_NET(EV_BIN_FRAME_INVALID, 0, (int32_t)length);
+    return;
+  }
+  // Puede ser un retenido viejo: adelanta la hora pero no la da por conocida
+  advanceClock(header.issuedAt);
+  desiredCount = 0;
+  for (uint8_t i = 0; i < header.count && desiredCount < GATE_COUNT; i++) {
+    desiredGates[desiredCount++] = decodeDesiredEntry(payload, i);
+  }
+  desiredReceived = true;
+  applyDesiredState();
+}
+
+// Abre lo que debería estar abierto. Un plazo solo se puede evaluar con hora
+// conocida; hasta entonces la entrada queda pendiente. CLOSED no requiere
+// acción: los portones cierran solos.
+void applyDesiredState() {
+  uint8_t kept = 0;
+  uint32_t now = epochNow();
+  for (uint8_t i = 0; i < desiredCount; i++) {
+    DesiredEntry entry = desiredGates[i];
+    if (entry.status != STATUS_OPEN || entry.gateId < 1 || entry.gateId > GATE_COUNT) continue;
+    if (entry.until != 0 && !clockKnown) {
+      desiredGates[kept++] = entry;
+      continue;
+    }
+    if (entry.until != 0 && now >= entry.until) continue;
+    GateStatusCode current = reportedStatus[entry.gateId - 1];
+    // Detenido a mano o atascado: no se reabre solo
+    if (current == STATUS_OPEN || current == STATUS_OPENING || current == STATUS_STOPPED ||
+        current == STATUS_OBSTRUCTED) {
+      continue;
+    }
+    LOG_NET(EV_DESIRED_OPEN, entry.gateId);
+    enqueueCommand(entry.gateId, ACTION_OPEN, PRIORITY_RESIDENT, 0, 0, 0, micros());
+  }
+  desiredCount = kept;
+}
+
+// Arranque "listo y consistente": enlace arriba, estado deseado resuelto (o
+// sin retenido tras DESIRED_STATE_WAIT) y snapshot publicado
+void updateConsistency() {
+  if (bootConsistentMs != 0) return;
+  if (!desiredReceived && millis() - bootReadyMs < DESIRED_STATE_WAIT) return;
+  bootConsistentMs = millis();
+  stateSnapshotDirty = true;
+  LOG_NET(EV_STATE_CONSISTENT, 0, (int32_t)bootConsistentMs, (int32_t)bootReadyMs);
+}
+
+// ==================== ENERGÍA ====================
+void setupPower() {
+#if POWER_SAVE
+  esp_pm_config_esp32_t pm = {};
+  pm.max_freq_mhz = POWER_MAX_FREQ_MHZ;
+  pm.min_freq_mhz = POWER_MIN_FREQ_MHZ;
+  pm.light_sleep_enable = true;
+  lightSleepEnabled = esp_pm_configure(&pm) == ESP_OK;
+  if (!lightSleepEnabled) {
+    // Sin tickless idle en el sdkconfig queda el escalado de frecuencia
+    pm.light_sleep_enable = false;
+    esp_pm_configure(&pm);
+  }
+  esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "gates", &gatesAwakeLock);
+  LOG_NET(EV_POWER_MODE, 0, lightSleepEnabled ? "modem-sleep y light sleep" : "modem-sleep",
+          WIFI_LISTEN_INTERVAL, MQTT_KEEPALIVE_S);
+#else
+  LOG_NET(EV_POWER_MODE, 0, "sin ahorro", 0, MQTT_KEEPALIVE_S);
+#endif
+}
+
+// WiFi.begin() no expone el listen interval; se ajusta sobre la
+// configuración que deja antes de conectar
+void setListenInterval() {
+  wifi_config_t sta;
+  if (esp_wifi_get_config(WIFI_IF_STA, &sta) != ESP_OK) return;
+  sta.sta.listen_interval = WIFI_LISTEN_INTERVAL;
+  esp_wifi_set_config(WIFI_IF_STA, &sta);
+}
+
+// Mientras un portón no está en reposo el sistema no entra en light sleep.
+// Solo la tarea de portones toma y suelta el lock.
+void updatePowerLock() {
+  bool active = false;
+  for (int i = 0; i < GATE_COUNT; i++) {
+    if (gates[i].state != IDLE) active = true;
+  }
+  if (active == gatesAwake) return;
+  uint32_t now = millis();
+  if (active) {
+    gatesAwakeSince = now;
+    if (gatesAwakeLock) esp_pm_lock_acquire(gatesAwakeLock);
+  } else {
+    gatesAwakeMsTotal += now - gatesAwakeSince;
+    if (gatesAwakeLock) esp_pm_lock_release(gatesAwakeLock);
+  }
+  gatesAwake = active;
+}
+
+// Tick corto solo con trabajo de red en curso; el resto lo despierta un
+// evento antes de NET_IDLE_TICK
+TickType_t netIdleWait() {
+  bool connecting = netState == NET_WIFI_START || netState == NET_WIFI_WAIT || netState == NET_TLS_CONNECT ||
+                    netState == NET_MQTT_CONNECT;
+  bool pending = otaState != OTA_IDLE || configPendingScope != CONFIG_SCOPE_NONE || stateSnapshotDirty ||
+                 qrLineLength > 0 || consoleLineLength > 0;
+  if (netState == NET_READY) pending = pending || espClient.buffered() || journalBacklog();
+#if !DUAL_CORE_TASKS || LOG_MQTT_SINK
+  pending = pending || logLineLength > 0 || !netLog.queue.empty() || !gateLog.queue.empty();
+#endif
+  return connecting || pending ? NET_TICK : NET_IDLE_TICK;
+}
+
+// Espera datos en el socket del broker y despierta a la red. Hasta que la
+// red termine su tick no vuelve a mirar: el socket sigue legible mientras
+// nadie lo lea.
+void netWakeTask(void* param) {
+  for (;;) {
+    int fd = netWakeFd;
+    if (fd < 0) {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      continue;
+    }
+    fd_set readable;
+    FD_ZERO(&readable);
+    FD_SET(fd, &readable);
+    timeval timeout = {1, 0};  // por si la red cambia de socket entretanto
+    int ready = select(fd + 1, &readable, nullptr, nullptr, &timeout);
+    if (ready == 0) continue;
+    if (ready > 0) {
+      netWokeAt = micros();
+      wakeNetTask();
+    }
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+  }
+}
+
+// ==================== WATCHDOG Y REINICIOS ====================
+const char* resetReasonName(uint8_t reason) {
+  switch (reason) {
+    case ESP_RST_POWERON: return "poweron";
+    case ESP_RST_EXT: return "ext";
+    case ESP_RST_SW: return "sw";
+    case ESP_RST_PANIC: return "panic";
+    case ESP_RST_INT_WDT: return "int_wdt";
+    case ESP_RST_TASK_WDT: return "task_wdt";
+    case ESP_RST_WDT: return "wdt";
+    case ESP_RST_DEEPSLEEP: return "deepsleep";
+    case ESP_RST_BROWNOUT: return "brownout";
+    case ESP_RST_SDIO: return "sdio";
+    default: return "unknown";
+  }
+}
+
+const char* loopStageName(uint8_t stage) {
+  return stage < STAGE_COUNT ? LOOP_STAGE_NAMES[stage] : "unknown";
+}
+
+bool resetUnexpected(esp_reset_reason_t reason) {
+  return reason == ESP_RST_PANIC || reason == ESP_RST_INT_WDT || reason == ESP_RST_TASK_WDT ||
+         reason == ESP_RST_WDT || reason == ESP_RST_BROWNOUT;
+}
+
+// Lee por qué arrancó y dónde estaba cada tarea (RTC), y lo suma al
+// historial en NVS. Tras un arranque en frío la RTC no trae nada válido.
+void setupResetDiagnostics() {
+  resetReason = esp_reset_reason();
+  bool unexpected = resetUnexpected(resetReason);
+  bool rtcValid = rtcDiag.magic == RTC_DIAG_MAGIC && resetReason != ESP_RST_POWERON;
+  uint8_t streak = rtcValid ? rtcDiag.crashStreak : 0;
+  rtcDiag.crashStreak = !unexpected ? 0 : streak < 255 ? streak + 1 : streak;
+
+  Preferences store;
+  store.begin(RESET_NAMESPACE, false);
+  if (store.getBytesLength("history") == sizeof(resetHistory)) {
+    store.getBytes("history", &resetHistory, sizeof(resetHistory));
+  }
+  resetHistory.boots++;
+  if (unexpected) {
+    resetHistory.crashes++;
+    resetHistory.crashReason = resetReason;
+    resetHistory.crashNetStage = rtcValid ? rtcDiag.netStage : (uint8_t)STAGE_COUNT;
+    resetHistory.crashGateStage = rtcValid ? rtcDiag.gateStage : (uint8_t)STAGE_COUNT;
+    resetHistory.crashUptimeS = rtcValid ? rtcDiag.uptimeS : 0;
+  }
+  store.putBytes("history", &resetHistory, sizeof(resetHistory));
+  store.end();
+
+  LOG_NET(EV_RESET_REASON, 0, resetReasonName(resetReason), (int32_t)resetHistory.boots,
+          (int32_t)resetHistory.crashes);
+  if (unexpected) {
+    LOG_NET(EV_RESET_CRASH, 0, loopStageName(resetHistory.crashNetStage), loopStageName(resetHistory.crashGateStage));
+  }
+
+  rtcDiag.magic = RTC_DIAG_MAGIC;
+  rtcDiag.netStage = STAGE_IDLE;
+  rtcDiag.gateStage = STAGE_IDLE;
+  rtcDiag.uptimeS = 0;
+}
+
+// Arduino deja el task watchdog solo sobre las tareas idle y sin pánico:
+// se reconfigura y cada tarea de trabajo se suscribe al arrancar
+void setupWatchdog() {
+  esp_task_wdt_init(WDT_TIMEOUT_S, true);
+#if !DUAL_CORE_TASKS
+  esp_task_wdt_add(nullptr);  // setup() y loop() comparten la tarea
+#endif
+
+  gateTickAliveMs = millis();
+  esp_timer_create_args_t timerArgs = {};
+  timerArgs.callback = onFailsafeTimer;
+  timerArgs.name = "gate_failsafe";
+  esp_timer_create(&timerArgs, &failsafeTimer);
+  esp_timer_start_periodic(failsafeTimer, msToUs(FAILSAFE_PERIOD_MS));
+}
+
+// Corre en la tarea de esp_timer. Si la tarea de portones lleva
+// GATE_STALL_TIMEOUT sin completar un tick, lleva directo al cerrado, sin
+// perfil, lo que ya debía cerrar o estar cerrando, y lo saca de rtcGates
+// para que el reinicio del watchdog no lo reabra. No registra: los anillos
+// del registro tienen un único productor por tarea. gates[] solo se lee; el
+// servo va directo por la HAL y servoDuty lo pone reconcileFailsafe().
+void onFailsafeTimer(void* arg) {
+  uint32_t stalledMs = millis() - gateTickAliveMs;
+  if (stalledMs < GATE_STALL_TIMEOUT) return;
+  int64_t now = esp_timer_get_time();
+  forEachGate([&](int i) {
+    const GateRuntime& gate = gates[i];
+    // En emergencia abierto es lo seguro; solo se termina un cierre en curso
+    if (emergencyActive && gate.state != CLOSING) return;
+    bool due = gate.state == CLOSING || (gate.state == OPENING && stalledMs >= GATES[i].openMs) ||
+               ((gate.state == OPEN || gate.state == STOPPED) && now >= gate.closeAt);
+    if (!due || failsafeClosed[i].load(std::memory_order_acquire)) return;
+    halServoWrite(i, servoDutyFor(GATES[i].closedAngle));
+    rtcGates.open[i] = 0;
+    failsafeStalledMs = stalledMs;
+    failsafeClosed[i].store(true, std::memory_order_release);
+  });
+}
+
+// De vuelta en la tarea de portones: adopta el cerrado del failsafe como
+// estado, sin una trayectoria que arranque desde donde se había quedado. Con
+// una tarea solo lenta, updateMotion pudo escribir un duty de trayectoria
+// después del failsafe en el mismo tick: el cerrado se vuelve a escribir en
+// el LEDC en lugar de suponer que sigue ahí.
+void reconcileFailsafe() {
+  forEachGate([&](int i) {
+    if (!failsafeClosed[i].load(std::memory_order_acquire)) return;
+    const GateConfig& config = GATES[i];
+    gates[i].state = IDLE;
+    gates[i].servoDuty = servoDutyFor(config.closedAngle);
+    halServoWrite(i, gates[i].servoDuty);
+    gates[i].holdMs = 0;
+    gates[i].trajectory.start(config.closedAngle, config.closedAngle, 0, config.motion);
+    gateDeadlines.cancel(i);
+    publishStatus(i + 1, STATUS_CLOSED);
+    failsafeCloses++;
+    LOG_GATE(EV_FAILSAFE_CLOSE, i + 1, (int32_t)failsafeStalledMs);
+    failsafeClosed[i].store(false, std::memory_order_release);
+  });
+}
+
+void startStages(StageTracker& tracker, LoopStage first) {
+  tracker.tickWorstUs = 0;
+  tracker.tickWorstStage = STAGE_IDLE;
+  markStage(tracker, first);
+}
+
+// La espera entre ticks (STAGE_IDLE) no cuenta como etapa
+void markStage(StageTracker& tracker, LoopStage next) {
+  uint32_t now = micros();
+  uint32_t elapsed = now - tracker.since;
+  if (tracker.stage != STAGE_IDLE && elapsed > tracker.tickWorstUs) {
+    tracker.tickWorstUs = elapsed;
+    tracker.tickWorstStage = tracker.stage;
+  }
+  tracker.stage = next;
+  tracker.since = now;
+  *tracker.rtcStage = next;
+}
+
+void finishStages(StageTracker& tracker) {
+  markStage(tracker, STAGE_IDLE);
+  if (tracker.tickWorstUs > tracker.worstUs) {
+    tracker.worstUs = tracker.tickWorstUs;
+    tracker.worstStage = tracker.tickWorstStage;
+  }
+}
+
+// ==================== OTA ====================
+// Arduino confirma la imagen al arrancar salvo que esto devuelva true; aquí
+// la confirma checkRunningImage() (requiere el rollback del bootloader)
+extern "C" bool verifyRollbackLater() {
+  return true;
+}
+
+void setupOta() {
+  otaStore.begin("ota", false);
+  otaStore.getBytes("rejected", otaRejectedSha, sizeof(otaRejectedSha));
+  const esp_partition_t* running = esp_ota_get_running_partition();
+  esp_ota_img_states_t state;
+  otaVerifying = running && esp_ota_get_state_partition(running, &state) == ESP_OK &&
+                 state == ESP_OTA_IMG_PENDING_VERIFY;
+  if (otaVerifying) {
+    LOG_NET(EV_OTA_VERIFYING, 0, FIRMWARE_VERSION);
+    return;
+  }
+  // El bootloader volvió a esta imagen: la otra no se vuelve a instalar
+  const esp_partition_t* invalid = esp_ota_get_last_invalid_partition();
+  uint8_t sha[32];
+  if (invalid && esp_partition_get_sha256(invalid, sha) == ESP_OK &&
+      memcmp(sha, otaRejectedSha, sizeof(sha)) != 0) {
+    memcpy(otaRejectedSha, sha, sizeof(sha));
+    otaStore.putBytes("rejected", otaRejectedSha, sizeof(otaRejectedSha));
+    otaRollbackReport = true;
+    LOG_NET(EV_OTA_ROLLED_BACK, 0, FIRMWARE_VERSION);
+  }
+}
+
+// El digest de la imagen en ejecución; se calcula (lee la app entera) la
+// primera vez que llega una oferta
+bool runningImageIs(const uint8_t* sha) {
+  if (!runningShaKnown) {
+    runningShaKnown = esp_partition_get_sha256(esp_ota_get_running_partition(), runningSha) == ESP_OK;
+    if (!runningShaKnown) return false;
+  }
+  return memcmp(sha, runningSha, sizeof(runningSha)) == 0;
+}
+
+void publishOtaStatus(const char* state, const char* detail) {
+  char msg[256];
+  snprintf(msg, sizeof(msg),
+           "{\"state\": \"%s\", \"version\": \"%s\", \"running\": \"%s\", \"received\": %lu, \"written\": %lu, "
+           "\"size\": %lu, \"detail\": \"%s\"}",
+           state, otaOffer.version, FIRMWARE_VERSION, (unsigned long)otaReceived,
+           (unsigned long)otaWriter.written(), (unsigned long)otaOffer.imageSize, detail);
+  mqttClient.publish(otaStatusTopic, msg, true);
+}
+
+// Una oferta a la vez: con una descarga en curso o una imagen lista, la
+// retenida nueva se evalúa en la próxima conexión
+void handleOtaOffer(const uint8_t* payload, unsigned int length) {
+  if (length == 0) return;  // oferta retirada
+  OtaOffer offer;
+  if (!decodeOtaOffer(payload, length, offer) || !verifyFrameMac(payload, length, config.configKey)) {
+    LOG_NET(EV_OTA_SKIPPED, 0, "-", "oferta inválida");
+    return;
+  }
+  if (otaState != OTA_IDLE && otaState != OTA_PENDING) {
+    LOG_NET(EV_OTA_SKIPPED, 0, otaOffer.version, "otra actualización en curso");
+    return;
+  }
+  otaOffer = offer;
+  otaState = OTA_IDLE;
+  otaReceived = 0;
+  if (runningImageIs(otaOffer.sha256)) {
+    publishOtaStatus("current", "");
+    return;
+  }
+  const char* skip = nullptr;
+  if (otaOffer.format > OTA_FORMAT_DELTA) {
+    skip = "formato desconocido";
+  } else if (memcmp(otaOffer.sha256, otaRejectedSha, sizeof(otaRejectedSha)) == 0) {
+    skip = "imagen descartada";
+  } else if (otaOffer.format == OTA_FORMAT_DELTA && !runningImageIs(otaOffer.baseSha256)) {
+    skip = "delta de otra imagen base";
+  }
+  if (skip) {
+    LOG_NET(EV_OTA_SKIPPED, 0, otaOffer.version, skip);
+    publishOtaStatus("skipped", skip);
+    return;
+  }
+  advanceClock(otaOffer.issuedAt);
+  otaAttempts = 0;
+  otaWaitMs = 0;
+  otaState = OTA_PENDING;
+  LOG_NET(EV_OTA_OFFERED, 0, otaOffer.version, (int32_t)otaOffer.imageSize, (int32_t)otaOffer.format);
+  publishOtaStatus("pending", "");
+}
+
+// La red solo lee el estado de cada portón (el actuador es el único que lo
+// escribe); para decidir cuándo molestar menos basta con eso
+bool gatesAtRest() {
+  if (!commandQueue.empty()) return false;
+  for (int i = 0; i < GATE_COUNT; i++) {
+    if (gates[i].state != IDLE) return false;
+  }
+  return true;
+}
+
+bool gatesMoving() {
+  if (!commandQueue.empty()) return true;
+  for (int i = 0; i < GATE_COUNT; i++) {
+    if (gates[i].state == OPENING || gates[i].state == CLOSING) return true;
+  }
+  return false;
+}
+
+void noteGateRest() {
+  if (!gatesAtRest()) {
+    gatesResting = false;
+  } else if (!gatesResting) {
+    gatesResting = true;
+    gatesRestSince = millis();
+  }
+}
+
+bool gatesQuiet() {
+  return gatesResting && millis() - gatesRestSince >= OTA_QUIET_MS;
+}
+
+// http[s]://host[:puerto]/ruta; path apunta dentro de url
+bool parseOtaUrl(const char* url, bool& tls, char* host, size_t hostSize, uint16_t& port, const char*& path) {
+  const char* p;
+  if (strncmp(url, "https://", 8) == 0) {
+    tls = true;
+    port = 443;
+    p = url + 8;
+  } else if (strncmp(url, "http://", 7) == 0) {
+    tls = false;
+    port = 80;
+    p = url + 7;
+  } else {
+    return false;
+  }
+  const char* slash = strchr(p, '/');
+  const char* end = slash ? slash : p + strlen(p);
+  path = slash ? slash : "/";
+  const char* colon = (const char*)memchr(p, ':', end - p);
+  size_t hostLength = (colon ? colon : end) - p;
+  if (hostLength == 0 || hostLength >= hostSize) return false;
+  memcpy(host, p, hostLength);
+  host[hostLength] = '\0';
+  if (colon) {
+    long value = strtol(colon + 1, nullptr, 10);
+    if (value <= 0 || value > 65535) return false;
+    port = (uint16_t)value;
+  }
+  return true;
+}
+
+// badImage: la imagen en sí no sirve (delta mal formada, digest distinto) y
+// no se reintenta; lo demás (red, servidor) se reintenta OTA_MAX_ATTEMPTS
+// veces y luego espera a que la oferta retenida vuelva a llegar
+void failOta(const char* reason, bool badImage) {
+  if (otaClient) otaClient->stop();
+  otaWriter.abort();
+  otaInflater.end();
+  LOG_NET(EV_OTA_FAILED, 0, otaOffer.version, reason);
+  if (!badImage && otaAttempts < OTA_MAX_ATTEMPTS) {
+    otaState = OTA_PENDING;
+    otaWaitSince = millis();
+    otaWaitMs = OTA_RETRY_DELAY;
+    publishOtaStatus("retrying", reason);
+    return;
+  }
+  if (badImage) {
+    memcpy(otaRejectedSha, otaOffer.sha256, sizeof(otaRejectedSha));
+    otaStore.putBytes("rejected", otaRejectedSha, sizeof(otaRejectedSha));
+  }
+  otaState = OTA_IDLE;
+  publishOtaStatus("failed", reason);
+}
+
+// Arma la cadena de etapas según el formato y pide la imagen. HTTP/1.0: el
+// cuerpo llega sin chunked y termina al cerrarse la conexión.
+void startOtaDownload() {
+  otaAttempts++;
+  bool tls = false;
+  char host[96];
+  uint16_t port = 0;
+  const char* path = nullptr;
+  if (!parseOtaUrl(otaOffer.url, tls, host, sizeof(host), port, path)) {
+    failOta("URL inválida", true);
+    return;
+  }
+  OtaSink* input = &otaWriter;
+  bool ready = otaWriter.begin(otaOffer.imageSize);
+  if (ready && otaOffer.format == OTA_FORMAT_DELTA) {
+    ready = otaBase.begin();
+    otaDelta.begin(&otaBase, otaBase.size(), input);
+    input = &otaDelta;
+  }
+  if (ready && otaOffer.format != OTA_FORMAT_RAW) {
+    ready = otaInflater.begin(input);
+    input = &otaInflater;
+  }
+  if (!ready) {
+    failOta("sin partición OTA o sin memoria", false);
+    return;
+  }
+  otaInput = input;
+  LOG_NET(EV_OTA_DOWNLOADING, 0, otaOffer.version, otaAttempts);
+
+  if (tls) {
+    otaHttpsClient.setInsecure();
+    otaHttpsClient.setHandshakeTimeout(OTA_HANDSHAKE_TIMEOUT_S);
+    otaClient = &otaHttpsClient;
+  } else {
+    otaClient = &otaHttpClient;
+  }
+  char request[400];
+  int length = snprintf(request, sizeof(request), "GET %s HTTP/1.0\r\nHost: %s\r\nUser-Agent: portones-fc/%s\r\n\r\n",
+                        path, host, FIRMWARE_VERSION);
+  if (length <= 0 || (size_t)length >= sizeof(request)) {
+    failOta("URL inválida", true);
+    return;
+  }
+  if (!otaClient->connect(host, port)) {
+    failOta("sin conexión al servidor", false);
+    return;
+  }
+  otaClient->write((const uint8_t*)request, length);
+  otaHeaderLength = 0;
+  otaStatusLineSeen = false;
+  otaReceived = 0;
+  otaStartedAt = otaLastDataAt = otaProgressAt = millis();
+  otaState = OTA_HEADERS;
+  publishOtaStatus("downloading", "");
+}
+
+// Solo importa el código de la línea de estado; el cuerpo empieza tras la
+// primera línea vacía. bodyOffset queda en length si no llegó todavía.
+bool consumeOtaHeaders(const uint8_t* data, size_t length, size_t& bodyOffset) {
+  for (size_t i = 0; i < length; i++) {
+    char c = (char)data[i];
+    if (c == '\r') continue;
+    if (c != '\n') {
+      if (otaHeaderLength < sizeof(otaHeaderLine) - 1) otaHeaderLine[otaHeaderLength++] = c;
+      continue;
+    }
+    otaHeaderLine[otaHeaderLength] = '\0';
+    if (!otaStatusLineSeen) {
+      // "HTTP/1.1 200 OK"
+      const char* code = strchr(otaHeaderLine, ' ');
+      if (!code || atoi(code + 1) != 200) return false;
+      otaStatusLineSeen = true;
+    } else if (otaHeaderLength == 0) {
+      otaState = OTA_DOWNLOADING;
+      bodyOffset = i + 1;
+      return true;
+    }
+    otaHeaderLength = 0;
+  }
+  bodyOffset = length;
+  return true;
+}
+
+void finishOtaDownload() {
+  otaClient->stop();
+  bool decoded = otaState == OTA_DOWNLOADING && otaWriter.written() == otaOffer.imageSize &&
+                 (otaOffer.format == OTA_FORMAT_RAW || otaInflater.finished()) &&
+                 (otaOffer.format != OTA_FORMAT_DELTA || otaDelta.finished());
+  otaInflater.end();
+  if (!decoded) {
+    failOta("descarga incompleta", false);
+    return;
+  }
+  if (!otaWriter.commit(otaOffer.sha256)) {
+    failOta("digest o imagen inválidos", true);
+    return;
+  }
+  otaState = OTA_STAGED;
+  LOG_NET(EV_OTA_STAGED, 0, otaOffer.version, (int32_t)otaWriter.written(), (int32_t)(millis() - otaStartedAt));
+  publishOtaStatus("staged", "");
+}
+
+// Escribir en flash detiene la caché de ambos cores: mientras un portón se
+// mueve la descarga espera y TCP retiene lo que llegue
+void pumpOtaDownload() {
+  if (gatesMoving()) {
+    otaLastDataAt = millis();
+    return;
+  }
+  auto& buffer = netArena.ota;
+  for (int i = 0; i < OTA_READS_PER_TICK; i++) {
+    int available = otaClient->available();
+    if (available <= 0) break;
+    int n = otaClient->read(buffer, (size_t)available < sizeof(buffer) ? (size_t)available : sizeof(buffer));
+    if (n <= 0) break;
+    otaLastDataAt = millis();
+    size_t offset = 0;
+    if (otaState == OTA_HEADERS && !consumeOtaHeaders(buffer, n, offset)) {
+      failOta("el servidor no respondió 200", false);
+      return;
+    }
+    if (otaState != OTA_DOWNLOADING || offset == (size_t)n) continue;
+    otaReceived += n - offset;
+    if (!otaInput->write(buffer + offset, n - offset)) {
+      failOta("imagen mal formada", true);
+      return;
+    }
+  }
+  if (!otaClient->connected() && otaClient->available() <= 0) {
+    finishOtaDownload();
+  } else if (millis() - otaLastDataAt >= OTA_STALL_TIMEOUT) {
+    failOta("descarga detenida", false);
+  } else if (millis() - otaProgressAt >= OTA_PROGRESS_INTERVAL) {
+    otaProgressAt = millis();
+    publishOtaStatus("downloading", "");
+  }
+}
+
+// Lo que espera en RAM pasa a flash antes de reiniciar
+void restartForOta() {
+  LOG_NET(EV_OTA_REBOOTING, 0, otaOffer.version);
+  publishOtaStatus("rebooting", "");
+  journal.flush();
+  if (journalAckDirty) journalStore.putUInt("acked", journalAckedSeq);
+  if (qrDirty) {
+    qrDirtySince = millis() - QR_PERSIST_DELAY;
+    persistQrAllowlist();
+  }
+#if !DUAL_CORE_TASKS || LOG_MQTT_SINK
+  drainLog();  // aquí la red es el consumidor del registro
+#endif
+  mqttClient.disconnect();
+  Serial.flush();
+  ESP.restart();
+}
+
+// Descarga e instalación; empieza con enlace, con los portones en reposo y
+// con esta imagen ya confirmada (la otra partición es la de respaldo)
+void updateOta() {
+  if (otaRollbackReport && netState == NET_READY) {
+    otaRollbackReport = false;
+    publishOtaStatus("rolledback", "");
+  }
+  switch (otaState) {
+    case OTA_IDLE:
+      break;
+    case OTA_PENDING:
+      if (netState == NET_READY && !otaVerifying && millis() - otaWaitSince >= otaWaitMs && gatesQuiet()) {
+        startOtaDownload();
+      }
+      break;
+    case OTA_HEADERS:
+    case OTA_DOWNLOADING:
+      pumpOtaDownload();
+      break;
+    case OTA_STAGED:
+      if (gatesQuiet()) restartForOta();
+      break;
+  }
+}
+
+// La imagen nueva se confirma al quedar consistente (enlace, estado deseado
+// resuelto y snapshot publicado). Si no lo logra, un reinicio con los
+// portones en reposo vuelve a la anterior; un pánico antes de confirmarla
+// también, porque el bootloader la descarta.
+void checkRunningImage() {
+  if (!otaVerifying) return;
+  if (bootConsistentMs != 0) {
+    esp_ota_mark_app_valid_cancel_rollback();
+    otaVerifying = false;
+    LOG_NET(EV_OTA_CONFIRMED, 0, FIRMWARE_VERSION);
+    publishOtaStatus("applied", "");
+    return;
+  }
+  if (millis() >= OTA_VERIFY_TIMEOUT && gatesQuiet()) {
+    LOG_NET(EV_OTA_ROLLBACK, 0, FIRMWARE_VERSION);
+    esp_ota_mark_app_invalid_rollback_and_reboot();
+  }
+}
+
+void setNetState(NetState next) {
+  if (netState == NET_READY && next != NET_READY) netDownSince = millis();
+  netState = next;
+  netStateSince = millis();
+}
+
+// Backoff exponencial con jitter: espera entre la mitad y el total del
+// intervalo actual, y lo duplica hasta NET_BACKOFF_MAX.
+void scheduleNetRetry(NetState retryState) {
+  netBackoffDelay = netBackoffMs / 2 + random(netBackoffMs / 2 + 1);
+  netBackoffMs = min(netBackoffMs * 2, NET_BACKOFF_MAX);
+  netRetryState = retryState;
+  LOG_NET(EV_NET_RETRY, 0, (int32_t)netBackoffDelay);
+  setNetState(NET_BACKOFF);
+}
+
+void updateNetwork() {
+  switch (netState) {
+    case NET_WIFI_START:
+      LOG_NET(EV_WIFI_CONNECTING, 0, config.wifiSsid);
+      WiFi.mode(WIFI_STA);
+#if POWER_SAVE
+      // El listen interval viaja en la asociación: se fija antes de conectar
+      WiFi.setSleep(WIFI_PS_MAX_MODEM);
+      WiFi.begin(config.wifiSsid, config.wifiPassword, 0, nullptr, false);
+      setListenInterval();
+      esp_wifi_connect();
+#else
+      WiFi.begin(config.wifiSsid, config.wifiPassword);
+#endif
+      setNetState(NET_WIFI_WAIT);
+      break;
+
+    case NET_WIFI_WAIT:
+      if (WiFi.status() == WL_CONNECTED) {
+        LOG_NET(EV_WIFI_CONNECTED, 0);
+        startSntp();
+        setNetState(NET_TLS_CONNECT);
+      } else if (millis() - netStateSince >= WIFI_CONNECT_TIMEOUT) {
+        LOG_NET(EV_WIFI_TIMEOUT, 0);
+        WiFi.disconnect();
+        scheduleNetRetry(NET_WIFI_START);
+      }
+      break;
+
+    case NET_TLS_CONNECT:
+      if (WiFi.status() != WL_CONNECTED) {
+        setNetState(NET_WIFI_START);
+        break;
+      }
+      LOG_NET(EV_TLS_CONNECTING, 0, config.mqttHost, config.mqttPort);
+      if (espClient.connect(config.mqttHost, config.mqttPort)) {
+        tlsHandshakes++;
+        if (espClient.lastResumed()) tlsResumed++;
+        tlsHandshakeMsMax = max(tlsHandshakeMsMax, espClient.lastHandshakeMs());
+        LOG_NET(EV_TLS_HANDSHAKE, 0, espClient.lastResumed() ? "reanudado" : "completo",
+                (int32_t)espClient.lastHandshakeMs(), (int32_t)tlsResumed);
+        setNetState(NET_MQTT_CONNECT);
+      } else {
+        LOG_NET(EV_TLS_FAILED, 0, espClient.lastError());
+        scheduleNetRetry(NET_TLS_CONNECT);
+      }
+      break;
+
+    case NET_MQTT_CONNECT:
+      // Con el socket TLS ya abierto, connect() solo envía CONNECT y espera CONNACK
+      LOG_NET(EV_MQTT_CONNECTING, 0);
+      chooseKeepAlive();
+      // Sin usuario configurado se conecta sin credenciales
+      if (mqttClient.connect(clientId, config.mqttUser[0] ? config.mqttUser : nullptr,
+                             config.mqttUser[0] ? config.mqttPassword : nullptr, healthTopic, HEALTH_WILL_QOS, true,
+                             HEALTH_OFFLINE)) {
+        LOG_NET(EV_MQTT_CONNECTED, 0, clientId);
+        mqttClient.subscribe(commandFilter, COMMAND_QOS);
+        mqttClient.subscribe(commandFilterBin, COMMAND_QOS);
+        mqttClient.publish(capsTopic, capsPayload, true);
+        mqttClient.subscribe(qrDeltaTopic, COMMAND_QOS);
+        mqttClient.subscribe(journalAckTopic, COMMAND_QOS);
+        mqttClient.subscribe(desiredTopic, COMMAND_QOS);
+        mqttClient.subscribe(configTopic, COMMAND_QOS);
+        mqttClient.subscribe(otaTopic, COMMAND_QOS);
+        // Lo enviado y no confirmado antes del corte se vuelve a mandar
+        journalSendSeq = journalAckedSeq + 1;
+        qrSyncRequested = false;
+        requestQrSync();
+        LOG_NET(EV_MQTT_SUBSCRIBED, 0, commandFilter, commandFilterBin);
+        if (LEGACY_SHARED_TOPIC) {
+          mqttClient.subscribe(MQTT_TOPIC, COMMAND_QOS);
+          mqttClient.subscribe(MQTT_TOPIC_BIN, COMMAND_QOS);
+          mqttClient.publish(CAPS_TOPIC, CAPS_PAYLOAD, true);
+          LOG_NET(EV_MQTT_SUBSCRIBED, 0, MQTT_TOPIC, MQTT_TOPIC_BIN);
+        }
+        netBackoffMs = NET_BACKOFF_MIN;
+        lastReconnectMs = millis() - netDownSince;
+        if (netEverReady) netReconnects++;
+        if (!netEverReady) bootReadyMs = millis();
+        netEverReady = true;
+        publishStateSnapshot();
+        publishHeartbeat();  // reemplaza la última voluntad que haya quedado retenida
+        mqttSessionSince = millis();
+        LOG_NET(EV_NET_READY, 0, (int32_t)lastReconnectMs);
+        setNetState(NET_READY);
+      } else {
+        LOG_NET(EV_MQTT_FAILED, 0, mqttClient.state());
+        espClient.stop();
+        scheduleNetRetry(NET_TLS_CONNECT);
+      }
+      break;
+
+    case NET_READY:
+      if (WiFi.status() != WL_CONNECTED) {
+        LOG_NET(EV_WIFI_LOST, 0);
+        endMqttSession();
+        espClient.stop();
+        setNetState(NET_WIFI_START);
+      } else if (!mqttClient.connected()) {
+        LOG_NET(EV_MQTT_LOST, 0);
+        endMqttSession();
+        espClient.stop();
+        setNetState(NET_TLS_CONNECT);
+      }
+      break;
+
+    case NET_BACKOFF:
+      if (millis() - netStateSince >= netBackoffDelay) {
+        bool needsWiFi = netRetryState != NET_WIFI_START && WiFi.status() != WL_CONNECTED;
+        setNetState(needsWiFi ? NET_WIFI_START : netRetryState);
+      }
+      break;
+
+    case NET_PROVISION:
+      break;
+  }
+}
@@ -0,0 +1,59 @@
+#include "mqtt_inbox.h"
+
+bool MqttInbox::begin(const char* label, size_t skip) {
+  partition_ = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+  skip_ = skip;
+  reset();
+  return partition_ != nullptr;
+}
+
+void MqttInbox::reset() {
+  length_ = 0;
+  flushed_ = 0;
+  failed_ = false;
+}
+
+size_t MqttInbox::write(uint8_t b) {
+  size_t at = length_++;
+  if (at < skip_ || failed_) return 1;
+  if (!partition_) {
+    failed_ = true;
+    return 1;
+  }
+  window_[at - skip_ - flushed_] = b;
+  if (at - skip_ - flushed_ + 1 == INBOX_WINDOW) flushWindow();
+  return 1;
+}
+
+size_t MqttInbox::write(const uint8_t* data, size_t length) {
+  for (size_t i = 0; i < length; i++) write(data[i]);
+  return length;
+}
+
+// La ventana empieza siempre en un múltiplo de página: cada sector se borra
+// al llegar a su primera página. Borrar 4 KB tarda decenas de ms, que la
+// tarea de red paga solo con mensajes que no caben en el buffer.
+bool MqttInbox::flushWindow() {
+  size_t pending = length_ - skip_ - flushed_;
+  if (pending == 0) return true;
+  if (flushed_ + pending > partition_->size) {
+    failed_ = true;
+    return false;
+  }
+  if (flushed_ % INBOX_SECTOR == 0 && esp_partition_erase_range(partition_, flushed_, INBOX_SECTOR) != ESP_OK) {
+    failed_ = true;
+    return false;
+  }
+  if (esp_partition_write(partition_, flushed_, window_, pending) != ESP_OK) {
+    failed_ = true;
+    return false;
+  }
+  flushed_ += pending;
+  return true;
+}
+
+bool MqttInbox::read(size_t offset, uint8_t* out, size_t length) {
+  if (failed_ || offset < skip_ || offset + length > length_) return false;
+  if (length_ - skip_ > flushed_ && !flushWindow()) return false;
+  return esp_partition_read(partition_, offset - skip_, out, length) == ESP_OK;
+}
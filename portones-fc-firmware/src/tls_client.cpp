@@ -0,0 +1,304 @@
+#include "tls_client.h"
+
+#include <mbedtls/net_sockets.h>
+#include <mbedtls/sha256.h>
+
+// ==================== SESIÓN EN MEMORIA RTC ====================
+// RTC_NOINIT no se borra en un reinicio por software; el número mágico y
+// mbedtls_ssl_session_load() descartan el contenido basura tras un arranque
+// en frío. Si la sesión serializada no cabe (incluye el certificado del
+// servidor) solo se conserva en RAM.
+const uint32_t RTC_SESSION_MAGIC = 0x544c5331;  // "TLS1"
+const size_t RTC_SESSION_MAX = 2048;
+
+struct RtcSession {
+  uint32_t magic;
+  uint32_t length;
+  uint8_t data[RTC_SESSION_MAX];
+};
+
+RTC_NOINIT_ATTR static RtcSession rtcSession;
+
+namespace {
+
+int netSend(void* ctx, const unsigned char* buf, size_t len) {
+  WiFiClient* tcp = static_cast<WiFiClient*>(ctx);
+  if (!tcp->connected()) return MBEDTLS_ERR_NET_CONN_RESET;
+  size_t written = tcp->write(buf, len);
+  return written > 0 ? (int)written : MBEDTLS_ERR_SSL_WANT_WRITE;
+}
+
+int netRecv(void* ctx, unsigned char* buf, size_t len) {
+  WiFiClient* tcp = static_cast<WiFiClient*>(ctx);
+  if (tcp->available() <= 0) {
+    return tcp->connected() ? MBEDTLS_ERR_SSL_WANT_READ : MBEDTLS_ERR_NET_CONN_RESET;
+  }
+  int n = tcp->read(buf, len);
+  return n > 0 ? n : MBEDTLS_ERR_SSL_WANT_READ;
+}
+
+}  // namespace
+
+TlsSessionClient::TlsSessionClient() {
+  mbedtls_x509_crt_init(&ca_);
+  mbedtls_ssl_session_init(&session_);
+  mbedtls_entropy_init(&entropy_);
+  mbedtls_ctr_drbg_init(&drbg_);
+  mbedtls_ssl_init(&ssl_);
+  mbedtls_ssl_config_init(&conf_);
+}
+
+TlsSessionClient::~TlsSessionClient() {
+  stop();
+  freeContext();
+  mbedtls_ssl_session_free(&session_);
+  mbedtls_x509_crt_free(&ca_);
+  mbedtls_ctr_drbg_free(&drbg_);
+  mbedtls_entropy_free(&entropy_);
+}
+
+void TlsSessionClient::clearSession() {
+  mbedtls_ssl_session_free(&session_);
+  mbedtls_ssl_session_init(&session_);
+  hasSession_ = false;
+  rtcSession.magic = 0;
+}
+
+// Una sola vez: mbedtls_ssl_setup() reserva los búferes de registro (~32 KB
+// entre entrada y salida) y hacerlo en cada reconexión, con la sesión MQTT y
+// WiFi reservando en medio, es lo que fragmenta el heap tras semanas de
+// cortes. Las conexiones siguientes reutilizan el contexto con
+// mbedtls_ssl_session_reset().
+bool TlsSessionClient::setupContext() {
+  mbedtls_ssl_init(&ssl_);
+  mbedtls_ssl_config_init(&conf_);
+  contextReady_ = true;
+
+  if (!drbgSeeded_) {
+    if ((lastError_ = mbedtls_ctr_drbg_seed(&drbg_, mbedtls_entropy_func, &entropy_, nullptr, 0)) != 0) return false;
+    drbgSeeded_ = true;
+  }
+  if ((lastError_ = mbedtls_ssl_config_defaults(&conf_, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                                MBEDTLS_SSL_PRESET_DEFAULT)) != 0) {
+    return false;
+  }
+
+  if (caCert_ && !caParsed_) {
+    if ((lastError_ = mbedtls_x509_crt_parse(&ca_, (const unsigned char*)caCert_, strlen(caCert_) + 1)) != 0) {
+      return false;
+    }
+    caParsed_ = true;
+  }
+  if (caParsed_) {
+    mbedtls_ssl_conf_ca_chain(&conf_, &ca_, nullptr);
+    mbedtls_ssl_conf_authmode(&conf_, MBEDTLS_SSL_VERIFY_REQUIRED);
+  } else {
+    // Sin CA solo queda el pin de huella, que se comprueba tras el handshake
+    mbedtls_ssl_conf_authmode(&conf_, fingerprint_ ? MBEDTLS_SSL_VERIFY_OPTIONAL : MBEDTLS_SSL_VERIFY_NONE);
+  }
+  mbedtls_ssl_conf_rng(&conf_, mbedtls_ctr_drbg_random, &drbg_);
+  mbedtls_ssl_conf_session_tickets(&conf_, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+
+  if ((lastError_ = mbedtls_ssl_setup(&ssl_, &conf_)) != 0) return false;
+  mbedtls_ssl_set_bio(&ssl_, &tcp_, netSend, netRecv, nullptr);
+  contextSetUp_ = true;
+  return true;
+}
+
+void TlsSessionClient::freeContext() {
+  if (!contextReady_) return;
+  mbedtls_ssl_free(&ssl_);
+  mbedtls_ssl_config_free(&conf_);
+  contextReady_ = false;
+  contextSetUp_ = false;
+}
+
+bool TlsSessionClient::loadSession() {
+  if (hasSession_) return true;
+  if (rtcSession.magic != RTC_SESSION_MAGIC || rtcSession.length == 0 || rtcSession.length > RTC_SESSION_MAX) {
+    return false;
+  }
+  if (mbedtls_ssl_session_load(&session_, rtcSession.data, rtcSession.length) != 0) {
+    clearSession();
+    return false;
+  }
+  hasSession_ = true;
+  return true;
+}
+
+void TlsSessionClient::storeSession() {
+  mbedtls_ssl_session_free(&session_);
+  mbedtls_ssl_session_init(&session_);
+  hasSession_ = mbedtls_ssl_get_session(&ssl_, &session_) == 0;
+  if (!hasSession_) return;
+
+  size_t length = 0;
+  if (mbedtls_ssl_session_save(&session_, rtcSession.data, RTC_SESSION_MAX, &length) == 0) {
+    rtcSession.length = length;
+    rtcSession.magic = RTC_SESSION_MAGIC;
+  } else {
+    rtcSession.magic = 0;
+  }
+}
+
+bool TlsSessionClient::verifyFingerprint() {
+  if (!fingerprint_) return true;
+  bool pinned = false;
+  for (int i = 0; i < 32; i++) pinned |= fingerprint_[i] != 0;
+  if (!pinned) return true;
+
+  const mbedtls_x509_crt* peer = mbedtls_ssl_get_peer_cert(&ssl_);
+  if (!peer) return false;
+  uint8_t digest[32];
+  if (mbedtls_sha256_ret(peer->raw.p, peer->raw.len, digest, 0) != 0) return false;
+  return memcmp(digest, fingerprint_, sizeof(digest)) == 0;
+}
+
+int TlsSessionClient::connect(IPAddress ip, uint16_t port) {
+  char host[16];  // sin String: nada de heap por reconexión
+  snprintf(host, sizeof(host), "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+  return connect(host, port);
+}
+
+int TlsSessionClient::connect(const char* host, uint16_t port) {
+  stop();
+  unsigned long start = millis();
+  lastResumed_ = false;
+
+  if (!tcp_.connect(host, port)) {
+    lastError_ = MBEDTLS_ERR_NET_CONN_RESET;
+    return 0;
+  }
+  tcp_.setNoDelay(true);
+  if (!contextSetUp_ && !setupContext()) {
+    freeContext();
+    stop();
+    return 0;
+  }
+  if ((lastError_ = mbedtls_ssl_session_reset(&ssl_)) != 0 ||
+      (lastError_ = mbedtls_ssl_set_hostname(&ssl_, host)) != 0) {
+    stop();
+    return 0;
+  }
+
+  bool offered = loadSession() && mbedtls_ssl_set_session(&ssl_, &session_) == 0;
+  unsigned char offeredId[32];
+  size_t offeredIdLen = 0;
+  if (offered) {
+    offeredIdLen = session_.id_len;
+    memcpy(offeredId, session_.id, offeredIdLen);
+  }
+
+  int ret;
+  while ((ret = mbedtls_ssl_handshake(&ssl_)) != 0) {
+    if ((ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) ||
+        millis() - start > handshakeTimeoutMs_) {
+      lastError_ = ret;
+      // Una sesión que el servidor rechaza no se vuelve a ofrecer
+      if (offered) clearSession();
+      stop();
+      return 0;
+    }
+    delay(1);
+  }
+
+  if (!verifyFingerprint()) {
+    lastError_ = -1;
+    clearSession();
+    stop();
+    return 0;
+  }
+
+  // El servidor repite el ID de sesión ofrecido cuando acepta reanudarla
+  lastResumed_ = offered && offeredIdLen > 0 && ssl_.session->id_len == offeredIdLen &&
+                 memcmp(ssl_.session->id, offeredId, offeredIdLen) == 0;
+  lastHandshakeMs_ = millis() - start;
+  lastError_ = 0;
+  connected_ = true;
+  storeSession();
+  return 1;
+}
+
+size_t TlsSessionClient::write(uint8_t b) {
+  return write(&b, 1);
+}
+
+size_t TlsSessionClient::write(const uint8_t* buf, size_t size) {
+  if (!connected_) return 0;
+  size_t sent = 0;
+  while (sent < size) {
+    int ret = mbedtls_ssl_write(&ssl_, buf + sent, size - sent);
+    if (ret > 0) {
+      sent += ret;
+    } else if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+      lastError_ = ret;
+      stop();
+      break;
+    }
+  }
+  return sent;
+}
+
+int TlsSessionClient::available() {
+  if (!connected_) return 0;
+  int pending = peekByte_ >= 0 ? 1 : 0;
+  // Una lectura de 0 bytes procesa el registro TLS que haya en el socket
+  int ret = mbedtls_ssl_read(&ssl_, nullptr, 0);
+  if (ret < 0 && ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+    if (ret != MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY) lastError_ = ret;
+    stop();
+    return pending;
+  }
+  return pending + (int)mbedtls_ssl_get_bytes_avail(&ssl_);
+}
+
+int TlsSessionClient::read() {
+  uint8_t b;
+  return read(&b, 1) == 1 ? b : -1;
+}
+
+int TlsSessionClient::read(uint8_t* buf, size_t size) {
+  if (!connected_ || size == 0) return -1;
+  size_t offset = 0;
+  if (peekByte_ >= 0) {
+    buf[offset++] = (uint8_t)peekByte_;
+    peekByte_ = -1;
+    if (offset == size) return offset;
+  }
+  int ret = mbedtls_ssl_read(&ssl_, buf + offset, size - offset);
+  if (ret > 0) return offset + ret;
+  if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+    lastError_ = ret;
+    stop();
+  }
+  return offset > 0 ? (int)offset : -1;
+}
+
+int TlsSessionClient::peek() {
+  if (peekByte_ < 0) {
+    uint8_t b;
+    int ret = connected_ ? mbedtls_ssl_read(&ssl_, &b, 1) : -1;
+    if (ret == 1) peekByte_ = b;
+  }
+  return peekByte_;
+}
+
+void TlsSessionClient::flush() {
+  tcp_.flush();
+}
+
+void TlsSessionClient::stop() {
+  if (connected_) {
+    mbedtls_ssl_close_notify(&ssl_);
+  }
+  connected_ = false;
+  peekByte_ = -1;
+  tcp_.stop();
+}
+
+uint8_t TlsSessionClient::connected() {
+  if (connected_ && !tcp_.connected() && mbedtls_ssl_get_bytes_avail(&ssl_) == 0 && peekByte_ < 0) {
+    stop();
+  }
+  return connected_;
+}
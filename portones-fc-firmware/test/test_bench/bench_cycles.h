@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdint.h>
+
+// Contador de ciclos para los benchmarks. En la placa es el CCOUNT del
+// Xtensa (32 bits, da la vuelta en ~18 s a 240 MHz: sobra para una
+// llamada); en el host, el TSC en x86 o un reloj en ns en otra
+// arquitectura. Las diferencias se toman en uint32_t.
+
+#if defined(ARDUINO)
+#include <Arduino.h>
+#include <esp_idf_version.h>
+#include <esp_cpu.h>
+
+inline uint32_t benchCycles() {
+#if ESP_IDF_VERSION_MAJOR >= 5
+  return esp_cpu_get_cycle_count();
+#else
+  return esp_cpu_get_ccount();  // mismo registro; el nombre nuevo es de IDF 5
+#endif
+}
+
+inline float benchCyclesPerUs() {
+  return (float)getCpuFrequencyMhz();
+}
+
+#else
+#include <chrono>
+
+inline uint64_t benchNowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+
+inline uint32_t benchCycles() {
+  return (uint32_t)__rdtsc();
+}
+
+// El TSC va a frecuencia fija: se calibra una vez contra el reloj
+inline float benchCyclesPerUs() {
+  static float perUs = 0;
+  if (perUs == 0) {
+    uint64_t startNs = benchNowNs();
+    uint64_t startCycles = __rdtsc();
+    while (benchNowNs() - startNs < 20000000) {
+    }
+    perUs = (float)(__rdtsc() - startCycles) * 1000.0f / (float)(benchNowNs() - startNs);
+  }
+  return perUs;
+}
+
+#else
+// Sin contador de ciclos: un "ciclo" es un ns
+inline uint32_t benchCycles() {
+  return (uint32_t)benchNowNs();
+}
+
+inline float benchCyclesPerUs() {
+  return 1000.0f;
+}
+#endif
+#endif
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <CommandParser.h>
+#include <GateProtocol.h>
+
+// Trazas de comandos MQTT para el benchmark: lo que llega a mqttCallback en
+// los topics de comando, con su instante relativo al inicio. Cada mensaje
+// lleva lo que se espera de él (resultado del parser y ack), así el
+// benchmark también detecta un cambio de comportamiento. Una traza grabada
+// con tools/bench_trace.py no trae expectativas (BENCH_ANY_*).
+
+const ParseResult BENCH_ANY_PARSE = PARSE_RESULT_COUNT;
+const AckResult BENCH_ANY_ACK = (AckResult)0;
+
+struct BenchMessage {
+  uint32_t atMs;
+  bool binary;  // command.bin
+  const uint8_t* payload;
+  size_t length;
+  ParseResult parse;
+  AckResult ack;  // solo con PARSE_OK
+};
+
+struct BenchTrace {
+  const char* name;
+  const BenchMessage* messages;
+  size_t count;
+};
+
+#define BENCH_JSON(at, text, parse, ack) {at, false, (const uint8_t*)text, sizeof(text) - 1, parse, ack}
+#define BENCH_BIN(at, bytes, parse, ack) {at, true, bytes, sizeof(bytes), parse, ack}
+
+// Cabecera de trama de comando: versión 1, FRAME_COMMAND
+#define BENCH_FRAME 0x11
+
+const uint8_t BIN_OPEN_2[] = {BENCH_FRAME, 2, ACTION_OPEN, 0, 106, 0, 0, 0};
+const uint8_t BIN_HOLD_3[] = {BENCH_FRAME, 3, ACTION_HOLD_OPEN, 0, 107, 0, 0, 0, 60, 0};
+const uint8_t BIN_SHORT[] = {BENCH_FRAME, 1, ACTION_OPEN, 0, 1, 0, 0, 0, 0};
+const uint8_t BIN_HOLD_NO_TIME[] = {BENCH_FRAME, 1, ACTION_HOLD_OPEN, 0, 2, 0, 0, 0};
+const uint8_t BIN_CLOSE_2_DUP[] = {BENCH_FRAME, 2, ACTION_CLOSE, 0, 113, 0, 0, 0};
+const uint8_t BIN_EMERGENCY[] = {BENCH_FRAME, 0, ACTION_EMERGENCY, 0, 204, 0, 0, 0};
+
+#define BENCH_PAD16 "................"
+#define BENCH_PAD256 \
+  BENCH_PAD16 BENCH_PAD16 BENCH_PAD16 BENCH_PAD16 BENCH_PAD16 BENCH_PAD16 BENCH_PAD16 BENCH_PAD16 \
+  BENCH_PAD16 BENCH_PAD16 BENCH_PAD16 BENCH_PAD16 BENCH_PAD16 BENCH_PAD16 BENCH_PAD16 BENCH_PAD16
+
+// Ráfaga de aperturas con reentregas, payloads inválidos y de más, un
+// CLOSE y un STOP a media trayectoria y, ya arriba, extensiones y un cierre
+const BenchMessage SYNTHETIC[] = {
+    BENCH_JSON(0, "{\"gateId\":1,\"action\":\"OPEN\",\"commandId\":101}", PARSE_OK, ACK_EXECUTED),
+    BENCH_JSON(5, "{\"gateId\":1,\"action\":\"OPEN\",\"commandId\":101}", PARSE_OK, ACK_DUPLICATE),
+    BENCH_JSON(10, "{\"gateId\":1,\"action\":\"OPEN\",\"commandId\":102}", PARSE_OK, ACK_MERGED),
+    BENCH_JSON(12, "{\"gateId\":2,\"action\":\"OPEN\",\"commandId\":103}", PARSE_OK, ACK_EXECUTED),
+    BENCH_JSON(13, "{\"gateId\":3,\"action\":\"OPEN\",\"commandId\":104}", PARSE_OK, ACK_EXECUTED),
+    BENCH_JSON(14, "{\"gateId\":4,\"action\":\"OPEN\",\"commandId\":105}", PARSE_OK, ACK_EXECUTED),
+    BENCH_BIN(30, BIN_OPEN_2, PARSE_OK, ACK_MERGED),
+    BENCH_BIN(40, BIN_HOLD_3, PARSE_OK, ACK_MERGED),
+    BENCH_BIN(50, BIN_SHORT, PARSE_MALFORMED, BENCH_ANY_ACK),
+    BENCH_BIN(55, BIN_HOLD_NO_TIME, PARSE_MALFORMED, BENCH_ANY_ACK),
+    BENCH_JSON(60, "{\"gateId\":4,\"note\":\"" BENCH_PAD256 BENCH_PAD256 "\",\"action\":\"OPEN\",\"commandId\":108}",
+               PARSE_OK, ACK_MERGED),
+    BENCH_JSON(61, "{\"gateId\":4,\"action\":\"OPEN_AND_KEEP_OPEN\",\"commandId\":120}", PARSE_FIELD_TOO_LONG,
+               BENCH_ANY_ACK),
+    BENCH_JSON(62, "{\"x\":[[[[[[[[[[1]]]]]]]]]],\"gateId\":1,\"action\":\"OPEN\"}", PARSE_TOO_DEEP, BENCH_ANY_ACK),
+    BENCH_JSON(63, "{\"gateId\":1,\"action\":\"OP", PARSE_MALFORMED, BENCH_ANY_ACK),
+    BENCH_JSON(64, "", PARSE_EMPTY, BENCH_ANY_ACK),
+    BENCH_JSON(65, "{\"gateId\":\"1\",\"action\":\"OPEN\"}", PARSE_BAD_TYPE, BENCH_ANY_ACK),
+    BENCH_JSON(70, "{\"gateId\":1,\"action\":\"FLY\",\"commandId\":109}", PARSE_OK, ACK_REJECTED),
+    BENCH_JSON(71, "{\"gateId\":9,\"action\":\"OPEN\",\"commandId\":110}", PARSE_OK, ACK_REJECTED),
+    BENCH_JSON(100, "{\"gateId\":4,\"action\":\"CLOSE\",\"commandId\":111}", PARSE_OK, ACK_EXECUTED),
+    BENCH_JSON(120, "{\"gateId\":4,\"action\":\"STOP\",\"commandId\":112}", PARSE_OK, ACK_EXECUTED),
+    BENCH_JSON(3000, "{\"gateId\":1,\"action\":\"OPEN\"}", PARSE_OK, ACK_MERGED),
+    BENCH_JSON(3100, "{\"gateId\":2,\"action\":\"CLOSE\",\"commandId\":113}", PARSE_OK, ACK_EXECUTED),
+    BENCH_BIN(3200, BIN_CLOSE_2_DUP, PARSE_OK, ACK_DUPLICATE),
+    BENCH_JSON(3300, "{\"gateId\":3,\"action\":\"CLOSE\",\"commandId\":114}", PARSE_OK, ACK_EXECUTED),
+};
+
+// Evacuación: con un portón ya abriendo, la emergencia abre todos; un CLOSE
+// de residente y un RESUME sin prioridad de admin se rechazan, un CLOSE de
+// emergencia pasa, y el RESUME del admin devuelve el cierre por plazo
+const BenchMessage EMERGENCY[] = {
+    BENCH_JSON(0, "{\"gateId\":1,\"action\":\"OPEN\",\"commandId\":201}", PARSE_OK, ACK_EXECUTED),
+    BENCH_JSON(10, "{\"gateId\":0,\"action\":\"EMERGENCY\",\"commandId\":202}", PARSE_OK, ACK_EXECUTED),
+    BENCH_JSON(20, "{\"gateId\":2,\"action\":\"CLOSE\",\"priority\":\"RESIDENT\",\"commandId\":203}", PARSE_OK,
+               ACK_REJECTED),
+    BENCH_BIN(30, BIN_EMERGENCY, PARSE_OK, ACK_MERGED),
+    BENCH_JSON(40, "{\"action\":\"RESUME\",\"priority\":\"RESIDENT\",\"commandId\":205}", PARSE_OK, ACK_REJECTED),
+    BENCH_JSON(60000, "{\"gateId\":3,\"action\":\"CLOSE\",\"priority\":\"EMERGENCY\",\"commandId\":206}", PARSE_OK,
+               ACK_EXECUTED),
+    BENCH_JSON(61000, "{\"action\":\"RESUME\",\"priority\":\"ADMIN\",\"commandId\":207}", PARSE_OK, ACK_EXECUTED),
+};
@@ -0,0 +1,288 @@
+// Benchmark del bucle de control: reproduce las trazas de bench_traces.h
+// contra la lógica de gate_control.cpp con la HAL simulada de abajo y mide
+// en ciclos cada llamada del camino de un comando:
+//   decode        decodeCommand + deduplicación (lo que hace mqttCallback)
+//   process       processCommand
+//   updateGates   cada despertar de la tarea de portones
+//   updateMotion  cada tick de control con algo en movimiento
+//
+//   pio test -e native            en el host
+//   pio test -e esp32dev-bench    en la placa, donde además el p99 de cada
+//                                 llamada debe quedar bajo su budgetUs
+//
+// El reloj es simulado: los plazos y las trayectorias avanzan igual en el
+// host y en la placa, y lo único que cambia entre ambos son los ciclos.
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <unity.h>
+#include <CommandDedup.h>
+
+#include "gate_control.h"
+#include "gate_hal.h"
+#include "bench_cycles.h"
+#include "bench_traces.h"
+
+const int BENCH_REPEAT = 5;         // pasadas por traza
+const size_t BENCH_SAMPLES = 2048;  // muestras guardadas para los percentiles
+const uint32_t BENCH_SETTLE_MS = 120000;
+
+// ==================== HAL SIMULADA ====================
+int64_t simNowUs = 1000000;
+bool simMotionRunning = false;
+int64_t simNextTickUs = 0;
+uint32_t simServoWrites = 0;
+uint32_t simStatuses = 0;
+uint32_t simLogs = 0;
+
+int64_t halNowUs() {
+  return simNowUs;
+}
+
+void halServoWrite(int idx, uint32_t duty) {
+  simServoWrites++;
+}
+
+void halServoRelease(int idx) {
+  simServoWrites++;
+}
+
+void halMotionTimer(bool run) {
+  if (run && !simMotionRunning) simNextTickUs = simNowUs + msToUs(MOTION_TICK_MS);
+  simMotionRunning = run;
+}
+
+void halRememberTarget(int idx, bool open) {}
+
+void halRememberEmergency(bool active) {}
+
+void halLogGate(LogEvent event, uint8_t gate, int32_t a, int32_t b) {
+  simLogs++;
+}
+
+void publishStatus(int gateId, GateStatusCode status) {
+  simStatuses++;
+}
+
+// ==================== ESTADÍSTICAS ====================
+struct BenchStats {
+  const char* name;
+  float budgetUs;  // p99 máximo en la placa
+  uint32_t samples[BENCH_SAMPLES];
+  uint32_t count;
+  uint64_t total;
+  uint32_t max;
+
+  void add(uint32_t cycles) {
+    if (count < BENCH_SAMPLES) samples[count] = cycles;
+    count++;
+    total += cycles;
+    if (cycles > max) max = cycles;
+  }
+
+  // Sobre las muestras guardadas; la media y el máximo cuentan todas
+  uint32_t percentile(uint32_t p) {
+    uint32_t stored = count < BENCH_SAMPLES ? count : BENCH_SAMPLES;
+    if (stored == 0) return 0;
+    std::sort(samples, samples + stored);
+    return samples[(uint64_t)(stored - 1) * p / 100];
+  }
+};
+
+BenchStats decodeStats = {"decode", 150, {}, 0, 0, 0};
+BenchStats processStats = {"process", 50, {}, 0, 0, 0};
+BenchStats gatesStats = {"updateGates", 20, {}, 0, 0, 0};
+BenchStats motionStats = {"updateMotion", 100, {}, 0, 0, 0};
+BenchStats* const ALL_STATS[] = {&decodeStats, &processStats, &gatesStats, &motionStats};
+
+// Las grabadas con tools/bench_trace.py se incluyen arriba y se agregan aquí
+const BenchTrace BENCH_TRACES[] = {
+    {"sintética", SYNTHETIC, sizeof(SYNTHETIC) / sizeof(SYNTHETIC[0])},
+    {"emergencia", EMERGENCY, sizeof(EMERGENCY) / sizeof(EMERGENCY[0])},
+};
+
+CommandDedup<32> recentCommands;  // como en main.cpp
+
+// ==================== REPRODUCCIÓN ====================
+void resetGates() {
+  for (int i = 0; i < GATE_COUNT; i++) {
+    gates[i] = GateRuntime();
+    gates[i].trajectory.start(GATES[i].closedAngle, GATES[i].closedAngle, 0, GATES[i].motion);
+  }
+  gateDeadlines = DeadlineHeap<GATE_COUNT>();
+  emergencyActive = false;
+  simMotionRunning = false;
+}
+
+// Lo que haría la tarea de portones hasta `target`: despierta por plazo de
+// cierre o por tick de control, lo que llegue antes
+void advanceTo(int64_t target) {
+  for (;;) {
+    int64_t next = target + 1;
+    if (simMotionRunning && simNextTickUs < next) next = simNextTickUs;
+    if (!gateDeadlines.empty() && gateDeadlines.nextDeadline() < next) next = gateDeadlines.nextDeadline();
+    if (next > target) break;
+    simNowUs = next;
+
+    uint32_t start = benchCycles();
+    updateGates();
+    gatesStats.add(benchCycles() - start);
+    if (simMotionRunning && simNowUs >= simNextTickUs) {
+      start = benchCycles();
+      updateMotion(simNowUs);
+      motionStats.add(benchCycles() - start);
+      simNextTickUs += msToUs(MOTION_TICK_MS);
+    }
+  }
+  simNowUs = target;
+}
+
+void deliver(const BenchTrace& trace, size_t i) {
+  const BenchMessage& message = trace.messages[i];
+  char where[64];
+  snprintf(where, sizeof(where), "%s, mensaje %u", trace.name, (unsigned)i);
+
+  uint32_t start = benchCycles();
+  GateCommand cmd;
+  ParseResult result = decodeCommand(message.payload, message.length, message.binary, cmd);
+  bool fresh = result == PARSE_OK && recentCommands.insert(cmd.commandId);
+  decodeStats.add(benchCycles() - start);
+  if (message.parse != BENCH_ANY_PARSE) TEST_ASSERT_EQUAL_INT_MESSAGE(message.parse, result, where);
+  if (result != PARSE_OK) return;
+
+  AckResult ack;
+  if (!fresh) {
+    ack = ACK_DUPLICATE;
+  } else if (!controllerAction(cmd.action) && (cmd.gateId < 1 || cmd.gateId > GATE_COUNT)) {
+    ack = ACK_REJECTED;
+  } else {
+    start = benchCycles();
+    ack = processCommand(cmd);
+    processStats.add(benchCycles() - start);
+  }
+  if (message.ack != BENCH_ANY_ACK) TEST_ASSERT_EQUAL_INT_MESSAGE(message.ack, ack, where);
+}
+
+void replay(const BenchTrace& trace) {
+  resetGates();
+  recentCommands = CommandDedup<32>();
+  int64_t base = simNowUs;
+  for (size_t i = 0; i < trace.count; i++) {
+    advanceTo(base + msToUs(trace.messages[i].atMs));
+    deliver(trace, i);
+  }
+  // Hasta que todo cierre solo
+  advanceTo(simNowUs + msToUs(BENCH_SETTLE_MS));
+  for (int i = 0; i < GATE_COUNT; i++) {
+    TEST_ASSERT_EQUAL_INT_MESSAGE(IDLE, gates[i].state, trace.name);
+  }
+  TEST_ASSERT_FALSE(simMotionRunning);
+}
+
+// ==================== PRUEBAS ====================
+void setUp() {}
+
+void tearDown() {}
+
+void test_replay_traces() {
+  for (int pass = 0; pass < BENCH_REPEAT; pass++) {
+    for (size_t t = 0; t < sizeof(BENCH_TRACES) / sizeof(BENCH_TRACES[0]); t++) replay(BENCH_TRACES[t]);
+  }
+  TEST_ASSERT_TRUE(processStats.count > 0);
+  TEST_ASSERT_TRUE(motionStats.count > 0);
+}
+
+// Con el nivel lleno el comando sale ACK_DROPPED y su id no queda en el
+// anillo: el reintento de la API con el mismo id se ejecuta
+void test_dropped_command_retry() {
+  resetGates();
+  recentCommands = CommandDedup<32>();
+  PriorityQueue<GateCommand, 8, PRIORITY_COUNT> queue;
+  AckResult rejection = ACK_EXECUTED;
+  for (uint32_t id = 1; id <= 8; id++) {
+    GateCommand cmd = {1, ACTION_OPEN, PRIORITY_VISITOR, 0, id, 0, 0};
+    TEST_ASSERT_TRUE(admitCommand(recentCommands, queue, cmd, rejection));
+  }
+  GateCommand retried = {1, ACTION_OPEN, PRIORITY_VISITOR, 0, 100, 0, 0};
+  TEST_ASSERT_FALSE(admitCommand(recentCommands, queue, retried, rejection));
+  TEST_ASSERT_EQUAL_INT(ACK_DROPPED, rejection);
+
+  GateCommand queued;
+  while (queue.pop(queued)) {}
+  TEST_ASSERT_TRUE(admitCommand(recentCommands, queue, retried, rejection));
+  TEST_ASSERT_TRUE(queue.pop(queued));
+  TEST_ASSERT_EQUAL_UINT32(100, queued.commandId);
+  TEST_ASSERT_EQUAL_INT(ACK_EXECUTED, processCommand(queued));
+  // Ya en la cola una vez: ahora sí es repetido
+  TEST_ASSERT_FALSE(admitCommand(recentCommands, queue, retried, rejection));
+  TEST_ASSERT_EQUAL_INT(ACK_DUPLICATE, rejection);
+  advanceTo(simNowUs + msToUs(BENCH_SETTLE_MS));
+}
+
+uint32_t le32(const uint8_t* in) {
+  return (uint32_t)in[0] | ((uint32_t)in[1] << 8) | ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+// El ack con oneWayUs ocupa ACK_ONE_WAY_FRAME_SIZE: en un buffer del tamaño
+// corto no cabe y encodeAckFrame devuelve 0 (sendAck no publica nada)
+void test_ack_frame_one_way() {
+  uint8_t frame[ACK_ONE_WAY_FRAME_SIZE];
+  size_t len = encodeAckFrame(3, ACK_EXECUTED, 0xA1B2C3D4, 1234, -5678, frame, sizeof(frame));
+  TEST_ASSERT_EQUAL_UINT(ACK_ONE_WAY_FRAME_SIZE, len);
+  TEST_ASSERT_EQUAL_HEX8((PROTOCOL_VERSION << 4) | FRAME_ACK, frame[0]);
+  TEST_ASSERT_EQUAL_UINT8(3, frame[1]);
+  TEST_ASSERT_EQUAL_UINT8(ACK_EXECUTED, frame[2]);
+  TEST_ASSERT_EQUAL_HEX8(ACK_FLAG_ONE_WAY, frame[3]);
+  TEST_ASSERT_EQUAL_HEX32(0xA1B2C3D4, le32(frame + 4));
+  TEST_ASSERT_EQUAL_UINT32(1234, le32(frame + 8));
+  TEST_ASSERT_EQUAL_INT32(-5678, (int32_t)le32(frame + 12));
+  TEST_ASSERT_EQUAL_UINT(0, encodeAckFrame(3, ACK_EXECUTED, 1, 1234, -5678, frame, ACK_FRAME_SIZE));
+
+  len = encodeAckFrame(3, ACK_EXECUTED, 1, 1234, ONE_WAY_UNKNOWN, frame, sizeof(frame));
+  TEST_ASSERT_EQUAL_UINT(ACK_FRAME_SIZE, len);
+  TEST_ASSERT_EQUAL_HEX8(0, frame[3]);
+}
+
+void test_report_cycles() {
+  float perUs = benchCyclesPerUs();
+  char line[160];
+  for (size_t i = 0; i < sizeof(ALL_STATS) / sizeof(ALL_STATS[0]); i++) {
+    BenchStats& stats = *ALL_STATS[i];
+    uint32_t p50 = stats.percentile(50);
+    uint32_t p99 = stats.percentile(99);
+    snprintf(line, sizeof(line), "%-12s n=%-6u media=%-8.0f p50=%-8u p99=%-8u max=%-8u ciclos  (p99 %.2f us)",
+             stats.name, (unsigned)stats.count, stats.count ? (double)stats.total / stats.count : 0.0,
+             (unsigned)p50, (unsigned)p99, (unsigned)stats.max, p99 / perUs);
+    TEST_MESSAGE(line);
+#if defined(ARDUINO)
+    // En el host los ciclos dependen de la máquina: solo informan
+    TEST_ASSERT_LESS_THAN_UINT32_MESSAGE((uint32_t)(stats.budgetUs * perUs), p99, stats.name);
+#endif
+  }
+  snprintf(line, sizeof(line), "servo=%u estados=%u registros=%u (%.0f ciclos/us)", (unsigned)simServoWrites,
+           (unsigned)simStatuses, (unsigned)simLogs, perUs);
+  TEST_MESSAGE(line);
+}
+
+int runBenchmarks() {
+  UNITY_BEGIN();
+  RUN_TEST(test_replay_traces);
+  RUN_TEST(test_ack_frame_one_way);
+  RUN_TEST(test_dropped_command_retry);
+  RUN_TEST(test_report_cycles);
+  return UNITY_END();
+}
+
+#if defined(ARDUINO)
+void setup() {
+  delay(2000);  // a que el monitor del test runner se conecte
+  runBenchmarks();
+}
+
+void loop() {}
+#else
+int main() {
+  return runBenchmarks();
+}
+#endif
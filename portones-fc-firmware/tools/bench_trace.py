@@ -0,0 +1,71 @@
+#!/usr/bin/env python3
+"""Convierte comandos MQTT grabados en una traza para test/test_bench.
+
+    mosquitto_sub -h <broker> -t 'portones/#' -F '%U %t %x' > grabacion.txt
+    bench_trace.py grabacion.txt --name campo -o test/test_bench/trace_campo.h
+
+Se quedan los mensajes de los topics de comando (.../command y
+.../command.bin); los instantes quedan relativos al primero. La traza no
+trae expectativas (BENCH_ANY_*): solo se mide. Para reproducirla, incluir el
+header en test_main.cpp y agregar su BenchTrace a BENCH_TRACES. En los
+topics por portón el portón sale del payload, no del topic.
+"""
+
+import argparse
+import re
+import sys
+
+LINE = re.compile(r"^(\d+)\.(\d+) (\S+) ?([0-9a-fA-F]*)$")
+
+
+def read_messages(path):
+    messages = []
+    with open(path) as f:
+        for number, line in enumerate(f, 1):
+            match = LINE.match(line.rstrip("\r\n"))
+            if not match:
+                sys.exit(f"{path}:{number}: se esperaba '%U %t %x'")
+            seconds, fraction, topic, payload = match.groups()
+            if not (topic.endswith("/command") or topic.endswith("/command.bin")):
+                continue
+            at_us = int(seconds) * 1000000 + int(fraction.ljust(9, "0")[:6])
+            messages.append((at_us, topic.endswith(".bin"), bytes.fromhex(payload)))
+    return messages
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("recording", help="salida de mosquitto_sub -F '%%U %%t %%x'")
+    parser.add_argument("--name", required=True, help="nombre de la traza (identificador de C)")
+    parser.add_argument("-o", "--output", required=True)
+    args = parser.parse_args()
+    if not re.match(r"^[A-Za-z_]\w*$", args.name):
+        sys.exit("--name debe ser un identificador de C")
+
+    messages = read_messages(args.recording)
+    if not messages:
+        sys.exit("no hay mensajes de comando en la grabación")
+    start = messages[0][0]
+    symbol = args.name.upper()
+
+    out = ["#pragma once", "", '#include "bench_traces.h"', ""]
+    for i, (_, _, payload) in enumerate(messages):
+        data = ", ".join(f"0x{b:02x}" for b in payload) or "0"
+        out.append(f"const uint8_t {symbol}_{i}[] = {{{data}}};")
+    out.append("")
+    out.append(f"const BenchMessage {symbol}[] = {{")
+    for i, (at_us, binary, payload) in enumerate(messages):
+        at_ms = (at_us - start) // 1000
+        out.append(f"    {{{at_ms}, {'true' if binary else 'false'}, {symbol}_{i}, {len(payload)}, "
+                   "BENCH_ANY_PARSE, BENCH_ANY_ACK},")
+    out.append("};")
+    out.append("")
+    out.append(f'// {{"{args.name}", {symbol}, sizeof({symbol}) / sizeof({symbol}[0])}}')
+
+    with open(args.output, "w") as f:
+        f.write("\n".join(out) + "\n")
+    print(f"{len(messages)} mensajes, {(messages[-1][0] - start) / 1e6:.1f} s")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,118 @@
+#!/usr/bin/env python3
+"""Prepara una imagen para la actualización OTA (ver lib/OtaImage).
+
+    ota_image.py firmware.bin -o firmware.ota
+    ota_image.py firmware.bin --base anterior.bin -o firmware.ota
+
+Sin --base la imagen sale comprimida con zlib (formato 1); con --base sale
+como delta comprimida contra esa imagen (formato 2), que debe ser la que
+corre en las placas. Si la delta no ahorra frente a la comprimida, se usa
+la comprimida. Imprime el JSON que espera POST /admin/controllers/ota
+(sin la URL, que depende de dónde se suba el archivo).
+"""
+
+import argparse
+import hashlib
+import json
+import struct
+import sys
+import zlib
+
+FORMAT_RAW = 0
+FORMAT_ZLIB = 1
+FORMAT_DELTA = 2
+
+DELTA_MAGIC = b"PFD1"
+OP_END = 0
+OP_COPY = 1
+OP_INSERT = 2
+
+DIGEST_SIZE = 32
+BLOCK = 32       # coincidencia mínima para emitir un COPY
+INDEX_STEP = 4   # el código del ESP32 se mueve en múltiplos de 4 bytes
+
+
+def app_digest(image, name):
+    """El SHA-256 que ESP-IDF agrega al final de la app."""
+    if len(image) <= DIGEST_SIZE or hashlib.sha256(image[:-DIGEST_SIZE]).digest() != image[-DIGEST_SIZE:]:
+        sys.exit(f"{name}: no es una app de ESP-IDF con el SHA-256 agregado")
+    return image[-DIGEST_SIZE:]
+
+
+def make_delta(base, image):
+    index = {}
+    for offset in range(0, len(base) - BLOCK + 1, INDEX_STEP):
+        index.setdefault(base[offset:offset + BLOCK], offset)
+
+    out = bytearray(DELTA_MAGIC)
+    literal = bytearray()
+    expected = -1  # donde seguiría el último COPY en la base
+
+    def flush_literal():
+        if literal:
+            out.extend(struct.pack("<BI", OP_INSERT, len(literal)))
+            out.extend(literal)
+            literal.clear()
+
+    i = 0
+    while i < len(image):
+        block = image[i:i + BLOCK]
+        match = -1
+        if 0 <= expected and base[expected:expected + BLOCK] == block and len(block) == BLOCK:
+            match = expected
+        elif len(block) == BLOCK:
+            match = index.get(block, -1)
+        if match < 0:
+            literal.append(image[i])
+            i += 1
+            continue
+        length = BLOCK
+        while i + length < len(image) and match + length < len(base) and image[i + length] == base[match + length]:
+            length += 1
+        flush_literal()
+        out.extend(struct.pack("<BII", OP_COPY, match, length))
+        i += length
+        expected = match + length
+    flush_literal()
+    out.append(OP_END)
+    return bytes(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("image", help="app .bin de la versión nueva")
+    parser.add_argument("--base", help="app .bin que corre en las placas, para una delta")
+    parser.add_argument("--version", default="", help="versión de firmware (hasta 16 caracteres)")
+    parser.add_argument("-o", "--output", required=True)
+    args = parser.parse_args()
+
+    with open(args.image, "rb") as f:
+        image = f.read()
+    digest = app_digest(image, args.image)
+    if len(args.version.encode()) > 16:
+        sys.exit("la versión no cabe en 16 bytes")
+
+    payload = zlib.compress(image, 9)
+    fmt = FORMAT_ZLIB
+    base_digest = bytes(DIGEST_SIZE)
+    if args.base:
+        with open(args.base, "rb") as f:
+            base = f.read()
+        delta = zlib.compress(make_delta(base, image), 9)
+        if len(delta) < len(payload):
+            payload, fmt, base_digest = delta, FORMAT_DELTA, app_digest(base, args.base)
+
+    with open(args.output, "wb") as f:
+        f.write(payload)
+    print(json.dumps({
+        "version": args.version,
+        "format": fmt,
+        "size": len(image),
+        "sha256": digest.hex(),
+        "baseSha256": base_digest.hex() if fmt == FORMAT_DELTA else None,
+        "downloadSize": len(payload),
+    }, indent=2))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,120 @@
+#!/usr/bin/env python3
+"""RAM estática por subsistema a partir del ELF del firmware.
+
+    ram_report.py .pio/build/esp32dev/firmware.elf --nm xtensa-esp32-elf-nm
+
+Suma los símbolos de .data y .bss (lo que ocupa RAM desde el arranque, sin
+contar heap ni pilas) y los agrupa: los de src/main.cpp por la sección
+"// ==== X ====" donde están definidos, los de lib/ por biblioteca y el resto
+por archivo o como framework. Necesita la información de depuración del ELF
+(la trae el build por defecto) para saber dónde se define cada símbolo.
+
+Como extra_scripts de platformio.ini corre solo tras cada build del ELF.
+"""
+
+import argparse
+import bisect
+import collections
+import os
+import re
+import subprocess
+import sys
+
+try:
+    Import  # noqa: F821: existe solo dentro de PlatformIO (SCons)
+except NameError:
+    Import = None
+
+BANNER = re.compile(r"^// =+ (.+?) =+$")
+SYMBOL = re.compile(r"^([0-9a-fA-F]+) ([0-9a-fA-F]+) ([bBdD]) (\S+)(?:\t(.+):(\d+))?$")
+DRAM = (0x3FFAE000, 0x40000000)
+
+
+def main_sections(path):
+    """Líneas donde empieza cada sección de main.cpp y su nombre."""
+    starts, names = [], []
+    with open(path, encoding="utf-8") as f:
+        for number, line in enumerate(f, 1):
+            match = BANNER.match(line.strip())
+            if match:
+                starts.append(number)
+                names.append(match.group(1).lower())
+    return starts, names
+
+
+def subsystem(source, line, firmware_dir, sections):
+    if not source:
+        return "framework"
+    source = os.path.normpath(source)
+    relative = os.path.relpath(source, firmware_dir)
+    if relative.startswith(".."):
+        return "framework"
+    parts = relative.split(os.sep)
+    if parts[0] == "lib":
+        return "lib/" + parts[1]
+    if parts[0] == ".pio" and "libdeps" in parts:
+        return parts[parts.index("libdeps") + 2]
+    if relative == os.path.join("src", "main.cpp"):
+        starts, names = sections
+        at = bisect.bisect_right(starts, line) - 1
+        return "main: " + (names[at] if at >= 0 else "inicio")
+    return relative
+
+
+def report(elf, nm, firmware_dir, env=None):
+    output = subprocess.run([nm, "-S", "-l", "-C", elf], check=True, capture_output=True, text=True, env=env).stdout
+    sections = main_sections(os.path.join(firmware_dir, "src", "main.cpp"))
+    dram = collections.Counter()
+    other = collections.Counter()  # memoria RTC: sobrevive al reinicio, no es DRAM
+    largest = {}
+    for line in output.splitlines():
+        match = SYMBOL.match(line)
+        if not match:
+            continue
+        address, size, _, name, source, number = match.groups()
+        size = int(size, 16)
+        group = subsystem(source, int(number or 0), firmware_dir, sections)
+        if DRAM[0] <= int(address, 16) < DRAM[1]:
+            dram[group] += size
+            if size > largest.get(group, ("", 0))[1]:
+                largest[group] = (name, size)
+        else:
+            other[group] += size
+
+    width = max(len(group) for group in list(dram) + list(other) + ["subsistema"])
+    print(f"{'subsistema':<{width}}  {'DRAM':>7}  {'RTC':>6}  mayor símbolo")
+    for group, size in sorted(dram.items(), key=lambda item: -item[1]):
+        name, biggest = largest[group]
+        print(f"{group:<{width}}  {size:>7}  {other.pop(group, 0):>6}  {name} ({biggest})")
+    for group, size in sorted(other.items(), key=lambda item: -item[1]):
+        print(f"{group:<{width}}  {0:>7}  {size:>6}")
+    print(f"{'total':<{width}}  {sum(dram.values()):>7}  {sum(other.values()):>6}")
+
+
+def pio_hook(env):
+    nm = env.subst("$CC").replace("gcc", "nm")  # la toolchain no define $NM
+
+    def after_elf(target, source, env):
+        print("RAM estática por subsistema (tools/ram_report.py):")
+        report(str(target[0]), nm, env.subst("$PROJECT_DIR"), env["ENV"])
+
+    env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", after_elf)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("elf", help="firmware.elf del build")
+    parser.add_argument("--nm", default="xtensa-esp32-elf-nm", help="nm de la toolchain")
+    parser.add_argument("--firmware", default=os.path.join(os.path.dirname(__file__), ".."),
+                        help="directorio de portones-fc-firmware")
+    args = parser.parse_args()
+    if not os.path.exists(args.elf):
+        sys.exit(f"no existe {args.elf}")
+    report(args.elf, args.nm, os.path.abspath(args.firmware))
+
+
+if Import:
+    Import("env")
+    pio_hook(env)  # noqa: F821
+elif __name__ == "__main__":
+    main()